@@ -31,6 +31,10 @@ typedef char* va_list;
 #define va_arg(ap, type) (*(type*)((ap) += ((sizeof(type) + 3) & ~3), (ap) - ((sizeof(type) + 3) & ~3)))
 #define va_end(ap) ((ap) = NULL)
 
+// Expand a macro and make a string of the result, for constants in assembly
+#define __stringify_1(x) #x
+#define __stringify(x) __stringify_1(x)
+
 // Video
 extern uint16_t* video_memory; // Pointer to VGA text mode memory (e.g., 0xB8000)
 extern int cursor_x, cursor_y; // Cursor position for terminal output
@@ -41,6 +45,9 @@ void terminal_clear(void); // Clear the terminal screen
 void printk(const char* format, ...); // Print formatted string to terminal
 void putchar(char c); // Print a single character
 char keyboard_getchar(void); // Get a character from keyboard input
+bool keyboard_haschar(void); // Check for keyboard input without waiting
+struct poll_table;
+bool keyboard_poll(struct poll_table* pt); // keyboard_haschar() for poll operations
 
 // System
 void outb(uint16_t port, uint8_t value); // Write byte to I/O port
@@ -74,6 +81,7 @@ int start_shell(void); // Start the OS shell, returns 0 on failure
 // Kernel
 void kmain(void); // Kernel entry point
 void kernel_shutdown(void); // Shutdown the kernel
+void kernel_panic(const char* message); // Halt the system with an error message
 uint32_t get_uptime(void); // Get system uptime in seconds
 void get_memory_stats(uint32_t* total, uint32_t* free); // Get memory statistics
 
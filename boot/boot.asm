@@ -1,8 +1,11 @@
 [org 0x7C00]
 [bits 16]
 
-KERNEL_OFFSET equ 0x1000
-KERNEL_SECTORS equ 32
+KERNEL_SEGMENT equ 0x1000       ; Kernel is loaded at 0x10000
+KERNEL_OFFSET equ 0x10000
+KERNEL_SECTORS equ 384          ; 192 KiB, linker.ld checks the kernel fits
+SECTORS_PER_TRACK equ 18
+HEADS equ 2
 
 start:
     xor ax, ax
@@ -12,16 +15,49 @@ start:
     mov sp, 0x7C00
     mov [boot_drive], dl
 
-    ; Load kernel
-    mov bx, KERNEL_OFFSET
-    mov dh, 0
+    ; Load kernel one sector at a time, floppy reads cannot cross a track
+    mov ax, KERNEL_SEGMENT
+    mov es, ax
+    xor bx, bx
+    mov cx, KERNEL_SECTORS
+load_sector:
+    push cx
+    mov ax, [lba]
+    xor dx, dx
+    mov cx, SECTORS_PER_TRACK
+    div cx                      ; ax = track, dx = sector index
+    mov cl, dl
+    inc cl                      ; Sectors count from 1
+    xor dx, dx
+    mov si, HEADS
+    div si                      ; ax = cylinder, dx = head
+    mov ch, al
+    mov dh, dl
     mov dl, [boot_drive]
-    mov ch, 0
-    mov cl, 2
-    mov al, KERNEL_SECTORS
-    mov ah, 0x02
+    mov di, 3                   ; Retries
+read_retry:
+    mov ax, 0x0201
+    int 0x13
+    jnc read_done
+    xor ax, ax                  ; Reset the drive and try again
     int 0x13
-    jc disk_error
+    dec di
+    jnz read_retry
+    jmp disk_error
+read_done:
+    mov ax, es
+    add ax, 0x20                ; Next 512 bytes
+    mov es, ax
+    inc word [lba]
+    pop cx
+    dec cx
+    jnz load_sector
+
+    ; Enable A20 so memory above 1 MiB is not wrapped around
+    in al, 0x92
+    or al, 0x02
+    and al, 0xFE
+    out 0x92, al
 
     ; Switch to protected mode
     cli
@@ -57,6 +93,7 @@ gdt_descriptor:
     dd gdt_start
 
 boot_drive db 0
+lba dw 1                        ; Next sector to read, the kernel follows the boot sector
 
 times 510-($-$$) db 0
-dw 0xAA55
\ No newline at end of file
+dw 0xAA55
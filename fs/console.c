@@ -0,0 +1,127 @@
+#include "fs/console.h"
+#include "fs/poll.h"
+#include "string.h"
+#include "sched.h"
+#include "softirq.h"
+#include "interrupts.h"
+
+static uint32_t console_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    (void)node;
+    (void)offset;
+    fs_node_t* in = current_task()->console_in;
+    if (in) {
+        return vfs_read(in, 0, size, buffer);
+    }
+
+    uint32_t n = 0;
+    while (n < size) {
+        char c = keyboard_getchar();
+        if (c == '\r' || c == '\n') {
+            putchar('\n');
+            buffer[n++] = '\n';
+            break;
+        }
+        if (c == '\b') {
+            if (n > 0) {
+                n--;
+                putchar('\b');
+            }
+            continue;
+        }
+        putchar(c);
+        buffer[n++] = c;
+    }
+    return n;
+}
+
+static uint32_t console_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    (void)node;
+    (void)offset;
+    // Whole buffers, so large writes to a pipe can move pages
+    fs_node_t* out = current_task()->console_out;
+    if (out) {
+        return vfs_write(out, 0, size, buffer);
+    }
+    terminal_write((const char*)buffer, size);
+    return size;
+}
+
+// The same node serves descriptors 0-2, so both directions are reported
+static uint32_t console_poll(fs_node_t* node, struct poll_table* pt) {
+    (void)node;
+    task_t* task = current_task();
+    uint32_t mask = 0;
+    if (task->console_in) {
+        mask |= vfs_poll(task->console_in, pt) & (POLLIN | POLLHUP);
+    } else if (keyboard_poll(pt)) {
+        mask |= POLLIN;
+    }
+    if (task->console_out) {
+        mask |= vfs_poll(task->console_out, pt) & (POLLOUT | POLLERR);
+    } else {
+        mask |= POLLOUT;
+    }
+    return mask;
+}
+
+static fs_node_t console_node;
+
+void console_initialize(void) {
+    memset(&console_node, 0, sizeof(console_node));
+    strcpy(console_node.name, "console");
+    console_node.mask = 0x1B6; // rw-rw-rw-
+    console_node.flags = FS_CHARDEVICE;
+    console_node.read = console_read;
+    console_node.write = console_write;
+    console_node.poll = console_poll;
+
+    if (open_node(&console_node, O_RDONLY) != 0 ||
+        open_node(&console_node, O_WRONLY) != 1 ||
+        open_node(&console_node, O_WRONLY) != 2) {
+        printk("Console: descriptors 0-2 already taken\n");
+    }
+}
+
+void console_redirect(fs_node_t* in, fs_node_t* out) {
+    task_t* task = current_task();
+    task->console_in = in;
+    task->console_out = out;
+}
+
+void console_unredirect(void) {
+    task_t* task = current_task();
+    fs_node_t* in = task->console_in;
+    fs_node_t* out = task->console_out;
+    task->console_in = NULL;
+    task->console_out = NULL;
+    if (in) {
+        vfs_close(in);
+    }
+    if (out) {
+        vfs_close(out);
+    }
+}
+
+void console_redirect_inherit(task_t* child) {
+    task_t* task = current_task();
+    child->console_in = task->console_in;
+    child->console_out = task->console_out;
+    if (child->console_in && child->console_in->open) {
+        child->console_in->open(child->console_in, O_RDONLY);
+    }
+    if (child->console_out && child->console_out->open) {
+        child->console_out->open(child->console_out, O_WRONLY);
+    }
+}
+
+bool console_redirect_putchar(char c) {
+    if (in_interrupt() || irqs_disabled() || !sched_can_block()) {
+        return false;
+    }
+    fs_node_t* out = current_task()->console_out;
+    if (!out) {
+        return false;
+    }
+    vfs_write(out, 0, 1, (uint8_t*)&c);
+    return true;
+}
@@ -10,17 +10,8 @@ typedef struct fs_node fs_node_t;
 void fs_test(void) {
     printk("=== Starting File System Test ===\n");
     
-    // Initialize VFS and memory filesystem
-    vfs_initialize();
-    memfs_initialize();
-    
-    // Mount the memory filesystem
-    if (vfs_mount("memdisk", "/", "memfs") != 0) {
-        printk("Failed to mount root filesystem!\n");
-        return;
-    }
-    
-    printk("Mounted memory filesystem at /\n");
+    // The root file system is mounted by kmain(). Initializing it again
+    // would drop the console's descriptors.
     
     // Test file creation and writing
     printk("Creating test file...\n");
@@ -1,25 +1,34 @@
 #include "fs/vfs.h"
+#include "memory.h"
+#include "spinlock.h"
 #include <string.h>
 #include <sys/types.h>
 
 #define MAX_FILES 64
-#define MAX_BLOCKS 1024
-#define BLOCK_SIZE 4096
+
+// File data lives in page frames, so mmap() can map them as they are.
+// A file's page index is itself a frame: one entry per page of data, 0
+// for a hole that reads as zeros.
+#define MEMFS_MAX_PAGES (PAGE_SIZE / sizeof(uint32_t))
+#define MEMFS_MAX_SIZE  (MEMFS_MAX_PAGES * PAGE_SIZE)
 
 typedef struct memfs_inode {
     char* name;
     uint32_t size;
-    uint8_t* data;
+    uint32_t* pages;            // Page index, NULL until the first write
     uint32_t is_dir;
     struct memfs_inode* parent;
     struct memfs_inode* children;
     struct memfs_inode* next;
+    fs_node_t* node;            // Made by the first lookup, then reused
 } memfs_inode_t;
 
 static memfs_inode_t* root_node = NULL;
 static memfs_inode_t* nodes = NULL;
-static uint8_t* block_bitmap = NULL;
-static uint8_t* blocks = NULL;
+
+// Inode slots, directory lists and page indexes. Data is copied in and
+// out unlocked: frames are never freed, as files never shrink.
+static spinlock_t memfs_lock = SPINLOCK_INIT;
 
 // Forward declarations
 static uint32_t memfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
@@ -28,6 +37,8 @@ static void memfs_open(fs_node_t* node, uint32_t flags);
 static void memfs_close(fs_node_t* node);
 static dirent_t* memfs_readdir(fs_node_t* node, uint32_t index);
 static fs_node_t* memfs_finddir(fs_node_t* node, char* name);
+static fs_node_t* memfs_create(fs_node_t* node, char* name);
+static uint32_t memfs_mmap_page(fs_node_t* node, uint32_t offset);
 
 // File system operations
 static filesystem_ops_t memfs_ops = {
@@ -42,13 +53,6 @@ void memfs_initialize(void) {
     nodes = (memfs_inode_t*)kmalloc(MAX_FILES * sizeof(memfs_inode_t));
     memset(nodes, 0, MAX_FILES * sizeof(memfs_inode_t));
     
-    // Allocate block bitmap (1 bit per block)
-    block_bitmap = (uint8_t*)kmalloc(MAX_BLOCKS / 8);
-    memset(block_bitmap, 0, MAX_BLOCKS / 8);
-    
-    // Allocate blocks
-    blocks = (uint8_t*)kmalloc(MAX_BLOCKS * BLOCK_SIZE);
-    
     // Create root directory
     root_node = &nodes[0];
     root_node->name = "/";
@@ -61,38 +65,23 @@ void memfs_initialize(void) {
     register_filesystem(&memfs_ops);
 }
 
-// Allocate a new inode (used internally)
-#if 0
+// Take a free inode slot, NULL when all are used. memfs_lock held.
 static memfs_inode_t* memfs_alloc_inode(const char* name, uint32_t is_dir) {
-    static uint32_t inode_counter = 1;
-    memfs_inode_t* inode = (memfs_inode_t*)kmalloc(sizeof(memfs_inode_t));
-    if (!inode) return NULL;
-    
-    memset(inode, 0, sizeof(memfs_inode_t));
-    inode->name = (char*)kmalloc(strlen(name) + 1);
-    if (!inode->name) {
-        kfree(inode);
-        return NULL;
+    for (uint32_t i = 1; i < MAX_FILES; i++) {
+        memfs_inode_t* inode = &nodes[i];
+        if (inode->name) {
+            continue;
+        }
+        inode->name = (char*)kmalloc(strlen(name) + 1);
+        if (!inode->name) {
+            return NULL;
+        }
+        strcpy(inode->name, name);
+        inode->is_dir = is_dir;
+        return inode;
     }
-    strcpy(inode->name, name);
-    inode->is_dir = is_dir;
-    inode->inode = inode_counter++;
-    
-    return inode;
-}
-#else
-// Temporary implementation that just returns NULL
-static memfs_inode_t* memfs_alloc_inode(const char* name, uint32_t is_dir) {
-    (void)name;     // Unused parameter
-    (void)is_dir;   // Unused parameter
     return NULL;
 }
-#endif
-
-// Suppress unused function warning
-static void __attribute__((unused)) suppress_unused_warning() {
-    (void)memfs_alloc_inode(NULL, 0);
-}
 
 // Mount the memory file system
 fs_node_t* memfs_mount(const char* device) {
@@ -118,12 +107,38 @@ fs_node_t* memfs_mount(const char* device) {
     root->close = memfs_close;
     root->readdir = memfs_readdir;
     root->finddir = memfs_finddir;
+    root->create = memfs_create;
     
     root->fs_specific = root_node;
     
     return root;
 }
 
+// Frame of page index of a file, 0 for a hole. With alloc a hole gets a
+// zeroed frame, 0 then means out of memory or past MEMFS_MAX_SIZE.
+static uint32_t memfs_page(memfs_inode_t* inode, uint32_t index, bool alloc) {
+    uint32_t flags = spin_lock_irqsave(&memfs_lock);
+    if (!inode->pages && alloc) {
+        inode->pages = alloc_page();
+        if (inode->pages) {
+            memset(inode->pages, 0, PAGE_SIZE);
+        }
+    }
+    uint32_t frame = 0;
+    if (inode->pages && index < MEMFS_MAX_PAGES) {
+        frame = inode->pages[index];
+        if (!frame && alloc) {
+            void* page = alloc_page();
+            if (page) {
+                memset(page, 0, PAGE_SIZE);
+                inode->pages[index] = frame = (uint32_t)page;
+            }
+        }
+    }
+    spin_unlock_irqrestore(&memfs_lock, flags);
+    return frame;
+}
+
 // Read from a file
 static uint32_t memfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
     memfs_inode_t* inode = (memfs_inode_t*)node->fs_specific;
@@ -136,8 +151,19 @@ static uint32_t memfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint
         size = inode->size - offset;
     }
     
-    if (inode->data) {
-        memcpy(buffer, inode->data + offset, size);
+    for (uint32_t done = 0; done < size; ) {
+        uint32_t in_page = (offset + done) & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        uint32_t frame = memfs_page(inode, (offset + done) / PAGE_SIZE, false);
+        if (frame) {
+            memcpy(buffer + done, (uint8_t*)frame + in_page, chunk);
+        } else {
+            memset(buffer + done, 0, chunk);
+        }
+        done += chunk;
     }
     
     return size;
@@ -152,21 +178,50 @@ static uint32_t memfs_write(fs_node_t* node, uint32_t offset, uint32_t size, uin
         return 0;
     }
     
-    // If we need more space, allocate it
-    if (offset + size > inode->size) {
-        // TODO: Implement block allocation
-        uint8_t* new_data = (uint8_t*)kmalloc(offset + size);
-        if (inode->data) {
-            memcpy(new_data, inode->data, inode->size);
-            kfree(inode->data);
+    if (offset >= MEMFS_MAX_SIZE) {
+        return 0;
+    }
+    if (size > MEMFS_MAX_SIZE - offset) {
+        size = MEMFS_MAX_SIZE - offset;
+    }
+    
+    // Write the data, stopping short when out of memory
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t in_page = (offset + done) & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        uint32_t frame = memfs_page(inode, (offset + done) / PAGE_SIZE, true);
+        if (!frame) {
+            break;
         }
-        inode->data = new_data;
-        inode->size = offset + size;
+        memcpy((uint8_t*)frame + in_page, buffer + done, chunk);
+        done += chunk;
     }
     
-    // Write the data
-    memcpy(inode->data + offset, buffer, size);
-    return size;
+    uint32_t flags = spin_lock_irqsave(&memfs_lock);
+    if (offset + done > inode->size) {
+        inode->size = offset + done;
+        node->length = inode->size;
+    }
+    spin_unlock_irqrestore(&memfs_lock, flags);
+    return done;
+}
+
+// Hand out the frame itself: a shared mapping writes to the file, a
+// private one copies the frame on its first write
+static uint32_t memfs_mmap_page(fs_node_t* node, uint32_t offset) {
+    memfs_inode_t* inode = (memfs_inode_t*)node->fs_specific;
+    if (offset >= inode->size) {
+        return 0;
+    }
+    uint32_t frame = memfs_page(inode, offset / PAGE_SIZE, true);
+    if (frame) {
+        page_get((void*)frame);
+    }
+    return frame;
 }
 
 // Open a file
@@ -205,6 +260,39 @@ static dirent_t* memfs_readdir(fs_node_t* node, uint32_t index) {
     return NULL;
 }
 
+// The node of an inode, made on the first lookup. Nodes are never freed,
+// so every open file and mapping of the inode shares one. memfs_lock held.
+static fs_node_t* memfs_node(memfs_inode_t* child) {
+    if (child->node) {
+        return child->node;
+    }
+    fs_node_t* fs_node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+    if (!fs_node) {
+        return NULL;
+    }
+    memset(fs_node, 0, sizeof(fs_node_t));
+    
+    strcpy(fs_node->name, child->name);
+    fs_node->mask = 0; // TODO: Set proper permissions
+    fs_node->uid = 0;
+    fs_node->gid = 0;
+    fs_node->flags = child->is_dir ? FS_DIRECTORY : FS_FILE;
+    fs_node->inode = (uint32_t)child;
+    fs_node->length = child->size;
+    fs_node->read = memfs_read;
+    fs_node->write = memfs_write;
+    fs_node->open = memfs_open;
+    fs_node->close = memfs_close;
+    fs_node->readdir = child->is_dir ? memfs_readdir : NULL;
+    fs_node->finddir = child->is_dir ? memfs_finddir : NULL;
+    fs_node->create = child->is_dir ? memfs_create : NULL;
+    fs_node->mmap_page = child->is_dir ? NULL : memfs_mmap_page;
+    fs_node->fs_specific = child;
+    
+    child->node = fs_node;
+    return fs_node;
+}
+
 // Find a directory entry
 static fs_node_t* memfs_finddir(fs_node_t* node, char* name) {
     memfs_inode_t* inode = (memfs_inode_t*)node->fs_specific;
@@ -213,29 +301,41 @@ static fs_node_t* memfs_finddir(fs_node_t* node, char* name) {
         return NULL;
     }
     
+    fs_node_t* found = NULL;
+    uint32_t flags = spin_lock_irqsave(&memfs_lock);
     for (memfs_inode_t* child = inode->children; child; child = child->next) {
         if (strcmp(child->name, name) == 0) {
-            fs_node_t* fs_node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
-            memset(fs_node, 0, sizeof(fs_node_t));
-            
-            strcpy(fs_node->name, child->name);
-            fs_node->mask = 0; // TODO: Set proper permissions
-            fs_node->uid = 0;
-            fs_node->gid = 0;
-            fs_node->flags = child->is_dir ? FS_DIRECTORY : FS_FILE;
-            fs_node->inode = (uint32_t)child;
-            fs_node->length = child->size;
-            fs_node->read = memfs_read;
-            fs_node->write = memfs_write;
-            fs_node->open = memfs_open;
-            fs_node->close = memfs_close;
-            fs_node->readdir = child->is_dir ? memfs_readdir : NULL;
-            fs_node->finddir = child->is_dir ? memfs_finddir : NULL;
-            fs_node->fs_specific = child;
-            
-            return fs_node;
+            found = memfs_node(child);
+            break;
         }
     }
+    spin_unlock_irqrestore(&memfs_lock, flags);
     
-    return NULL;
+    return found;
+}
+
+// Create an empty file, or find the one another task just created
+static fs_node_t* memfs_create(fs_node_t* node, char* name) {
+    memfs_inode_t* dir = (memfs_inode_t*)node->fs_specific;
+    
+    fs_node_t* created = NULL;
+    uint32_t flags = spin_lock_irqsave(&memfs_lock);
+    memfs_inode_t* child = dir->children;
+    while (child && strcmp(child->name, name) != 0) {
+        child = child->next;
+    }
+    if (!child) {
+        child = memfs_alloc_inode(name, 0);
+        if (child) {
+            child->parent = dir;
+            child->next = dir->children;
+            dir->children = child;
+        }
+    }
+    if (child && !child->is_dir) {
+        created = memfs_node(child);
+    }
+    spin_unlock_irqrestore(&memfs_lock, flags);
+    
+    return created;
 }
@@ -0,0 +1,326 @@
+#include "fs/pipe.h"
+#include "fs/poll.h"
+#include "memory.h"
+#include "paging.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "string.h"
+#include "wait.h"
+
+typedef struct {
+    uint32_t frame;
+    uint32_t offset;               // Unread part of the frame
+    uint32_t len;
+} pipe_page_t;
+
+// Data is either in the ring or in moved pages, never both: a write
+// switching from one to the other waits until the reader drained the
+// first, which keeps the bytes in order
+typedef struct {
+    spinlock_t lock;
+    uint8_t* ring;
+    uint32_t head;                 // Next byte to read
+    uint32_t count;                // Bytes in the ring
+    pipe_page_t pages[PIPE_MAX_PAGES];
+    uint32_t page_head;
+    uint32_t nr_pages;
+    uint32_t readers;              // References to each end
+    uint32_t writers;
+    wait_queue_head_t read_wq;
+    wait_queue_head_t write_wq;
+    fs_node_t read_end;
+    fs_node_t write_end;
+    bool used;
+} pipe_t;
+
+static pipe_t pipes[MAX_PIPES];
+static spinlock_t pipes_lock = SPINLOCK_INIT;
+static uint32_t pipe_bytes_copied;
+static uint32_t pipe_pages_moved;
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+// User memory of the current task, where pages can be moved
+static mm_t* pipe_user_mm(const uint8_t* buffer) {
+    mm_t* mm = current_task()->mm;
+    return mm && (uint32_t)buffer >= USER_BASE ? mm : NULL;
+}
+
+static uint32_t pipe_read_ring(pipe_t* pipe, uint8_t* buffer, uint32_t size) {
+    uint32_t n = min_u32(size, pipe->count);
+    uint32_t first = min_u32(n, PAGE_SIZE - pipe->head);
+    memcpy(buffer, pipe->ring + pipe->head, first);
+    memcpy(buffer + first, pipe->ring, n - first);
+    pipe->head = (pipe->head + n) % PAGE_SIZE;
+    pipe->count -= n;
+    pipe_bytes_copied += n;
+    return n;
+}
+
+static uint32_t pipe_read_page(pipe_t* pipe, uint8_t* buffer, uint32_t size) {
+    pipe_page_t* page = &pipe->pages[pipe->page_head];
+    mm_t* mm = pipe_user_mm(buffer);
+    uint32_t n;
+
+    if (mm && page->len == PAGE_SIZE && size >= PAGE_SIZE &&
+        mm_insert_shared(mm, (uint32_t)buffer, page->frame) == 0) {
+        // The reference went to the reader's page table
+        n = PAGE_SIZE;
+        pipe_pages_moved++;
+    } else {
+        n = min_u32(size, page->len);
+        memcpy(buffer, (uint8_t*)page->frame + page->offset, n);
+        page->offset += n;
+        page->len -= n;
+        pipe_bytes_copied += n;
+        if (page->len) {
+            return n;
+        }
+        free_page((void*)page->frame);
+    }
+    pipe->page_head = (pipe->page_head + 1) % PIPE_MAX_PAGES;
+    pipe->nr_pages--;
+    return n;
+}
+
+static uint32_t pipe_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    (void)offset;
+    pipe_t* pipe = node->fs_specific;
+    if (size == 0) {
+        return 0;
+    }
+
+    while (1) {
+        wait_event(pipe->read_wq, pipe->count || pipe->nr_pages || !pipe->writers);
+
+        uint32_t n = 0;
+        uint32_t flags = spin_lock_irqsave(&pipe->lock);
+        if (pipe->count) {
+            n = pipe_read_ring(pipe, buffer, size);
+        } else if (pipe->nr_pages) {
+            n = pipe_read_page(pipe, buffer, size);
+        }
+        bool eof = !n && !pipe->writers;
+        spin_unlock_irqrestore(&pipe->lock, flags);
+
+        if (n) {
+            wake_up_all(&pipe->write_wq);
+            return n;
+        }
+        if (eof) {
+            return 0;
+        }
+        // Another reader was faster
+    }
+}
+
+// Copy into the ring, at most up to the next page boundary of a user
+// source so the rest can be moved. 0 when the readers are gone.
+static uint32_t pipe_write_ring(pipe_t* pipe, const uint8_t* src, uint32_t len) {
+    if (pipe_user_mm(src)) {
+        len = min_u32(len, PAGE_SIZE - ((uint32_t)src & (PAGE_SIZE - 1)));
+    }
+
+    while (1) {
+        wait_event(pipe->write_wq, !pipe->readers || (!pipe->nr_pages && pipe->count < PAGE_SIZE));
+
+        uint32_t n = 0;
+        uint32_t flags = spin_lock_irqsave(&pipe->lock);
+        bool gone = !pipe->readers;
+        if (!gone && !pipe->nr_pages && pipe->count < PAGE_SIZE) {
+            n = min_u32(len, PAGE_SIZE - pipe->count);
+            uint32_t tail = (pipe->head + pipe->count) % PAGE_SIZE;
+            uint32_t first = min_u32(n, PAGE_SIZE - tail);
+            memcpy(pipe->ring + tail, src, first);
+            memcpy(pipe->ring, src + first, n - first);
+            pipe->count += n;
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+
+        if (n) {
+            wake_up_all(&pipe->read_wq);
+            return n;
+        }
+        if (gone) {
+            return 0;
+        }
+    }
+}
+
+// Queue the page at addr by reference. 0 when it cannot be moved or the
+// readers are gone, the caller then copies it.
+static uint32_t pipe_write_page(pipe_t* pipe, mm_t* mm, uint32_t addr) {
+    while (1) {
+        wait_event(pipe->write_wq, !pipe->readers || (!pipe->count && pipe->nr_pages < PIPE_MAX_PAGES));
+
+        uint32_t frame = 0;
+        uint32_t flags = spin_lock_irqsave(&pipe->lock);
+        bool gone = !pipe->readers;
+        bool room = !pipe->count && pipe->nr_pages < PIPE_MAX_PAGES;
+        if (!gone && room && (frame = mm_share_page(mm, addr)) != 0) {
+            pipe_page_t* page = &pipe->pages[(pipe->page_head + pipe->nr_pages) % PIPE_MAX_PAGES];
+            page->frame = frame;
+            page->offset = 0;
+            page->len = PAGE_SIZE;
+            pipe->nr_pages++;
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+
+        if (frame) {
+            wake_up_all(&pipe->read_wq);
+            return PAGE_SIZE;
+        }
+        if (gone || room) {
+            return 0;
+        }
+    }
+}
+
+static uint32_t pipe_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    (void)offset;
+    pipe_t* pipe = node->fs_specific;
+    uint32_t written = 0;
+
+    while (written < size) {
+        uint8_t* src = buffer + written;
+        uint32_t left = size - written;
+        mm_t* mm = pipe_user_mm(src);
+        uint32_t n = 0;
+        if (mm && !((uint32_t)src & (PAGE_SIZE - 1)) && left >= PAGE_SIZE) {
+            n = pipe_write_page(pipe, mm, (uint32_t)src);
+        }
+        if (!n) {
+            n = pipe_write_ring(pipe, src, left);
+        }
+        if (!n) {
+            break;   // Nobody reads any more
+        }
+        written += n;
+    }
+    return written;
+}
+
+static void pipe_open(fs_node_t* node, uint32_t flags) {
+    (void)flags;
+    pipe_t* pipe = node->fs_specific;
+    uint32_t irq_flags = spin_lock_irqsave(&pipe->lock);
+    if (node == &pipe->read_end) {
+        pipe->readers++;
+    } else {
+        pipe->writers++;
+    }
+    spin_unlock_irqrestore(&pipe->lock, irq_flags);
+}
+
+static void pipe_release(pipe_t* pipe) {
+    for (; pipe->nr_pages; pipe->nr_pages--) {
+        free_page((void*)pipe->pages[pipe->page_head].frame);
+        pipe->page_head = (pipe->page_head + 1) % PIPE_MAX_PAGES;
+    }
+    free_page(pipe->ring);
+
+    uint32_t flags = spin_lock_irqsave(&pipes_lock);
+    pipe->used = false;
+    spin_unlock_irqrestore(&pipes_lock, flags);
+}
+
+static void pipe_close(fs_node_t* node) {
+    pipe_t* pipe = node->fs_specific;
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    if (node == &pipe->read_end) {
+        pipe->readers--;
+    } else {
+        pipe->writers--;
+    }
+    bool last = !pipe->readers && !pipe->writers;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    if (last) {
+        pipe_release(pipe);
+    } else {
+        // Blocked ends see end of file or a broken pipe
+        wake_up_all(&pipe->read_wq);
+        wake_up_all(&pipe->write_wq);
+    }
+}
+
+static uint32_t pipe_poll(fs_node_t* node, struct poll_table* pt) {
+    pipe_t* pipe = node->fs_specific;
+    uint32_t mask = 0;
+
+    // Queued before looking, so a change in between is not missed
+    poll_wait(pt, node == &pipe->read_end ? &pipe->read_wq : &pipe->write_wq);
+
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    if (node == &pipe->read_end) {
+        if (pipe->count || pipe->nr_pages) {
+            mask |= POLLIN;
+        }
+        if (!pipe->writers) {
+            mask |= POLLIN | POLLHUP;
+        }
+    } else if (!pipe->readers) {
+        mask |= POLLERR;
+    } else if (!pipe->nr_pages && pipe->count < PAGE_SIZE) {
+        mask |= POLLOUT;
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return mask;
+}
+
+static void pipe_init_end(pipe_t* pipe, fs_node_t* node, const char* name, uint32_t mask) {
+    memset(node, 0, sizeof(*node));
+    strcpy(node->name, name);
+    node->mask = mask;
+    node->flags = FS_PIPE;
+    node->open = pipe_open;
+    node->close = pipe_close;
+    node->poll = pipe_poll;
+    node->fs_specific = pipe;
+}
+
+int pipe_create(fs_node_t** read_end, fs_node_t** write_end) {
+    pipe_t* pipe = NULL;
+    uint32_t flags = spin_lock_irqsave(&pipes_lock);
+    for (uint32_t i = 0; i < MAX_PIPES; i++) {
+        if (!pipes[i].used) {
+            pipe = &pipes[i];
+            pipe->used = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pipes_lock, flags);
+    if (!pipe) {
+        return -1;
+    }
+
+    pipe->ring = alloc_page();
+    if (!pipe->ring) {
+        flags = spin_lock_irqsave(&pipes_lock);
+        pipe->used = false;
+        spin_unlock_irqrestore(&pipes_lock, flags);
+        return -1;
+    }
+    spin_lock_init(&pipe->lock);
+    init_waitqueue_head(&pipe->read_wq);
+    init_waitqueue_head(&pipe->write_wq);
+    pipe->head = pipe->count = 0;
+    pipe->page_head = pipe->nr_pages = 0;
+    pipe->readers = pipe->writers = 1;
+
+    pipe_init_end(pipe, &pipe->read_end, "pipe:r", 0x124);   // r--r--r--
+    pipe->read_end.read = pipe_read;
+    pipe_init_end(pipe, &pipe->write_end, "pipe:w", 0x092);  // -w--w--w-
+    pipe->write_end.write = pipe_write;
+
+    *read_end = &pipe->read_end;
+    *write_end = &pipe->write_end;
+    return 0;
+}
+
+void pipe_stats(uint32_t* bytes_copied, uint32_t* pages_moved) {
+    *bytes_copied = pipe_bytes_copied;
+    *pages_moved = pipe_pages_moved;
+}
@@ -0,0 +1,457 @@
+#include "fs/poll.h"
+#include "string.h"
+#include "spinlock.h"
+#include "sched.h"
+#include "timer.h"
+
+uint32_t vfs_poll(fs_node_t* node, poll_table_t* pt) {
+    if (node->poll) {
+        return node->poll(node, pt);
+    }
+    return POLLIN | POLLOUT;
+}
+
+// poll(): one callback entry per wait queue of every descriptor, all
+// waking the polling task
+#define POLL_MAX_ENTRIES (2 * POLL_MAX_FDS)
+
+typedef struct {
+    poll_table_t table;          // Must stay first
+    task_t* task;
+    volatile bool triggered;
+    uint32_t nr_entries;
+    wait_queue_entry_t entries[POLL_MAX_ENTRIES];
+    wait_queue_head_t* heads[POLL_MAX_ENTRIES];
+} poll_wqueues_t;
+
+static void poll_wake(wait_queue_entry_t* entry) {
+    poll_wqueues_t* pw = entry->private;
+    pw->triggered = true;
+    wake_up_task(pw->task);
+}
+
+static void poll_queue(poll_table_t* pt, wait_queue_head_t* wq) {
+    poll_wqueues_t* pw = (poll_wqueues_t*)pt;
+    if (pw->nr_entries == POLL_MAX_ENTRIES) {
+        return;
+    }
+    wait_queue_entry_t* entry = &pw->entries[pw->nr_entries];
+    init_wait_func(entry, poll_wake, pw);
+    pw->heads[pw->nr_entries++] = wq;
+    add_wait_queue(wq, entry);
+}
+
+static void poll_timeout(uint32_t data) {
+    wake_up_task((task_t*)data);
+}
+
+static uint32_t poll_fd(pollfd_t* pfd, poll_table_t* pt) {
+    fs_node_t* node = fd_lookup(pfd->fd);
+    uint32_t mask = node ? vfs_poll(node, pt) & (pfd->events | POLLERR | POLLHUP) : POLLNVAL;
+    pfd->revents = mask;
+    return mask;
+}
+
+// Sleep until a wakeup callback or the timer fires
+static void poll_sleep(poll_wqueues_t* pw, timer_list_t* timer, bool timed) {
+    while (1) {
+        set_current_state(TASK_BLOCKED);
+        if (pw->triggered || (timed && !timer_pending(timer))) {
+            break;
+        }
+        schedule();
+    }
+    set_current_state(TASK_RUNNING);
+    pw->triggered = false;
+}
+
+int32_t poll(pollfd_t* fds, uint32_t nfds, int32_t timeout_ms) {
+    if (nfds > POLL_MAX_FDS) {
+        return -1;
+    }
+
+    poll_wqueues_t pw;
+    pw.table.queue = poll_queue;
+    pw.task = current_task();
+    pw.triggered = false;
+    pw.nr_entries = 0;
+
+    timer_list_t timer;
+    bool timed = timeout_ms > 0;
+    if (timed) {
+        timer_setup(&timer, poll_timeout, (uint32_t)pw.task);
+        mod_timer(&timer, timer_ticks + msecs_to_ticks(timeout_ms));
+    }
+
+    // Queued on the first pass only, later passes just look
+    poll_table_t* pt = timeout_ms ? &pw.table : NULL;
+    int32_t ready;
+    while (1) {
+        ready = 0;
+        for (uint32_t i = 0; i < nfds; i++) {
+            if (poll_fd(&fds[i], pt)) {
+                ready++;
+            }
+        }
+        pt = NULL;
+        if (ready || timeout_ms == 0 || (timed && !timer_pending(&timer)) || !sched_can_block()) {
+            break;
+        }
+        poll_sleep(&pw, &timer, timed);
+    }
+
+    if (timed) {
+        del_timer(&timer);
+    }
+    for (uint32_t i = 0; i < pw.nr_entries; i++) {
+        remove_wait_queue(pw.heads[i], &pw.entries[i]);
+    }
+    return ready;
+}
+
+// A registration of one descriptor in one set. Its callback entries stay
+// on the node's wait queues and move it to the set's ready list.
+#define EPITEM_MAX_WAITS 2
+
+struct eventpoll;
+
+typedef struct epitem {
+    struct eventpoll* ep;
+    int32_t fd;
+    fs_node_t* node;
+    uint32_t events;
+    uint32_t data;
+    wait_queue_entry_t waits[EPITEM_MAX_WAITS];
+    wait_queue_head_t* heads[EPITEM_MAX_WAITS];
+    uint32_t nr_waits;
+    bool ready;                  // On the ready list
+    bool used;
+    struct epitem* next;         // In the set
+    struct epitem* ready_next;
+} epitem_t;
+
+// ctl_lock serializes changes to the set and is taken before wait queue
+// locks; lock protects the lists and is taken inside them by callbacks
+typedef struct eventpoll {
+    spinlock_t ctl_lock;
+    spinlock_t lock;
+    epitem_t* items;
+    epitem_t* ready_head;
+    epitem_t* ready_tail;
+    wait_queue_head_t wq;        // Tasks in epoll_wait() and polls of the set
+    fs_node_t node;
+    bool used;
+} eventpoll_t;
+
+typedef struct {
+    poll_table_t table;          // Must stay first
+    epitem_t* item;
+} ep_pqueue_t;
+
+static eventpoll_t eventpolls[EPOLL_MAX_INSTANCES];
+static epitem_t epitems[EPOLL_MAX_ITEMS];
+static spinlock_t epoll_alloc_lock = SPINLOCK_INIT;
+
+// Set locked
+static void ep_ready_add(eventpoll_t* ep, epitem_t* item) {
+    item->ready = true;
+    item->ready_next = NULL;
+    if (ep->ready_tail) {
+        ep->ready_tail->ready_next = item;
+    } else {
+        ep->ready_head = item;
+    }
+    ep->ready_tail = item;
+}
+
+static void ep_poll_callback(wait_queue_entry_t* entry) {
+    epitem_t* item = entry->private;
+    eventpoll_t* ep = item->ep;
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    if (!item->ready) {
+        ep_ready_add(ep, item);
+    }
+    spin_unlock_irqrestore(&ep->lock, flags);
+    wake_up_all(&ep->wq);
+}
+
+static void ep_queue(poll_table_t* pt, wait_queue_head_t* wq) {
+    epitem_t* item = ((ep_pqueue_t*)pt)->item;
+    if (item->nr_waits == EPITEM_MAX_WAITS) {
+        return;
+    }
+    wait_queue_entry_t* entry = &item->waits[item->nr_waits];
+    init_wait_func(entry, ep_poll_callback, item);
+    item->heads[item->nr_waits++] = wq;
+    add_wait_queue(wq, entry);
+}
+
+static eventpoll_t* ep_from_node(fs_node_t* node) {
+    return node && (node->flags & 0x7) == FS_EVENTPOLL ? node->fs_specific : NULL;
+}
+
+// Unhook an item and free it, ctl_lock held
+static void ep_remove(eventpoll_t* ep, epitem_t* item) {
+    for (uint32_t i = 0; i < item->nr_waits; i++) {
+        remove_wait_queue(item->heads[i], &item->waits[i]);
+    }
+
+    // No callback can queue it any more
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    for (epitem_t** link = &ep->items; *link; link = &(*link)->next) {
+        if (*link == item) {
+            *link = item->next;
+            break;
+        }
+    }
+    if (item->ready) {
+        epitem_t* prev = NULL;
+        for (epitem_t* it = ep->ready_head; it; prev = it, it = it->ready_next) {
+            if (it == item) {
+                if (prev) {
+                    prev->ready_next = it->ready_next;
+                } else {
+                    ep->ready_head = it->ready_next;
+                }
+                if (ep->ready_tail == it) {
+                    ep->ready_tail = prev;
+                }
+                break;
+            }
+        }
+    }
+    spin_unlock_irqrestore(&ep->lock, flags);
+
+    flags = spin_lock_irqsave(&epoll_alloc_lock);
+    item->used = false;
+    spin_unlock_irqrestore(&epoll_alloc_lock, flags);
+}
+
+static epitem_t* ep_find(eventpoll_t* ep, int32_t fd) {
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    epitem_t* item = ep->items;
+    while (item && item->fd != fd) {
+        item = item->next;
+    }
+    spin_unlock_irqrestore(&ep->lock, flags);
+    return item;
+}
+
+static int32_t ep_insert(eventpoll_t* ep, int32_t fd, fs_node_t* node, const epoll_event_t* event) {
+    epitem_t* item = NULL;
+    uint32_t flags = spin_lock_irqsave(&epoll_alloc_lock);
+    for (uint32_t i = 0; i < EPOLL_MAX_ITEMS; i++) {
+        if (!epitems[i].used) {
+            item = &epitems[i];
+            item->used = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&epoll_alloc_lock, flags);
+    if (!item) {
+        return -1;
+    }
+
+    item->ep = ep;
+    item->fd = fd;
+    item->node = node;
+    item->events = event->events;
+    item->data = event->data;
+    item->nr_waits = 0;
+    item->ready = false;
+    item->ready_next = NULL;
+
+    // Hook onto the node's wait queues, then see whether it is ready already
+    ep_pqueue_t pq = { { ep_queue }, item };
+    uint32_t mask = vfs_poll(node, &pq.table) & (item->events | POLLERR | POLLHUP);
+
+    flags = spin_lock_irqsave(&ep->lock);
+    item->next = ep->items;
+    ep->items = item;
+    if (mask && !item->ready) {
+        ep_ready_add(ep, item);
+    }
+    spin_unlock_irqrestore(&ep->lock, flags);
+    if (mask) {
+        wake_up_all(&ep->wq);
+    }
+    return 0;
+}
+
+// Move the ready items that still are into events, set locked. Level
+// triggered ones go to the back of the list to be checked again next time.
+static uint32_t ep_collect(eventpoll_t* ep, epoll_event_t* events, uint32_t max) {
+    epitem_t* list = ep->ready_head;
+    epitem_t* again = NULL;
+    epitem_t* again_tail = NULL;
+    ep->ready_head = ep->ready_tail = NULL;
+
+    uint32_t n = 0;
+    while (list && n < max) {
+        epitem_t* item = list;
+        list = item->ready_next;
+        item->ready = false;
+        uint32_t mask = vfs_poll(item->node, NULL) & (item->events | POLLERR | POLLHUP);
+        if (!mask) {
+            continue;
+        }
+        events[n].events = mask;
+        events[n].data = item->data;
+        n++;
+        if (!(item->events & EPOLLET)) {
+            item->ready = true;
+            item->ready_next = NULL;
+            if (again_tail) {
+                again_tail->ready_next = item;
+            } else {
+                again = item;
+            }
+            again_tail = item;
+        }
+    }
+
+    // Not looked at for lack of room: first in line next time
+    while (list) {
+        epitem_t* item = list;
+        list = item->ready_next;
+        ep_ready_add(ep, item);
+    }
+    for (epitem_t* item = again; item; ) {
+        epitem_t* next = item->ready_next;
+        ep_ready_add(ep, item);
+        item = next;
+    }
+    return n;
+}
+
+static uint32_t ep_node_poll(fs_node_t* node, poll_table_t* pt) {
+    eventpoll_t* ep = node->fs_specific;
+    poll_wait(pt, &ep->wq);
+    return ep->ready_head ? POLLIN : 0;
+}
+
+static void ep_node_close(fs_node_t* node) {
+    eventpoll_t* ep = node->fs_specific;
+    uint32_t flags = spin_lock_irqsave(&ep->ctl_lock);
+    while (ep->items) {
+        ep_remove(ep, ep->items);
+    }
+    spin_unlock_irqrestore(&ep->ctl_lock, flags);
+
+    flags = spin_lock_irqsave(&epoll_alloc_lock);
+    ep->used = false;
+    spin_unlock_irqrestore(&epoll_alloc_lock, flags);
+}
+
+int32_t epoll_create(void) {
+    eventpoll_t* ep = NULL;
+    uint32_t flags = spin_lock_irqsave(&epoll_alloc_lock);
+    for (uint32_t i = 0; i < EPOLL_MAX_INSTANCES; i++) {
+        if (!eventpolls[i].used) {
+            ep = &eventpolls[i];
+            ep->used = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&epoll_alloc_lock, flags);
+    if (!ep) {
+        return -1;
+    }
+
+    spin_lock_init(&ep->ctl_lock);
+    spin_lock_init(&ep->lock);
+    init_waitqueue_head(&ep->wq);
+    ep->items = NULL;
+    ep->ready_head = ep->ready_tail = NULL;
+    memset(&ep->node, 0, sizeof(ep->node));
+    strcpy(ep->node.name, "epoll");
+    ep->node.mask = 0x124;   // r--r--r--
+    ep->node.flags = FS_EVENTPOLL;
+    ep->node.poll = ep_node_poll;
+    ep->node.close = ep_node_close;
+    ep->node.fs_specific = ep;
+
+    int32_t fd = open_node(&ep->node, O_RDONLY);
+    if (fd < 0) {
+        ep->used = false;
+    }
+    return fd;
+}
+
+int32_t epoll_ctl(int32_t epfd, int32_t op, int32_t fd, const epoll_event_t* event) {
+    eventpoll_t* ep = ep_from_node(fd_lookup(epfd));
+    fs_node_t* node = fd_lookup(fd);
+    if (!ep || !node || fd == epfd || (op != EPOLL_CTL_DEL && !event)) {
+        return -1;
+    }
+
+    int32_t ret = -1;
+    uint32_t flags = spin_lock_irqsave(&ep->ctl_lock);
+    epitem_t* item = ep_find(ep, fd);
+    if (op == EPOLL_CTL_ADD && !item) {
+        ret = ep_insert(ep, fd, node, event);
+    } else if (op == EPOLL_CTL_DEL && item) {
+        ep_remove(ep, item);
+        ret = 0;
+    } else if (op == EPOLL_CTL_MOD && item) {
+        ep_remove(ep, item);
+        ret = ep_insert(ep, fd, node, event);
+    }
+    spin_unlock_irqrestore(&ep->ctl_lock, flags);
+    return ret;
+}
+
+int32_t epoll_wait(int32_t epfd, epoll_event_t* events, uint32_t max, int32_t timeout_ms) {
+    eventpoll_t* ep = ep_from_node(fd_lookup(epfd));
+    if (!ep || max == 0) {
+        return -1;
+    }
+
+    timer_list_t timer;
+    bool timed = timeout_ms > 0;
+    if (timed) {
+        timer_setup(&timer, poll_timeout, (uint32_t)current_task());
+        mod_timer(&timer, timer_ticks + msecs_to_ticks(timeout_ms));
+    }
+
+    uint32_t n;
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&ep->lock);
+        n = ep_collect(ep, events, max);
+        spin_unlock_irqrestore(&ep->lock, flags);
+        if (n || timeout_ms == 0 || (timed && !timer_pending(&timer)) || !sched_can_block()) {
+            break;
+        }
+
+        wait_queue_entry_t wait;
+        init_wait_entry(&wait, 0);
+        while (1) {
+            prepare_to_wait(&ep->wq, &wait);
+            if (ep->ready_head || (timed && !timer_pending(&timer))) {
+                break;
+            }
+            schedule();
+        }
+        finish_wait(&ep->wq, &wait);
+    }
+
+    if (timed) {
+        del_timer(&timer);
+    }
+    return (int32_t)n;
+}
+
+void eventpoll_release(int32_t fd) {
+    for (uint32_t i = 0; i < EPOLL_MAX_INSTANCES; i++) {
+        eventpoll_t* ep = &eventpolls[i];
+        if (!ep->used) {
+            continue;
+        }
+        uint32_t flags = spin_lock_irqsave(&ep->ctl_lock);
+        epitem_t* item = ep_find(ep, fd);
+        if (item) {
+            ep_remove(ep, item);
+        }
+        spin_unlock_irqrestore(&ep->ctl_lock, flags);
+    }
+}
@@ -1,5 +1,8 @@
 #include "fs/vfs.h"
 #include "string.h"
+#include "spinlock.h"
+#include "rcu.h"
+#include "fs/poll.h"
 
 // Global root filesystem node
 fs_node_t* fs_root = NULL;
@@ -8,11 +11,12 @@ fs_node_t* fs_root = NULL;
 #define MAX_FILE_DESCRIPTORS 64
 static file_descriptor_t file_descriptors[MAX_FILE_DESCRIPTORS];
 static uint32_t next_fd = 0;
+static spinlock_t fd_lock = SPINLOCK_INIT;  // Descriptor slots and positions, shared by all CPUs
 
-// List of registered filesystems
-#define MAX_FILESYSTEMS 8
-static filesystem_ops_t* filesystems[MAX_FILESYSTEMS];
-static uint32_t num_filesystems = 0;
+// Registered filesystems. Lookups walk the list under RCU without a lock,
+// the lock only serializes registration.
+static filesystem_ops_t* filesystems = NULL;
+static spinlock_t filesystems_lock = SPINLOCK_INIT;
 
 // Initialize the virtual file system
 void vfs_initialize(void) {
@@ -32,50 +36,55 @@ void vfs_initialize(void) {
     fs_root->flags = FS_DIRECTORY;
     fs_root->inode = 0;
     fs_root->length = 0;
-    
-    // Initialize filesystem list
-    memset(filesystems, 0, sizeof(filesystems));
-    num_filesystems = 0;
 }
 
 // Register a new filesystem
 void register_filesystem(filesystem_ops_t* fs_ops) {
-    if (num_filesystems >= MAX_FILESYSTEMS) {
-        return; // No more space
-    }
-    
-    filesystems[num_filesystems++] = fs_ops;
+    uint32_t flags = spin_lock_irqsave(&filesystems_lock);
+    rcu_list_add(filesystems, fs_ops);
+    spin_unlock_irqrestore(&filesystems_lock, flags);
+}
+
+// Unregister a filesystem
+void unregister_filesystem(filesystem_ops_t* fs_ops) {
+    uint32_t flags = spin_lock_irqsave(&filesystems_lock);
+    rcu_list_del(filesystems, fs_ops);
+    spin_unlock_irqrestore(&filesystems_lock, flags);
+
+    // A lookup may still be looking at it
+    synchronize_rcu();
 }
 
 // Mount a filesystem
 int32_t vfs_mount(const char* device, const char* mountpoint, const char* fs_type) {
     // Find the filesystem type
     filesystem_ops_t* fs_ops = NULL;
-    for (uint32_t i = 0; i < num_filesystems; i++) {
-        if (strcmp(filesystems[i]->name, fs_type) == 0) {
-            fs_ops = filesystems[i];
+    filesystem_ops_t* fs;
+    rcu_read_lock();
+    rcu_list_for_each(fs, filesystems) {
+        if (strcmp(fs->name, fs_type) == 0) {
+            fs_ops = fs;
             break;
         }
     }
+    rcu_read_unlock();
     
     if (!fs_ops) {
         return -1; // Filesystem type not found
     }
     
     // Call the filesystem's mount function
-    fs_node_t* fs_root = fs_ops->mount(device);
-    if (!fs_root) {
+    fs_node_t* root = fs_ops->mount(device);
+    if (!root) {
         return -1; // Mount failed
     }
     
     // For now, we only support mounting at the root
     if (strcmp(mountpoint, "/") == 0) {
         // Copy the mounted filesystem's root to our global root
-        if (fs_root) {
-            memcpy(fs_root, fs_root, sizeof(fs_node_t));
-            // Make sure the root node has the correct flags
-            fs_root->flags |= FS_DIRECTORY;
-        }
+        memcpy(fs_root, root, sizeof(fs_node_t));
+        // Make sure the root node has the correct flags
+        fs_root->flags |= FS_DIRECTORY;
     }
     
     return 0; // Success
@@ -114,9 +123,8 @@ fs_node_t* vfs_open(const char* filename, uint32_t flags) {
             fs_node_t* next = vfs_finddir(current, component);
             if (!next) {
                 // If O_CREAT is set, create the file
-                if ((flags & O_CREAT) && (!slash || *slash == '\0')) {
-                    // TODO: Implement file creation
-                    return NULL;
+                if ((flags & O_CREAT) && (!slash || *slash == '\0') && current->create) {
+                    return current->create(current, component);
                 }
                 return NULL; // Not found
             }
@@ -160,6 +168,13 @@ uint32_t vfs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buf
     return 0;
 }
 
+uint32_t vfs_mmap_page(fs_node_t* node, uint32_t offset) {
+    if (node->mmap_page) {
+        return node->mmap_page(node, offset);
+    }
+    return 0;
+}
+
 // Read directory entry
 dirent_t* vfs_readdir(fs_node_t* node, uint32_t index) {
     if (node->readdir != NULL) {
@@ -179,30 +194,34 @@ fs_node_t* vfs_finddir(fs_node_t* node, char* name) {
 // Standard POSIX-like file operations
 
 int32_t open(const char* filename, uint32_t flags) {
-    // Find an available file descriptor
+    // Open the file
+    fs_node_t* node = vfs_open(filename, flags);
+    if (!node) {
+        return -1; // Failed to open file
+    }
+    return open_node(node, flags);
+}
+
+int32_t open_node(fs_node_t* node, uint32_t flags) {
+    // Find and claim an available file descriptor in one step, so two
+    // CPUs opening at the same time cannot get the same slot
     int32_t fd = -1;
+    uint32_t irq_flags = spin_lock_irqsave(&fd_lock);
     for (uint32_t i = 0; i < MAX_FILE_DESCRIPTORS; i++) {
         if (file_descriptors[i].node == NULL) {
             fd = i;
+            file_descriptors[fd].node = node;
+            file_descriptors[fd].pos = 0;
+            file_descriptors[fd].flags = flags;
             break;
         }
     }
+    spin_unlock_irqrestore(&fd_lock, irq_flags);
     
     if (fd == -1) {
         return -1; // No available file descriptors
     }
     
-    // Open the file
-    fs_node_t* node = vfs_open(filename, flags);
-    if (!node) {
-        return -1; // Failed to open file
-    }
-    
-    // Set up the file descriptor
-    file_descriptors[fd].node = node;
-    file_descriptors[fd].pos = 0;
-    file_descriptors[fd].flags = flags;
-    
     // Call the file's open function if it exists
     if (node->open) {
         node->open(node, flags);
@@ -212,75 +231,110 @@ int32_t open(const char* filename, uint32_t flags) {
 }
 
 int32_t close(int32_t fd) {
-    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || file_descriptors[fd].node == NULL) {
+    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS) {
         return -1; // Invalid file descriptor
     }
     
-    // Call the file's close function if it exists
-    fs_node_t* node = file_descriptors[fd].node;
-    if (node->close) {
-        node->close(node);
-    }
+    // Unregister it from epoll sets while the number still names it
+    eventpoll_release(fd);
     
     // Clear the file descriptor
+    uint32_t flags = spin_lock_irqsave(&fd_lock);
+    fs_node_t* node = file_descriptors[fd].node;
     file_descriptors[fd].node = NULL;
     file_descriptors[fd].pos = 0;
     file_descriptors[fd].flags = 0;
+    spin_unlock_irqrestore(&fd_lock, flags);
+    
+    if (node == NULL) {
+        return -1; // Invalid file descriptor
+    }
+    
+    // Call the file's close function if it exists
+    if (node->close) {
+        node->close(node);
+    }
     
     return 0; // Success
 }
 
+// Copy a descriptor out of the table, the I/O itself runs unlocked
+static bool fd_get(int32_t fd, file_descriptor_t* desc) {
+    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS) {
+        return false;
+    }
+    uint32_t flags = spin_lock_irqsave(&fd_lock);
+    *desc = file_descriptors[fd];
+    spin_unlock_irqrestore(&fd_lock, flags);
+    return desc->node != NULL;
+}
+
+fs_node_t* fd_lookup(int32_t fd) {
+    file_descriptor_t desc;
+    return fd_get(fd, &desc) ? desc.node : NULL;
+}
+
+// Move the position forward unless the descriptor was closed meanwhile
+static void fd_advance(int32_t fd, fs_node_t* node, uint32_t count) {
+    uint32_t flags = spin_lock_irqsave(&fd_lock);
+    if (file_descriptors[fd].node == node) {
+        file_descriptors[fd].pos += count;
+    }
+    spin_unlock_irqrestore(&fd_lock, flags);
+}
+
 int32_t read(int32_t fd, void* buf, uint32_t size) {
-    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || file_descriptors[fd].node == NULL) {
+    file_descriptor_t desc;
+    if (!fd_get(fd, &desc)) {
         return -1; // Invalid file descriptor
     }
     
-    file_descriptor_t* desc = &file_descriptors[fd];
-    fs_node_t* node = desc->node;
-    
-    // Check if the file is opened for reading
-    if ((desc->flags & O_RDONLY) == 0 && (desc->flags & O_RDWR) == 0) {
+    // Check if the file is opened for reading, O_RDONLY is 0
+    if ((desc.flags & (O_WRONLY | O_RDWR)) == O_WRONLY) {
         return -1; // Not opened for reading
     }
     
     // Read from the file
-    uint32_t bytes_read = vfs_read(node, desc->pos, size, (uint8_t*)buf);
+    uint32_t bytes_read = vfs_read(desc.node, desc.pos, size, (uint8_t*)buf);
     
     // Update the file position
-    desc->pos += bytes_read;
+    fd_advance(fd, desc.node, bytes_read);
     
     return bytes_read;
 }
 
 int32_t write(int32_t fd, const void* buf, uint32_t size) {
-    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || file_descriptors[fd].node == NULL) {
+    file_descriptor_t desc;
+    if (!fd_get(fd, &desc)) {
         return -1; // Invalid file descriptor
     }
     
-    file_descriptor_t* desc = &file_descriptors[fd];
-    fs_node_t* node = desc->node;
-    
     // Check if the file is opened for writing
-    if ((desc->flags & O_WRONLY) == 0 && (desc->flags & O_RDWR) == 0) {
+    if ((desc.flags & O_WRONLY) == 0 && (desc.flags & O_RDWR) == 0) {
         return -1; // Not opened for writing
     }
     
     // Write to the file
-    uint32_t bytes_written = vfs_write(node, desc->pos, size, (uint8_t*)buf);
+    uint32_t bytes_written = vfs_write(desc.node, desc.pos, size, (uint8_t*)buf);
     
     // Update the file position
-    desc->pos += bytes_written;
+    fd_advance(fd, desc.node, bytes_written);
     
     return bytes_written;
 }
 
 int32_t lseek(int32_t fd, int32_t offset, int32_t whence) {
-    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS || file_descriptors[fd].node == NULL) {
+    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS) {
         return -1; // Invalid file descriptor
     }
     
+    uint32_t flags = spin_lock_irqsave(&fd_lock);
     file_descriptor_t* desc = &file_descriptors[fd];
     fs_node_t* node = desc->node;
+    if (node == NULL) {
+        spin_unlock_irqrestore(&fd_lock, flags);
+        return -1; // Invalid file descriptor
+    }
     
     switch (whence) {
         case SEEK_SET:
@@ -296,8 +350,11 @@ int32_t lseek(int32_t fd, int32_t offset, int32_t whence) {
             break;
             
         default:
+            spin_unlock_irqrestore(&fd_lock, flags);
             return -1; // Invalid whence
     }
     
-    return desc->pos;
+    int32_t pos = desc->pos;
+    spin_unlock_irqrestore(&fd_lock, flags);
+    return pos;
 }
@@ -0,0 +1,36 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "basedos.h"
+
+// Local APIC interrupt vectors, above the remapped PIC range
+#define LOCAL_VECTOR_BASE       0x40
+#define LAPIC_TIMER_VECTOR      0x40
+#define RESCHEDULE_VECTOR       0x41
+#define NR_LOCAL_VECTORS        2
+#define SPURIOUS_VECTOR         0xFF
+
+// Interrupt command register delivery modes
+#define APIC_DM_INIT    0x00000500
+#define APIC_DM_STARTUP 0x00000600
+#define APIC_LEVEL_ASSERT 0x00004000
+
+// True when CPUID reports a local APIC
+bool lapic_present(void);
+
+// Enable the local APIC of the calling CPU. The boot CPU keeps the
+// LINT0/LINT1 setup of the BIOS so PIC interrupts still arrive.
+void lapic_initialize(bool boot_cpu);
+
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+// Send an IPI with the given ICR low word and wait until it is delivered
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+
+// Periodic TIMER_HZ tick from the local APIC timer. Calibrated once on
+// the boot CPU, then started on each application processor.
+void lapic_timer_calibrate(void);
+void lapic_timer_start(void);
+
+#endif // APIC_H
@@ -0,0 +1,114 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "basedos.h"
+#include "spinlock.h"
+#include "timer.h"
+
+// Stackless coroutines for code that waits on I/O or timers without a
+// kernel thread per request. A coroutine is a function plus a small
+// control block; locals do not survive a wait, keep state in the block
+// or in a structure around it. The function body is wrapped in
+// CORO_BEGIN/CORO_END and resumes at the last wait point:
+//
+//   static int read_request(coro_t* co) {
+//       request_t* req = co->data;
+//       CORO_BEGIN(co);
+//       start_io(req);
+//       CORO_AWAIT(co, &req->done);
+//       CORO_SLEEP(co, 10);
+//       CORO_END(co);
+//   }
+//
+// Coroutines run from the per-CPU executor softirq with interrupts
+// enabled, so a step must not sleep or spin for long. A coroutine waits
+// on one event or timer at a time, and CORO_* macros may not be used
+// inside a switch statement of its own.
+
+typedef enum {
+    CORO_IDLE = 0,       // Not started
+    CORO_READY,          // On an executor queue
+    CORO_RUNNING,
+    CORO_WOKEN,          // Woken while still running, runs again right away
+    CORO_WAITING,        // Waiting for an event or timer
+    CORO_DONE
+} coro_state_t;
+
+// Return values of a coroutine step
+enum {
+    CORO_RET_DONE = 0,
+    CORO_RET_YIELD,      // Run again after the other ready coroutines
+    CORO_RET_WAIT,       // Parked until coro_wake()
+};
+
+typedef struct coro {
+    struct coro* next;             // Executor queue or event wait list
+    volatile uint32_t state;
+    uint32_t resume;               // Line of the wait point to resume at, 0 at the start
+    int (*fn)(struct coro* co);
+    void* data;
+    void (*release)(struct coro* co); // Called once finished, may free the coroutine
+    timer_list_t timer;            // CORO_SLEEP
+} coro_t;
+
+#define CORO_BEGIN(co)  switch ((co)->resume) { case 0:
+#define CORO_END(co)    } (co)->resume = 0; return CORO_RET_DONE
+
+#define CORO_YIELD(co) \
+    do { (co)->resume = __LINE__; return CORO_RET_YIELD; case __LINE__:; } while (0)
+
+// Wait until the event has been signalled, returns at once if it already was
+#define CORO_AWAIT(co, event) \
+    do { \
+        (co)->resume = __LINE__; \
+        __attribute__((fallthrough)); \
+        case __LINE__: \
+        if (!async_event_wait((event), (co))) { \
+            return CORO_RET_WAIT; \
+        } \
+    } while (0)
+
+#define CORO_SLEEP(co, msecs) \
+    do { \
+        (co)->resume = __LINE__; \
+        coro_sleep_start((co), (msecs)); \
+        return CORO_RET_WAIT; \
+        case __LINE__:; \
+    } while (0)
+
+// One-shot completion a coroutine can wait for, e.g. the end of an I/O
+// request. Signalling wakes every waiter, safe from any context.
+typedef struct {
+    spinlock_t lock;
+    volatile bool done;
+    coro_t* waiters;
+} async_event_t;
+
+#define ASYNC_EVENT_INIT { SPINLOCK_INIT, false, NULL }
+
+void async_event_init(async_event_t* event);
+void async_event_signal(async_event_t* event);
+
+// Re-arm a signalled event that nobody waits for any more
+void async_event_reset(async_event_t* event);
+
+// Used by CORO_AWAIT: true if done, otherwise queue co on the event
+bool async_event_wait(async_event_t* event, coro_t* co);
+
+void coro_init(coro_t* co, int (*fn)(coro_t* co), void* data);
+
+// Queue a coroutine on this CPU's executor
+void coro_start(coro_t* co);
+
+// Make a waiting coroutine ready on this CPU, safe from any context
+void coro_wake(coro_t* co);
+
+// Used by CORO_SLEEP
+void coro_sleep_start(coro_t* co, uint32_t msecs);
+
+void async_initialize(void);
+
+// Print per-CPU executor statistics
+void async_show(void);
+
+#endif // ASYNC_H
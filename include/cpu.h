@@ -0,0 +1,97 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <sys/types.h>
+
+// Read the time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Execute CPUID for the given leaf
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+// Read/write a model specific register
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+// EFLAGS: the interrupt flag, and the flags user code may change
+// (arithmetic, trap, direction, alignment check)
+#define EFLAGS_IF        0x00000200
+#define EFLAGS_USER_MASK 0x00040DD5
+
+// Control registers
+#define CR0_MP  0x00000002  // Monitor coprocessor: wait/fwait honour TS
+#define CR0_EM  0x00000004  // No x87, every FPU instruction traps
+#define CR0_TS  0x00000008  // Task switched: next FPU/SSE instruction raises #NM
+#define CR0_NE  0x00000020  // Report x87 errors as #MF instead of IRQ 13
+#define CR0_WP  0x00010000  // Read-only pages are read-only for the kernel too
+#define CR0_PG  0x80000000  // Paging
+#define CR4_PSE        0x00000010  // 4 MiB pages
+#define CR4_PGE        0x00000080  // Global pages survive CR3 reloads
+#define CR4_OSFXSR     0x00000200  // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT 0x00000400  // SSE exceptions raise #XM
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    asm volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    asm volatile("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    asm volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    asm volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    asm volatile("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t value;
+    asm volatile("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint32_t value) {
+    asm volatile("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+// Drop the TLB entry of one page
+static inline void invlpg(uint32_t addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Clear CR0.TS
+static inline void clts(void) {
+    asm volatile("clts" : : : "memory");
+}
+
+// Spin-wait hint for busy loops
+static inline void cpu_relax(void) {
+    asm volatile("pause" : : : "memory");
+}
+
+#endif // CPU_H
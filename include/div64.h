@@ -0,0 +1,46 @@
+#ifndef DIV64_H
+#define DIV64_H
+
+#include <sys/types.h>
+
+// 64-bit by 32-bit division without libgcc helpers.
+// Divides *n by base in place and returns the remainder.
+static inline uint32_t div64_u32_rem(uint64_t* n, uint32_t base) {
+    uint32_t hi = (uint32_t)(*n >> 32);
+    uint32_t lo = (uint32_t)*n;
+    uint32_t qhi = hi / base;
+    uint32_t rem = hi % base;
+    uint32_t qlo;
+
+    asm("divl %4" : "=a"(qlo), "=d"(rem) : "a"(lo), "d"(rem), "rm"(base));
+    *n = ((uint64_t)qhi << 32) | qlo;
+    return rem;
+}
+
+static inline uint64_t div64_u32(uint64_t n, uint32_t base) {
+    div64_u32_rem(&n, base);
+    return n;
+}
+
+// (a * mul) >> shift with a 96-bit intermediate, for cycle to ns scaling
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t ah = (uint32_t)(a >> 32);
+    uint32_t al = (uint32_t)a;
+    uint64_t ret = ((uint64_t)al * mul) >> shift;
+    if (ah) {
+        ret += ((uint64_t)ah * mul) << (32 - shift);
+    }
+    return ret;
+}
+
+// Index of the highest set bit, used for log2 histogram buckets
+static inline uint32_t ilog2_u64(uint64_t v) {
+    uint32_t hi = (uint32_t)(v >> 32);
+    if (hi) {
+        return 63 - __builtin_clz(hi);
+    }
+    uint32_t lo = (uint32_t)v;
+    return lo ? 31 - __builtin_clz(lo) : 0;
+}
+
+#endif // DIV64_H
@@ -0,0 +1,40 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "basedos.h"
+#include "fs/vfs.h"
+#include "interrupts.h"
+
+// Arguments passed to a program, the name included
+#define EXEC_MAX_ARGS 16
+
+// Programs built into the kernel
+#define EXEC_MAX_IMAGES 8
+
+// Run a static ELF32 executable in the calling kernel thread. Its
+// PT_LOAD segments are mapped on demand from the file into a fresh
+// address space, and the stack starts with argc, argv[], NULL and an
+// empty environment as on i386 System V. Returns 0 and the program's
+// exit status in *exit_code (-1 when it was killed), or -1 with a
+// message when the file cannot be loaded.
+int exec_run(fs_node_t* node, int argc, char** argv, int* exit_code);
+
+// exec() for the current task's program from its system call: replace
+// its address space with the file and point the user registers in frame
+// at the new entry point. Returns 0, or -1 with the old program intact.
+int exec_replace(fs_node_t* node, int argc, char** argv, interrupt_frame_t* frame);
+
+// File to run for a command or exec() path: a built-in image of that
+// name, an absolute path, or a name in the root directory. NULL when
+// there is none.
+fs_node_t* exec_find(const char* path);
+
+// Make an in-kernel executable image available to exec_find() under
+// name, replacing an image of the same name. data must stay valid.
+// Returns its node, NULL when the table is full.
+fs_node_t* exec_register_image(const char* name, const void* data, uint32_t size);
+
+// Register the C programs in user/ that the build links into the kernel
+void exec_initialize(void);
+
+#endif // EXEC_H
@@ -0,0 +1,46 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "basedos.h"
+
+struct task;
+
+// x87/SSE register image as written by fxsave (fnsave uses the first 108 bytes)
+typedef struct {
+    uint8_t data[512];
+} __attribute__((aligned(16))) fpu_state_t;
+
+// fpu_cpu of a task whose state is in no CPU's registers
+#define FPU_NO_CPU 0xFFFFFFFF
+
+// Lazy FPU switching: CR0.TS is set when a task is switched in, and its
+// registers are only loaded when it first touches the FPU (#NM trap).
+// A task that used the FPU is saved when it is switched out, but its
+// registers stay loaded: if it comes back to the same CPU before anyone
+// else used the FPU there, TS stays clear and nothing is reloaded.
+
+// Enable the FPU and SSE on the calling CPU, boot_cpu also installs the
+// #NM handler and records the initial register state for new tasks
+void fpu_initialize(bool boot_cpu);
+
+// Called by the scheduler before switching from prev to next
+void fpu_switch(struct task* prev, struct task* next);
+
+// Give a new task that has not used the FPU yet a copy of the current
+// task's registers, for fork()
+void fpu_fork(struct task* child);
+
+// Bracket kernel code using x87 or SSE instructions. Not allowed in
+// interrupt context; the section must not sleep, preemption is disabled.
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+// CPU features found at boot
+bool fpu_has_fxsr(void);
+bool fpu_has_sse(void);
+bool fpu_has_sse2(void);
+
+// Print features and per-CPU switching statistics
+void fpu_show(void);
+
+#endif // FPU_H
@@ -0,0 +1,28 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "fs/vfs.h"
+
+// Character device for the screen and keyboard. Reads return one line
+// typed with echo and backspace, ending in '\n'; writes go to the screen.
+// console_initialize() opens it as descriptors 0, 1 and 2 (standard
+// input, output and error), so call it right after vfs_initialize().
+void console_initialize(void);
+
+// Shell pipelines: send the current task's console output (printk,
+// putchar, writes to the console device) to out and take console device
+// reads from in, either may be NULL. The task takes over the caller's
+// reference to each; console_unredirect() closes them.
+void console_redirect(fs_node_t* in, fs_node_t* out);
+void console_unredirect(void);
+
+// Give a new task its own references to the current task's redirection,
+// for fork()
+struct task;
+void console_redirect_inherit(struct task* child);
+
+// Called by putchar(): true when the character went to the current
+// task's redirected output. Only tasks that may sleep are redirected.
+bool console_redirect_putchar(char c);
+
+#endif // CONSOLE_H
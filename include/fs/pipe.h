@@ -0,0 +1,24 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "fs/vfs.h"
+
+// Pipes: a one-page ring buffer between a read end and a write end,
+// both FS_PIPE nodes. Reads block until there is data or every writer
+// is gone (end of file, read returns 0); writes block until the data is
+// in or every reader is gone (the rest is dropped). Page-aligned whole
+// pages written from user memory are not copied: the pipe queues a
+// copy-on-write reference to the frame instead, and a reader with a
+// page-aligned user buffer gets the frame mapped in the same way.
+#define MAX_PIPES      8
+#define PIPE_MAX_PAGES 4   // Moved pages queued at once
+
+// Make a pipe. Each end comes with one reference owned by the caller;
+// opening an end adds one and vfs_close() drops one. Returns 0, or -1
+// when out of pipes or memory.
+int pipe_create(fs_node_t** read_end, fs_node_t** write_end);
+
+// Bytes copied through the ring and pages moved since boot
+void pipe_stats(uint32_t* bytes_copied, uint32_t* pages_moved);
+
+#endif // PIPE_H
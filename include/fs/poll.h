@@ -0,0 +1,80 @@
+#ifndef POLL_H
+#define POLL_H
+
+#include "fs/vfs.h"
+#include "wait.h"
+
+// Readiness of file descriptors. A node's poll operation returns which
+// of these hold now and, when given a poll table, queues it on every wait
+// queue woken when that may change. Nodes without one are always ready,
+// like regular files.
+#define POLLIN   0x001    // Data to read, or end of file
+#define POLLOUT  0x004    // Room to write
+#define POLLERR  0x008    // Writing end whose readers are gone
+#define POLLHUP  0x010    // Reading end whose writers are gone
+#define POLLNVAL 0x020    // Not an open descriptor
+
+typedef struct poll_table {
+    void (*queue)(struct poll_table* pt, wait_queue_head_t* wq);
+} poll_table_t;
+
+// Called by poll operations for each wait queue, pt may be NULL
+static inline void poll_wait(poll_table_t* pt, wait_queue_head_t* wq) {
+    if (pt && pt->queue) {
+        pt->queue(pt, wq);
+    }
+}
+
+uint32_t vfs_poll(fs_node_t* node, poll_table_t* pt);
+
+typedef struct {
+    int32_t fd;
+    uint16_t events;      // Wanted, POLLERR and POLLHUP are always reported
+    uint16_t revents;     // Filled in
+} pollfd_t;
+
+#define POLL_MAX_FDS 16
+
+// Wait until one of nfds descriptors is ready, at most timeout_ms
+// milliseconds (0 does not wait, negative waits forever). Returns the
+// number with revents set, 0 on timeout or -1.
+int32_t poll(pollfd_t* fds, uint32_t nfds, int32_t timeout_ms);
+
+// epoll: a set of descriptors registered once, whose wakeups put them on
+// a ready list, so waiting costs time in the number of ready descriptors
+// rather than registered ones. The set is itself a descriptor that can
+// be polled.
+#define EPOLLIN      POLLIN
+#define EPOLLOUT     POLLOUT
+#define EPOLLERR     POLLERR
+#define EPOLLHUP     POLLHUP
+#define EPOLLET      0x80000000   // Edge triggered: reported once per wakeup
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define EPOLL_MAX_INSTANCES 8
+#define EPOLL_MAX_ITEMS     64    // Registrations over all sets
+#define EPOLL_MAX_EVENTS    16    // Returned by one system call
+
+typedef struct {
+    uint32_t events;
+    uint32_t data;        // Returned as given
+} epoll_event_t;
+
+// New empty set, returns its descriptor or -1
+int32_t epoll_create(void);
+
+// Add, change or remove the registration of fd in the set. Returns 0 or -1.
+int32_t epoll_ctl(int32_t epfd, int32_t op, int32_t fd, const epoll_event_t* event);
+
+// Wait like poll() for registered descriptors to be ready, filling in up
+// to max events. Level triggered descriptors are reported on every call
+// while they stay ready. Returns the number filled in, 0 on timeout or -1.
+int32_t epoll_wait(int32_t epfd, epoll_event_t* events, uint32_t max, int32_t timeout_ms);
+
+// Drop the registrations of a descriptor being closed, called by close()
+void eventpoll_release(int32_t fd);
+
+#endif // POLL_H
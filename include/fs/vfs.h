@@ -5,6 +5,7 @@
 
 // Forward declarations
 typedef struct fs_node fs_node_t;
+struct poll_table;
 
 // Include system types
 #include <sys/types.h>  // For dirent_t, etc.
@@ -16,6 +17,7 @@ typedef struct fs_node fs_node_t;
 #define FS_BLOCKDEVICE 0x04
 #define FS_PIPE        0x05
 #define FS_SYMLINK     0x06
+#define FS_EVENTPOLL   0x07
 #define FS_MOUNTPOINT  0x08
 
 // File open flags
@@ -49,6 +51,9 @@ typedef struct fs_node {
     void (*close)(struct fs_node*);
     dirent_t* (*readdir)(struct fs_node*, uint32_t);
     struct fs_node* (*finddir)(struct fs_node*, char* name);
+    uint32_t (*poll)(struct fs_node*, struct poll_table*);  // See fs/poll.h
+    struct fs_node* (*create)(struct fs_node*, char* name);  // New file in a directory
+    uint32_t (*mmap_page)(struct fs_node*, uint32_t offset); // See vfs_mmap_page()
     
     // File pointer for this node (used by the file system)
     void* fs_specific;
@@ -64,10 +69,11 @@ typedef struct {
 } file_descriptor_t;
 
 // File system operations
-typedef struct {
+typedef struct filesystem_ops {
     const char* name;
     fs_node_t* (*mount)(const char* device);
     void (*unmount)(fs_node_t* fs_root);
+    struct filesystem_ops* next;   // Registry link, RCU protected
 } filesystem_ops_t;
 
 // Standard file operations
@@ -82,14 +88,25 @@ uint32_t vfs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buf
 dirent_t* vfs_readdir(fs_node_t* node, uint32_t index);
 fs_node_t* vfs_finddir(fs_node_t* node, char* name);
 
+// Frame that holds the file's data at offset (page aligned), for mapping
+// it instead of copying. A reference is taken for the caller, who drops
+// it with free_page(). 0 past the end of the file, when out of memory or
+// when the file system keeps no data in frames.
+uint32_t vfs_mmap_page(fs_node_t* node, uint32_t offset);
+
 // File descriptor operations
 int32_t open(const char* filename, uint32_t flags);
+int32_t open_node(fs_node_t* node, uint32_t flags);  // Descriptor for a node found or made elsewhere
 int32_t close(int32_t fd);
 int32_t read(int32_t fd, void* buf, uint32_t size);
 int32_t write(int32_t fd, const void* buf, uint32_t size);
 int32_t lseek(int32_t fd, int32_t offset, int32_t whence);
+fs_node_t* fd_lookup(int32_t fd);  // Node of an open descriptor or NULL
 
 // File system registration
 void register_filesystem(filesystem_ops_t* fs_ops);
 
+// Remove a filesystem type, returns once no lookup can still see it
+void unregister_filesystem(filesystem_ops_t* fs_ops);
+
 #endif // VFS_H
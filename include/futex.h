@@ -0,0 +1,25 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "basedos.h"
+
+// Sleeping on a 32-bit word in user memory, the slow path of user-space
+// locks (lib/sync.c): the fast path only uses atomic instructions on the
+// word and enters the kernel only to wait or to wake waiters. Waiters
+// are hashed by the physical address of the word, so processes sharing
+// the memory (see mm_map_shared()) meet on the same queue.
+#define FUTEX_WAIT   0    // Sleep while *uaddr == val, until FUTEX_WAKE
+#define FUTEX_WAKE   1    // Wake up to val waiters, returns how many
+#define FUTEX_LOCK   2    // Kernel-arbitrated lock on *uaddr (0 free, 1 taken),
+#define FUTEX_UNLOCK 3    // every operation a system call, for comparison
+
+// Return 0, or -1 for a bad address or, from futex_wait(), a changed value
+int32_t futex_wait(uint32_t uaddr, uint32_t val);
+int32_t futex_wake(uint32_t uaddr, uint32_t count);
+int32_t futex_lock(uint32_t uaddr);
+int32_t futex_unlock(uint32_t uaddr);
+
+// User programs: the system call, see user/crt0.c
+int32_t futex(volatile uint32_t* uaddr, int32_t op, uint32_t val);
+
+#endif // FUTEX_H
@@ -3,6 +3,25 @@
 
 #include <sys/types.h>
 
+// Hardware IRQs are remapped to vectors 0x20-0x2F
+#define IRQ_BASE 0x20
+#define NR_IRQS  16
+
+// CPU exceptions use vectors 0-31
+#define NR_EXCEPTIONS 32
+
+// System calls from user mode, see syscall.h
+#define SYSCALL_VECTOR 0x80
+
+// Register state pushed by the interrupt entry stubs
+typedef struct interrupt_frame {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; // pusha
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags;                        // pushed by the CPU
+    uint32_t useresp, ss;                            // only on entry from user mode (cs & 3)
+} interrupt_frame_t;
+
 // Initialize the interrupt descriptor table (IDT)
 void init_interrupts(void);
 
@@ -10,10 +29,56 @@ void init_interrupts(void);
 void enable_interrupts(void);
 void disable_interrupts(void);
 
+// Save EFLAGS and disable interrupts, restore the saved interrupt flag
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+static inline bool irqs_disabled(void) {
+    uint32_t flags;
+    asm volatile("pushf\n\tpop %0" : "=r"(flags));
+    return !(flags & 0x200);
+}
+
 // Register an interrupt handler for a specific interrupt number
 typedef void (*interrupt_handler_t)(void);
 void register_interrupt_handler(uint8_t interrupt_number, interrupt_handler_t handler);
 
+// Install a C handler for a hardware IRQ line and unmask it at the PIC.
+// Handlers run with interrupts disabled and should only acknowledge the
+// device and defer the rest of the work to a softirq or tasklet.
+typedef void (*irq_handler_t)(interrupt_frame_t* frame);
+void irq_install_handler(uint8_t irq, irq_handler_t handler);
+
+// Install a C handler for a local APIC vector (see apic.h), called on
+// whichever CPU the interrupt is delivered to
+void local_irq_install_handler(uint8_t vector, irq_handler_t handler);
+
+// Install a C handler for a CPU exception. It runs with interrupts
+// disabled in the context of the code that faulted.
+void exception_install_handler(uint8_t vector, irq_handler_t handler);
+
+// Load the IDT on the calling CPU, used by application processors
+void idt_load(void);
+
+// Mask/unmask a hardware IRQ line at the PIC
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
+// Per-vector interrupt cost statistics (handler cycles, irqs-off time),
+// for the PIC lines and the local APIC timer and IPIs
+void irqstat_enable(bool enable);
+bool irqstat_is_enabled(void);
+void irqstat_reset(void);
+void irqstat_show(void);
+void irqstat_irqs_on(void);
+
 // Default interrupt handler (for unhandled interrupts)
 void default_interrupt_handler(void);
 
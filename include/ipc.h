@@ -0,0 +1,90 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "basedos.h"
+#include "interrupts.h"
+
+// Synchronous message passing through ports. A call sends a message to a
+// port and blocks until the task that received it replies. Each message
+// carries two words in registers, up to IPC_INLINE_SIZE bytes copied
+// once, and up to IPC_MAX_PAGES whole pages that are not copied at all:
+// the receiver gets the sender's frames mapped copy-on-write into a
+// window of its own address space. When a receiver is already waiting,
+// the call is handed to it directly and the CPU switches straight to it;
+// a reply switches straight back to the caller.
+
+#define IPC_MAX_PORTS    16
+#define IPC_INLINE_SIZE  64
+#define IPC_MAX_PAGES    16
+
+// Message buffer in user memory, see SYS_ipc_call. On receipt len, data
+// and pages are filled in, pages counting those mapped at window.
+typedef struct {
+    uint32_t len;            // Bytes used in data
+    uint32_t pages;          // Pages at addr to send
+    uint32_t addr;           // Page-aligned
+    uint32_t window;         // Page-aligned room for pages received
+    uint32_t window_pages;
+    uint8_t data[IPC_INLINE_SIZE];
+} ipc_msg_t;
+
+// Byte offsets in ipc_msg_t, for user programs in assembly
+#define IPC_MSG_LEN          0
+#define IPC_MSG_PAGES        4
+#define IPC_MSG_ADDR         8
+#define IPC_MSG_WINDOW       12
+#define IPC_MSG_WINDOW_PAGES 16
+#define IPC_MSG_DATA         20
+
+// A message inside the kernel
+typedef struct {
+    uint32_t words[2];
+    uint32_t len;
+    uint8_t data[IPC_INLINE_SIZE];
+    uint32_t nr_frames;
+    uint32_t frames[IPC_MAX_PAGES];  // One reference each, see mm_share_page()
+} ipc_payload_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t direct;         // Calls handed straight to a waiting receiver
+    uint32_t pages;          // Pages moved without copying
+} ipc_stats_t;
+
+// New port owned by the current task, returns its id or -1
+int32_t ipc_port_create(void);
+
+// Close a port of the current task. Pending calls and waiting receivers
+// fail. Returns 0 or -1.
+int ipc_port_destroy(int32_t port);
+
+// Send msg and wait for the reply, which replaces it. Returns 0, or -1
+// when there is no such port or it was closed; the pages of msg are
+// released on failure.
+int ipc_call(int32_t port, ipc_payload_t* msg);
+
+// Answer the call token received on port with msg
+int ipc_reply(int32_t port, uint32_t token, ipc_payload_t* msg);
+
+// Answer the call token (0 for none) with msg, then wait for the next
+// call on port, which replaces msg. Returns its token, or -1.
+int32_t ipc_reply_wait(int32_t port, uint32_t token, ipc_payload_t* msg);
+
+// The current task stops running its program: its ports are closed and
+// the calls it received but did not answer fail
+void ipc_task_exit(void);
+
+// Convert between a message of the current program, with the register
+// words w0 and w1, and the kernel form. ipc_msg_in() shares the pages to
+// send and returns 0 or -1. ipc_msg_out() maps the pages received into
+// the window, releases those that do not fit and returns the words in
+// the esi and edi of frame.
+int ipc_msg_in(ipc_payload_t* msg, const ipc_msg_t* umsg, uint32_t w0, uint32_t w1);
+void ipc_msg_out(ipc_payload_t* msg, ipc_msg_t* umsg, interrupt_frame_t* frame);
+
+// Drop the page references of msg
+void ipc_payload_release(ipc_payload_t* msg);
+
+void ipc_get_stats(ipc_stats_t* stats);
+
+#endif // IPC_H
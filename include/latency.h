@@ -0,0 +1,38 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "basedos.h"
+
+// Log-linear latency histogram: 8 sub-buckets per power of two, so any
+// percentile is reported within 12.5% of the true value at O(1) record cost
+#define LATENCY_SUB_BITS 3
+#define LATENCY_BUCKETS  (32 << LATENCY_SUB_BITS)
+
+typedef struct {
+    const char* name;
+    uint32_t count;
+    uint64_t total_ns;
+    uint32_t min_ns;
+    uint32_t max_ns;
+    uint32_t hist[LATENCY_BUCKETS];
+} latency_stat_t;
+
+#define LATENCY_STAT_INIT(label) { .name = (label), .min_ns = 0xFFFFFFFF }
+
+void latency_record(latency_stat_t* st, uint64_t ns);
+void latency_reset(latency_stat_t* st);
+
+// Upper bound of the bucket holding the given percentile (1-100)
+uint32_t latency_percentile(const latency_stat_t* st, uint32_t pct);
+
+// Print count, min, avg, p50, p99 and max on one line
+void latency_show(const latency_stat_t* st);
+
+// Keypress to echo latency, measured from IRQ1 entry to the echoed
+// character reaching video memory
+void input_latency_key_consumed(uint64_t irq_tsc);
+void input_latency_echo_done(void);
+extern volatile uint64_t input_latency_pending;
+latency_stat_t* input_latency_stats(void);
+
+#endif // LATENCY_H
@@ -8,6 +8,23 @@ uint32_t detect_memory(void);
 void* kmalloc(size_t size);
 void kfree(void* ptr);
 
+// Physical page frames (4 KiB, identity mapped above 1 MiB)
+#define PAGE_SIZE 4096
+
+void page_allocator_initialize(void);
+void* alloc_pages(uint32_t count);
+void free_pages(void* addr, uint32_t count);
+void* alloc_page(void);
+void free_page(void* addr);
+
+// Frames can be shared, by copy-on-write address spaces for instance.
+// Allocation hands out one reference, page_get() adds one, and freeing
+// drops one: the frame is only released with its last reference.
+void page_get(void* addr);
+uint32_t page_refs(void* addr);
+uint32_t pages_free(void);
+uint32_t pages_total(void);
+
 // Memory statistics
 void get_memory_stats(uint32_t* total, uint32_t* free);
 
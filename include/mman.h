@@ -0,0 +1,24 @@
+#ifndef MMAN_H
+#define MMAN_H
+
+#include "basedos.h"
+
+// mmap() protections and flags, passed together in one argument. One of
+// MAP_SHARED and MAP_PRIVATE is required.
+#define PROT_READ     0x01
+#define PROT_WRITE    0x02
+#define MAP_SHARED    0x10    // Changes are seen by every process mapping it
+#define MAP_PRIVATE   0x20    // Changes stay in this process, copied on write
+#define MAP_ANONYMOUS 0x80    // Zeroed memory, fd and offset are ignored
+
+#define MAP_FAILED ((void*)-1)
+
+// User programs: the system calls, see user/crt0.c. offset must be page
+// aligned. A file mapping reaching past the end of the file reads zeros
+// there, which are not written back. Shared anonymous memory is made at
+// once, and fork() passes it on to children shared; everything else is
+// made on first touch.
+void* mmap(void* addr, uint32_t len, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset);
+int32_t munmap(void* addr, uint32_t len);
+
+#endif // MMAN_H
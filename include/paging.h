@@ -0,0 +1,181 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "basedos.h"
+
+// Two-level 32-bit paging. Every address space shares the kernel half:
+// the low 1 GiB (RAM, identity mapped) and the top 1 GiB (device memory
+// such as the local APIC), both with 4 MiB global pages. User programs
+// get the 2 GiB in between, mapped with 4 KiB pages.
+#define KERNEL_LOW_END  0x40000000
+#define USER_BASE       0x40000000
+#define USER_END        0xC0000000
+
+// Shared read-only page with the time data and syscall stubs, see vdso.h.
+// User stacks grow down from USER_STACK_TOP, below a guard gap.
+#define VDSO_BASE       0xBFFFF000
+#define USER_STACK_TOP  0xBFFF0000
+#define USER_STACK_SIZE 0x10000
+
+// mmap() picks addresses upwards from here
+#define MMAP_BASE       0x80000000
+
+// Page table entry bits
+#define PTE_PRESENT  0x001
+#define PTE_WRITE    0x002
+#define PTE_USER     0x004
+#define PTE_PWT      0x008
+#define PTE_PCD      0x010
+#define PTE_ACCESSED 0x020
+#define PTE_DIRTY    0x040
+#define PTE_LARGE    0x080  // 4 MiB page, directory entries only
+#define PTE_GLOBAL   0x100
+#define PTE_NOFREE   0x200  // Available to software: frame not owned by the address space
+#define PTE_COW      0x400  // Available to software: writable, but the frame may be shared
+#define PTE_SHARED   0x800  // Available to software: shared on purpose, fork() keeps it writable
+#define PTE_FRAME    0xFFFFF000
+
+// Page fault error code bits
+#define PF_PRESENT 0x01     // Protection violation, otherwise not present
+#define PF_WRITE   0x02
+#define PF_USER    0x04
+
+#define MM_MAX_REGIONS 16
+
+struct fs_node;
+
+// Range of an address space whose pages are made on first touch: read
+// from a file, zero-filled past file_len (bss, stacks). Files that keep
+// their data in frames (vfs_mmap_page()) have those mapped instead, see
+// mm_map_file().
+typedef struct {
+    uint32_t start, end;       // Page aligned
+    uint32_t flags;            // PTE_* bits of the pages
+    struct fs_node* node;      // Backing file, NULL for zero-filled memory
+    uint32_t offset;           // File offset of start
+    uint32_t file_len;         // Bytes from start that come from the file
+} mm_region_t;
+
+// Address space of a user program. The page directory and the page
+// tables of the user half are page frames; frames are identity mapped,
+// so the kernel reaches them through their physical address.
+typedef struct mm {
+    uint32_t* pgdir;
+    uint32_t nr_pages;     // User frames owned, page tables not included
+    uint32_t nr_faults;    // Pages made on demand from the regions
+    uint32_t nr_cow;       // Shared pages copied on a write
+    mm_region_t regions[MM_MAX_REGIONS];
+    uint32_t nr_regions;
+    uint32_t brk_start;    // Heap: from the end of the program's segments
+    uint32_t brk;          // to the break, see mm_brk()
+    bool used;             // Pool slot taken
+} mm_t;
+
+// Build the kernel page directory and turn paging on for the boot CPU.
+// Fails when the CPU has no 4 MiB pages, user programs are then refused.
+bool paging_initialize(void);
+
+// Turn paging on for an application processor, with the boot CPU's tables
+void paging_enable_ap(void);
+
+bool paging_enabled(void);
+
+// New address space with the kernel half and the vDSO mapped, NULL when
+// out of memory
+mm_t* mm_create(void);
+
+// Free the address space and every frame it owns. It must not be loaded
+// on any CPU.
+void mm_destroy(mm_t* mm);
+
+// Copy of mm for fork(). Nothing is copied: both share every frame,
+// writable pages become read-only PTE_COW pages in both, and the first
+// write to one copies the frame unless it is no longer shared. mm must
+// be the caller's own or not loaded anywhere. NULL when out of memory.
+mm_t* mm_fork(mm_t* mm);
+
+// Give mm the pages and regions of with, for exec(), and free the old
+// ones with the with slot. mm may be loaded on this CPU.
+void mm_replace(mm_t* mm, mm_t* with);
+
+// Map one user page to a frame, flags are PTE_* bits (PTE_PRESENT is
+// implied). Returns 0, or -1 outside the user range or out of memory.
+int mm_map_page(mm_t* mm, uint32_t vaddr, uint32_t paddr, uint32_t flags);
+
+// Map zeroed pages over [vaddr, vaddr + len)
+int mm_map_anon(mm_t* mm, uint32_t vaddr, uint32_t len, uint32_t flags);
+
+// Map [vaddr, vaddr + len) on demand: the first len_from_file bytes
+// come from node at offset, the rest reads zero; node NULL for anonymous
+// memory. vaddr and offset need not be page aligned but must be equal
+// modulo the page size, like ELF segments. Returns 0, or -1 outside the
+// user range, over another region or when the region table is full.
+// When node can hand out its frames, pages wholly from it (or holding
+// the end of the file) are those frames:
+// with PTE_SHARED in flags writes go to the file, otherwise a write
+// copies the frame first.
+// Anonymous memory continuing an anonymous region with the same flags
+// extends it instead of taking a slot.
+int mm_map_file(mm_t* mm, uint32_t vaddr, uint32_t len, uint32_t flags,
+                struct fs_node* node, uint32_t offset, uint32_t len_from_file);
+
+// Shared memory: a region of zeroed frames made at once and mapped with
+// PTE_SHARED, so a fork()ed child uses the same frames instead of
+// copies. Returns 0, or -1 like mm_map_file() or when out of memory.
+int mm_map_shared(mm_t* mm, uint32_t vaddr, uint32_t len, uint32_t flags);
+
+// munmap(): drop the regions and pages in [vaddr, vaddr + len), vaddr
+// page aligned. Parts of regions outside the range stay. Pages mapped
+// outside any region are left alone. Returns 0, or -1 for a bad range
+// or when splitting a region needs a slot and the table is full.
+int mm_unmap(mm_t* mm, uint32_t vaddr, uint32_t len);
+
+// brk(): move the end of the heap to brk, mapping or dropping the pages
+// in between. It may not go below brk_start or past MMAP_BASE. Returns
+// the break, unchanged on failure.
+uint32_t mm_brk(mm_t* mm, uint32_t brk);
+
+// Start of a free range of len bytes from MMAP_BASE up, clear of every
+// region and page, 0 when there is none
+uint32_t mm_find_free(mm_t* mm, uint32_t len);
+
+// Resolve a fault at vaddr: make a demand page from its region, or copy
+// a shared page on a write. Returns 0, or -1 when no region covers it,
+// it is a write to a read-only page or out of memory.
+int mm_fault(mm_t* mm, uint32_t vaddr, bool write);
+
+// Page moves between address spaces (pipes). mm_share_page() takes a
+// reference to the frame of a present page, which becomes copy-on-write,
+// and returns it, 0 when there is none. mm_insert_shared() puts such a
+// frame at a present writable page in place of its own, consuming the
+// reference; the page is copy-on-write as well. 0 or -1. Neither takes
+// PTE_SHARED pages, their users have to copy.
+uint32_t mm_share_page(mm_t* mm, uint32_t vaddr);
+int mm_insert_shared(mm_t* mm, uint32_t vaddr, uint32_t frame);
+
+// Physical address behind a user address, 0 when it is not mapped
+uint32_t mm_translate(mm_t* mm, uint32_t vaddr);
+
+// Copy into or out of an address space that need not be loaded, ignoring
+// page protections and making demand pages as needed. Used to load
+// programs and read back their results.
+int mm_write(mm_t* mm, uint32_t vaddr, const void* src, uint32_t len);
+int mm_read(mm_t* mm, uint32_t vaddr, void* dst, uint32_t len);
+
+// Load an address space on this CPU, NULL for the kernel page directory.
+// Interrupts must be disabled or the caller must own mm.
+void switch_mm(mm_t* mm);
+
+// Access to the current task's user memory from a system call. The range
+// is checked against the page tables first, making demand pages, so a
+// bad pointer from user space fails with -1 instead of faulting in the
+// kernel.
+bool user_access_ok(const void* addr, uint32_t len, bool write);
+int copy_from_user(void* dst, const void* src, uint32_t len);
+int copy_to_user(void* dst, const void* src, uint32_t len);
+
+// Copy a NUL-terminated string of at most max - 1 characters, returns
+// its length or -1 when it is unmapped or too long
+int32_t strncpy_from_user(char* dst, const char* src, uint32_t max);
+
+#endif // PAGING_H
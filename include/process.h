@@ -0,0 +1,27 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "basedos.h"
+
+// User processes created by fork(). Each child runs in a kernel thread
+// of its own (see user_run_frame()) in a copy-on-write copy of the
+// parent's address space. Its exit status is kept until the parent
+// reaps it with process_wait() or stops running user code.
+
+// Most children alive or waiting to be reaped at once
+#define MAX_CHILDREN 32
+
+// fork() for the current task's program, called from its system call.
+// Returns the child's pid, or -1 when out of memory or child slots.
+int32_t process_fork(void);
+
+// Wait for a child of the current task to exit: pid, or -1 for any. The
+// child is reaped and its status stored in *status. Returns its pid, or
+// -1 when there is no such child.
+int32_t process_wait(int32_t pid, int* status);
+
+// The current task's program ended: its children are reparented to
+// nobody, and those that already exited are reaped
+void process_orphan_children(void);
+
+#endif // PROCESS_H
@@ -0,0 +1,100 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include "basedos.h"
+#include "sched.h"
+
+// Read-copy-update for read-mostly tables. Readers take no lock and write
+// no shared memory: they only disable preemption, so they must not sleep.
+// Writers serialize among themselves with a lock, publish new entries
+// with rcu_assign_pointer() and free old ones only after a grace period,
+// once every CPU has passed a quiescent state (a context switch, the idle
+// loop or a tick outside any read-side section).
+//
+//   rcu_read_lock();
+//   rcu_list_for_each(fs, filesystems) { ... }
+//   rcu_read_unlock();
+
+static inline void rcu_read_lock(void) {
+    preempt_disable();
+}
+
+static inline void rcu_read_unlock(void) {
+    preempt_enable();
+}
+
+// Load a pointer a writer may replace concurrently
+#define rcu_dereference(p) (*(volatile __typeof__(p)*)&(p))
+
+// Publish a pointer after the object it points to is initialized. x86
+// does not reorder stores, keeping the compiler from doing so is enough.
+#define rcu_assign_pointer(p, v) \
+    do { \
+        asm volatile("" : : : "memory"); \
+        (p) = (v); \
+    } while (0)
+
+// Callback run after a grace period, usually embedded in the object it frees
+typedef struct rcu_head {
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+} rcu_head_t;
+
+// Run func(head) from softirq context once all current readers are done.
+// Safe from any context.
+void call_rcu(rcu_head_t* head, void (*func)(rcu_head_t* head));
+
+// Sleep until all current readers are done, must be called from a task
+void synchronize_rcu(void);
+
+// Quiescent state of this CPU, called by the scheduler with interrupts
+// disabled at context switches and in the idle loop
+void rcu_note_qs(void);
+
+// Per-tick check, quiescent is true when the tick did not interrupt a
+// read-side section (preemption was enabled)
+void rcu_sched_tick(bool quiescent);
+
+void rcu_initialize(void);
+
+// Print grace period and callback statistics
+void rcu_show(void);
+
+// Lists of structures linked through a 'next' field. Writers hold the
+// list's own lock; readers iterate under rcu_read_lock(). A deleted entry
+// keeps its next pointer, so a reader standing on it can go on, and may
+// only be freed after a grace period.
+#define rcu_list_add(head, entry) \
+    do { \
+        (entry)->next = (head); \
+        rcu_assign_pointer((head), (entry)); \
+    } while (0)
+
+#define rcu_list_del(head, entry) \
+    do { \
+        __typeof__(entry)* __link = &(head); \
+        while (*__link && *__link != (entry)) { \
+            __link = &(*__link)->next; \
+        } \
+        if (*__link) { \
+            rcu_assign_pointer(*__link, (entry)->next); \
+        } \
+    } while (0)
+
+// Swap old for a copy in place, readers see either one complete version
+#define rcu_list_replace(head, old, entry) \
+    do { \
+        __typeof__(old)* __link = &(head); \
+        while (*__link && *__link != (old)) { \
+            __link = &(*__link)->next; \
+        } \
+        if (*__link) { \
+            (entry)->next = (old)->next; \
+            rcu_assign_pointer(*__link, (entry)); \
+        } \
+    } while (0)
+
+#define rcu_list_for_each(pos, head) \
+    for ((pos) = rcu_dereference(head); (pos); (pos) = rcu_dereference((pos)->next))
+
+#endif // RCU_H
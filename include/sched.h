@@ -0,0 +1,210 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "basedos.h"
+#include "fpu.h"
+#include "time.h"
+
+// Kernel thread stacks: THREAD_STACK_PAGES pages, aligned to their size.
+// The task structure lives at the bottom of its stack.
+#define THREAD_STACK_PAGES 2
+#define THREAD_STACK_SIZE  (THREAD_STACK_PAGES * 4096)
+
+// Timer ticks a task runs before it is preempted
+#define SCHED_TIME_SLICE 5
+
+// Priorities, 0 is the highest. Each priority has its own FIFO and a bit
+// in the ready bitmap, so picking the next task is a find-first-set.
+#define SCHED_PRIORITIES       32
+#define SCHED_PRIO_HIGHEST     0
+#define SCHED_PRIO_DEFAULT     16
+#define SCHED_PRIO_BACKGROUND  24
+#define SCHED_PRIO_LOWEST      (SCHED_PRIORITIES - 1)
+
+// Priority levels an interactive task is raised by when input wakes it.
+// The boost lasts until the task uses up a whole time slice.
+#define SCHED_INTERACTIVE_BOOST 8
+
+// Scheduling classes. Deadline tasks run before every normal task,
+// earliest absolute deadline first, see sched_set_deadline().
+#define SCHED_NORMAL   0
+#define SCHED_DEADLINE 1
+
+// Percentage of each CPU deadline tasks may reserve, the rest is left to
+// normal tasks so the shell stays usable under a full real-time load
+#define SCHED_DL_MAX_UTIL 90
+
+// Runtime is replenished on the timer tick, shorter periods cannot be met
+#define SCHED_DL_MIN_PERIOD_US (1000000 / TIMER_HZ)
+#define SCHED_DL_MAX_PERIOD_US 4000000
+
+#define TASK_NAME_LEN 16
+#define STACK_MAGIC   0x57AC6E9D
+
+typedef enum {
+    TASK_RUNNING = 0,
+    TASK_READY   = 1,
+    TASK_BLOCKED = 2,
+    TASK_DEAD    = 3,
+    TASK_WAKING  = 4,  // Being queued by a wakeup, READY once on a run queue
+    TASK_THROTTLED = 5 // Deadline task waiting for its next period
+} task_state_t;
+
+// Deadline task parameters and the state of its current job. Times are
+// ktime_get_ns() nanoseconds.
+typedef struct {
+    uint64_t runtime;            // Budget per period
+    uint64_t deadline;           // Relative to the start of the period
+    uint64_t period;
+    uint32_t util;               // runtime/period in 1/2^20 of a CPU
+    uint32_t cpu;                // CPU the bandwidth is reserved on
+    uint64_t release;            // Start of the current period
+    uint64_t abs_deadline;       // Deadline of the current job
+    int64_t runtime_left;        // Budget left, negative after an overrun
+    uint64_t last_update;        // When runtime_left was last charged
+    bool yielded;                // Job done, wait for the next period
+    bool missed;                 // Current job already counted as missed
+    uint32_t nr_periods;
+    uint32_t nr_missed;          // Jobs still running past their deadline
+    uint32_t nr_overruns;        // Periods that ran out of runtime
+} sched_dl_t;
+
+typedef struct task {
+    uint32_t esp;                // Saved stack pointer, must stay first (used by switch_to)
+    uint32_t id;
+    volatile uint32_t state;
+    char name[TASK_NAME_LEN];
+    void (*entry)(void* arg);
+    void* arg;
+    void* stack;                 // Stack pages, NULL for the boot task
+    uint32_t time_slice;         // Ticks left before preemption
+    uint32_t prio;               // Effective priority, boosted below static_prio
+    uint32_t static_prio;        // Base priority
+    uint32_t cpu;                // CPU whose run queue holds or runs the task
+    uint32_t policy;             // SCHED_NORMAL or SCHED_DEADLINE
+    sched_dl_t dl;
+    struct task* next;           // Run queue links
+    struct task* prev;
+    struct task* all_next;       // Link in the list of all tasks
+    uint64_t exec_start;         // TSC when it was last switched in
+    uint64_t sum_exec;           // TSC cycles spent running
+    uint32_t nr_switches;        // Times switched in
+    uint32_t fpu_cpu;            // CPU whose registers hold the FPU state, see fpu.h
+    bool fpu_used;               // fpu holds a saved state, otherwise start from the initial one
+    fpu_state_t fpu;
+    struct mm* mm;               // Address space while running a user program, see user_run()
+    uint32_t user_esp0;          // Kernel stack pointer on entry from user mode, 0 in kernel threads
+    struct fs_node* console_in;  // Pipe ends standing in for the console, see console_redirect()
+    struct fs_node* console_out;
+    uint32_t magic;              // STACK_MAGIC, overwritten on stack overflow
+} task_t;
+
+// Accounting snapshot of one task, see sched_task_stats()
+typedef struct {
+    task_t* task;
+    uint32_t id;
+    uint32_t cpu;
+    uint32_t state;
+    uint32_t prio;
+    uint32_t nr_switches;
+    uint64_t exec_cycles;        // Including the current run if it is running
+    char name[TASK_NAME_LEN];
+} task_stat_t;
+
+// Set up the scheduler, turning the caller into the idle task of CPU 0
+void sched_initialize(void);
+
+// Start a kernel thread running fn(arg), returns NULL when out of memory
+task_t* kthread_create(const char* name, void (*fn)(void* arg), void* arg);
+
+// Start a kernel thread running entry_point(), returns its id or 0
+uint32_t create_task(void (*entry_point)(void));
+
+// Terminate the calling task, its stack is freed by the idle task
+void task_exit(void) __attribute__((noreturn));
+
+// Task running on this CPU
+task_t* current_task(void);
+
+// Give up the CPU to the next ready task
+void schedule(void);
+void yield(void);
+
+// Make a blocked task runnable again
+void wake_up_task(task_t* task);
+
+// Wake a task blocked on user input, raising its priority by boost levels
+void wake_up_task_boost(task_t* task, uint32_t boost);
+
+// Wake a task onto this CPU to run at the next schedule(), ahead of the
+// priority order, for a caller about to block until that task answers
+// (IPC call and reply). The caller's CPU and caches are handed over.
+void wake_up_task_sync(task_t* task);
+
+// Mark the current task TASK_BLOCKED before checking the wakeup condition,
+// then call schedule(). A wakeup in between sets it back to TASK_RUNNING
+// and schedule() returns without blocking. Use wait_event() where possible.
+void set_current_state(uint32_t state);
+
+// Change the base priority of a task
+void sched_set_priority(task_t* task, uint32_t prio);
+
+// Make the calling task a deadline task: every period_us it gets runtime_us
+// of CPU time, to be used within deadline_us (0 means the period). Fails
+// with -1 when the parameters are invalid or no CPU has the bandwidth
+// left; runtime_us 0 turns it back into a normal task. The task is moved
+// to the CPU its bandwidth was reserved on.
+int sched_set_deadline(uint32_t runtime_us, uint32_t deadline_us, uint32_t period_us);
+
+// End the current job of a deadline task, it sleeps until its next period
+void sched_dl_yield(void);
+
+// Print deadline tasks and the reserved bandwidth per CPU
+void sched_dl_show(void);
+
+// Look up a task by id
+task_t* find_task(uint32_t id);
+
+// True when the caller may sleep, false before sched_initialize() and in the idle task
+bool sched_can_block(void);
+
+// True when another task is waiting for the CPU
+bool sched_has_ready_tasks(void);
+
+// Tasks running or ready on a CPU
+uint32_t sched_nr_running(uint32_t cpu);
+
+// Context switches on a CPU since boot
+uint32_t sched_nr_switches(uint32_t cpu);
+
+// Copy the accounting of up to max tasks, idle tasks included, returns the count
+uint32_t sched_task_stats(task_stat_t* stats, uint32_t max);
+
+// Name of a task state for listings
+const char* task_state_name(uint32_t state);
+
+// Timer tick accounting, called from the timer interrupt
+void scheduler_tick(void);
+
+// Preemption point on interrupt return
+void preempt_schedule_irq(void);
+
+// Disable/enable preemption of the current task
+void preempt_disable(void);
+void preempt_enable(void);
+
+// Free stacks of exited tasks, returns the number reaped
+uint32_t reap_dead_tasks(void);
+
+// Idle task of an application processor, allocated by the boot CPU and
+// installed by the AP itself before it enables interrupts
+task_t* sched_create_idle(uint32_t cpu);
+void sched_initialize_ap(task_t* idle);
+
+// Idle loop of a CPU, never returns
+void cpu_idle(void) __attribute__((noreturn));
+
+// Print the task list
+void sched_show_tasks(void);
+
+#endif // SCHED_H
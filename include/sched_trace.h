@@ -0,0 +1,72 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include "basedos.h"
+#include "cpu.h"
+#include "smp.h"
+#include "sched.h"
+
+// Scheduler events in a per-CPU ring buffer. Recording is an rdtsc and a
+// few stores into this CPU's buffer by code that already runs with
+// interrupts disabled, so it needs no lock and is always on.
+#define TRACE_EVENTS 256   // Per CPU, a power of two
+
+enum {
+    TRACE_SWITCH = 1,      // id switched out after running for runtime cycles, next_id in
+    TRACE_WAKEUP,          // id queued on cpu at prio
+};
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t runtime;      // Cycles prev ran, saturated
+    uint16_t id;
+    uint16_t next_id;
+    uint8_t type;
+    uint8_t state;         // State prev was switched out in
+    uint8_t cpu;
+    uint8_t prio;
+} trace_event_t;
+
+typedef struct {
+    trace_event_t events[TRACE_EVENTS];
+    uint32_t head;         // Events recorded since boot
+} __attribute__((aligned(64))) trace_buffer_t;
+
+extern trace_buffer_t trace_buffers[NR_CPUS];
+
+static inline trace_event_t* trace_next_event(uint32_t cpu, uint32_t type, uint64_t now) {
+    trace_buffer_t* buf = &trace_buffers[cpu];
+    trace_event_t* ev = &buf->events[buf->head & (TRACE_EVENTS - 1)];
+    buf->head++;
+    ev->tsc = now;
+    ev->type = type;
+    return ev;
+}
+
+static inline void trace_sched_switch(uint32_t cpu, task_t* prev, task_t* next, uint64_t runtime, uint64_t now) {
+    trace_event_t* ev = trace_next_event(cpu, TRACE_SWITCH, now);
+    ev->runtime = runtime > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)runtime;
+    ev->id = prev->id;
+    ev->next_id = next->id;
+    ev->state = prev->state;
+    ev->cpu = cpu;
+    ev->prio = prev->prio;
+}
+
+static inline void trace_sched_wakeup(uint32_t cpu, task_t* task, uint32_t target_cpu) {
+    trace_event_t* ev = trace_next_event(cpu, TRACE_WAKEUP, rdtsc());
+    ev->runtime = 0;
+    ev->id = task->id;
+    ev->next_id = 0;
+    ev->state = task->state;
+    ev->cpu = target_cpu;
+    ev->prio = task->prio;
+}
+
+// Print the last count events recorded on a CPU, newest last
+void trace_show(uint32_t cpu, uint32_t count);
+
+// Full screen task monitor refreshed every interval_ms until a key is pressed
+void sched_top(uint32_t interval_ms);
+
+#endif // SCHED_TRACE_H
@@ -0,0 +1,91 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "basedos.h"
+
+// Maximum number of CPUs the kernel keeps per-CPU state for, set from the
+// Makefile. A uniprocessor build (1) compiles the spinlocks away.
+#ifndef NR_CPUS
+#define NR_CPUS 8
+#endif
+
+#if NR_CPUS > 1
+#define CONFIG_SMP
+#endif
+
+// GDT layout, the same on every CPU. Each CPU has its own copy so the
+// TSS and the per-CPU segment can point at that CPU's data.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x18
+#define GDT_USER_DATA   0x20
+#define GDT_TSS         0x28
+#define GDT_PERCPU      0x30  // Loaded in %fs, based at the CPU's cpu_t
+#define GDT_ENTRIES     7
+
+// Application processors start in real mode at this page (SIPI vector)
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+// 32-bit task state segment, only esp0/ss0 are used
+typedef struct {
+    uint32_t prev_tss;
+    uint32_t esp0, ss0;
+    uint32_t esp1, ss1;
+    uint32_t esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+// Per-CPU data, reached through %fs
+typedef struct cpu {
+    struct cpu* self;          // Must stay first, read by this_cpu()
+    uint32_t id;               // Index into cpus[], read by smp_processor_id()
+    uint32_t apic_id;
+    volatile bool online;
+    struct task* fpu_owner;    // Task whose FPU state is in this CPU's registers
+    uint64_t gdt[GDT_ENTRIES];
+    tss_t tss;
+} __attribute__((aligned(64))) cpu_t;
+
+extern cpu_t cpus[NR_CPUS];
+
+// Index of the CPU executing the caller. A task can migrate between
+// CPUs whenever it is preempted, so the result is only stable while
+// preemption or interrupts are disabled.
+static inline uint32_t smp_processor_id(void) {
+    uint32_t id;
+    asm volatile("movl %%fs:%c1, %0" : "=r"(id) : "i"(__builtin_offsetof(cpu_t, id)));
+    return id;
+}
+
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    asm volatile("movl %%fs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Load the GDT, TSS and per-CPU segment of the boot CPU, must run before
+// anything calls smp_processor_id()
+void smp_prepare_boot_cpu(void);
+
+// Find the other CPUs in the ACPI MADT and start them
+void smp_initialize(void);
+
+// Number of CPUs running the scheduler
+uint32_t smp_num_cpus(void);
+
+static inline bool cpu_online(uint32_t cpu) {
+    return cpus[cpu].online;
+}
+
+// Make a CPU run its scheduler soon
+void smp_send_reschedule(uint32_t cpu);
+
+// Print the CPU list
+void smp_show_cpus(void);
+
+#endif // SMP_H
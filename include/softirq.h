@@ -0,0 +1,64 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "basedos.h"
+
+// Softirq numbers, lower numbers run first
+enum {
+    HI_SOFTIRQ = 0,    // High priority tasklets
+    TIMER_SOFTIRQ,     // Timer tick bookkeeping
+    TASKLET_SOFTIRQ,   // Normal priority tasklets
+    ASYNC_SOFTIRQ,     // Coroutine executor
+    SCHED_SOFTIRQ,     // Scheduler tick work
+    RCU_SOFTIRQ,       // RCU callbacks and grace period wakeups
+    NR_SOFTIRQS
+};
+
+typedef void (*softirq_action_t)(void);
+
+// Register the action run for a softirq number
+void open_softirq(uint32_t nr, softirq_action_t action);
+
+// Mark a softirq pending on this CPU (safe from any context)
+void raise_softirq(uint32_t nr);
+
+// Same as raise_softirq, caller must have interrupts disabled
+void raise_softirq_irqoff(uint32_t nr);
+
+// Run pending softirqs with interrupts enabled, unless already in interrupt context
+void do_softirq(void);
+
+// Check for pending softirqs on this CPU
+bool softirq_pending(void);
+
+// Hard interrupt accounting, called by the interrupt dispatcher
+void irq_enter(void);
+void irq_exit(void);
+
+// True while in a hard interrupt handler or running softirqs
+bool in_interrupt(void);
+bool in_irq(void);
+
+// Tasklets: small deferred work items run from softirq context.
+// A tasklet is never queued twice and never runs on two CPUs at once.
+typedef struct tasklet {
+    struct tasklet* next;
+    volatile uint32_t state;
+    void (*func)(uint32_t data);
+    uint32_t data;
+} tasklet_t;
+
+#define TASKLET_STATE_SCHED 0x01  // Queued, waiting to run
+#define TASKLET_STATE_RUN   0x02  // Currently running
+
+#define DECLARE_TASKLET(name, fn, arg) \
+    tasklet_t name = { .next = NULL, .state = 0, .func = (fn), .data = (arg) }
+
+void tasklet_init(tasklet_t* t, void (*func)(uint32_t data), uint32_t data);
+void tasklet_schedule(tasklet_t* t);
+void tasklet_hi_schedule(tasklet_t* t);
+
+// Set up the softirq subsystem, must run before interrupts are enabled
+void softirq_initialize(void);
+
+#endif // SOFTIRQ_H
@@ -0,0 +1,342 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "basedos.h"
+#include "interrupts.h"
+#include "cpu.h"
+#include "smp.h"
+
+// Locking primitives for data shared between CPUs and interrupt handlers:
+//
+//   spinlock_t    test-and-test-and-set, cheapest when uncontended
+//   ticketlock_t  FIFO handoff, waiters are served in arrival order
+//   rwlock_t      many readers or one writer, for read-mostly data
+//
+// Locks taken from interrupt context must use the irqsave variants
+// everywhere, or a CPU can deadlock against itself. The plain variants
+// require interrupts to be disabled already or the lock to be task-only.
+//
+// On a uniprocessor build (NR_CPUS = 1) there is no other CPU to exclude,
+// so the locks compile away and the irqsave variants only mask interrupts.
+
+// Per acquisition site contention statistics (lockstat shell command)
+typedef struct lockstat_site {
+    const char* name;              // Lock expression as written at the site
+    const char* file;
+    uint32_t line;
+    volatile uint32_t registered;
+    volatile uint32_t acquisitions;
+    uint32_t contended;
+    uint64_t wait_cycles;
+    uint64_t max_wait_cycles;
+    struct lockstat_site* next;
+} lockstat_site_t;
+
+#if CONFIG_LOCKSTAT
+extern volatile bool lockstat_enabled;
+
+// One static record per call site, created by the lock macros below
+#define LOCK_SITE(lock) ({ \
+    static lockstat_site_t __lock_site = { .name = #lock, .file = __FILE__, .line = __LINE__ }; \
+    &__lock_site; })
+
+void lockstat_register(lockstat_site_t* site);
+void lockstat_record_wait(lockstat_site_t* site, uint64_t cycles);
+
+static inline void lockstat_acquired(lockstat_site_t* site) {
+    if (lockstat_enabled) {
+        __sync_fetch_and_add(&site->acquisitions, 1);
+        if (!site->registered) {
+            lockstat_register(site);
+        }
+    }
+}
+
+static inline uint64_t lockstat_wait_begin(void) {
+    return lockstat_enabled ? rdtsc() : 0;
+}
+
+static inline void lockstat_wait_end(lockstat_site_t* site, uint64_t start) {
+    if (start) {
+        lockstat_record_wait(site, rdtsc() - start);
+    }
+}
+#else
+#define LOCK_SITE(lock) ((lockstat_site_t*)0)
+
+static inline void lockstat_acquired(lockstat_site_t* site) {
+    (void)site;
+}
+
+static inline uint64_t lockstat_wait_begin(void) {
+    return 0;
+}
+
+static inline void lockstat_wait_end(lockstat_site_t* site, uint64_t start) {
+    (void)site;
+    (void)start;
+}
+#endif
+
+void lockstat_enable(bool enable);
+void lockstat_reset(void);
+void lockstat_show(void);
+
+// Spinlock
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+static inline bool spin_is_locked(spinlock_t* lock) {
+    return lock->locked != 0;
+}
+
+#ifdef CONFIG_SMP
+void spin_lock_slow(spinlock_t* lock, lockstat_site_t* site);
+
+static inline bool arch_spin_trylock(spinlock_t* lock) {
+    uint32_t old = 1;
+    asm volatile("xchgl %0, %1" : "+r"(old), "+m"(lock->locked) : : "memory");
+    return old == 0;
+}
+
+static inline void _spin_lock(spinlock_t* lock, lockstat_site_t* site) {
+    if (arch_spin_trylock(lock)) {
+        lockstat_acquired(site);
+    } else {
+        spin_lock_slow(lock, site);
+    }
+}
+
+static inline bool _spin_trylock(spinlock_t* lock, lockstat_site_t* site) {
+    if (!arch_spin_trylock(lock)) {
+        return false;
+    }
+    lockstat_acquired(site);
+    return true;
+}
+
+static inline void _spin_unlock(spinlock_t* lock) {
+    // x86 stores are not reordered with earlier loads or stores
+    asm volatile("" : : : "memory");
+    lock->locked = 0;
+}
+#else
+static inline void _spin_lock(spinlock_t* lock, lockstat_site_t* site) {
+    (void)lock;
+    lockstat_acquired(site);
+    asm volatile("" : : : "memory");
+}
+
+static inline bool _spin_trylock(spinlock_t* lock, lockstat_site_t* site) {
+    _spin_lock(lock, site);
+    return true;
+}
+
+static inline void _spin_unlock(spinlock_t* lock) {
+    (void)lock;
+    asm volatile("" : : : "memory");
+}
+#endif
+
+#define spin_lock(lock)    _spin_lock((lock), LOCK_SITE(lock))
+#define spin_trylock(lock) _spin_trylock((lock), LOCK_SITE(lock))
+#define spin_unlock(lock)  _spin_unlock(lock)
+
+#define spin_lock_irqsave(lock) ({ \
+    uint32_t __flags = irq_save(); \
+    spin_lock(lock); \
+    __flags; })
+
+#define spin_unlock_irqrestore(lock, flags) do { \
+    spin_unlock(lock); \
+    irq_restore(flags); \
+} while (0)
+
+// Ticket lock: taking a ticket is one xadd on the next field, the holder
+// passes the lock on by advancing owner. Waiters spin on a read-only load.
+
+typedef struct {
+    union {
+        volatile uint32_t tickets;
+        struct {
+            volatile uint16_t owner;   // Ticket being served
+            volatile uint16_t next;    // Next ticket handed out
+        };
+    };
+} ticketlock_t;
+
+#define TICKETLOCK_INIT { { 0 } }
+
+static inline void ticket_lock_init(ticketlock_t* lock) {
+    lock->tickets = 0;
+}
+
+static inline bool ticket_is_locked(ticketlock_t* lock) {
+    uint32_t tickets = lock->tickets;
+    return (uint16_t)tickets != (uint16_t)(tickets >> 16);
+}
+
+#ifdef CONFIG_SMP
+void ticket_lock_slow(ticketlock_t* lock, uint16_t ticket, lockstat_site_t* site);
+
+static inline void _ticket_lock(ticketlock_t* lock, lockstat_site_t* site) {
+    uint32_t tickets = 1 << 16;
+    asm volatile("lock xaddl %0, %1" : "+r"(tickets), "+m"(lock->tickets) : : "memory");
+    uint16_t ticket = tickets >> 16;
+    if (ticket == (uint16_t)tickets) {
+        lockstat_acquired(site);
+    } else {
+        ticket_lock_slow(lock, ticket, site);
+    }
+}
+
+static inline bool _ticket_trylock(ticketlock_t* lock, lockstat_site_t* site) {
+    uint32_t tickets = lock->tickets;
+    if ((uint16_t)tickets != (uint16_t)(tickets >> 16)) {
+        return false;
+    }
+    if (!__sync_bool_compare_and_swap(&lock->tickets, tickets, tickets + (1 << 16))) {
+        return false;
+    }
+    lockstat_acquired(site);
+    return true;
+}
+
+static inline void _ticket_unlock(ticketlock_t* lock) {
+    // Only the holder writes owner, a plain 16-bit store is enough
+    asm volatile("" : : : "memory");
+    lock->owner = lock->owner + 1;
+}
+#else
+static inline void _ticket_lock(ticketlock_t* lock, lockstat_site_t* site) {
+    (void)lock;
+    lockstat_acquired(site);
+    asm volatile("" : : : "memory");
+}
+
+static inline bool _ticket_trylock(ticketlock_t* lock, lockstat_site_t* site) {
+    _ticket_lock(lock, site);
+    return true;
+}
+
+static inline void _ticket_unlock(ticketlock_t* lock) {
+    (void)lock;
+    asm volatile("" : : : "memory");
+}
+#endif
+
+#define ticket_lock(lock)    _ticket_lock((lock), LOCK_SITE(lock))
+#define ticket_trylock(lock) _ticket_trylock((lock), LOCK_SITE(lock))
+#define ticket_unlock(lock)  _ticket_unlock(lock)
+
+#define ticket_lock_irqsave(lock) ({ \
+    uint32_t __flags = irq_save(); \
+    ticket_lock(lock); \
+    __flags; })
+
+#define ticket_unlock_irqrestore(lock, flags) do { \
+    ticket_unlock(lock); \
+    irq_restore(flags); \
+} while (0)
+
+// Reader-writer lock: count is the number of readers, or -1 while a writer
+// holds it. Readers are not held back by a waiting writer, so a steady
+// stream of readers can starve writers; use it where writes are rare.
+
+typedef struct {
+    volatile int32_t count;
+} rwlock_t;
+
+#define RWLOCK_INIT { 0 }
+
+static inline void rwlock_init(rwlock_t* lock) {
+    lock->count = 0;
+}
+
+#ifdef CONFIG_SMP
+void read_lock_slow(rwlock_t* lock, lockstat_site_t* site);
+void write_lock_slow(rwlock_t* lock, lockstat_site_t* site);
+
+static inline bool arch_read_trylock(rwlock_t* lock) {
+    int32_t count = lock->count;
+    return count >= 0 && __sync_bool_compare_and_swap(&lock->count, count, count + 1);
+}
+
+static inline bool arch_write_trylock(rwlock_t* lock) {
+    return lock->count == 0 && __sync_bool_compare_and_swap(&lock->count, 0, -1);
+}
+
+static inline void _read_lock(rwlock_t* lock, lockstat_site_t* site) {
+    if (arch_read_trylock(lock)) {
+        lockstat_acquired(site);
+    } else {
+        read_lock_slow(lock, site);
+    }
+}
+
+static inline void _read_unlock(rwlock_t* lock) {
+    __sync_fetch_and_sub(&lock->count, 1);
+}
+
+static inline void _write_lock(rwlock_t* lock, lockstat_site_t* site) {
+    if (arch_write_trylock(lock)) {
+        lockstat_acquired(site);
+    } else {
+        write_lock_slow(lock, site);
+    }
+}
+
+static inline void _write_unlock(rwlock_t* lock) {
+    asm volatile("" : : : "memory");
+    lock->count = 0;
+}
+#else
+static inline void _read_lock(rwlock_t* lock, lockstat_site_t* site) {
+    (void)lock;
+    lockstat_acquired(site);
+    asm volatile("" : : : "memory");
+}
+
+static inline void _read_unlock(rwlock_t* lock) {
+    (void)lock;
+    asm volatile("" : : : "memory");
+}
+
+#define _write_lock   _read_lock
+#define _write_unlock _read_unlock
+#endif
+
+#define read_lock(lock)    _read_lock((lock), LOCK_SITE(lock))
+#define read_unlock(lock)  _read_unlock(lock)
+#define write_lock(lock)   _write_lock((lock), LOCK_SITE(lock))
+#define write_unlock(lock) _write_unlock(lock)
+
+#define read_lock_irqsave(lock) ({ \
+    uint32_t __flags = irq_save(); \
+    read_lock(lock); \
+    __flags; })
+
+#define read_unlock_irqrestore(lock, flags) do { \
+    read_unlock(lock); \
+    irq_restore(flags); \
+} while (0)
+
+#define write_lock_irqsave(lock) ({ \
+    uint32_t __flags = irq_save(); \
+    write_lock(lock); \
+    __flags; })
+
+#define write_unlock_irqrestore(lock, flags) do { \
+    write_unlock(lock); \
+    irq_restore(flags); \
+} while (0)
+
+#endif // SPINLOCK_H
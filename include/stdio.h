@@ -0,0 +1,73 @@
+#ifndef STDIO_H
+#define STDIO_H
+
+#include "basedos.h"
+
+// Buffered streams over file descriptors, for user programs and kernel
+// threads alike: the only calls below it are open(), close(), read(),
+// write() and lseek(). Output collects in the stream's buffer and goes
+// out in one write() per flush:
+//
+//   _IOFBF  when the buffer is full, the default for files
+//   _IOLBF  also after each newline, the default for stdin and stdout
+//   _IONBF  at once, the default for stderr
+//
+// Streams are not locked. Kernel threads share stdin, stdout and stderr,
+// so they should use streams of their own.
+
+#define _IOFBF 0
+#define _IOLBF 1
+#define _IONBF 2
+
+#define BUFSIZ    512
+#define FOPEN_MAX 8
+#define EOF       (-1)
+
+typedef struct {
+    int32_t fd;
+    uint32_t flags;          // FILE_* in stdio.c
+    int mode;                // _IOFBF, _IOLBF or _IONBF
+    uint8_t* buf;
+    uint32_t size;
+    uint32_t len;            // Bytes buffered: to write, or read and valid
+    uint32_t pos;            // Next byte to read
+} FILE;
+
+extern FILE* stdin;
+extern FILE* stdout;
+extern FILE* stderr;
+
+// mode is "r", "w" or "a", with an optional "+"
+FILE* fopen(const char* path, const char* mode);
+FILE* fdopen(int32_t fd, const char* mode);
+int fclose(FILE* stream);
+
+// Write out buffered output, of every stream when stream is NULL
+int fflush(FILE* stream);
+
+// Before any I/O on the stream. buf NULL uses the stream's own BUFSIZ
+// bytes, which also caps size.
+int setvbuf(FILE* stream, char* buf, int mode, uint32_t size);
+
+uint32_t fread(void* ptr, uint32_t size, uint32_t nmemb, FILE* stream);
+uint32_t fwrite(const void* ptr, uint32_t size, uint32_t nmemb, FILE* stream);
+int fgetc(FILE* stream);
+int fputc(int c, FILE* stream);
+char* fgets(char* s, int n, FILE* stream);
+int fputs(const char* s, FILE* stream);
+int puts(const char* s);
+
+int feof(FILE* stream);
+int ferror(FILE* stream);
+void clearerr(FILE* stream);
+int32_t fileno(FILE* stream);
+
+// Conversions as printk plus the - flag, precision for %s and %p. Return
+// the number of characters produced, snprintf() also those cut off.
+int printf(const char* format, ...);
+int fprintf(FILE* stream, const char* format, ...);
+int vfprintf(FILE* stream, const char* format, va_list args);
+int snprintf(char* str, uint32_t size, const char* format, ...);
+int vsnprintf(char* str, uint32_t size, const char* format, va_list args);
+
+#endif // STDIO_H
@@ -0,0 +1,15 @@
+#ifndef STDLIB_H
+#define STDLIB_H
+
+#include "basedos.h"
+
+// Heap for user programs, see lib/malloc.c. Blocks are 16-byte aligned.
+// Up to 16 KiB they come from size-class bins on brk() memory and are
+// reused without system calls; larger ones are mappings of their own,
+// given back to the kernel by free().
+void* malloc(uint32_t size);
+void free(void* ptr);
+void* calloc(uint32_t nmemb, uint32_t size);
+void* realloc(void* ptr, uint32_t size);
+
+#endif // STDLIB_H
@@ -0,0 +1,35 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "basedos.h"
+
+// Mutexes and condition variables for user programs, on futex(). An
+// uncontended lock or unlock is one atomic instruction and no system
+// call; only a task that has to wait, and an unlock that has waiters to
+// wake, enter the kernel. Between processes they must live in shared
+// memory (MAP_SHARED).
+
+typedef struct {
+    volatile uint32_t state;     // 0 free, 1 locked, 2 locked and maybe waited for
+} mutex_t;
+
+typedef struct {
+    volatile uint32_t seq;       // Bumped by every signal
+    volatile uint32_t waiters;   // In cond_wait(), signals without any stay in user space
+} cond_t;
+
+#define MUTEX_INIT { 0 }
+#define COND_INIT  { 0, 0 }
+
+void mutex_lock(mutex_t* mutex);
+bool mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+// Unlock mutex and sleep until signalled, then lock it again. Wakeups
+// can be spurious, so wait in a loop on the condition. Signal after
+// changing the condition with the mutex held.
+void cond_wait(cond_t* cond, mutex_t* mutex);
+void cond_signal(cond_t* cond);
+void cond_broadcast(cond_t* cond);
+
+#endif // SYNC_H
@@ -0,0 +1,22 @@
+#ifndef SYSBENCH_H
+#define SYSBENCH_H
+
+#include "basedos.h"
+
+// Run a small user program that times each way into the kernel and back
+// (int 0x80, SYSENTER through the vDSO) and the vDSO clock against the
+// clock_ns system call, then print the cycles per call. Runs in the
+// calling kernel thread, returns 0 or -1.
+int sysbench_run(uint32_t iterations);
+
+// Time fork() followed by exit, and by exec() of a tiny program, in a
+// parent with more and more touched memory. With copy-on-write the cost
+// should barely depend on the parent's size. Returns 0 or -1.
+int forkbench_run(uint32_t iterations);
+
+// Ping-pong between two user processes over an IPC port: round trip
+// latency of register, inline and page-remapping messages, and the
+// throughput of the remapped payload. Returns 0 or -1.
+int ipcbench_run(uint32_t iterations);
+
+#endif // SYSBENCH_H
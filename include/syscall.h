@@ -0,0 +1,78 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "basedos.h"
+#include "interrupts.h"
+#include "paging.h"
+
+// System calls from user mode, through int 0x80 or the SYSENTER stub of
+// the vDSO (see vdso.h). The number goes in eax and up to five arguments
+// in ebx, ecx, edx, esi and edi. The result comes back in eax, -1 on
+// error; every other register is preserved unless noted.
+#define SYS_exit      0   // (code), does not return
+#define SYS_read      1   // (fd, buf, len)
+#define SYS_write     2   // (fd, buf, len)
+#define SYS_open      3   // (path, flags)
+#define SYS_close     4   // (fd)
+#define SYS_lseek     5   // (fd, offset, whence)
+#define SYS_getpid    6   // ()
+#define SYS_yield     7   // ()
+#define SYS_sleep     8   // (msecs)
+#define SYS_clock_ns  9   // (uint64_t* ns), monotonic nanoseconds since boot
+#define SYS_fork      10  // (), child pid in the parent, 0 in the child
+#define SYS_exec      11  // (path, argv), argv NULL-terminated; no return on success
+#define SYS_wait      12  // (pid or -1 for any child, int* status or NULL), pid reaped
+#define SYS_port_create    13  // (), new IPC port id, see ipc.h
+#define SYS_port_destroy   14  // (port)
+#define SYS_ipc_call       15  // (port, ipc_msg_t* or NULL, -, w0, w1), reply words in esi, edi
+#define SYS_ipc_reply      16  // (port, msg, token, w0, w1)
+#define SYS_ipc_reply_wait 17  // (port, msg, token or 0, w0, w1), token of the next call, its words in esi, edi
+#define SYS_poll           18  // (pollfd_t* fds, nfds, timeout_ms), see fs/poll.h
+#define SYS_epoll_create   19  // (), new set descriptor
+#define SYS_epoll_ctl      20  // (epfd, op, fd, epoll_event_t* or NULL for EPOLL_CTL_DEL)
+#define SYS_epoll_wait     21  // (epfd, epoll_event_t* events, max, timeout_ms), events filled in
+#define SYS_futex          22  // (uaddr, op, val), see futex.h
+#define SYS_mmap           23  // (addr, len, prot | flags, fd, offset), see mman.h; address or -1
+#define SYS_munmap         24  // (addr, len)
+#define SYS_brk            25  // (addr), the new break or the old one; 0 just returns it
+#define NR_SYSCALLS   26
+
+// Install the int 0x80 gate and SYSENTER, and build the vDSO. Call on
+// the boot CPU after the clocksource and paging are set up.
+void syscall_initialize(void);
+
+// SYSENTER setup of an application processor
+void syscall_cpu_init(void);
+
+// System call through int 0x80, called by interrupt_dispatch()
+void syscall_interrupt(interrupt_frame_t* frame);
+
+// Run the current kernel thread in user mode in address space mm, from
+// eip with stack esp, until the program exits. Returns its exit code, or
+// -1 when it was killed or user mode is not available. The caller still
+// owns mm afterwards.
+int user_run(mm_t* mm, uint32_t eip, uint32_t esp);
+
+// Like user_run(), resuming with every register of frame. Selectors and
+// privileged flags in it are ignored.
+int user_run_frame(mm_t* mm, const interrupt_frame_t* frame);
+
+// User registers of a task inside a system call or user mode exception,
+// pushed right below its user_esp0
+struct task;
+interrupt_frame_t* user_frame(struct task* task);
+
+// Leave user mode for good: the pending user_run() returns code. Called
+// by system calls and exception handlers of the program.
+void user_return(int code) __attribute__((noreturn));
+
+// Kill the current program after an exception it caused in user mode
+void user_fault(interrupt_frame_t* frame, const char* what) __attribute__((noreturn));
+
+// True if the CPU supports SYSENTER and the vDSO uses it
+bool syscall_has_sysenter(void);
+
+// Print per-system call counts and kernel cycles
+void syscall_show(void);
+
+#endif // SYSCALL_H
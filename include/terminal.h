@@ -29,6 +29,7 @@ void terminal_writestring(const char* str);
 void terminal_write_hex(uint32_t value);
 void terminal_write_dec(uint32_t value);
 void putchar(char c);
+void terminal_write(const char* data, uint32_t len);  // A buffer at once, not redirected
 void printk(const char* format, ...);
 
 // Global variables (declared as extern)
@@ -0,0 +1,58 @@
+#ifndef TIME_H
+#define TIME_H
+
+#include "basedos.h"
+
+// PIT input clock and the programmed timer interrupt rate
+#define PIT_FREQUENCY 1193182
+#define TIMER_HZ      100
+
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC  1000000000ULL
+
+// Timer interrupts since the PIT was programmed
+extern volatile uint32_t timer_ticks;
+
+// Broken-down calendar time (UTC)
+typedef struct {
+    uint32_t year;
+    uint32_t month;   // 1-12
+    uint32_t day;     // 1-31
+    uint32_t hour;
+    uint32_t minute;
+    uint32_t second;
+} rtc_time_t;
+
+// Calibrate the TSC against the PIT and read the RTC, call once at boot
+// after the PIT channel 0 tick is running
+void clocksource_initialize(void);
+
+// Monotonic nanoseconds since the clocksource was initialized
+uint64_t ktime_get_ns(void);
+
+// Convert a TSC cycle delta to nanoseconds (0 if the TSC is not in use)
+uint64_t cycles_to_ns(uint64_t cycles);
+
+// Conversion used by ktime_get_ns(), for readers outside the kernel such
+// as the vDSO. False when the TSC is not the clocksource.
+bool clocksource_tsc_params(uint64_t* base, uint32_t* mult, uint32_t* shift);
+
+// Calibrated TSC frequency in kHz, 0 if the TSC is not used
+uint32_t tsc_khz_get(void);
+
+// Name of the active clocksource ("tsc" or "pit")
+const char* clocksource_name(void);
+
+// Wall clock as seconds since the Unix epoch and broken down
+time_t wall_clock_seconds(void);
+void wall_clock_get(rtc_time_t* tm);
+
+// Wall clock seconds when ktime_get_ns() was 0
+time_t wall_clock_boot_time(void);
+
+// Busy-wait delays driven by the clocksource
+void udelay(uint32_t usecs);
+void mdelay(uint32_t msecs);
+
+#endif // TIME_H
@@ -0,0 +1,42 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "basedos.h"
+#include "time.h"
+
+// Kernel timers with tick resolution. The callback runs from the timer
+// softirq on the boot CPU, so it must not sleep.
+typedef struct timer_list {
+    struct timer_list* next;
+    uint32_t expires;              // timer_ticks value at which it fires
+    void (*func)(uint32_t data);
+    uint32_t data;
+    bool pending;
+} timer_list_t;
+
+// Wrap-safe comparison of tick values
+#define time_after_eq(a, b) ((int32_t)((a) - (b)) >= 0)
+
+static inline uint32_t msecs_to_ticks(uint32_t msecs) {
+    return (msecs * TIMER_HZ + 999) / 1000;
+}
+
+void timer_setup(timer_list_t* timer, void (*func)(uint32_t data), uint32_t data);
+
+// Arm the timer to fire at expires, moving it if it is already pending
+void mod_timer(timer_list_t* timer, uint32_t expires);
+
+// Disarm the timer, true if it was pending. A callback that already
+// started running is not waited for.
+bool del_timer(timer_list_t* timer);
+
+bool timer_pending(timer_list_t* timer);
+
+// Run expired timers, called from the timer softirq
+void run_timers(void);
+
+// Sleep for at least msecs, rounded up to whole ticks. Busy-waits when
+// the caller cannot block.
+void msleep(uint32_t msecs);
+
+#endif // TIMER_H
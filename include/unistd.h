@@ -0,0 +1,31 @@
+#ifndef UNISTD_H
+#define UNISTD_H
+
+#include "basedos.h"
+
+// User programs only: the system call wrappers in user/crt0.c. read(),
+// write(), open(), close() and lseek() keep the kernel's declarations
+// in fs/vfs.h, so lib/ code runs on either side.
+
+// Output still buffered by stdio is flushed first, so the child does
+// not print it again. Returns the child's pid, 0 in the child, or -1.
+int32_t fork(void);
+
+// Reap a child (-1 for any), see SYS_wait. Returns its pid or -1.
+int32_t wait(int32_t pid, int* status);
+
+// Move the end of the heap, which starts after the program's data.
+// brk() returns 0 or -1, sbrk() the old break or (void*)-1.
+int brk(void* addr);
+void* sbrk(int32_t increment);
+
+// Flush stdio and end the program
+void exit(int status) __attribute__((noreturn));
+
+// Monotonic nanoseconds since boot from the vDSO, without a system call
+uint64_t clock_ns(void);
+
+// System calls made so far
+extern uint32_t syscall_count;
+
+#endif // UNISTD_H
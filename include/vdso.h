@@ -0,0 +1,58 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include "basedos.h"
+#include "paging.h"
+
+// The vDSO is one page mapped read-only at VDSO_BASE in every address
+// space. It starts with vdso_data_t, which the kernel keeps current, and
+// holds small routines at VDSO_CODE_OFFSET that user code calls through
+// the addresses published in the data:
+//
+//   vdso_data_t* vd = (vdso_data_t*)VDSO_BASE;
+//   uint64_t ns = ((uint64_t (*)(void))vd->clock_ns)();
+//
+// clock_ns returns monotonic nanoseconds since boot in edx:eax without
+// entering the kernel. syscall_entry takes the system call number in eax
+// and arguments in ebx, ecx, edx, esi, edi like int 0x80, and uses
+// SYSENTER when the CPU has it.
+
+#define VDSO_CODE_OFFSET 0x100
+
+// Field offsets, used by the assembly routines
+#define VDSO_SEQ           0
+#define VDSO_TICKS         4
+#define VDSO_TICK_NS       8
+#define VDSO_TSC_MULT      12
+#define VDSO_TSC_SHIFT     16
+#define VDSO_TSC_BASE      20
+#define VDSO_SYSCALL_ENTRY 40
+#define VDSO_CLOCK_NS      44
+
+typedef struct {
+    volatile uint32_t seq;      // Odd while the kernel updates the page, readers retry
+    volatile uint32_t ticks;    // Timer ticks since boot
+    uint32_t tick_ns;           // Length of a tick
+    uint32_t tsc_mult;          // ns = (tsc - tsc_base) * tsc_mult >> tsc_shift,
+    uint32_t tsc_shift;         // tsc_mult is 0 when the TSC is not used
+    uint64_t tsc_base;
+    uint32_t tsc_khz;
+    uint32_t hz;                // Timer ticks per second
+    time_t boot_epoch;          // Wall clock seconds at boot
+    uint32_t syscall_entry;     // System call stub
+    uint32_t clock_ns;          // Time read without a system call
+} vdso_data_t;
+
+// Build the page, sysenter selects the system call stub
+void vdso_initialize(bool sysenter);
+
+// Map the page into an address space, 0 or -1
+int vdso_map(mm_t* mm);
+
+// Return address of the SYSENTER stub, where SYSEXIT resumes
+uint32_t vdso_sysenter_return(void);
+
+// Publish a timer tick, called from the timer interrupt
+void vdso_tick(uint32_t ticks);
+
+#endif // VDSO_H
@@ -0,0 +1,89 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "basedos.h"
+#include "spinlock.h"
+#include "sched.h"
+
+// Tasks sleeping until some condition becomes true. The waker changes
+// the condition first and then calls wake_up(); the sleeper marks itself
+// blocked before checking the condition, so no wakeup is lost.
+typedef struct wait_queue_entry {
+    task_t* task;
+    uint32_t flags;
+    void (*func)(struct wait_queue_entry* entry);  // Instead of waking task, see add_wait_queue()
+    void* private;
+    struct wait_queue_entry* next;
+    struct wait_queue_entry* prev;
+} wait_queue_entry_t;
+
+// Only one exclusive waiter is woken per wake_up()
+#define WQ_FLAG_EXCLUSIVE 0x01
+
+typedef struct {
+    spinlock_t lock;
+    wait_queue_entry_t* head;
+    wait_queue_entry_t* tail;
+} wait_queue_head_t;
+
+#define WAIT_QUEUE_HEAD_INIT { SPINLOCK_INIT, NULL, NULL }
+#define DECLARE_WAIT_QUEUE_HEAD(name) wait_queue_head_t name = WAIT_QUEUE_HEAD_INIT
+
+void init_waitqueue_head(wait_queue_head_t* wq);
+void init_wait_entry(wait_queue_entry_t* entry, uint32_t flags);
+
+// Queue the current task if needed and mark it blocked
+void prepare_to_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry);
+
+// Dequeue the current task and mark it running again
+void finish_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry);
+
+// Entries that call func(entry) on every wakeup and stay queued until
+// removed, for poll() and epoll. func runs with the queue locked and
+// interrupts disabled, possibly from interrupt context, and must not sleep.
+void init_wait_func(wait_queue_entry_t* entry, void (*func)(wait_queue_entry_t* entry), void* private);
+void add_wait_queue(wait_queue_head_t* wq, wait_queue_entry_t* entry);
+void remove_wait_queue(wait_queue_head_t* wq, wait_queue_entry_t* entry);
+
+// Wake every non-exclusive waiter and up to nr_exclusive exclusive ones,
+// raising their priority by boost levels. Safe from interrupt context.
+void __wake_up(wait_queue_head_t* wq, uint32_t nr_exclusive, uint32_t boost);
+
+#define wake_up(wq)             __wake_up((wq), 1, 0)
+#define wake_up_all(wq)         __wake_up((wq), 0, 0)
+#define wake_up_interactive(wq) __wake_up((wq), 1, SCHED_INTERACTIVE_BOOST)
+
+bool waitqueue_active(wait_queue_head_t* wq);
+
+#define __wait_event(wq, condition, entry_flags)                    \
+    do {                                                            \
+        wait_queue_entry_t __wait;                                  \
+        init_wait_entry(&__wait, (entry_flags));                    \
+        while (1) {                                                 \
+            prepare_to_wait(&(wq), &__wait);                        \
+            if (condition) {                                        \
+                break;                                              \
+            }                                                       \
+            schedule();                                             \
+        }                                                           \
+        finish_wait(&(wq), &__wait);                                \
+    } while (0)
+
+// Sleep until condition is true, must not be called from interrupt
+// context or the idle task
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        if (!(condition)) {                                         \
+            __wait_event(wq, condition, 0);                         \
+        }                                                           \
+    } while (0)
+
+// Like wait_event(), but wake_up() only wakes one exclusive waiter
+#define wait_event_exclusive(wq, condition)                         \
+    do {                                                            \
+        if (!(condition)) {                                         \
+            __wait_event(wq, condition, WQ_FLAG_EXCLUSIVE);         \
+        }                                                           \
+    } while (0)
+
+#endif // WAIT_H
@@ -0,0 +1,106 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "basedos.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "timer.h"
+#include "softirq.h"
+
+// Work items run in process context by a pool of kernel worker threads,
+// so unlike tasklets they may sleep and take as long as they need. A work
+// item is never queued twice and never runs on two workers at once.
+// It must stay allocated until it has finished running; its own function
+// must not free it.
+struct workqueue;
+
+typedef struct work {
+    struct work* next;
+    volatile uint32_t state;
+    void (*func)(struct work* work);
+    struct workqueue* wq;          // Queue it was last queued on
+} work_t;
+
+#define WORK_STATE_PENDING 0x01    // Queued, or waiting for its timer or its running instance
+#define WORK_STATE_RUNNING 0x02
+
+#define WORK_INIT(fn) { .next = NULL, .state = 0, .func = (fn), .wq = NULL }
+#define DECLARE_WORK(name, fn) work_t name = WORK_INIT(fn)
+
+// Work queued after a delay
+typedef struct {
+    work_t work;
+    timer_list_t timer;
+} delayed_work_t;
+
+// Worker pool: starts with min_workers threads, adds one whenever work is
+// queued and none is idle, up to max_workers, and retires the extra ones
+// once the pool has had idle workers for WQ_IDLE_TIMEOUT_MS.
+#define WQ_IDLE_TIMEOUT_MS 5000
+#define WQ_NAME_LEN        12
+
+typedef struct workqueue {
+    char name[WQ_NAME_LEN];
+    spinlock_t lock;
+    work_t* head;                  // Pending work, FIFO
+    work_t* tail;
+    wait_queue_head_t more_work;   // Idle workers
+    wait_queue_head_t work_done;   // flush_work() callers
+    uint32_t prio;
+    uint32_t min_workers;
+    uint32_t max_workers;
+    uint32_t nr_workers;
+    uint32_t nr_idle;
+    uint32_t nr_pending;
+    uint32_t nr_retire;            // Idle workers asked to exit
+    uint32_t completed;
+    uint32_t last_busy;            // Tick when no worker was idle
+    bool grow_failed;
+    timer_list_t idle_timer;
+    tasklet_t grow_tasklet;        // Adds a worker when queued from a hard interrupt
+    struct workqueue* next;
+} workqueue_t;
+
+// Shared queue for work that does not need its own pool
+extern workqueue_t* system_wq;
+
+// Create a queue whose workers run at priority prio, NULL when out of memory
+workqueue_t* alloc_workqueue(const char* name, uint32_t prio, uint32_t min_workers, uint32_t max_workers);
+
+void init_work(work_t* work, void (*func)(work_t* work));
+void init_delayed_work(delayed_work_t* dwork, void (*func)(work_t* work));
+
+// Queue work, false if it was already pending. Safe from any context.
+bool queue_work(workqueue_t* wq, work_t* work);
+
+// Queue work once delay_ms have passed, false if it was already pending
+bool queue_delayed_work(workqueue_t* wq, delayed_work_t* dwork, uint32_t delay_ms);
+
+static inline bool schedule_work(work_t* work) {
+    return queue_work(system_wq, work);
+}
+
+static inline bool schedule_delayed_work(delayed_work_t* dwork, uint32_t delay_ms) {
+    return queue_delayed_work(system_wq, dwork, delay_ms);
+}
+
+// Remove pending work that has not started, true if it was pending
+bool cancel_work(work_t* work);
+bool cancel_delayed_work(delayed_work_t* dwork);
+
+// Sleep until the work is neither pending nor running. Must be called
+// from a task that may sleep, never from the work's own function.
+void flush_work(work_t* work);
+void flush_delayed_work(delayed_work_t* dwork);
+
+static inline bool work_pending(work_t* work) {
+    return (work->state & WORK_STATE_PENDING) != 0;
+}
+
+// Create the system queue, needs the scheduler
+void workqueue_initialize(void);
+
+// Print the state of every queue
+void workqueue_show(void);
+
+#endif // WORKQUEUE_H
@@ -0,0 +1,112 @@
+#include "basedos.h"
+#include "apic.h"
+#include "cpu.h"
+#include "time.h"
+#include "div64.h"
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE   (1 << 11)
+
+// Local APIC registers, offsets from the MMIO base
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define SVR_ENABLE          (1 << 8)
+#define LVT_MASKED          (1 << 16)
+#define LVT_TIMER_PERIODIC  (1 << 17)
+#define LVT_DM_NMI          0x400
+#define LVT_DM_EXTINT       0x700
+#define ICR_PENDING         (1 << 12)
+#define TIMER_DIVIDE_16     0x3
+
+#define LAPIC_CALIBRATE_MS  10
+
+static volatile uint32_t* lapic = (volatile uint32_t*)0xFEE00000;
+static uint32_t lapic_timer_initial = 0; // Timer count for one TIMER_HZ tick
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4]; // Wait for the write to complete
+}
+
+bool lapic_present(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    return (d >> 9) & 1;
+}
+
+void lapic_initialize(bool boot_cpu) {
+    uint64_t base = rdmsr(IA32_APIC_BASE_MSR);
+    wrmsr(IA32_APIC_BASE_MSR, base | APIC_BASE_ENABLE);
+    lapic = (volatile uint32_t*)((uint32_t)base & 0xFFFFF000);
+
+    lapic_write(LAPIC_SVR, SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+    if (boot_cpu) {
+        // Virtual wire mode: the PIC keeps interrupting through LINT0
+        lapic_write(LAPIC_LVT_LINT0, LVT_DM_EXTINT);
+        lapic_write(LAPIC_LVT_LINT1, LVT_DM_NMI);
+    } else {
+        lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LVT_MASKED);
+    }
+    lapic_eoi();
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic[LAPIC_EOI / 4] = 0;
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    uint32_t flags = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        cpu_relax();
+    }
+    irq_restore(flags);
+}
+
+// Count timer decrements over a known delay, the timer frequency is the
+// bus clock and the same on every CPU
+void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    mdelay(LAPIC_CALIBRATE_MS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    lapic_timer_initial = (uint32_t)div64_u32((uint64_t)elapsed * 1000, LAPIC_CALIBRATE_MS * TIMER_HZ);
+    printk("LAPIC timer: %u kHz\n", elapsed / LAPIC_CALIBRATE_MS);
+}
+
+void lapic_timer_start(void) {
+    if (!lapic_timer_initial) {
+        return;
+    }
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, lapic_timer_initial);
+}
@@ -0,0 +1,195 @@
+#include "basedos.h"
+#include "async.h"
+#include "softirq.h"
+#include "smp.h"
+#include "interrupts.h"
+#include "time.h"
+
+// Coroutine steps run per softirq invocation, the rest waits for the next
+// one so a flood of ready coroutines cannot starve tasks
+#define ASYNC_BUDGET 64
+
+// Per-CPU executor. Only its own CPU touches the queue, with interrupts
+// disabled, so it needs no lock.
+typedef struct {
+    coro_t* head;
+    coro_t* tail;
+    uint32_t queued;
+    uint32_t steps;        // Coroutine steps run
+    uint32_t started;
+    uint32_t finished;
+} __attribute__((aligned(64))) executor_t;
+
+static executor_t executors[NR_CPUS];
+
+// Append to this CPU's queue, interrupts must be disabled
+static void executor_enqueue(coro_t* co) {
+    executor_t* ex = &executors[smp_processor_id()];
+    co->next = NULL;
+    if (ex->tail) {
+        ex->tail->next = co;
+    } else {
+        ex->head = co;
+    }
+    ex->tail = co;
+    ex->queued++;
+    raise_softirq_irqoff(ASYNC_SOFTIRQ);
+}
+
+void coro_init(coro_t* co, int (*fn)(coro_t* co), void* data) {
+    co->next = NULL;
+    co->state = CORO_IDLE;
+    co->resume = 0;
+    co->fn = fn;
+    co->data = data;
+    co->release = NULL;
+    timer_setup(&co->timer, NULL, (uint32_t)co);
+}
+
+void coro_start(coro_t* co) {
+    uint32_t flags = irq_save();
+    co->state = CORO_READY;
+    co->resume = 0;
+    executors[smp_processor_id()].started++;
+    executor_enqueue(co);
+    irq_restore(flags);
+}
+
+void coro_wake(coro_t* co) {
+    while (1) {
+        uint32_t state = co->state;
+        if (state == CORO_WAITING) {
+            if (__sync_bool_compare_and_swap(&co->state, CORO_WAITING, CORO_READY)) {
+                uint32_t flags = irq_save();
+                executor_enqueue(co);
+                irq_restore(flags);
+                return;
+            }
+        } else if (state == CORO_RUNNING) {
+            // Still returning from the step that started the wait
+            if (__sync_bool_compare_and_swap(&co->state, CORO_RUNNING, CORO_WOKEN)) {
+                return;
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+static void coro_sleep_timeout(uint32_t data) {
+    coro_wake((coro_t*)data);
+}
+
+void coro_sleep_start(coro_t* co, uint32_t msecs) {
+    co->timer.func = coro_sleep_timeout;
+    co->timer.data = (uint32_t)co;
+    mod_timer(&co->timer, timer_ticks + msecs_to_ticks(msecs));
+}
+
+void async_event_init(async_event_t* event) {
+    spin_lock_init(&event->lock);
+    event->done = false;
+    event->waiters = NULL;
+}
+
+void async_event_reset(async_event_t* event) {
+    uint32_t flags = spin_lock_irqsave(&event->lock);
+    event->done = false;
+    spin_unlock_irqrestore(&event->lock, flags);
+}
+
+bool async_event_wait(async_event_t* event, coro_t* co) {
+    if (event->done) {
+        return true;
+    }
+    uint32_t flags = spin_lock_irqsave(&event->lock);
+    bool done = event->done;
+    if (!done) {
+        co->next = event->waiters;
+        event->waiters = co;
+    }
+    spin_unlock_irqrestore(&event->lock, flags);
+    return done;
+}
+
+void async_event_signal(async_event_t* event) {
+    uint32_t flags = spin_lock_irqsave(&event->lock);
+    event->done = true;
+    coro_t* list = event->waiters;
+    event->waiters = NULL;
+    spin_unlock_irqrestore(&event->lock, flags);
+
+    while (list) {
+        // coro_wake reuses the link, read it first
+        coro_t* co = list;
+        list = list->next;
+        coro_wake(co);
+    }
+}
+
+// Run ready coroutines of this CPU, softirq context with interrupts enabled
+static void async_softirq(void) {
+    executor_t* ex = &executors[smp_processor_id()];
+
+    for (int budget = ASYNC_BUDGET; budget > 0; budget--) {
+        disable_interrupts();
+        coro_t* co = ex->head;
+        if (!co) {
+            enable_interrupts();
+            return;
+        }
+        ex->head = co->next;
+        if (!ex->head) {
+            ex->tail = NULL;
+        }
+        ex->queued--;
+        ex->steps++;
+        co->next = NULL;
+        co->state = CORO_RUNNING;
+        enable_interrupts();
+
+        int ret = co->fn(co);
+
+        if (ret == CORO_RET_DONE) {
+            co->state = CORO_DONE;
+            ex->finished++;
+            if (co->release) {
+                co->release(co);
+            }
+            continue;
+        }
+
+        // A wakeup that raced with the return turned RUNNING into WOKEN
+        if (ret == CORO_RET_WAIT &&
+            __sync_bool_compare_and_swap(&co->state, CORO_RUNNING, CORO_WAITING)) {
+            continue;
+        }
+        disable_interrupts();
+        co->state = CORO_READY;
+        executor_enqueue(co);
+        enable_interrupts();
+    }
+
+    // Out of budget with work left, the pending bit brings us back
+    disable_interrupts();
+    if (ex->head) {
+        raise_softirq_irqoff(ASYNC_SOFTIRQ);
+    }
+    enable_interrupts();
+}
+
+void async_initialize(void) {
+    open_softirq(ASYNC_SOFTIRQ, async_softirq);
+}
+
+void async_show(void) {
+    printk("  CPU  QUEUED     STEPS   STARTED  FINISHED\n");
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu_online(cpu)) {
+            executor_t* ex = &executors[cpu];
+            printk("  %3u  %6u  %8u  %8u  %8u\n", cpu, ex->queued, ex->steps,
+                   ex->started, ex->finished);
+        }
+    }
+    printk("  Coroutine control block: %u bytes\n", (uint32_t)sizeof(coro_t));
+}
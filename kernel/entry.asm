@@ -1,6 +1,8 @@
 [bits 32]
 section .text
 extern kmain
+extern __bss_start
+extern __bss_end
 global _start
 
 _start:
@@ -16,6 +18,13 @@ _start:
     ; Clear direction flag
     cld
     
+    ; Zero .bss, the boot loader only loads the file image
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    xor eax, eax
+    rep stosb
+    
     ; Initialize FPU
     fninit
     
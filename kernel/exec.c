@@ -0,0 +1,244 @@
+#include "basedos.h"
+#include "exec.h"
+#include "elf.h"
+#include "paging.h"
+#include "memory.h"
+#include "string.h"
+#include "syscall.h"
+#include "sched.h"
+#include "cpu.h"
+#include "spinlock.h"
+
+#define EXEC_MAX_PHDRS 16
+#define EXEC_ARGS_MAX  PAGE_SIZE    // Bytes of argument strings
+
+// NULL when the header describes something we can run, else the reason
+static const char* exec_check_header(fs_node_t* node, Elf32_Ehdr* eh) {
+    if ((node->flags & 0x7) != FS_FILE) {
+        return "not a regular file";
+    }
+    if (vfs_read(node, 0, sizeof(*eh), (uint8_t*)eh) != sizeof(*eh) ||
+        eh->e_ident[0] != ELFMAG0 || eh->e_ident[1] != ELFMAG1 ||
+        eh->e_ident[2] != ELFMAG2 || eh->e_ident[3] != ELFMAG3) {
+        return "not an ELF file";
+    }
+    if (eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+        eh->e_machine != EM_386 || eh->e_version != EV_CURRENT) {
+        return "not an i386 ELF32 file";
+    }
+    if (eh->e_type != ET_EXEC) {
+        return "not an executable";
+    }
+    if (eh->e_phentsize != sizeof(Elf32_Phdr) || eh->e_phnum == 0 ||
+        eh->e_phnum > EXEC_MAX_PHDRS) {
+        return "bad program headers";
+    }
+    return NULL;
+}
+
+// Register each PT_LOAD segment as a region backed by the file. Nothing
+// is read yet: text and data come in page by page as the program touches
+// them, and bss is the zero-filled tail of its region. The heap begins
+// after the last one.
+static const char* exec_map_segments(mm_t* mm, fs_node_t* node, const Elf32_Ehdr* eh) {
+    Elf32_Phdr phdrs[EXEC_MAX_PHDRS];
+    uint32_t size = eh->e_phnum * sizeof(Elf32_Phdr);
+    if (vfs_read(node, eh->e_phoff, size, (uint8_t*)phdrs) != size) {
+        return "bad program headers";
+    }
+
+    uint32_t loaded = 0;
+    uint32_t end = 0;
+    for (uint32_t i = 0; i < eh->e_phnum; i++) {
+        const Elf32_Phdr* ph = &phdrs[i];
+        if (ph->p_type == PT_INTERP || ph->p_type == PT_DYNAMIC) {
+            return "dynamically linked";
+        }
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+            continue;
+        }
+        if (ph->p_filesz > ph->p_memsz || ph->p_filesz > node->length ||
+            ph->p_offset > node->length - ph->p_filesz) {
+            return "segment past the end of the file";
+        }
+        uint32_t flags = PTE_USER | ((ph->p_flags & PF_W) ? PTE_WRITE : 0);
+        if (mm_map_file(mm, ph->p_vaddr, ph->p_memsz, flags, node, ph->p_offset,
+                        ph->p_filesz) != 0) {
+            return "segment outside user space or overlapping";
+        }
+        if (ph->p_vaddr + ph->p_memsz > end) {
+            end = ph->p_vaddr + ph->p_memsz;
+        }
+        loaded++;
+    }
+    // The heap starts empty on the page after the last segment
+    mm->brk_start = mm->brk = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    return loaded ? NULL : "no loadable segments";
+}
+
+// Strings at the top of the stack, then argc, argv[] and an empty envp[]
+// with esp 16-byte aligned pointing at argc. Returns esp, 0 on failure.
+static uint32_t exec_setup_stack(mm_t* mm, int argc, char** argv) {
+    uint32_t vector[EXEC_MAX_ARGS + 3];
+    uint32_t sp = USER_STACK_TOP;
+
+    vector[0] = argc;
+    for (int i = argc - 1; i >= 0; i--) {
+        uint32_t len = strlen(argv[i]) + 1;
+        if (USER_STACK_TOP - sp + len > EXEC_ARGS_MAX) {
+            return 0;
+        }
+        sp -= len;
+        if (mm_write(mm, sp, argv[i], len) != 0) {
+            return 0;
+        }
+        vector[1 + i] = sp;
+    }
+    vector[1 + argc] = 0;       // argv terminator
+    vector[2 + argc] = 0;       // envp terminator
+
+    uint32_t size = (argc + 3) * sizeof(uint32_t);
+    sp = (sp - size) & ~15;
+    return mm_write(mm, sp, vector, size) == 0 ? sp : 0;
+}
+
+static const char* exec_load(mm_t* mm, fs_node_t* node, const Elf32_Ehdr* eh,
+                             int argc, char** argv, uint32_t* esp) {
+    // The stack first, so no segment can claim its range
+    if (mm_map_file(mm, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE,
+                    PTE_USER | PTE_WRITE, NULL, 0, 0) != 0) {
+        return "out of memory";
+    }
+    const char* err = exec_map_segments(mm, node, eh);
+    if (err) {
+        return err;
+    }
+    *esp = exec_setup_stack(mm, argc, argv);
+    return *esp ? NULL : "arguments too long or out of memory";
+}
+
+// Check and map the file into a new address space, NULL with a message
+// when it cannot be run
+static mm_t* exec_build(fs_node_t* node, int argc, char** argv, uint32_t* entry, uint32_t* esp) {
+    if (argc < 1 || argc > EXEC_MAX_ARGS) {
+        return NULL;
+    }
+
+    Elf32_Ehdr eh;
+    const char* err = exec_check_header(node, &eh);
+    if (err) {
+        printk("%s: %s\n", argv[0], err);
+        return NULL;
+    }
+
+    mm_t* mm = mm_create();
+    if (!mm) {
+        printk("%s: %s\n", argv[0], paging_enabled() ? "out of memory" : "no user mode without paging");
+        return NULL;
+    }
+
+    err = exec_load(mm, node, &eh, argc, argv, esp);
+    if (err) {
+        printk("%s: %s\n", argv[0], err);
+        mm_destroy(mm);
+        return NULL;
+    }
+    *entry = eh.e_entry;
+    return mm;
+}
+
+int exec_run(fs_node_t* node, int argc, char** argv, int* exit_code) {
+    uint32_t entry, esp;
+    mm_t* mm = exec_build(node, argc, argv, &entry, &esp);
+    if (!mm) {
+        return -1;
+    }
+    *exit_code = user_run(mm, entry, esp);
+    mm_destroy(mm);
+    return 0;
+}
+
+int exec_replace(fs_node_t* node, int argc, char** argv, interrupt_frame_t* frame) {
+    uint32_t entry, esp;
+    mm_t* mm = exec_build(node, argc, argv, &entry, &esp);
+    if (!mm) {
+        return -1;
+    }
+    mm_replace(current_task()->mm, mm);
+
+    // Start afresh: the system call returns to the entry point, eax 0
+    frame->edi = frame->esi = frame->ebp = frame->ebx = frame->edx = frame->ecx = 0;
+    frame->eip = entry;
+    frame->useresp = esp;
+    frame->eflags = EFLAGS_IF;
+    return 0;
+}
+
+// Programs built into the kernel, found by name before the file system
+static fs_node_t exec_images[EXEC_MAX_IMAGES];
+static uint32_t nr_exec_images;
+static spinlock_t exec_images_lock = SPINLOCK_INIT;
+
+static uint32_t exec_image_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    if (offset >= node->length) {
+        return 0;
+    }
+    if (size > node->length - offset) {
+        size = node->length - offset;
+    }
+    memcpy(buffer, (const uint8_t*)node->fs_specific + offset, size);
+    return size;
+}
+
+fs_node_t* exec_register_image(const char* name, const void* data, uint32_t size) {
+    fs_node_t* node = NULL;
+    uint32_t flags = spin_lock_irqsave(&exec_images_lock);
+    for (uint32_t i = 0; i < nr_exec_images; i++) {
+        if (strcmp(exec_images[i].name, name) == 0) {
+            node = &exec_images[i];
+        }
+    }
+    if (!node && nr_exec_images < EXEC_MAX_IMAGES) {
+        node = &exec_images[nr_exec_images++];
+    }
+    if (node) {
+        memset(node, 0, sizeof(*node));
+        strncpy(node->name, name, sizeof(node->name) - 1);
+        node->flags = FS_FILE;
+        node->length = size;
+        node->read = exec_image_read;
+        node->fs_specific = (void*)data;
+    }
+    spin_unlock_irqrestore(&exec_images_lock, flags);
+    return node;
+}
+
+// Linked into the image as raw ELF files by the Makefile
+extern char _binary_user_stdiobench_elf_start[], _binary_user_stdiobench_elf_end[];
+extern char _binary_user_futexbench_elf_start[], _binary_user_futexbench_elf_end[];
+extern char _binary_user_mallocbench_elf_start[], _binary_user_mallocbench_elf_end[];
+
+void exec_initialize(void) {
+    exec_register_image("stdiobench", _binary_user_stdiobench_elf_start,
+                        _binary_user_stdiobench_elf_end - _binary_user_stdiobench_elf_start);
+    exec_register_image("futexbench", _binary_user_futexbench_elf_start,
+                        _binary_user_futexbench_elf_end - _binary_user_futexbench_elf_start);
+    exec_register_image("mallocbench", _binary_user_mallocbench_elf_start,
+                        _binary_user_mallocbench_elf_end - _binary_user_mallocbench_elf_start);
+}
+
+fs_node_t* exec_find(const char* path) {
+    fs_node_t* node = NULL;
+    uint32_t flags = spin_lock_irqsave(&exec_images_lock);
+    for (uint32_t i = 0; i < nr_exec_images; i++) {
+        if (strcmp(exec_images[i].name, path) == 0) {
+            node = &exec_images[i];
+        }
+    }
+    spin_unlock_irqrestore(&exec_images_lock, flags);
+
+    if (node) {
+        return node;
+    }
+    return path[0] == '/' ? vfs_open(path, O_RDONLY) : vfs_finddir(fs_root, (char*)path);
+}
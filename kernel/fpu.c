@@ -0,0 +1,191 @@
+#include "basedos.h"
+#include "fpu.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "sched.h"
+#include "smp.h"
+#include "softirq.h"
+
+#define NM_VECTOR      7
+#define MXCSR_DEFAULT  0x1F80  // All SSE exceptions masked, round to nearest
+
+// CPUID leaf 1 EDX
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE  (1 << 25)
+#define CPUID_SSE2 (1 << 26)
+
+static bool has_fxsr;
+static bool has_sse;
+static bool has_sse2;
+
+// Register state a task starts from on its first FPU instruction
+static fpu_state_t fpu_init_state;
+
+static struct {
+    uint32_t traps;       // #NM traps that loaded a state
+    uint32_t saves;       // States saved at switch-out
+    uint32_t reuses;      // Switch-ins that found their registers still loaded
+} fpu_stats[NR_CPUS];
+
+static inline void fpu_save(fpu_state_t* state) {
+    if (has_fxsr) {
+        asm volatile("fxsave %0" : "=m"(*state));
+    } else {
+        // fnsave also reinitializes the FPU, the registers no longer hold the state
+        asm volatile("fnsave %0" : "=m"(*state));
+        this_cpu()->fpu_owner = NULL;
+    }
+}
+
+static inline void fpu_restore(fpu_state_t* state) {
+    if (has_fxsr) {
+        asm volatile("fxrstor %0" : : "m"(*state));
+    } else {
+        asm volatile("frstor %0" : : "m"(*state));
+    }
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// First FPU instruction of the current task since it was switched in
+static void fpu_nm_trap(interrupt_frame_t* frame) {
+    (void)frame;
+    if (in_interrupt()) {
+        kernel_panic("FPU used in interrupt context");
+    }
+    clts();
+
+    task_t* cur = current_task();
+    cpu_t* cpu = this_cpu();
+    if (!cur || (cpu->fpu_owner == cur && cur->fpu_cpu == cpu->id)) {
+        return;
+    }
+
+    fpu_restore(cur->fpu_used ? &cur->fpu : &fpu_init_state);
+    cur->fpu_used = true;
+    cur->fpu_cpu = cpu->id;
+    cpu->fpu_owner = cur;
+    fpu_stats[cpu->id].traps++;
+}
+
+// TS is only ever clear while the running task owns the registers, so a
+// clear TS means prev used the FPU during this time slice
+void fpu_switch(task_t* prev, task_t* next) {
+    cpu_t* cpu = this_cpu();
+    uint32_t cr0 = read_cr0();
+
+    if (!(cr0 & CR0_TS)) {
+        fpu_save(&prev->fpu);
+        fpu_stats[cpu->id].saves++;
+    }
+
+    if (next == cpu->fpu_owner && next->fpu_cpu == cpu->id) {
+        if (cr0 & CR0_TS) {
+            clts();
+        }
+        fpu_stats[cpu->id].reuses++;
+    } else if (!(cr0 & CR0_TS)) {
+        write_cr0(cr0 | CR0_TS);
+    }
+}
+
+void fpu_fork(task_t* child) {
+    uint32_t flags = irq_save();
+    task_t* cur = current_task();
+    if (!(read_cr0() & CR0_TS)) {
+        fpu_save(&cur->fpu);
+        if (!has_fxsr) {
+            // fnsave reset the registers, put the state back
+            fpu_restore(&cur->fpu);
+            this_cpu()->fpu_owner = cur;
+        }
+    }
+    child->fpu = cur->fpu;
+    child->fpu_used = cur->fpu_used;
+    irq_restore(flags);
+}
+
+void kernel_fpu_begin(void) {
+    if (in_interrupt()) {
+        kernel_panic("kernel_fpu_begin in interrupt context");
+    }
+    preempt_disable();
+
+    uint32_t flags = irq_save();
+    if (!(read_cr0() & CR0_TS)) {
+        // The current task's live state is in the registers
+        fpu_save(&current_task()->fpu);
+    }
+    // The kernel section clobbers the registers, whoever uses the FPU next reloads
+    this_cpu()->fpu_owner = NULL;
+    clts();
+    irq_restore(flags);
+}
+
+void kernel_fpu_end(void) {
+    stts();
+    preempt_enable();
+}
+
+void fpu_initialize(bool boot_cpu) {
+    if (boot_cpu) {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        has_fxsr = (edx & CPUID_FXSR) != 0;
+        has_sse = has_fxsr && (edx & CPUID_SSE);
+        has_sse2 = has_sse && (edx & CPUID_SSE2);
+    }
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if (has_fxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (has_sse) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    asm volatile("fninit");
+    if (has_sse) {
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+
+    if (boot_cpu) {
+        fpu_save(&fpu_init_state);
+        if (!has_fxsr) {
+            fpu_restore(&fpu_init_state);
+        }
+        exception_install_handler(NM_VECTOR, fpu_nm_trap);
+    }
+
+    // Nobody owns the registers yet, the first user traps
+    this_cpu()->fpu_owner = NULL;
+    stts();
+}
+
+bool fpu_has_fxsr(void) {
+    return has_fxsr;
+}
+
+bool fpu_has_sse(void) {
+    return has_sse;
+}
+
+bool fpu_has_sse2(void) {
+    return has_sse2;
+}
+
+void fpu_show(void) {
+    printk("FPU: x87%s%s%s, lazy switching\n", has_fxsr ? " fxsr" : "",
+           has_sse ? " sse" : "", has_sse2 ? " sse2" : "");
+    printk("  CPU     TRAPS     SAVES    REUSES\n");
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu_online(cpu)) {
+            printk("  %3u  %8u  %8u  %8u\n", cpu, fpu_stats[cpu].traps,
+                   fpu_stats[cpu].saves, fpu_stats[cpu].reuses);
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#include "futex.h"
+#include "paging.h"
+#include "sched.h"
+#include "spinlock.h"
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+// A sleeping task, on its own stack
+typedef struct futex_q {
+    uint32_t key;                  // Physical address of the word
+    task_t* task;
+    volatile bool woken;           // Set by the waker, for FUTEX_LOCK with the lock
+    struct futex_q* next;
+} futex_q_t;
+
+// Waiters in arrival order. The lock also orders the value check of a
+// waiter against the wakeup that follows a change of the value.
+typedef struct {
+    spinlock_t lock;
+    futex_q_t* head;
+    futex_q_t* tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_table[FUTEX_HASH_SIZE];
+
+// Physical address of the word at uaddr, 0 for a bad address. The page
+// is made present and writable first, so a copy-on-write page is already
+// this address space's own copy and the key does not change under it.
+static uint32_t futex_key(uint32_t uaddr) {
+    if ((uaddr & 3) || !user_access_ok((const void*)uaddr, sizeof(uint32_t), true)) {
+        return 0;
+    }
+    return mm_translate(current_task()->mm, uaddr);
+}
+
+static futex_bucket_t* futex_bucket(uint32_t key) {
+    return &futex_table[((key >> 2) * 0x9E3779B1) >> (32 - FUTEX_HASH_BITS)];
+}
+
+// The word through the identity mapping of its frame
+static volatile uint32_t* futex_word(uint32_t key) {
+    return (volatile uint32_t*)key;
+}
+
+// Bucket locked
+static void futex_enqueue(futex_bucket_t* bucket, futex_q_t* q) {
+    q->next = NULL;
+    if (bucket->tail) {
+        bucket->tail->next = q;
+    } else {
+        bucket->head = q;
+    }
+    bucket->tail = q;
+}
+
+// Dequeue and wake up to count waiters on key, bucket locked
+static uint32_t futex_wake_locked(futex_bucket_t* bucket, uint32_t key, uint32_t count) {
+    uint32_t woken = 0;
+    futex_q_t* prev = NULL;
+    futex_q_t* q = bucket->head;
+    while (q && woken < count) {
+        futex_q_t* next = q->next;
+        if (q->key != key) {
+            prev = q;
+            q = next;
+            continue;
+        }
+        if (prev) {
+            prev->next = next;
+        } else {
+            bucket->head = next;
+        }
+        if (bucket->tail == q) {
+            bucket->tail = prev;
+        }
+        task_t* task = q->task;
+        q->woken = true;
+        wake_up_task(task);
+        woken++;
+        q = next;
+    }
+    return woken;
+}
+
+// Queue q, then sleep until a waker dequeued it. Called with the bucket
+// locked, returns with it unlocked.
+static void futex_sleep(futex_bucket_t* bucket, futex_q_t* q, uint32_t flags) {
+    futex_enqueue(bucket, q);
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    while (1) {
+        set_current_state(TASK_BLOCKED);
+        if (q->woken) {
+            break;
+        }
+        schedule();
+    }
+    set_current_state(TASK_RUNNING);
+
+    // The waker is done with q once it let go of the bucket
+    flags = spin_lock_irqsave(&bucket->lock);
+    spin_unlock_irqrestore(&bucket->lock, flags);
+}
+
+int32_t futex_wait(uint32_t uaddr, uint32_t val) {
+    uint32_t key = futex_key(uaddr);
+    if (!key) {
+        return -1;
+    }
+    futex_bucket_t* bucket = futex_bucket(key);
+    futex_q_t q = { key, current_task(), false, NULL };
+
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    if (*futex_word(key) != val) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return -1;
+    }
+    futex_sleep(bucket, &q, flags);
+    return 0;
+}
+
+int32_t futex_wake(uint32_t uaddr, uint32_t count) {
+    uint32_t key = futex_key(uaddr);
+    if (!key) {
+        return -1;
+    }
+    futex_bucket_t* bucket = futex_bucket(key);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    uint32_t woken = futex_wake_locked(bucket, key, count);
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return woken;
+}
+
+int32_t futex_lock(uint32_t uaddr) {
+    uint32_t key = futex_key(uaddr);
+    if (!key) {
+        return -1;
+    }
+    futex_bucket_t* bucket = futex_bucket(key);
+    futex_q_t q = { key, current_task(), false, NULL };
+
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    if (*futex_word(key) == 0) {
+        *futex_word(key) = 1;
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return 0;
+    }
+    // futex_unlock() hands the lock over with the wakeup
+    futex_sleep(bucket, &q, flags);
+    return 0;
+}
+
+int32_t futex_unlock(uint32_t uaddr) {
+    uint32_t key = futex_key(uaddr);
+    if (!key) {
+        return -1;
+    }
+    futex_bucket_t* bucket = futex_bucket(key);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    if (futex_wake_locked(bucket, key, 1) == 0) {
+        *futex_word(key) = 0;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return 0;
+}
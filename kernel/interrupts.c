@@ -1,4 +1,16 @@
 #include "basedos.h"
+#include "string.h"
+#include "softirq.h"
+#include "cpu.h"
+#include "div64.h"
+#include "smp.h"
+#include "latency.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "fs/poll.h"
+#include "apic.h"
+#include "syscall.h"
 
 // Simple IDT entry structure
 struct idt_entry {
@@ -19,7 +31,53 @@ struct idt_ptr {
 static struct idt_entry idt[256];
 static struct idt_ptr idtp;
 static char key_buffer[256];
-static int key_buffer_pos = 0;
+static uint64_t key_stamp[256];               // TSC at IRQ1 entry for each key
+static volatile uint32_t key_buffer_head = 0; // Next slot written by the keyboard tasklet
+static volatile uint32_t key_buffer_tail = 0; // Next slot read by keyboard_getchar
+static spinlock_t key_lock = SPINLOCK_INIT;   // Key buffer, the reader may be on another CPU
+static DECLARE_WAIT_QUEUE_HEAD(keyboard_wait); // Tasks sleeping in keyboard_getchar
+
+// Raw scancodes queued by IRQ1 for the keyboard tasklet
+#define SCANCODE_QUEUE_SIZE 32
+static uint8_t scancode_queue[SCANCODE_QUEUE_SIZE];
+static uint64_t scancode_stamp[SCANCODE_QUEUE_SIZE];
+static volatile uint32_t scancode_head = 0;
+static volatile uint32_t scancode_tail = 0;
+
+// C handlers for hardware IRQ lines and the current PIC masks
+static irq_handler_t irq_handlers[NR_IRQS];
+static irq_handler_t local_handlers[NR_LOCAL_VECTORS]; // Local APIC timer and IPIs
+static uint16_t irq_masks = 0xFFFF;
+
+// Per-vector interrupt cost statistics, collected while irqstat is enabled
+#define IRQSTAT_BUCKETS 32
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_cycles;                   // Handler duration, summed
+    uint64_t max_cycles;
+    uint64_t irqs_off_cycles;                // Time with interrupts disabled, summed
+    uint32_t duration_hist[IRQSTAT_BUCKETS]; // log2(cycles) buckets, the last open-ended
+    uint32_t irqs_off_hist[IRQSTAT_BUCKETS];
+} irq_vector_stat_t;
+
+// PIC lines first, then the local APIC timer and IPIs
+#define NR_IRQ_STATS (NR_IRQS + NR_LOCAL_VECTORS)
+
+static irq_vector_stat_t irq_stats[NR_IRQ_STATS];
+static volatile bool irqstat_enabled = false;
+
+// Entry timestamp and irq_stats slot of the interrupt whose irqs-off
+// window is open
+static struct {
+    uint64_t irqs_off_start;
+    uint32_t irq;
+} irqstat_cpu[NR_CPUS];
+
+static const char* const local_vector_names[NR_LOCAL_VECTORS] = {
+    [LAPIC_TIMER_VECTOR - LOCAL_VECTOR_BASE] = "timer",
+    [RESCHEDULE_VECTOR - LOCAL_VECTOR_BASE] = "resched",
+};
 
 // Scancode to ASCII mapping (simplified)
 static const char scancode_to_ascii[] = {
@@ -33,17 +91,74 @@ static const char scancode_to_ascii[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
-// Forward declaration for keyboard handler
-void keyboard_handler(void);
+// Entry stubs for the hardware IRQs, defined in assembly below
+extern void irq_stub_0(void), irq_stub_1(void), irq_stub_2(void), irq_stub_3(void);
+extern void irq_stub_4(void), irq_stub_5(void), irq_stub_6(void), irq_stub_7(void);
+extern void irq_stub_8(void), irq_stub_9(void), irq_stub_10(void), irq_stub_11(void);
+extern void irq_stub_12(void), irq_stub_13(void), irq_stub_14(void), irq_stub_15(void);
+
+static interrupt_handler_t irq_stubs[NR_IRQS] = {
+    irq_stub_0, irq_stub_1, irq_stub_2, irq_stub_3,
+    irq_stub_4, irq_stub_5, irq_stub_6, irq_stub_7,
+    irq_stub_8, irq_stub_9, irq_stub_10, irq_stub_11,
+    irq_stub_12, irq_stub_13, irq_stub_14, irq_stub_15
+};
+
+extern void local_stub_0(void), local_stub_1(void), spurious_stub(void), syscall_stub(void);
+
+static interrupt_handler_t local_stubs[NR_LOCAL_VECTORS] = {
+    local_stub_0, local_stub_1
+};
+
+extern void exc_stub_0(void), exc_stub_1(void), exc_stub_2(void), exc_stub_3(void);
+extern void exc_stub_4(void), exc_stub_5(void), exc_stub_6(void), exc_stub_7(void);
+extern void exc_stub_8(void), exc_stub_9(void), exc_stub_10(void), exc_stub_11(void);
+extern void exc_stub_12(void), exc_stub_13(void), exc_stub_14(void), exc_stub_15(void);
+extern void exc_stub_16(void), exc_stub_17(void), exc_stub_18(void), exc_stub_19(void);
+extern void exc_stub_20(void), exc_stub_21(void), exc_stub_22(void), exc_stub_23(void);
+extern void exc_stub_24(void), exc_stub_25(void), exc_stub_26(void), exc_stub_27(void);
+extern void exc_stub_28(void), exc_stub_29(void), exc_stub_30(void), exc_stub_31(void);
+
+static interrupt_handler_t exc_stubs[NR_EXCEPTIONS] = {
+    exc_stub_0, exc_stub_1, exc_stub_2, exc_stub_3,
+    exc_stub_4, exc_stub_5, exc_stub_6, exc_stub_7,
+    exc_stub_8, exc_stub_9, exc_stub_10, exc_stub_11,
+    exc_stub_12, exc_stub_13, exc_stub_14, exc_stub_15,
+    exc_stub_16, exc_stub_17, exc_stub_18, exc_stub_19,
+    exc_stub_20, exc_stub_21, exc_stub_22, exc_stub_23,
+    exc_stub_24, exc_stub_25, exc_stub_26, exc_stub_27,
+    exc_stub_28, exc_stub_29, exc_stub_30, exc_stub_31
+};
+
+static irq_handler_t exception_handlers[NR_EXCEPTIONS];
+
+static const char* exception_names[NR_EXCEPTIONS] = {
+    "divide error", "debug", "NMI", "breakpoint", "overflow", "bound range",
+    "invalid opcode", "device not available", "double fault", "coprocessor overrun",
+    "invalid TSS", "segment not present", "stack fault", "general protection",
+    "page fault", "reserved", "x87 error", "alignment check", "machine check",
+    "SIMD error", "virtualization", "control protection"
+};
+
+static void keyboard_irq(interrupt_frame_t* frame);
+static void keyboard_tasklet_func(uint32_t data);
+static DECLARE_TASKLET(keyboard_tasklet, keyboard_tasklet_func, 0);
+
+static void pic_write_masks(void) {
+    outb(0x21, irq_masks & 0xFF);
+    outb(0xA1, (irq_masks >> 8) & 0xFF);
+}
 
 void init_interrupts(void) {
-    // Set up IDT for IRQ1 (keyboard, interrupt 0x21)
-    uint32_t handler_addr = (uint32_t)&keyboard_handler;
-    idt[0x21].base_lo = handler_addr & 0xFFFF;
-    idt[0x21].base_hi = (handler_addr >> 16) & 0xFFFF;
-    idt[0x21].sel = 0x08; // Code segment from bootloader
-    idt[0x21].always0 = 0;
-    idt[0x21].flags = 0x8E; // Present, ring 0, interrupt gate
+    // CPU exceptions, unhandled ones panic instead of triple faulting
+    for (int i = 0; i < NR_EXCEPTIONS; i++) {
+        register_interrupt_handler(i, exc_stubs[i]);
+    }
+
+    // Route all hardware IRQs through the common entry stub
+    for (int i = 0; i < NR_IRQS; i++) {
+        register_interrupt_handler(IRQ_BASE + i, irq_stubs[i]);
+    }
 
     // Remap PIC to avoid conflicts
     outb(0x20, 0x11); // ICW1: Initialize master PIC
@@ -54,12 +169,30 @@ void init_interrupts(void) {
     outb(0xA1, 0x02); // Slave ID
     outb(0x21, 0x01); // ICW4: 8086 mode
     outb(0xA1, 0x01);
-    outb(0x21, 0xFD); // Mask all except IRQ1 (keyboard)
-    outb(0xA1, 0xFF); // Mask all slave IRQs
+    irq_masks = 0xFFFF & ~(1 << 2); // Mask everything except the cascade
+    pic_write_masks();
+
+    // Local APIC vectors, delivered to each CPU separately
+    for (int i = 0; i < NR_LOCAL_VECTORS; i++) {
+        register_interrupt_handler(LOCAL_VECTOR_BASE + i, local_stubs[i]);
+    }
+    register_interrupt_handler(SPURIOUS_VECTOR, spurious_stub);
+
+    // System calls, the only gate user mode may use
+    register_interrupt_handler(SYSCALL_VECTOR, syscall_stub);
+    idt[SYSCALL_VECTOR].flags = 0xEE; // Present, ring 3, interrupt gate
+
+    // Keyboard on IRQ1
+    irq_install_handler(1, keyboard_irq);
 
     // Load IDT
     idtp.limit = sizeof(idt) - 1;
     idtp.base = (uint32_t)&idt;
+    idt_load();
+}
+
+// Load the shared IDT on the calling CPU
+void idt_load(void) {
     asm volatile("lidt %0" : : "m"(idtp));
 }
 
@@ -71,50 +204,342 @@ void disable_interrupts(void) {
     asm volatile("cli");
 }
 
+static bool key_available(void) {
+    return key_buffer_tail != key_buffer_head;
+}
+
+bool keyboard_haschar(void) {
+    return key_available();
+}
+
+bool keyboard_poll(struct poll_table* pt) {
+    poll_wait(pt, &keyboard_wait);
+    return key_available();
+}
+
 char keyboard_getchar(void) {
-    while (key_buffer_pos == 0) {
-        asm volatile("hlt");
+    while (1) {
+        if (sched_can_block()) {
+            wait_event(keyboard_wait, key_available());
+        } else {
+            // No task to put to sleep yet, poll
+            while (!key_available()) {
+                do_softirq();
+                asm volatile("hlt");
+            }
+        }
+
+        // Another reader may have taken the key first
+        uint32_t flags = spin_lock_irqsave(&key_lock);
+        if (key_available()) {
+            uint32_t slot = key_buffer_tail % sizeof(key_buffer);
+            char c = key_buffer[slot];
+            uint64_t stamp = key_stamp[slot];
+            key_buffer_tail++;
+            spin_unlock_irqrestore(&key_lock, flags);
+
+            input_latency_key_consumed(stamp);
+            return c;
+        }
+        spin_unlock_irqrestore(&key_lock, flags);
+    }
+}
+
+// Keyboard IRQ: grab the scancode and leave translation to the tasklet
+static void keyboard_irq(interrupt_frame_t* frame) {
+    (void)frame;
+    uint64_t stamp = rdtsc();
+    uint8_t scancode = inb(0x60);
+    if (scancode_head - scancode_tail < SCANCODE_QUEUE_SIZE) {
+        scancode_queue[scancode_head % SCANCODE_QUEUE_SIZE] = scancode;
+        scancode_stamp[scancode_head % SCANCODE_QUEUE_SIZE] = stamp;
+        scancode_head++;
+    }
+    tasklet_schedule(&keyboard_tasklet);
+}
+
+// Translate queued scancodes into the key buffer, runs with interrupts enabled
+static void keyboard_tasklet_func(uint32_t data) {
+    (void)data;
+    while (scancode_tail != scancode_head) {
+        uint8_t scancode = scancode_queue[scancode_tail % SCANCODE_QUEUE_SIZE];
+        uint64_t stamp = scancode_stamp[scancode_tail % SCANCODE_QUEUE_SIZE];
+        scancode_tail++;
+
+        // Ignore break codes (bit 7 set)
+        if (scancode & 0x80) {
+            continue;
+        }
+
+        // Convert to ASCII if valid
+        if (scancode < sizeof(scancode_to_ascii)) {
+            char ascii = scancode_to_ascii[scancode];
+            uint32_t flags = spin_lock_irqsave(&key_lock);
+            if (ascii != 0 && key_buffer_head - key_buffer_tail < sizeof(key_buffer)) {
+                key_buffer[key_buffer_head % sizeof(key_buffer)] = ascii;
+                key_stamp[key_buffer_head % sizeof(key_buffer)] = stamp;
+                key_buffer_head++;
+            }
+            spin_unlock_irqrestore(&key_lock, flags);
+        }
     }
-    char c = key_buffer[0];
-    for (int i = 0; i < key_buffer_pos - 1; i++) {
-        key_buffer[i] = key_buffer[i + 1];
+
+    // Interactive wakeup: the reader runs ahead of CPU-bound tasks
+    if (key_available()) {
+        wake_up_interactive(&keyboard_wait);
     }
-    key_buffer_pos--;
-    return c;
 }
 
-// Keyboard interrupt handler in C
-void keyboard_handler_internal(void) {
-    // Send EOI to PIC
+static void pic_send_eoi(uint32_t irq) {
+    if (irq >= 8) {
+        outb(0xA0, 0x20);
+    }
     outb(0x20, 0x20);
-    
-    // Read scancode
-    uint8_t scancode = inb(0x60);
-    
-    // Ignore break codes (bit 7 set)
-    if (scancode & 0x80) {
+}
+
+// Histogram bucket for an interval. 2^32 cycles and longer, or a TSC
+// that went backwards, all land in the last one.
+static uint32_t irqstat_bucket(uint64_t cycles) {
+    uint32_t b = ilog2_u64(cycles);
+    return b < IRQSTAT_BUCKETS ? b : IRQSTAT_BUCKETS - 1;
+}
+
+static void irqstat_record_irqs_off(uint32_t irq, uint64_t cycles) {
+    irq_vector_stat_t* st = &irq_stats[irq];
+    st->irqs_off_cycles += cycles;
+    st->irqs_off_hist[irqstat_bucket(cycles)]++;
+}
+
+// Close the irqs-off window of the current interrupt, called right before
+// softirq processing re-enables interrupts on the way out of an IRQ
+void irqstat_irqs_on(void) {
+    uint32_t cpu = smp_processor_id();
+    if (irqstat_cpu[cpu].irqs_off_start) {
+        irqstat_record_irqs_off(irqstat_cpu[cpu].irq, rdtsc() - irqstat_cpu[cpu].irqs_off_start);
+        irqstat_cpu[cpu].irqs_off_start = 0;
+    }
+}
+
+// Exceptions run in the context of whatever they interrupted
+static void exception_dispatch(interrupt_frame_t* frame) {
+    uint32_t vector = frame->int_no;
+    if (exception_handlers[vector]) {
+        exception_handlers[vector](frame);
+        return;
+    }
+
+    const char* name = vector < sizeof(exception_names) / sizeof(exception_names[0]) ?
+                       exception_names[vector] : "reserved";
+    // A user program only hurts itself
+    if (frame->cs & 3) {
+        user_fault(frame, name);
+    }
+    printk("\nException %u (%s) on CPU %u at %x, error code %x\n", vector, name,
+           smp_processor_id(), frame->eip, frame->err_code);
+    kernel_panic("Unhandled CPU exception");
+}
+
+// Local APIC interrupts are acknowledged at the local APIC, PIC lines
+// at the PIC
+static void irq_ack(uint32_t stat) {
+    if (stat >= NR_IRQS) {
+        lapic_eoi();
+    } else {
+        pic_send_eoi(stat);
+    }
+}
+
+// Run a hardware interrupt's handler and acknowledge it, timing it while
+// irqstat is on. stat is its slot in irq_stats.
+static void irq_handle(interrupt_frame_t* frame, irq_handler_t handler, uint32_t stat) {
+    if (!irqstat_enabled) {
+        irq_enter();
+        if (handler) {
+            handler(frame);
+        }
+        irq_ack(stat);
+        irq_exit();
+        preempt_schedule_irq();
+        return;
+    }
+
+    uint32_t cpu = smp_processor_id();
+    uint64_t start = rdtsc();
+
+    // A nested IRQ closes the window of the one it interrupted
+    if (irqstat_cpu[cpu].irqs_off_start) {
+        irqstat_irqs_on();
+    }
+
+    irq_enter();
+    if (handler) {
+        handler(frame);
+    }
+    irq_ack(stat);
+
+    uint64_t cycles = rdtsc() - start;
+    irq_vector_stat_t* st = &irq_stats[stat];
+    st->count++;
+    st->total_cycles += cycles;
+    if (cycles > st->max_cycles) {
+        st->max_cycles = cycles;
+    }
+    st->duration_hist[irqstat_bucket(cycles)]++;
+
+    irqstat_cpu[cpu].irqs_off_start = start;
+    irqstat_cpu[cpu].irq = stat;
+    irq_exit();
+
+    // No softirqs ran, interrupts stay off until iret
+    irqstat_irqs_on();
+    preempt_schedule_irq();
+}
+
+// Common C entry point for hardware IRQs and exceptions
+void interrupt_dispatch(interrupt_frame_t* frame) {
+    if (frame->int_no < NR_EXCEPTIONS) {
+        exception_dispatch(frame);
+        return;
+    }
+    if (frame->int_no == SYSCALL_VECTOR) {
+        syscall_interrupt(frame);
         return;
     }
-    
-    // Convert to ASCII if valid
-    if (scancode < sizeof(scancode_to_ascii)) {
-        char ascii = scancode_to_ascii[scancode];
-        if (ascii != 0 && key_buffer_pos < (int)(sizeof(key_buffer) - 1)) {
-            key_buffer[key_buffer_pos++] = ascii;
+    if (frame->int_no >= LOCAL_VECTOR_BASE) {
+        uint32_t n = frame->int_no - LOCAL_VECTOR_BASE;
+        if (n < NR_LOCAL_VECTORS) {
+            irq_handle(frame, local_handlers[n], NR_IRQS + n);
+        } else {
+            lapic_eoi();
         }
+        return;
+    }
+
+    uint32_t irq = frame->int_no - IRQ_BASE;
+    if (irq < NR_IRQS) {
+        irq_handle(frame, irq_handlers[irq], irq);
     }
 }
 
-// Assembly wrapper for the keyboard handler
+// Assembly entry stubs: save registers, load the kernel data and per-CPU
+// segments and hand a pointer to the saved frame to interrupt_dispatch
+#define IRQ_STUB(n) \
+    ".global irq_stub_" #n "\n" \
+    "irq_stub_" #n ":\n" \
+    "    pushl $0\n" \
+    "    pushl $(0x20 + " #n ")\n" \
+    "    jmp irq_common_stub\n"
+
+// The CPU pushes an error code for some exceptions, the others get a 0
+#define EXC_STUB(n) \
+    ".global exc_stub_" #n "\n" \
+    "exc_stub_" #n ":\n" \
+    "    pushl $0\n" \
+    "    pushl $" #n "\n" \
+    "    jmp irq_common_stub\n"
+
+#define EXC_STUB_ERR(n) \
+    ".global exc_stub_" #n "\n" \
+    "exc_stub_" #n ":\n" \
+    "    pushl $" #n "\n" \
+    "    jmp irq_common_stub\n"
+
+#define LOCAL_STUB(n) \
+    ".global local_stub_" #n "\n" \
+    "local_stub_" #n ":\n" \
+    "    pushl $0\n" \
+    "    pushl $(0x40 + " #n ")\n" \
+    "    jmp irq_common_stub\n"
+
 asm (
-    ".global keyboard_handler\n"
-    "keyboard_handler:\n"
+    IRQ_STUB(0) IRQ_STUB(1) IRQ_STUB(2) IRQ_STUB(3)
+    IRQ_STUB(4) IRQ_STUB(5) IRQ_STUB(6) IRQ_STUB(7)
+    IRQ_STUB(8) IRQ_STUB(9) IRQ_STUB(10) IRQ_STUB(11)
+    IRQ_STUB(12) IRQ_STUB(13) IRQ_STUB(14) IRQ_STUB(15)
+    LOCAL_STUB(0) LOCAL_STUB(1)
+    EXC_STUB(0) EXC_STUB(1) EXC_STUB(2) EXC_STUB(3)
+    EXC_STUB(4) EXC_STUB(5) EXC_STUB(6) EXC_STUB(7)
+    EXC_STUB_ERR(8) EXC_STUB(9) EXC_STUB_ERR(10) EXC_STUB_ERR(11)
+    EXC_STUB_ERR(12) EXC_STUB_ERR(13) EXC_STUB_ERR(14) EXC_STUB(15)
+    EXC_STUB(16) EXC_STUB_ERR(17) EXC_STUB(18) EXC_STUB(19)
+    EXC_STUB(20) EXC_STUB_ERR(21) EXC_STUB(22) EXC_STUB(23)
+    EXC_STUB(24) EXC_STUB(25) EXC_STUB(26) EXC_STUB(27)
+    EXC_STUB(28) EXC_STUB_ERR(29) EXC_STUB_ERR(30) EXC_STUB(31)
+    // Spurious local APIC interrupts must not be acknowledged
+    ".global spurious_stub\n"
+    "spurious_stub:\n"
+    "    iret\n"
+    ".global syscall_stub\n"
+    "syscall_stub:\n"
+    "    pushl $0\n"
+    "    pushl $0x80\n"
+    "    jmp irq_common_stub\n"
+    "irq_common_stub:\n"
     "    pusha\n"
-    "    call keyboard_handler_internal\n"
+    "    push %ds\n"
+    "    push %es\n"
+    "    push %fs\n"
+    "    push %gs\n"
+    "    mov $0x10, %ax\n"
+    "    mov %ax, %ds\n"
+    "    mov %ax, %es\n"
+    "    mov $0x30, %ax\n"
+    "    mov %ax, %fs\n"
+    "    cld\n"
+    "    push %esp\n"
+    "    call interrupt_dispatch\n"
+    "    add $4, %esp\n"
+    "    pop %gs\n"
+    "    pop %fs\n"
+    "    pop %es\n"
+    "    pop %ds\n"
     "    popa\n"
+    "    add $8, %esp\n"
     "    iret\n"
 );
 
+void irq_mask(uint8_t irq) {
+    uint32_t flags = irq_save();
+    irq_masks |= (1 << irq);
+    pic_write_masks();
+    irq_restore(flags);
+}
+
+void irq_unmask(uint8_t irq) {
+    uint32_t flags = irq_save();
+    irq_masks &= ~(1 << irq);
+    pic_write_masks();
+    irq_restore(flags);
+}
+
+// Install a C handler for a hardware IRQ and unmask the line
+void irq_install_handler(uint8_t irq, irq_handler_t handler) {
+    if (irq >= NR_IRQS) {
+        return;
+    }
+    irq_handlers[irq] = handler;
+    if (handler) {
+        irq_unmask(irq);
+    } else {
+        irq_mask(irq);
+    }
+}
+
+// Install a C handler for a CPU exception, shared by all CPUs
+void exception_install_handler(uint8_t vector, irq_handler_t handler) {
+    if (vector < NR_EXCEPTIONS) {
+        exception_handlers[vector] = handler;
+    }
+}
+
+// Install a C handler for a local APIC vector, shared by all CPUs
+void local_irq_install_handler(uint8_t vector, irq_handler_t handler) {
+    if (vector < LOCAL_VECTOR_BASE || vector >= LOCAL_VECTOR_BASE + NR_LOCAL_VECTORS) {
+        return;
+    }
+    local_handlers[vector - LOCAL_VECTOR_BASE] = handler;
+}
+
 // Register an interrupt handler
 void register_interrupt_handler(uint8_t n, void (*handler)(void)) {
     uint32_t handler_addr = (uint32_t)handler;
@@ -123,4 +548,65 @@ void register_interrupt_handler(uint8_t n, void (*handler)(void)) {
     idt[n].sel = 0x08; // Kernel code segment
     idt[n].always0 = 0;
     idt[n].flags = 0x8E; // Present, ring 0, interrupt gate
-}
\ No newline at end of file
+}
+
+// Interrupt statistics
+
+void irqstat_enable(bool enable) {
+    irqstat_enabled = enable;
+}
+
+bool irqstat_is_enabled(void) {
+    return irqstat_enabled;
+}
+
+void irqstat_reset(void) {
+    uint32_t flags = irq_save();
+    memset(irq_stats, 0, sizeof(irq_stats));
+    memset(irqstat_cpu, 0, sizeof(irqstat_cpu));
+    irq_restore(flags);
+}
+
+static void irqstat_show_hist(const char* label, const uint32_t* hist) {
+    printk("    %s", label);
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        if (hist[b]) {
+            printk(" 2^%d%s:%u", b, b == IRQSTAT_BUCKETS - 1 ? "+" : "", hist[b]);
+        }
+    }
+    printk("\n");
+}
+
+void irqstat_show(void) {
+    irq_vector_stat_t snapshot;
+    bool any = false;
+
+    printk("IRQ statistics (%s), cycles:\n", irqstat_enabled ? "on" : "off");
+    printk("  vec  irq      count      avg      max   avg-irqoff\n");
+    for (int irq = 0; irq < NR_IRQ_STATS; irq++) {
+        uint32_t flags = irq_save();
+        memcpy(&snapshot, &irq_stats[irq], sizeof(snapshot));
+        irq_restore(flags);
+
+        if (snapshot.count == 0) {
+            continue;
+        }
+        any = true;
+
+        if (irq < NR_IRQS) {
+            printk("  0x%x  %d", IRQ_BASE + irq, irq);
+        } else {
+            printk("  0x%x  %s", LOCAL_VECTOR_BASE + irq - NR_IRQS, local_vector_names[irq - NR_IRQS]);
+        }
+        printk("  %u  %llu  %llu  %llu\n", snapshot.count,
+               div64_u32(snapshot.total_cycles, snapshot.count),
+               snapshot.max_cycles,
+               div64_u32(snapshot.irqs_off_cycles, snapshot.count));
+        irqstat_show_hist("duration:", snapshot.duration_hist);
+        irqstat_show_hist("irqs-off:", snapshot.irqs_off_hist);
+    }
+
+    if (!any) {
+        printk("  No samples%s\n", irqstat_enabled ? "" : ", enable with 'irqstat on'");
+    }
+}
@@ -0,0 +1,391 @@
+#include "basedos.h"
+#include "ipc.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "paging.h"
+#include "memory.h"
+#include "string.h"
+
+_Static_assert(__builtin_offsetof(ipc_msg_t, len) == IPC_MSG_LEN, "ipc_msg_t layout");
+_Static_assert(__builtin_offsetof(ipc_msg_t, pages) == IPC_MSG_PAGES, "ipc_msg_t layout");
+_Static_assert(__builtin_offsetof(ipc_msg_t, addr) == IPC_MSG_ADDR, "ipc_msg_t layout");
+_Static_assert(__builtin_offsetof(ipc_msg_t, window) == IPC_MSG_WINDOW, "ipc_msg_t layout");
+_Static_assert(__builtin_offsetof(ipc_msg_t, window_pages) == IPC_MSG_WINDOW_PAGES, "ipc_msg_t layout");
+_Static_assert(__builtin_offsetof(ipc_msg_t, data) == IPC_MSG_DATA, "ipc_msg_t layout");
+
+struct ipc_port;
+
+// A call in progress, on the caller's stack until it returns
+typedef struct ipc_call {
+    struct ipc_port* port;
+    task_t* caller;
+    task_t* receiver;          // Task serving it once received
+    uint32_t token;
+    ipc_payload_t* msg;        // The message, then the reply
+    int status;                // 0 replied, -1 failed
+    volatile bool done;
+    struct ipc_call* next;
+} ipc_call_t;
+
+// A receiver blocked in ipc_reply_wait(), calls are handed to it directly
+typedef struct ipc_waiter {
+    task_t* task;
+    ipc_payload_t* msg;
+    uint32_t token;            // Call received, 0 when the port was closed
+    volatile bool done;
+    struct ipc_waiter* next;
+} ipc_waiter_t;
+
+// Messages are only copied with the port locked, so a port closing can
+// fail every call without racing the tasks serving them
+typedef struct ipc_port {
+    spinlock_t lock;
+    int32_t id;                // 0 when free
+    task_t* owner;
+    ipc_call_t* head;          // Calls not received yet, oldest first
+    ipc_call_t* tail;
+    ipc_call_t* active;        // Received, waiting for the reply
+    ipc_waiter_t* waiters;
+    uint32_t next_token;
+} ipc_port_t;
+
+static ipc_port_t ports[IPC_MAX_PORTS];
+static spinlock_t ports_lock = SPINLOCK_INIT;
+static uint32_t ipc_generation;
+static ipc_stats_t ipc_totals;
+
+// Lock the port with id, NULL when there is none
+static ipc_port_t* ipc_port_lock(int32_t id, uint32_t* flags) {
+    if (id <= 0) {
+        return NULL;
+    }
+    ipc_port_t* port = &ports[id % IPC_MAX_PORTS];
+    *flags = spin_lock_irqsave(&port->lock);
+    if (port->id == id) {
+        return port;
+    }
+    spin_unlock_irqrestore(&port->lock, *flags);
+    return NULL;
+}
+
+void ipc_payload_release(ipc_payload_t* msg) {
+    for (uint32_t i = 0; i < msg->nr_frames; i++) {
+        free_page((void*)msg->frames[i]);
+    }
+    msg->nr_frames = 0;
+}
+
+// Copy the used part of src, its page references go along
+static void ipc_payload_move(ipc_payload_t* dst, ipc_payload_t* src) {
+    dst->words[0] = src->words[0];
+    dst->words[1] = src->words[1];
+    dst->len = src->len;
+    memcpy(dst->data, src->data, src->len);
+    dst->nr_frames = src->nr_frames;
+    memcpy(dst->frames, src->frames, src->nr_frames * sizeof(uint32_t));
+    src->nr_frames = 0;
+}
+
+// Sleep until done is set by a task holding the port lock, then take the
+// lock once so the waker has let go of us before our stack is reused
+static void ipc_wait(ipc_port_t* port, volatile bool* done) {
+    while (1) {
+        set_current_state(TASK_BLOCKED);
+        if (*done) {
+            break;
+        }
+        schedule();
+    }
+    set_current_state(TASK_RUNNING);
+
+    uint32_t flags = spin_lock_irqsave(&port->lock);
+    spin_unlock_irqrestore(&port->lock, flags);
+}
+
+static void ipc_fail(ipc_call_t* call) {
+    call->status = -1;
+    call->done = true;
+    wake_up_task(call->caller);
+}
+
+// Port locked: fail everything pending and free it
+static void ipc_port_close(ipc_port_t* port) {
+    port->id = 0;
+    port->owner = NULL;
+    for (ipc_call_t* call = port->head; call; call = call->next) {
+        ipc_fail(call);
+    }
+    for (ipc_call_t* call = port->active; call; call = call->next) {
+        ipc_fail(call);
+    }
+    for (ipc_waiter_t* waiter = port->waiters; waiter; waiter = waiter->next) {
+        waiter->token = 0;
+        waiter->done = true;
+        wake_up_task(waiter->task);
+    }
+    port->head = port->tail = port->active = NULL;
+    port->waiters = NULL;
+}
+
+int32_t ipc_port_create(void) {
+    int32_t id = -1;
+    uint32_t flags = spin_lock_irqsave(&ports_lock);
+    for (uint32_t i = 0; i < IPC_MAX_PORTS; i++) {
+        ipc_port_t* port = &ports[i];
+        if (port->id) {
+            continue;
+        }
+        // A new number for each use of the slot, so stale ids miss
+        ipc_generation = (ipc_generation + 1) & 0x3FFFFFF;
+        id = (int32_t)((ipc_generation + 1) * IPC_MAX_PORTS + i);
+
+        uint32_t port_flags = spin_lock_irqsave(&port->lock);
+        port->id = id;
+        port->owner = current_task();
+        port->next_token = 0;
+        spin_unlock_irqrestore(&port->lock, port_flags);
+        break;
+    }
+    spin_unlock_irqrestore(&ports_lock, flags);
+    return id;
+}
+
+int ipc_port_destroy(int32_t id) {
+    uint32_t flags;
+    ipc_port_t* port = ipc_port_lock(id, &flags);
+    if (!port) {
+        return -1;
+    }
+    int ret = -1;
+    if (port->owner == current_task()) {
+        ipc_port_close(port);
+        ret = 0;
+    }
+    spin_unlock_irqrestore(&port->lock, flags);
+    return ret;
+}
+
+// Port locked: give the call to a waiting receiver, or queue it. Returns
+// the receiver to switch to, NULL when it was queued.
+static task_t* ipc_deliver(ipc_port_t* port, ipc_call_t* call) {
+    port->next_token = (port->next_token + 1) & 0x7FFFFFFF;
+    if (!port->next_token) {
+        port->next_token = 1;
+    }
+    call->token = port->next_token;
+    call->next = NULL;
+
+    ipc_waiter_t* waiter = port->waiters;
+    if (!waiter) {
+        if (port->tail) {
+            port->tail->next = call;
+        } else {
+            port->head = call;
+        }
+        port->tail = call;
+        return NULL;
+    }
+
+    port->waiters = waiter->next;
+    ipc_payload_move(waiter->msg, call->msg);
+    call->receiver = waiter->task;
+    call->next = port->active;
+    port->active = call;
+    waiter->token = call->token;
+    waiter->done = true;
+    __sync_fetch_and_add(&ipc_totals.direct, 1);
+    return waiter->task;
+}
+
+// Port locked: answer the call token received by the current task.
+// Returns its caller, NULL when there is no such call.
+static task_t* ipc_answer(ipc_port_t* port, uint32_t token, ipc_payload_t* msg) {
+    task_t* self = current_task();
+    for (ipc_call_t** link = &port->active; *link; link = &(*link)->next) {
+        ipc_call_t* call = *link;
+        if (call->token == token && call->receiver == self) {
+            *link = call->next;
+            ipc_payload_move(call->msg, msg);
+            call->status = 0;
+            call->done = true;
+            return call->caller;
+        }
+    }
+    return NULL;
+}
+
+int ipc_call(int32_t id, ipc_payload_t* msg) {
+    uint32_t flags;
+    ipc_port_t* port = ipc_port_lock(id, &flags);
+    if (!port) {
+        ipc_payload_release(msg);
+        return -1;
+    }
+
+    ipc_call_t call = { .port = port, .caller = current_task(), .msg = msg };
+    __sync_fetch_and_add(&ipc_totals.calls, 1);
+    task_t* receiver = ipc_deliver(port, &call);
+    if (receiver) {
+        wake_up_task_sync(receiver);
+    }
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    ipc_wait(port, &call.done);
+    if (call.status != 0) {
+        ipc_payload_release(msg);
+    }
+    return call.status;
+}
+
+int ipc_reply(int32_t id, uint32_t token, ipc_payload_t* msg) {
+    uint32_t flags;
+    ipc_port_t* port = ipc_port_lock(id, &flags);
+    task_t* caller = port ? ipc_answer(port, token, msg) : NULL;
+    if (caller) {
+        wake_up_task(caller);
+    }
+    if (port) {
+        spin_unlock_irqrestore(&port->lock, flags);
+    }
+    if (!caller) {
+        ipc_payload_release(msg);
+        return -1;
+    }
+    return 0;
+}
+
+int32_t ipc_reply_wait(int32_t id, uint32_t token, ipc_payload_t* msg) {
+    uint32_t flags;
+    ipc_port_t* port = ipc_port_lock(id, &flags);
+    if (!port) {
+        ipc_payload_release(msg);
+        return -1;
+    }
+
+    if (token) {
+        task_t* caller = ipc_answer(port, token, msg);
+        if (!caller) {
+            spin_unlock_irqrestore(&port->lock, flags);
+            ipc_payload_release(msg);
+            return -1;
+        }
+        // Straight back to the caller, unless there is more work queued
+        if (port->head) {
+            wake_up_task(caller);
+        } else {
+            wake_up_task_sync(caller);
+        }
+    }
+
+    ipc_call_t* call = port->head;
+    if (call) {
+        port->head = call->next;
+        if (!port->head) {
+            port->tail = NULL;
+        }
+        ipc_payload_move(msg, call->msg);
+        call->receiver = current_task();
+        call->next = port->active;
+        port->active = call;
+        token = call->token;
+        spin_unlock_irqrestore(&port->lock, flags);
+        return (int32_t)token;
+    }
+
+    ipc_waiter_t waiter = { .task = current_task(), .msg = msg, .next = port->waiters };
+    port->waiters = &waiter;
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    ipc_wait(port, &waiter.done);
+    return waiter.token ? (int32_t)waiter.token : -1;
+}
+
+void ipc_task_exit(void) {
+    task_t* self = current_task();
+    for (uint32_t i = 0; i < IPC_MAX_PORTS; i++) {
+        ipc_port_t* port = &ports[i];
+        uint32_t flags = spin_lock_irqsave(&port->lock);
+        if (port->id && port->owner == self) {
+            ipc_port_close(port);
+        } else if (port->id) {
+            for (ipc_call_t** link = &port->active; *link; ) {
+                ipc_call_t* call = *link;
+                if (call->receiver == self) {
+                    *link = call->next;
+                    ipc_fail(call);
+                } else {
+                    link = &call->next;
+                }
+            }
+        }
+        spin_unlock_irqrestore(&port->lock, flags);
+    }
+}
+
+int ipc_msg_in(ipc_payload_t* msg, const ipc_msg_t* umsg, uint32_t w0, uint32_t w1) {
+    msg->words[0] = w0;
+    msg->words[1] = w1;
+    msg->len = 0;
+    msg->nr_frames = 0;
+    if (!umsg) {
+        return 0;
+    }
+
+    ipc_msg_t head;
+    if (copy_from_user(&head, umsg, IPC_MSG_DATA) != 0 || head.len > IPC_INLINE_SIZE ||
+        head.pages > IPC_MAX_PAGES || copy_from_user(msg->data, umsg->data, head.len) != 0) {
+        return -1;
+    }
+    msg->len = head.len;
+
+    // Fault the pages in first, only present pages can be shared
+    if (head.pages && !user_access_ok((const void*)head.addr, head.pages * PAGE_SIZE, false)) {
+        return -1;
+    }
+    mm_t* mm = current_task()->mm;
+    for (uint32_t i = 0; i < head.pages; i++) {
+        uint32_t frame = mm_share_page(mm, head.addr + i * PAGE_SIZE);
+        if (!frame) {
+            ipc_payload_release(msg);
+            return -1;
+        }
+        msg->frames[msg->nr_frames++] = frame;
+    }
+    return 0;
+}
+
+void ipc_msg_out(ipc_payload_t* msg, ipc_msg_t* umsg, interrupt_frame_t* frame) {
+    frame->esi = msg->words[0];
+    frame->edi = msg->words[1];
+
+    ipc_msg_t head;
+    uint32_t mapped = 0;
+    if (umsg && copy_from_user(&head, umsg, IPC_MSG_DATA) == 0) {
+        mm_t* mm = current_task()->mm;
+        while (mapped < msg->nr_frames && mapped < head.window_pages) {
+            uint32_t page = head.window + mapped * PAGE_SIZE;
+            if (!mm_translate(mm, page)) {
+                mm_fault(mm, page, false);
+            }
+            if (mm_insert_shared(mm, page, msg->frames[mapped]) != 0) {
+                break;
+            }
+            mapped++;
+        }
+        head.len = msg->len;
+        head.pages = mapped;
+        copy_to_user(umsg, &head, IPC_MSG_DATA);
+        copy_to_user(umsg->data, msg->data, msg->len);
+        __sync_fetch_and_add(&ipc_totals.pages, mapped);
+    }
+
+    // What did not fit the window is dropped
+    for (uint32_t i = mapped; i < msg->nr_frames; i++) {
+        free_page((void*)msg->frames[i]);
+    }
+    msg->nr_frames = 0;
+}
+
+void ipc_get_stats(ipc_stats_t* stats) {
+    *stats = ipc_totals;
+}
@@ -1,5 +1,18 @@
 #include "basedos.h"
 #include "memory.h"
+#include "softirq.h"
+#include "time.h"
+#include "sched.h"
+#include "smp.h"
+#include "timer.h"
+#include "workqueue.h"
+#include "async.h"
+#include "rcu.h"
+#include "paging.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "exec.h"
+#include "fs/console.h"
 
 // Kernel subsystem status flags
 static struct {
@@ -11,77 +24,55 @@ static struct {
     uint32_t free_memory;
 } kernel_status = {0};
 
-// Simple task structure for basic multitasking
-typedef struct task {
-    uint32_t id;
-    uint32_t esp;
-    uint32_t ebp;
-    uint32_t state; // 0=running, 1=ready, 2=blocked
-    struct task* next;
-} task_t;
-
-static task_t* current_task = NULL;
-static task_t* task_queue = NULL;
-static uint32_t next_task_id = 1;
-
-// Timer callback for uptime tracking
-static void timer_callback(void) {
-    static uint32_t ticks = 0;
-    ticks++;
-    if (ticks >= 100) { // Assuming 100Hz timer
-        kernel_status.uptime_seconds++;
-        ticks = 0;
-    }
-    
-    // Simple round-robin scheduler
-    if (kernel_status.scheduler_active && current_task && current_task->next) {
-        // Save current task state (simplified)
-        asm volatile("mov %%esp, %0" : "=m"(current_task->esp));
-        asm volatile("mov %%ebp, %0" : "=m"(current_task->ebp));
-        
-        // Switch to next task
-        current_task = current_task->next;
-        
-        // Restore next task state (simplified)
-        asm volatile("mov %0, %%esp" : : "m"(current_task->esp));
-        asm volatile("mov %0, %%ebp" : : "m"(current_task->ebp));
+volatile uint32_t timer_ticks = 0;
+
+// Timer IRQ: count the tick and leave the bookkeeping to the timer softirq
+static void timer_callback(interrupt_frame_t* frame) {
+    (void)frame;
+    timer_ticks++;
+    vdso_tick(timer_ticks);
+    raise_softirq_irqoff(TIMER_SOFTIRQ);
+    if (kernel_status.scheduler_active) {
+        raise_softirq_irqoff(SCHED_SOFTIRQ);
     }
 }
 
+// Uptime tracking and kernel timers, runs with interrupts enabled
+static void timer_softirq(void) {
+    kernel_status.uptime_seconds = timer_ticks / TIMER_HZ;
+    run_timers();
+}
+
 // Initialize basic memory management
 static void init_memory_manager(void) {
     // Simple memory initialization
     kernel_status.total_memory = detect_memory(); // Assume this function exists
     kernel_status.free_memory = kernel_status.total_memory - 0x100000; // Reserve 1MB for kernel
+    page_allocator_initialize();
     kernel_status.memory_manager_ready = true;
 }
 
-// Initialize basic task scheduler
+// Initialize the task scheduler, the boot context becomes the idle task
 static void init_scheduler(void) {
-    // Create main task
-    current_task = (task_t*)kmalloc(sizeof(task_t));
-    if (current_task) {
-        current_task->id = next_task_id++;
-        current_task->state = 0; // running
-        current_task->next = current_task; // circular list
-        task_queue = current_task;
-        kernel_status.scheduler_active = true;
-    }
+    sched_initialize();
+    kernel_status.scheduler_active = true;
 }
 
 // Enhanced interrupt initialization with timer
 static void init_enhanced_interrupts(void) {
+    softirq_initialize();
     init_interrupts();
     
-    // Set up timer interrupt for scheduler and uptime
-    register_interrupt_handler(0x20, timer_callback);
-    
     // Initialize PIT (Programmable Interval Timer) for 100Hz
-    outb(0x43, 0x36); // Command byte: channel 0, lobyte/hibyte, rate generator
-    uint16_t divisor = 1193180 / 100; // 100Hz
+    outb(0x43, 0x34); // Command byte: channel 0, lobyte/hibyte, rate generator
+    uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
     outb(0x40, divisor & 0xFF);
     outb(0x40, (divisor >> 8) & 0xFF);
     
+    // Set up timer interrupt for uptime
+    open_softirq(TIMER_SOFTIRQ, timer_softirq);
+    irq_install_handler(0, timer_callback);
+    
     kernel_status.interrupts_enabled = true;
 }
 
@@ -135,12 +126,6 @@ void kernel_shutdown(void) {
     // Disable scheduler
     kernel_status.scheduler_active = false;
     
-    // Clean up resources
-    if (task_queue) {
-        // Free task structures (simplified)
-        kfree(task_queue);
-    }
-    
     // Final cleanup
     disable_interrupts();
     terminal_writestring("System halted safely.\n");
@@ -150,8 +135,17 @@ void kernel_shutdown(void) {
     }
 }
 
+// Shell thread entry
+static void shell_thread(void* arg) {
+    (void)arg;
+    start_shell();
+}
+
 // Enhanced kernel main function
 void kmain(void) {
+    // Per-CPU segment and GDT of the boot CPU, needed by everything below
+    smp_prepare_boot_cpu();
+    
     // Initialize terminal
     terminal_initialize();
     
@@ -160,13 +154,40 @@ void kmain(void) {
     
     // Initialize interrupts
     init_enhanced_interrupts();
+    enable_interrupts();
+    
+    // Calibrate the high resolution clock and read the wall clock
+    clocksource_initialize();
     
     // Initialize scheduler
     init_scheduler();
     
+    // x87 and SSE with lazy switching, needs the scheduler for the #NM trap
+    fpu_initialize(true);
+    
+    // Address spaces for user programs, then the system call entry points
+    // and the vDSO, which exports the calibrated clock
+    paging_initialize();
+    syscall_initialize();
+    
+    // Read-copy-update, ready before the other CPUs start reading
+    rcu_initialize();
+    
+    // Start the other CPUs
+    smp_initialize();
+    
+    // Worker threads for deferred work
+    workqueue_initialize();
+    
+    // Executor for stackless coroutines
+    async_initialize();
+    
     // Initialize virtual file system
     vfs_initialize();
     
+    // Standard input, output and error on the console
+    console_initialize();
+    
     // Initialize memory file system
     memfs_initialize();
     
@@ -175,6 +196,9 @@ void kmain(void) {
         printk("Failed to mount root filesystem!\n");
     }
     
+    // C programs built into the kernel
+    exec_initialize();
+    
     // Print welcome message
     printk("BasedOS Kernel v0.1\n");
     
@@ -182,13 +206,13 @@ void kmain(void) {
     extern void fs_test(void);
     fs_test();
     
-    // Start shell
-    start_shell();
-    
-    // Halt if shell returns
-    while (1) {
-        asm volatile("hlt");
+    // Start shell in its own thread
+    if (!kthread_create("shell", shell_thread, NULL)) {
+        kernel_panic("Could not start the shell thread");
     }
+    
+    // The boot context becomes the idle task
+    cpu_idle();
 }
 
 // Additional utility functions for the enhanced kernel
@@ -201,6 +225,9 @@ uint32_t get_uptime(void) {
 // Get memory statistics
 void get_memory_stats(uint32_t* total, uint32_t* free) {
     *total = kernel_status.total_memory;
+    if (kernel_status.memory_manager_ready) {
+        kernel_status.free_memory = pages_free() * PAGE_SIZE;
+    }
     *free = kernel_status.free_memory;
 }
 
@@ -215,41 +242,3 @@ bool is_subsystem_ready(const char* subsystem) {
     }
     return false;
 }
-
-// Create a new task (simplified)
-uint32_t create_task(void (*entry_point)(void)) {
-    (void)entry_point; // Currently unused, will be used in a future implementation
-    if (!kernel_status.scheduler_active) {
-        return 0;
-    }
-    
-    task_t* new_task = (task_t*)kmalloc(sizeof(task_t));
-    if (!new_task) {
-        return 0;
-    }
-    
-    new_task->id = next_task_id++;
-    new_task->state = 1; // ready
-    
-    // Set up stack (simplified)
-    new_task->esp = (uint32_t)kmalloc(4096) + 4096; // 4KB stack
-    new_task->ebp = new_task->esp;
-    
-    // Add to task queue
-    if (task_queue) {
-        new_task->next = task_queue->next;
-        task_queue->next = new_task;
-    } else {
-        new_task->next = new_task;
-        task_queue = new_task;
-    }
-    
-    return new_task->id;
-}
-
-// Yield CPU to next task
-void yield(void) {
-    if (kernel_status.scheduler_active) {
-        asm volatile("int $0x20"); // Trigger timer interrupt
-    }
-}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "basedos.h"
+#include "latency.h"
+#include "string.h"
+#include "cpu.h"
+#include "div64.h"
+#include "time.h"
+
+static uint32_t latency_bucket(uint32_t v) {
+    if (v < (1 << LATENCY_SUB_BITS)) {
+        return v;
+    }
+    uint32_t e = 31 - __builtin_clz(v);
+    uint32_t sub = (v >> (e - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1);
+    return ((e - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + sub;
+}
+
+static uint32_t latency_bucket_max(uint32_t idx) {
+    if (idx < (1 << LATENCY_SUB_BITS)) {
+        return idx;
+    }
+    uint32_t e = (idx >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    uint32_t sub = idx & ((1 << LATENCY_SUB_BITS) - 1);
+    uint32_t width = 1 << (e - LATENCY_SUB_BITS);
+    return (((1 << LATENCY_SUB_BITS) + sub) << (e - LATENCY_SUB_BITS)) + width - 1;
+}
+
+void latency_record(latency_stat_t* st, uint64_t ns) {
+    uint32_t v = (ns >> 32) ? 0xFFFFFFFF : (uint32_t)ns;
+
+    uint32_t flags = irq_save();
+    st->count++;
+    st->total_ns += v;
+    if (v < st->min_ns) st->min_ns = v;
+    if (v > st->max_ns) st->max_ns = v;
+    st->hist[latency_bucket(v)]++;
+    irq_restore(flags);
+}
+
+void latency_reset(latency_stat_t* st) {
+    uint32_t flags = irq_save();
+    st->count = 0;
+    st->total_ns = 0;
+    st->min_ns = 0xFFFFFFFF;
+    st->max_ns = 0;
+    memset(st->hist, 0, sizeof(st->hist));
+    irq_restore(flags);
+}
+
+uint32_t latency_percentile(const latency_stat_t* st, uint32_t pct) {
+    if (st->count == 0) {
+        return 0;
+    }
+
+    // Rank of the sample at the percentile, rounded up
+    uint32_t rank = (uint32_t)div64_u32((uint64_t)st->count * pct + 99, 100);
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += st->hist[i];
+        if (seen >= rank) {
+            uint32_t max = latency_bucket_max(i);
+            return max < st->max_ns ? max : st->max_ns;
+        }
+    }
+    return st->max_ns;
+}
+
+void latency_show(const latency_stat_t* st) {
+    if (st->count == 0) {
+        printk("%s: no samples\n", st->name);
+        return;
+    }
+    printk("%s: n=%u min=%uns avg=%lluns p50=%uns p99=%uns max=%uns\n",
+           st->name, st->count, st->min_ns,
+           div64_u32(st->total_ns, st->count),
+           latency_percentile(st, 50), latency_percentile(st, 99), st->max_ns);
+}
+
+// Keypress to echo latency
+
+static latency_stat_t input_latency = LATENCY_STAT_INIT("keypress->echo");
+
+// IRQ timestamp of the last key handed to a reader, 0 once its echo is measured
+volatile uint64_t input_latency_pending = 0;
+
+void input_latency_key_consumed(uint64_t irq_tsc) {
+    input_latency_pending = irq_tsc;
+}
+
+// Called by the terminal once a character and the cursor are on screen
+void input_latency_echo_done(void) {
+    uint64_t stamp = input_latency_pending;
+    input_latency_pending = 0;
+    if (stamp) {
+        uint64_t ns = cycles_to_ns(rdtsc() - stamp);
+        if (ns) {
+            latency_record(&input_latency, ns);
+        }
+    }
+}
+
+latency_stat_t* input_latency_stats(void) {
+    return &input_latency;
+}
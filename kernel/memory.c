@@ -1,10 +1,14 @@
 #include "basedos.h"
+#include "memory.h"
+#include "string.h"
+#include "spinlock.h"
 
 #define HEAP_START 0x10000
 #define HEAP_SIZE 0x10000
 
 static uint8_t heap[HEAP_SIZE];
 static uint32_t heap_pos = 0;
+static spinlock_t heap_lock = SPINLOCK_INIT;
 static uint32_t total_memory = 0;
 
 // Memory map entry structure would be defined here in a full implementation
@@ -21,18 +25,158 @@ uint32_t detect_memory(void) {
 
 // Memory statistics are now handled in kernel.c
 
+// Physical page frame allocator: one bit per 4 KiB frame from 1 MiB up to
+// the detected memory size. Frames are identity mapped, so the physical
+// address of a frame is also the pointer returned to the caller.
+#define PAGE_REGION_START 0x100000
+#define MAX_PHYS_MEMORY   (64 * 1024 * 1024)
+#define MAX_FRAMES        ((MAX_PHYS_MEMORY - PAGE_REGION_START) / PAGE_SIZE)
+
+static uint32_t frame_bitmap[MAX_FRAMES / 32];
+static uint16_t frame_refs[MAX_FRAMES];     // Mappings sharing each used frame
+static uint32_t frame_count = 0;
+static uint32_t frames_free = 0;
+static uint32_t frame_hint = 0; // Where the next search starts
+static spinlock_t frame_lock = SPINLOCK_INIT;
+
+static inline bool frame_used(uint32_t frame) {
+    return (frame_bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+static inline void frame_set(uint32_t frame, bool used) {
+    if (used) {
+        frame_bitmap[frame / 32] |= 1u << (frame % 32);
+    } else {
+        frame_bitmap[frame / 32] &= ~(1u << (frame % 32));
+    }
+}
+
+void page_allocator_initialize(void) {
+    uint32_t top = total_memory ? total_memory : detect_memory();
+    if (top > MAX_PHYS_MEMORY) {
+        top = MAX_PHYS_MEMORY;
+    }
+
+    memset(frame_bitmap, 0, sizeof(frame_bitmap));
+    frame_count = (top - PAGE_REGION_START) / PAGE_SIZE;
+    frames_free = frame_count;
+    frame_hint = 0;
+}
+
+// Find count physically contiguous free frames, first fit from the hint
+void* alloc_pages(uint32_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    uint32_t run = 0;
+    for (uint32_t n = 0; n < frame_count + count; n++) {
+        uint32_t frame = (frame_hint + n) % frame_count;
+        if (frame == 0) {
+            run = 0; // Runs do not wrap around the end
+        }
+
+        // Skip whole words that are fully used
+        if (run == 0 && frame % 32 == 0 && frame_bitmap[frame / 32] == 0xFFFFFFFF) {
+            n += 31;
+            continue;
+        }
+
+        if (frame_used(frame)) {
+            run = 0;
+            continue;
+        }
+
+        if (++run == count) {
+            uint32_t first = frame + 1 - count;
+            for (uint32_t i = first; i <= frame; i++) {
+                frame_set(i, true);
+                frame_refs[i] = 1;
+            }
+            frames_free -= count;
+            frame_hint = frame + 1;
+            spin_unlock_irqrestore(&frame_lock, flags);
+            return (void*)(PAGE_REGION_START + first * PAGE_SIZE);
+        }
+    }
+
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return NULL;
+}
+
+void free_pages(void* addr, uint32_t count) {
+    uint32_t first = ((uint32_t)addr - PAGE_REGION_START) / PAGE_SIZE;
+    if ((uint32_t)addr < PAGE_REGION_START || first + count > frame_count) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    for (uint32_t i = first; i < first + count; i++) {
+        if (frame_used(i) && --frame_refs[i] == 0) {
+            frame_set(i, false);
+            frames_free++;
+        }
+    }
+    if (first < frame_hint) {
+        frame_hint = first;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+void* alloc_page(void) {
+    return alloc_pages(1);
+}
+
+void free_page(void* addr) {
+    free_pages(addr, 1);
+}
+
+void page_get(void* addr) {
+    uint32_t frame = ((uint32_t)addr - PAGE_REGION_START) / PAGE_SIZE;
+    if ((uint32_t)addr < PAGE_REGION_START || frame >= frame_count) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    if (frame_used(frame)) {
+        frame_refs[frame]++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+uint32_t page_refs(void* addr) {
+    uint32_t frame = ((uint32_t)addr - PAGE_REGION_START) / PAGE_SIZE;
+    if ((uint32_t)addr < PAGE_REGION_START || frame >= frame_count || !frame_used(frame)) {
+        return 0;
+    }
+    return frame_refs[frame];
+}
+
+uint32_t pages_free(void) {
+    return frames_free;
+}
+
+uint32_t pages_total(void) {
+    return frame_count;
+}
+
 void* kmalloc(size_t size) {
+ uint32_t flags = spin_lock_irqsave(&heap_lock);
  if (heap_pos + size > HEAP_SIZE) {
+ spin_unlock_irqrestore(&heap_lock, flags);
  return NULL;
  }
  void* ptr = &heap[heap_pos];
  heap_pos += (size + 3) & ~3; // Align to 4 bytes
+ spin_unlock_irqrestore(&heap_lock, flags);
  return ptr;
 }
 
 void kfree(void* ptr) {
  // Simple heap: no actual freeing, just reset if at end
+ uint32_t flags = spin_lock_irqsave(&heap_lock);
  if (ptr == &heap[heap_pos - 1]) {
  heap_pos = (uint32_t)((uint8_t*)ptr - heap);
  }
+ spin_unlock_irqrestore(&heap_lock, flags);
 }
\ No newline at end of file
@@ -0,0 +1,755 @@
+#include "basedos.h"
+#include "paging.h"
+#include "memory.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "sched.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "fs/vfs.h"
+
+#define PF_VECTOR 14
+#define MAX_MM    32
+
+// CPUID leaf 1 EDX
+#define CPUID_PSE (1 << 3)
+#define CPUID_PGE (1 << 13)
+
+#define PDE_INDEX(addr) ((uint32_t)(addr) >> 22)
+#define PTE_INDEX(addr) (((uint32_t)(addr) >> 12) & 0x3FF)
+
+// Kernel half of every page directory, the user half stays empty
+static uint32_t kernel_pgdir[1024] __attribute__((aligned(PAGE_SIZE)));
+static bool has_pge;
+static bool paging_on;
+
+// Address spaces are few and long-lived, a fixed pool avoids the kernel heap
+static mm_t mm_pool[MAX_MM];
+static spinlock_t mm_pool_lock = SPINLOCK_INIT;
+
+static inline bool user_range_ok(uint32_t addr, uint32_t len) {
+    return addr >= USER_BASE && addr < USER_END && len <= USER_END - addr;
+}
+
+static void page_fault(interrupt_frame_t* frame) {
+    uint32_t addr = read_cr2();
+    const char* kind = (frame->err_code & PF_PRESENT) ? "protection" : "not present";
+    const char* access = (frame->err_code & PF_WRITE) ? "write" : "read";
+
+    if (frame->cs & 3) {
+        // A first touch of a demand page or a write to a shared one. Both
+        // may sleep, so run with interrupts enabled like a system call.
+        if (!(frame->err_code & PF_PRESENT) || (frame->err_code & PF_WRITE)) {
+            enable_interrupts();
+            int ret = mm_fault(current_task()->mm, addr, frame->err_code & PF_WRITE);
+            disable_interrupts();
+            if (ret == 0) {
+                return;
+            }
+        }
+        printk("Page fault: %s of %x, %s\n", access, addr, kind);
+        user_fault(frame, "page fault");
+    }
+
+    printk("\nPage fault on CPU %u at %x: %s of %x, %s\n", smp_processor_id(),
+           frame->eip, access, addr, kind);
+    kernel_panic("Page fault in kernel mode");
+}
+
+static void paging_enable(void) {
+    uint32_t cr4 = read_cr4() | CR4_PSE;
+    if (has_pge) {
+        cr4 |= CR4_PGE;
+    }
+    write_cr4(cr4);
+    write_cr3((uint32_t)kernel_pgdir);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+}
+
+bool paging_initialize(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_PSE)) {
+        printk("Paging: no 4 MiB page support, user programs disabled\n");
+        return false;
+    }
+    has_pge = (edx & CPUID_PGE) != 0;
+
+    uint32_t global = has_pge ? PTE_GLOBAL : 0;
+    memset(kernel_pgdir, 0, sizeof(kernel_pgdir));
+    for (uint32_t i = 0; i < PDE_INDEX(KERNEL_LOW_END); i++) {
+        kernel_pgdir[i] = (i << 22) | PTE_PRESENT | PTE_WRITE | PTE_LARGE | global;
+    }
+    // Device memory, uncached
+    for (uint32_t i = PDE_INDEX(USER_END); i < 1024; i++) {
+        kernel_pgdir[i] = (i << 22) | PTE_PRESENT | PTE_WRITE | PTE_LARGE | PTE_PCD | PTE_PWT | global;
+    }
+
+    exception_install_handler(PF_VECTOR, page_fault);
+    paging_enable();
+    paging_on = true;
+    return true;
+}
+
+void paging_enable_ap(void) {
+    if (paging_on) {
+        paging_enable();
+    }
+}
+
+bool paging_enabled(void) {
+    return paging_on;
+}
+
+mm_t* mm_create(void) {
+    if (!paging_on) {
+        return NULL;
+    }
+
+    mm_t* mm = NULL;
+    uint32_t flags = spin_lock_irqsave(&mm_pool_lock);
+    for (uint32_t i = 0; i < MAX_MM; i++) {
+        if (!mm_pool[i].used) {
+            mm = &mm_pool[i];
+            mm->used = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&mm_pool_lock, flags);
+    if (!mm) {
+        return NULL;
+    }
+
+    mm->pgdir = alloc_page();
+    mm->nr_pages = 0;
+    mm->nr_faults = 0;
+    mm->nr_cow = 0;
+    mm->nr_regions = 0;
+    mm->brk_start = mm->brk = 0;
+    if (!mm->pgdir) {
+        mm->used = false;
+        return NULL;
+    }
+    memcpy(mm->pgdir, kernel_pgdir, PAGE_SIZE);
+
+    if (vdso_map(mm) != 0) {
+        mm_destroy(mm);
+        return NULL;
+    }
+    return mm;
+}
+
+void mm_destroy(mm_t* mm) {
+    for (uint32_t pde = PDE_INDEX(USER_BASE); pde < PDE_INDEX(USER_END); pde++) {
+        if (!(mm->pgdir[pde] & PTE_PRESENT)) {
+            continue;
+        }
+        uint32_t* table = (uint32_t*)(mm->pgdir[pde] & PTE_FRAME);
+        for (uint32_t i = 0; i < 1024; i++) {
+            if ((table[i] & PTE_PRESENT) && !(table[i] & PTE_NOFREE)) {
+                free_page((void*)(table[i] & PTE_FRAME));
+            }
+        }
+        free_page(table);
+    }
+    free_page(mm->pgdir);
+    mm->pgdir = NULL;
+    mm->nr_pages = 0;
+    mm->nr_regions = 0;
+    mm->used = false;
+}
+
+// Page table entry of a user address, allocating the page table if asked
+static uint32_t* mm_pte(mm_t* mm, uint32_t vaddr, bool alloc) {
+    uint32_t* pde = &mm->pgdir[PDE_INDEX(vaddr)];
+    if (!(*pde & PTE_PRESENT)) {
+        if (!alloc) {
+            return NULL;
+        }
+        uint32_t* table = alloc_page();
+        if (!table) {
+            return NULL;
+        }
+        memset(table, 0, PAGE_SIZE);
+        // Permissions are decided per page, the directory allows everything
+        *pde = (uint32_t)table | PTE_PRESENT | PTE_WRITE | PTE_USER;
+    }
+    return &((uint32_t*)(*pde & PTE_FRAME))[PTE_INDEX(vaddr)];
+}
+
+mm_t* mm_fork(mm_t* mm) {
+    mm_t* child = mm_create();
+    if (!child) {
+        return NULL;
+    }
+
+    bool ok = true;
+    for (uint32_t pde = PDE_INDEX(USER_BASE); ok && pde < PDE_INDEX(USER_END); pde++) {
+        if (!(mm->pgdir[pde] & PTE_PRESENT)) {
+            continue;
+        }
+        uint32_t* table = (uint32_t*)(mm->pgdir[pde] & PTE_FRAME);
+        for (uint32_t i = 0; i < 1024; i++) {
+            uint32_t pte = table[i];
+            // Frames it does not own (the vDSO) are mapped by mm_create()
+            if (!(pte & PTE_PRESENT) || (pte & PTE_NOFREE)) {
+                continue;
+            }
+            uint32_t* dst = mm_pte(child, (pde << 22) | (i << 12), true);
+            if (!dst) {
+                ok = false;
+                break;
+            }
+            if ((pte & PTE_WRITE) && !(pte & PTE_SHARED)) {
+                pte = (pte & ~PTE_WRITE) | PTE_COW;
+                table[i] = pte;
+            }
+            page_get((void*)(pte & PTE_FRAME));
+            *dst = pte;
+            child->nr_pages++;
+        }
+    }
+    memcpy(child->regions, mm->regions, sizeof(mm->regions));
+    child->nr_regions = mm->nr_regions;
+    child->brk_start = mm->brk_start;
+    child->brk = mm->brk;
+
+    // Only this CPU can hold TLB entries of the caller's address space:
+    // every other one switched away from it through another page directory
+    if (read_cr3() == (uint32_t)mm->pgdir) {
+        write_cr3((uint32_t)mm->pgdir);
+    }
+    if (!ok) {
+        mm_destroy(child);
+        return NULL;
+    }
+    return child;
+}
+
+void mm_replace(mm_t* mm, mm_t* with) {
+    mm_t old = *mm;
+    uint32_t flags = irq_save();
+    bool loaded = read_cr3() == (uint32_t)old.pgdir;
+    *mm = *with;
+    if (loaded) {
+        switch_mm(mm);
+    }
+    irq_restore(flags);
+    *with = old;
+    mm_destroy(with);
+}
+
+int mm_map_page(mm_t* mm, uint32_t vaddr, uint32_t paddr, uint32_t flags) {
+    if ((vaddr & (PAGE_SIZE - 1)) || !user_range_ok(vaddr, PAGE_SIZE)) {
+        return -1;
+    }
+    uint32_t* pte = mm_pte(mm, vaddr, true);
+    if (!pte) {
+        return -1;
+    }
+
+    uint32_t old = *pte;
+    *pte = (paddr & PTE_FRAME) | (flags & ~PTE_FRAME) | PTE_PRESENT;
+    if (!(flags & PTE_NOFREE)) {
+        mm->nr_pages++;
+    }
+    if (old & PTE_PRESENT) {
+        if (!(old & PTE_NOFREE)) {
+            free_page((void*)(old & PTE_FRAME));
+            mm->nr_pages--;
+        }
+        if (read_cr3() == (uint32_t)mm->pgdir) {
+            invlpg(vaddr);
+        }
+    }
+    return 0;
+}
+
+int mm_map_anon(mm_t* mm, uint32_t vaddr, uint32_t len, uint32_t flags) {
+    uint32_t end = (vaddr + len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    vaddr &= ~(PAGE_SIZE - 1);
+    if (!user_range_ok(vaddr, end - vaddr)) {
+        return -1;
+    }
+
+    for (; vaddr < end; vaddr += PAGE_SIZE) {
+        void* frame = alloc_page();
+        if (!frame) {
+            return -1;
+        }
+        memset(frame, 0, PAGE_SIZE);
+        if (mm_map_page(mm, vaddr, (uint32_t)frame, flags) != 0) {
+            free_page(frame);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Grow an anonymous region that [start, end) continues, joining the one
+// after it as well when the range closes the gap between them. false
+// when there is none to grow.
+static bool mm_merge_anon(mm_t* mm, uint32_t start, uint32_t end, uint32_t flags) {
+    mm_region_t* before = NULL;
+    mm_region_t* after = NULL;
+    for (uint32_t i = 0; i < mm->nr_regions; i++) {
+        mm_region_t* region = &mm->regions[i];
+        if (region->node || region->flags != flags) {
+            continue;
+        }
+        if (region->end == start) {
+            before = region;
+        } else if (region->start == end) {
+            after = region;
+        }
+    }
+    if (before && after) {
+        before->end = after->end;
+        *after = mm->regions[--mm->nr_regions];
+    } else if (before) {
+        before->end = end;
+    } else if (after) {
+        after->start = start;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int mm_map_file(mm_t* mm, uint32_t vaddr, uint32_t len, uint32_t flags,
+                fs_node_t* node, uint32_t offset, uint32_t len_from_file) {
+    uint32_t start = vaddr & ~(PAGE_SIZE - 1);
+    uint32_t skip = vaddr - start;
+    if (len == 0 || len_from_file > len || (offset & (PAGE_SIZE - 1)) != skip ||
+        !user_range_ok(vaddr, len)) {
+        return -1;
+    }
+    uint32_t end = (vaddr + len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    for (uint32_t i = 0; i < mm->nr_regions; i++) {
+        if (start < mm->regions[i].end && mm->regions[i].start < end) {
+            return -1;
+        }
+    }
+    if (!node && !(flags & PTE_SHARED) && mm_merge_anon(mm, start, end, flags)) {
+        return 0;
+    }
+    if (mm->nr_regions == MM_MAX_REGIONS) {
+        return -1;
+    }
+
+    // The head of the first page comes from the file as well, like mmap
+    mm_region_t* region = &mm->regions[mm->nr_regions++];
+    region->start = start;
+    region->end = end;
+    region->flags = flags;
+    region->node = node;
+    region->offset = offset - skip;
+    region->file_len = node ? len_from_file + skip : 0;
+    return 0;
+}
+
+// Unmap the pages of [start, end), dropping their frames
+static void mm_clear_range(mm_t* mm, uint32_t start, uint32_t end) {
+    bool loaded = read_cr3() == (uint32_t)mm->pgdir;
+    for (uint32_t page = start; page < end; page += PAGE_SIZE) {
+        uint32_t* pte = mm_pte(mm, page, false);
+        if (!pte || !(*pte & PTE_PRESENT)) {
+            continue;
+        }
+        uint32_t old = *pte;
+        *pte = 0;
+        if (loaded) {
+            invlpg(page);
+        }
+        if (!(old & PTE_NOFREE)) {
+            free_page((void*)(old & PTE_FRAME));
+            mm->nr_pages--;
+        }
+    }
+}
+
+int mm_map_shared(mm_t* mm, uint32_t vaddr, uint32_t len, uint32_t flags) {
+    if (mm_map_file(mm, vaddr, len, flags | PTE_SHARED, NULL, 0, 0) != 0) {
+        return -1;
+    }
+    // Every page now: one made later by a fault would differ between a
+    // parent and the children it forked before
+    mm_region_t* region = &mm->regions[mm->nr_regions - 1];
+    for (uint32_t page = region->start; page < region->end; page += PAGE_SIZE) {
+        if (mm_fault(mm, page, false) != 0) {
+            mm_clear_range(mm, region->start, region->end);
+            mm->nr_regions--;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Drop the head of a region, up to start
+static void mm_region_advance(mm_region_t* region, uint32_t start) {
+    uint32_t skip = start - region->start;
+    region->offset += skip;
+    region->file_len = region->file_len > skip ? region->file_len - skip : 0;
+    region->start = start;
+}
+
+// Drop the tail of a region, from end
+static void mm_region_truncate(mm_region_t* region, uint32_t end) {
+    if (region->file_len > end - region->start) {
+        region->file_len = end - region->start;
+    }
+    region->end = end;
+}
+
+int mm_unmap(mm_t* mm, uint32_t vaddr, uint32_t len) {
+    if ((vaddr & (PAGE_SIZE - 1)) || len == 0 || !user_range_ok(vaddr, len)) {
+        return -1;
+    }
+    uint32_t end = (vaddr + len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // A hole in the middle of a region leaves two, check for room first
+    for (uint32_t i = 0; i < mm->nr_regions; i++) {
+        if (mm->regions[i].start < vaddr && end < mm->regions[i].end &&
+            mm->nr_regions == MM_MAX_REGIONS) {
+            return -1;
+        }
+    }
+
+    uint32_t i = 0;
+    while (i < mm->nr_regions) {
+        mm_region_t* region = &mm->regions[i];
+        uint32_t start = region->start > vaddr ? region->start : vaddr;
+        uint32_t stop = region->end < end ? region->end : end;
+        if (start >= stop) {
+            i++;
+            continue;
+        }
+        mm_clear_range(mm, start, stop);
+        if (start == region->start && stop == region->end) {
+            *region = mm->regions[--mm->nr_regions];
+            continue;
+        }
+        if (start == region->start) {
+            mm_region_advance(region, stop);
+        } else if (stop == region->end) {
+            mm_region_truncate(region, start);
+        } else {
+            mm_region_t* tail = &mm->regions[mm->nr_regions++];
+            *tail = *region;
+            mm_region_advance(tail, stop);
+            mm_region_truncate(region, start);
+        }
+        i++;
+    }
+    return 0;
+}
+
+uint32_t mm_brk(mm_t* mm, uint32_t brk) {
+    if (!mm->brk_start || brk < mm->brk_start || brk > MMAP_BASE) {
+        return mm->brk;
+    }
+    uint32_t old_end = (mm->brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t new_end = (brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (new_end > old_end &&
+        mm_map_file(mm, old_end, new_end - old_end, PTE_USER | PTE_WRITE, NULL, 0, 0) != 0) {
+        return mm->brk;
+    }
+    if (new_end < old_end && mm_unmap(mm, new_end, old_end - new_end) != 0) {
+        return mm->brk;
+    }
+    mm->brk = brk;
+    return brk;
+}
+
+uint32_t mm_find_free(mm_t* mm, uint32_t len) {
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t start = MMAP_BASE;
+    uint32_t limit = USER_STACK_TOP - USER_STACK_SIZE;
+    while (len && start < limit && len <= limit - start) {
+        uint32_t end = start + len;
+        uint32_t next = 0;
+        for (uint32_t i = 0; i < mm->nr_regions; i++) {
+            if (start < mm->regions[i].end && mm->regions[i].start < end) {
+                next = mm->regions[i].end;
+                break;
+            }
+        }
+        // Pages mapped outside any region, such as IPC windows
+        for (uint32_t page = start; !next && page < end; page += PAGE_SIZE) {
+            uint32_t* pte = mm_pte(mm, page, false);
+            if (pte && (*pte & PTE_PRESENT)) {
+                next = page + PAGE_SIZE;
+            }
+        }
+        if (!next) {
+            return start;
+        }
+        start = next;
+    }
+    return 0;
+}
+
+// Make a PTE_COW page writable: copy the frame if another address space
+// still shares it, otherwise take it over as it is
+static int mm_unshare(mm_t* mm, uint32_t* pte, uint32_t page) {
+    uint32_t old = *pte;
+    void* frame = (void*)(old & PTE_FRAME);
+    void* copy = frame;
+    if (page_refs(frame) > 1) {
+        copy = alloc_page();
+        if (!copy) {
+            return -1;
+        }
+        memcpy(copy, frame, PAGE_SIZE);
+        mm->nr_cow++;
+    }
+    *pte = (uint32_t)copy | (old & ~(PTE_FRAME | PTE_COW)) | PTE_WRITE;
+    if (read_cr3() == (uint32_t)mm->pgdir) {
+        invlpg(page);
+    }
+    if (copy != frame) {
+        free_page(frame);
+    }
+    return 0;
+}
+
+// Map the file's own frame instead of a copy. Only a shared region may
+// write to it, a private one gets it copy-on-write.
+static int mm_fault_file(mm_t* mm, mm_region_t* region, uint32_t page, bool write) {
+    uint32_t frame = vfs_mmap_page(region->node, region->offset + (page - region->start));
+    if (!frame) {
+        return -1;
+    }
+    uint32_t flags = region->flags;
+    if ((flags & PTE_WRITE) && !(flags & PTE_SHARED)) {
+        flags = (flags & ~PTE_WRITE) | PTE_COW;
+    }
+    if (mm_map_page(mm, page, frame, flags) != 0) {
+        free_page((void*)frame);
+        return -1;
+    }
+    mm->nr_faults++;
+    if (write && (flags & PTE_COW)) {
+        return mm_unshare(mm, mm_pte(mm, page, false), page);
+    }
+    return 0;
+}
+
+int mm_fault(mm_t* mm, uint32_t vaddr, bool write) {
+    if (!mm || !user_range_ok(vaddr, 1)) {
+        return -1;
+    }
+    uint32_t page = vaddr & ~(PAGE_SIZE - 1);
+    uint32_t* pte = mm_pte(mm, page, false);
+    if (pte && (*pte & PTE_PRESENT)) {
+        if (write && (*pte & PTE_COW)) {
+            return mm_unshare(mm, pte, page);
+        }
+        return (!write || (*pte & PTE_WRITE)) ? 0 : -1;
+    }
+
+    mm_region_t* region = NULL;
+    for (uint32_t i = 0; i < mm->nr_regions; i++) {
+        if (page >= mm->regions[i].start && page < mm->regions[i].end) {
+            region = &mm->regions[i];
+            break;
+        }
+    }
+    if (!region || (write && !(region->flags & PTE_WRITE))) {
+        return -1;
+    }
+
+    // Only whole pages of file data: the rest of a page that is cut
+    // short (an ELF .data followed by .bss) must read zeros, not what
+    // follows in the file. A page holding the end of the file is whole
+    // as well, memfs keeps the bytes past it zero.
+    uint32_t in_region = page - region->start;
+    if (in_region < region->file_len && region->node->mmap_page &&
+        (in_region + PAGE_SIZE <= region->file_len ||
+         region->offset + region->file_len >= region->node->length)) {
+        return mm_fault_file(mm, region, page, write);
+    }
+
+    uint8_t* frame = alloc_page();
+    if (!frame) {
+        return -1;
+    }
+    memset(frame, 0, PAGE_SIZE);
+    if (in_region < region->file_len) {
+        uint32_t len = region->file_len - in_region;
+        vfs_read(region->node, region->offset + in_region, len < PAGE_SIZE ? len : PAGE_SIZE, frame);
+    }
+    if (mm_map_page(mm, page, (uint32_t)frame, region->flags) != 0) {
+        free_page(frame);
+        return -1;
+    }
+    mm->nr_faults++;
+    return 0;
+}
+
+uint32_t mm_share_page(mm_t* mm, uint32_t vaddr) {
+    if (!mm || (vaddr & (PAGE_SIZE - 1)) || !user_range_ok(vaddr, PAGE_SIZE)) {
+        return 0;
+    }
+    uint32_t* pte = mm_pte(mm, vaddr, false);
+    // Shared memory stays writable to its other users, who could change
+    // the frame after it was handed over
+    if (!pte || !(*pte & PTE_PRESENT) || (*pte & (PTE_NOFREE | PTE_SHARED))) {
+        return 0;
+    }
+    if (*pte & PTE_WRITE) {
+        *pte = (*pte & ~PTE_WRITE) | PTE_COW;
+        if (read_cr3() == (uint32_t)mm->pgdir) {
+            invlpg(vaddr);
+        }
+    }
+    page_get((void*)(*pte & PTE_FRAME));
+    return *pte & PTE_FRAME;
+}
+
+int mm_insert_shared(mm_t* mm, uint32_t vaddr, uint32_t frame) {
+    if (!mm || (vaddr & (PAGE_SIZE - 1)) || !user_range_ok(vaddr, PAGE_SIZE)) {
+        return -1;
+    }
+    uint32_t* pte = mm_pte(mm, vaddr, false);
+    // A shared page must keep its frame, or the data would never reach
+    // the other users
+    if (!pte || !(*pte & PTE_PRESENT) || (*pte & (PTE_NOFREE | PTE_SHARED)) ||
+        !(*pte & (PTE_WRITE | PTE_COW))) {
+        return -1;
+    }
+    uint32_t old = *pte;
+    *pte = frame | (old & ~(PTE_FRAME | PTE_WRITE)) | PTE_COW;
+    if (read_cr3() == (uint32_t)mm->pgdir) {
+        invlpg(vaddr);
+    }
+    free_page((void*)(old & PTE_FRAME));
+    return 0;
+}
+
+uint32_t mm_translate(mm_t* mm, uint32_t vaddr) {
+    if (!user_range_ok(vaddr, 1)) {
+        return 0;
+    }
+    uint32_t* pte = mm_pte(mm, vaddr, false);
+    if (!pte || !(*pte & PTE_PRESENT)) {
+        return 0;
+    }
+    return (*pte & PTE_FRAME) | (vaddr & (PAGE_SIZE - 1));
+}
+
+// Copy page by page through the identity mapping of the frames
+static int mm_copy(mm_t* mm, uint32_t vaddr, uint8_t* buf, uint32_t len, bool to_mm) {
+    if (!user_range_ok(vaddr, len)) {
+        return -1;
+    }
+    while (len) {
+        uint32_t chunk = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (chunk > len) {
+            chunk = len;
+        }
+        uint32_t* pte = mm_pte(mm, vaddr, false);
+        if ((!pte || !(*pte & PTE_PRESENT)) && mm_fault(mm, vaddr, false) == 0) {
+            pte = mm_pte(mm, vaddr, false);
+        }
+        if (!pte || !(*pte & PTE_PRESENT)) {
+            return -1;
+        }
+        // Protections are ignored, but a shared frame is never written
+        if (to_mm && (*pte & PTE_COW) && mm_unshare(mm, pte, vaddr & ~(PAGE_SIZE - 1)) != 0) {
+            return -1;
+        }
+        uint32_t paddr = (*pte & PTE_FRAME) | (vaddr & (PAGE_SIZE - 1));
+        if (to_mm) {
+            memcpy((void*)paddr, buf, chunk);
+        } else {
+            memcpy(buf, (void*)paddr, chunk);
+        }
+        vaddr += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int mm_write(mm_t* mm, uint32_t vaddr, const void* src, uint32_t len) {
+    return mm_copy(mm, vaddr, (uint8_t*)src, len, true);
+}
+
+int mm_read(mm_t* mm, uint32_t vaddr, void* dst, uint32_t len) {
+    return mm_copy(mm, vaddr, dst, len, false);
+}
+
+void switch_mm(mm_t* mm) {
+    if (!paging_on) {
+        return;
+    }
+    uint32_t pgdir = mm ? (uint32_t)mm->pgdir : (uint32_t)kernel_pgdir;
+    // Reloading flushes the non-global TLB entries, skip it when nothing changes
+    if (read_cr3() != pgdir) {
+        write_cr3(pgdir);
+    }
+}
+
+bool user_access_ok(const void* addr, uint32_t len, bool write) {
+    mm_t* mm = current_task()->mm;
+    uint32_t start = (uint32_t)addr;
+    if (!mm || !user_range_ok(start, len)) {
+        return false;
+    }
+    if (len == 0) {
+        return true;
+    }
+
+    uint32_t need = PTE_PRESENT | PTE_USER | (write ? PTE_WRITE : 0);
+    uint32_t last = (start + len - 1) & ~(PAGE_SIZE - 1);
+    for (uint32_t page = start & ~(PAGE_SIZE - 1); ; page += PAGE_SIZE) {
+        uint32_t* pte = mm_pte(mm, page, false);
+        if ((!pte || (*pte & need) != need) && mm_fault(mm, page, write) == 0) {
+            pte = mm_pte(mm, page, false);
+        }
+        if (!pte || (*pte & need) != need) {
+            return false;
+        }
+        if (page == last) {
+            return true;
+        }
+    }
+}
+
+int copy_from_user(void* dst, const void* src, uint32_t len) {
+    if (!user_access_ok(src, len, false)) {
+        return -1;
+    }
+    memcpy(dst, src, len);
+    return 0;
+}
+
+int copy_to_user(void* dst, const void* src, uint32_t len) {
+    if (!user_access_ok(dst, len, true)) {
+        return -1;
+    }
+    memcpy(dst, src, len);
+    return 0;
+}
+
+int32_t strncpy_from_user(char* dst, const char* src, uint32_t max) {
+    uint32_t checked_to = 0;   // First address not validated yet
+    for (uint32_t i = 0; i < max; i++) {
+        uint32_t addr = (uint32_t)src + i;
+        if (addr >= checked_to) {
+            if (!user_access_ok(src + i, 1, false)) {
+                return -1;
+            }
+            checked_to = (addr & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+        }
+        dst[i] = src[i];
+        if (dst[i] == '\0') {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,136 @@
+#include "basedos.h"
+#include "process.h"
+#include "paging.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "wait.h"
+#include "fs/console.h"
+
+typedef struct {
+    volatile uint32_t pid;     // Child task id, 0 until the parent set it up
+    uint32_t parent;           // Parent task id, 0 once the parent stopped waiting
+    mm_t* mm;                  // Address space the child runs in
+    interrupt_frame_t frame;   // User registers it starts with
+    int exit_code;
+    bool exited;
+    bool used;
+} child_t;
+
+static child_t children[MAX_CHILDREN];
+static spinlock_t children_lock = SPINLOCK_INIT;
+
+// Woken when a child is set up and when one exits
+static DECLARE_WAIT_QUEUE_HEAD(children_wq);
+
+static child_t* child_alloc(uint32_t parent) {
+    child_t* child = NULL;
+    uint32_t flags = spin_lock_irqsave(&children_lock);
+    for (uint32_t i = 0; i < MAX_CHILDREN; i++) {
+        if (!children[i].used) {
+            child = &children[i];
+            child->used = true;
+            child->pid = 0;
+            child->parent = parent;
+            child->exited = false;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&children_lock, flags);
+    return child;
+}
+
+static void child_free(child_t* child) {
+    uint32_t flags = spin_lock_irqsave(&children_lock);
+    child->used = false;
+    spin_unlock_irqrestore(&children_lock, flags);
+}
+
+// Kernel thread of a child. It waits until the parent has given it the
+// FPU state, then resumes the parent's registers with fork() returning 0.
+static void fork_child(void* arg) {
+    child_t* child = arg;
+    wait_event(children_wq, child->pid != 0);
+
+    int code = user_run_frame(child->mm, &child->frame);
+    mm_destroy(child->mm);
+    console_unredirect();
+
+    uint32_t flags = spin_lock_irqsave(&children_lock);
+    child->exit_code = code;
+    child->exited = true;
+    if (!child->parent) {
+        child->used = false;
+    }
+    spin_unlock_irqrestore(&children_lock, flags);
+    wake_up_all(&children_wq);
+}
+
+int32_t process_fork(void) {
+    task_t* parent = current_task();
+    child_t* child = child_alloc(parent->id);
+    if (!child) {
+        return -1;
+    }
+    child->mm = mm_fork(parent->mm);
+    if (!child->mm) {
+        child_free(child);
+        return -1;
+    }
+    child->frame = *user_frame(parent);
+    child->frame.eax = 0;
+
+    task_t* task = kthread_create(parent->name, fork_child, child);
+    if (!task) {
+        mm_destroy(child->mm);
+        child_free(child);
+        return -1;
+    }
+    fpu_fork(task);
+    console_redirect_inherit(task);
+    child->pid = task->id;
+    wake_up_all(&children_wq);
+    return task->id;
+}
+
+// Reap an exited child of parent matching pid: its pid, 0 when matching
+// children are all still running, -1 when there is none
+static int32_t child_reap(uint32_t parent, int32_t pid, int* status) {
+    int32_t ret = -1;
+    uint32_t flags = spin_lock_irqsave(&children_lock);
+    for (uint32_t i = 0; i < MAX_CHILDREN; i++) {
+        child_t* child = &children[i];
+        if (!child->used || child->parent != parent || (pid != -1 && (int32_t)child->pid != pid)) {
+            continue;
+        }
+        if (child->exited) {
+            *status = child->exit_code;
+            ret = child->pid;
+            child->used = false;
+            break;
+        }
+        ret = 0;
+    }
+    spin_unlock_irqrestore(&children_lock, flags);
+    return ret;
+}
+
+int32_t process_wait(int32_t pid, int* status) {
+    uint32_t parent = current_task()->id;
+    int32_t ret;
+    wait_event(children_wq, (ret = child_reap(parent, pid, status)) != 0);
+    return ret;
+}
+
+void process_orphan_children(void) {
+    uint32_t parent = current_task()->id;
+    uint32_t flags = spin_lock_irqsave(&children_lock);
+    for (uint32_t i = 0; i < MAX_CHILDREN; i++) {
+        child_t* child = &children[i];
+        if (child->used && child->parent == parent) {
+            child->parent = 0;
+            child->used = !child->exited;
+        }
+    }
+    spin_unlock_irqrestore(&children_lock, flags);
+}
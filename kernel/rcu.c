@@ -0,0 +1,200 @@
+#include "basedos.h"
+#include "rcu.h"
+#include "smp.h"
+#include "softirq.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "time.h"
+#include "div64.h"
+#include "string.h"
+
+// Grace periods are numbered; grace period completed + 1 is the one
+// running while in_progress is set. Each online CPU clears its bit in
+// qs_pending at its next quiescent state, the last one ends it.
+static struct {
+    spinlock_t lock;
+    volatile uint32_t completed;
+    volatile bool in_progress;
+    volatile uint32_t qs_pending;    // CPUs that still owe a quiescent state
+    bool requested;                  // Start another one when this one ends
+    uint64_t started_ns;
+    uint64_t total_ns;               // Summed length of completed grace periods
+} rcu_state = { .lock = SPINLOCK_INIT };
+
+// Callbacks of one CPU. New ones wait on the next list until they are
+// assigned a grace period, then on the wait list until it completes.
+// Only the owning CPU touches them, with interrupts disabled.
+typedef struct {
+    rcu_head_t* next_head;
+    rcu_head_t* next_tail;
+    rcu_head_t* wait_head;
+    rcu_head_t* wait_tail;
+    uint32_t wait_gp;        // Grace period the wait list needs
+    uint32_t queued;
+    uint32_t invoked;
+    uint32_t qs;             // Quiescent states reported
+} __attribute__((aligned(64))) rcu_data_t;
+
+static rcu_data_t rcu_data[NR_CPUS];
+
+// synchronize_rcu() callers, woken from the softirq after each grace period
+static DECLARE_WAIT_QUEUE_HEAD(rcu_gp_wq);
+
+// Rcu_state locked. Readers that started before this moment may still run
+// on any online CPU, so all of them have to pass a quiescent state.
+static void rcu_start_gp(void) {
+    if (rcu_state.in_progress) {
+        rcu_state.requested = true;
+        return;
+    }
+    uint32_t mask = 0;
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu_online(cpu)) {
+            mask |= 1u << cpu;
+        }
+    }
+    rcu_state.qs_pending = mask;
+    rcu_state.in_progress = true;
+    rcu_state.started_ns = ktime_get_ns();
+}
+
+// Grace period a caller needs: one starting after now
+static uint32_t rcu_gp_needed(void) {
+    return rcu_state.completed + (rcu_state.in_progress ? 2 : 1);
+}
+
+void rcu_note_qs(void) {
+    uint32_t cpu = smp_processor_id();
+    uint32_t bit = 1u << cpu;
+    // Nothing owed in the common case, checked without the lock
+    if (!(rcu_state.qs_pending & bit)) {
+        return;
+    }
+
+    spin_lock(&rcu_state.lock);
+    if (rcu_state.qs_pending & bit) {
+        rcu_state.qs_pending &= ~bit;
+        rcu_data[cpu].qs++;
+        if (!rcu_state.qs_pending) {
+            rcu_state.completed++;
+            rcu_state.in_progress = false;
+            rcu_state.total_ns += ktime_get_ns() - rcu_state.started_ns;
+            if (rcu_state.requested) {
+                rcu_state.requested = false;
+                rcu_start_gp();
+            }
+            // The scheduler may call in with a run queue locked, waking
+            // tasks and running callbacks is left to the softirq
+            raise_softirq_irqoff(RCU_SOFTIRQ);
+        }
+    }
+    spin_unlock(&rcu_state.lock);
+}
+
+// Move callbacks along, interrupts disabled. Returns the callbacks whose
+// grace period has completed.
+static rcu_head_t* rcu_advance(rcu_data_t* rd) {
+    rcu_head_t* done = NULL;
+    if (rd->wait_head && (int32_t)(rcu_state.completed - rd->wait_gp) >= 0) {
+        done = rd->wait_head;
+        rd->wait_head = rd->wait_tail = NULL;
+    }
+    if (!rd->wait_head && rd->next_head) {
+        spin_lock(&rcu_state.lock);
+        rd->wait_gp = rcu_gp_needed();
+        rcu_start_gp();
+        spin_unlock(&rcu_state.lock);
+        rd->wait_head = rd->next_head;
+        rd->wait_tail = rd->next_tail;
+        rd->next_head = rd->next_tail = NULL;
+    }
+    return done;
+}
+
+void call_rcu(rcu_head_t* head, void (*func)(rcu_head_t* head)) {
+    head->func = func;
+    head->next = NULL;
+
+    uint32_t flags = irq_save();
+    rcu_data_t* rd = &rcu_data[smp_processor_id()];
+    if (rd->next_tail) {
+        rd->next_tail->next = head;
+    } else {
+        rd->next_head = head;
+    }
+    rd->next_tail = head;
+    rd->queued++;
+    // Start the grace period now rather than on the next tick
+    if (!rd->wait_head) {
+        raise_softirq_irqoff(RCU_SOFTIRQ);
+    }
+    irq_restore(flags);
+}
+
+void synchronize_rcu(void) {
+    // Readers never sleep or get preempted, so with one CPU none can be
+    // running while a task sleeps in here
+    if (smp_num_cpus() == 1) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&rcu_state.lock);
+    uint32_t target = rcu_gp_needed();
+    rcu_start_gp();
+    spin_unlock_irqrestore(&rcu_state.lock, flags);
+
+    wait_event(rcu_gp_wq, (int32_t)(rcu_state.completed - target) >= 0);
+}
+
+void rcu_sched_tick(bool quiescent) {
+    uint32_t flags = irq_save();
+    if (quiescent) {
+        rcu_note_qs();
+    }
+    rcu_data_t* rd = &rcu_data[smp_processor_id()];
+    if ((rd->wait_head && (int32_t)(rcu_state.completed - rd->wait_gp) >= 0) ||
+        (!rd->wait_head && rd->next_head)) {
+        raise_softirq_irqoff(RCU_SOFTIRQ);
+    }
+    irq_restore(flags);
+}
+
+static void rcu_softirq(void) {
+    disable_interrupts();
+    rcu_data_t* rd = &rcu_data[smp_processor_id()];
+    rcu_head_t* list = rcu_advance(rd);
+    enable_interrupts();
+
+    uint32_t invoked = 0;
+    while (list) {
+        // The callback usually frees the head
+        rcu_head_t* head = list;
+        list = list->next;
+        head->func(head);
+        invoked++;
+    }
+    rd->invoked += invoked;
+
+    if (waitqueue_active(&rcu_gp_wq)) {
+        wake_up_all(&rcu_gp_wq);
+    }
+}
+
+void rcu_initialize(void) {
+    memset(rcu_data, 0, sizeof(rcu_data));
+    open_softirq(RCU_SOFTIRQ, rcu_softirq);
+}
+
+void rcu_show(void) {
+    uint32_t completed = rcu_state.completed;
+    uint32_t avg_us = completed ? (uint32_t)div64_u32(rcu_state.total_ns, completed) / 1000 : 0;
+    printk("RCU: %u grace periods, average %u us, %s\n", completed, avg_us,
+           rcu_state.in_progress ? "one in progress" : "idle");
+    printk("  CPU  QUIESCENT    QUEUED   INVOKED\n");
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu_online(cpu)) {
+            rcu_data_t* rd = &rcu_data[cpu];
+            printk("  %3u  %9u  %8u  %8u\n", cpu, rd->qs, rd->queued, rd->invoked);
+        }
+    }
+}
@@ -0,0 +1,1101 @@
+#include "basedos.h"
+#include "sched.h"
+#include "memory.h"
+#include "softirq.h"
+#include "smp.h"
+#include "string.h"
+#include "spinlock.h"
+#include "sched_trace.h"
+#include "time.h"
+#include "div64.h"
+#include "rcu.h"
+#include "paging.h"
+
+// FIFO of ready tasks at one priority
+typedef struct {
+    task_t* head;
+    task_t* tail;
+} prio_queue_t;
+
+// Per-CPU scheduler state. The lock protects the queues and is held
+// across switch_to, the next task releases it in finish_task_switch. It is
+// a ticket lock so remote wakeups and stealing CPUs are served in order.
+typedef struct {
+    ticketlock_t lock;
+    uint32_t cpu;
+    task_t* current;
+    task_t* idle;
+    task_t* last;              // Task switched away from, finished by the next task
+    task_t* dead;              // Exited tasks waiting to be reaped
+    prio_queue_t queues[SCHED_PRIORITIES];
+    uint32_t ready_bitmap;     // Bit n set when queues[n] is not empty
+    volatile uint32_t nr_ready;    // Normal tasks in queues[]
+    task_t* dl_head;           // Ready deadline tasks, earliest deadline first
+    volatile uint32_t nr_dl_ready;
+    task_t* dl_throttled;      // Deadline tasks waiting for their next period
+    uint32_t dl_util;          // Bandwidth reserved by deadline tasks, under dl_bw_lock
+    task_t* sync_next;         // Woken by wake_up_task_sync(), runs next while queued
+    volatile bool need_resched;
+    uint32_t preempt_count;
+    uint32_t nr_switches;
+} __attribute__((aligned(64))) runqueue_t;
+
+static runqueue_t runqueues[NR_CPUS];
+static task_t boot_task;              // Boot context, becomes CPU 0's idle task
+static task_t* all_tasks = NULL;
+static rwlock_t tasks_lock = RWLOCK_INIT;    // all_tasks and next_task_id, read-mostly
+static uint32_t next_task_id = 1;
+static bool sched_ready = false;
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;   // Deadline admission, dl_util of all CPUs
+
+// switch_to(&prev->esp, next->esp): save the callee-saved registers on the
+// current stack, store the stack pointer and resume the next task from its
+// saved stack. New tasks start in task_trampoline with ebx = entry, esi = arg.
+void switch_to(uint32_t* prev_esp, uint32_t next_esp);
+void task_trampoline(void);
+
+asm (
+    ".pushsection .text\n"
+    ".global switch_to\n"
+    "switch_to:\n"
+    "    mov 4(%esp), %eax\n"
+    "    mov 8(%esp), %edx\n"
+    "    push %ebp\n"
+    "    push %ebx\n"
+    "    push %esi\n"
+    "    push %edi\n"
+    "    mov %esp, (%eax)\n"
+    "    mov %edx, %esp\n"
+    "    pop %edi\n"
+    "    pop %esi\n"
+    "    pop %ebx\n"
+    "    pop %ebp\n"
+    "    ret\n"
+    ".global task_trampoline\n"
+    "task_trampoline:\n"
+    "    call finish_task_switch\n"
+    "    sti\n"
+    "    push %esi\n"
+    "    call *%ebx\n"
+    "    call task_exit\n"
+    ".popsection\n"
+);
+
+static inline runqueue_t* cpu_rq(uint32_t cpu) {
+    return &runqueues[cpu];
+}
+
+// Run queue of the calling CPU, interrupts must be disabled
+static inline runqueue_t* this_rq(void) {
+    return cpu_rq(smp_processor_id());
+}
+
+static void rq_enqueue(runqueue_t* rq, task_t* task) {
+    prio_queue_t* q = &rq->queues[task->prio];
+    task->next = NULL;
+    task->prev = q->tail;
+    if (q->tail) {
+        q->tail->next = task;
+    } else {
+        q->head = task;
+    }
+    q->tail = task;
+    task->cpu = rq->cpu;
+    rq->ready_bitmap |= 1u << task->prio;
+    rq->nr_ready++;
+}
+
+static void rq_remove(runqueue_t* rq, task_t* task) {
+    prio_queue_t* q = &rq->queues[task->prio];
+    if (task->prev) {
+        task->prev->next = task->next;
+    } else {
+        q->head = task->next;
+    }
+    if (task->next) {
+        task->next->prev = task->prev;
+    } else {
+        q->tail = task->prev;
+    }
+    if (!q->head) {
+        rq->ready_bitmap &= ~(1u << task->prio);
+    }
+    if (rq->sync_next == task) {
+        rq->sync_next = NULL;
+    }
+    task->next = task->prev = NULL;
+    rq->nr_ready--;
+}
+
+// Highest priority ready task, constant time regardless of the task count
+static task_t* rq_dequeue(runqueue_t* rq) {
+    if (!rq->ready_bitmap) {
+        return NULL;
+    }
+    task_t* task = rq->queues[__builtin_ctz(rq->ready_bitmap)].head;
+    rq_remove(rq, task);
+    return task;
+}
+
+static inline bool task_is_dl(task_t* task) {
+    return task->policy == SCHED_DEADLINE;
+}
+
+static inline bool dl_before(task_t* a, task_t* b) {
+    return (int64_t)(a->dl.abs_deadline - b->dl.abs_deadline) < 0;
+}
+
+// Deadline tasks are few, a list sorted by deadline is enough. Equal
+// deadlines keep FIFO order.
+static void dl_enqueue(runqueue_t* rq, task_t* task) {
+    task_t* prev = NULL;
+    task_t* pos = rq->dl_head;
+    while (pos && !dl_before(task, pos)) {
+        prev = pos;
+        pos = pos->next;
+    }
+    task->prev = prev;
+    task->next = pos;
+    if (prev) {
+        prev->next = task;
+    } else {
+        rq->dl_head = task;
+    }
+    if (pos) {
+        pos->prev = task;
+    }
+    task->cpu = rq->cpu;
+    rq->nr_dl_ready++;
+}
+
+static void dl_remove(runqueue_t* rq, task_t* task) {
+    if (task->prev) {
+        task->prev->next = task->next;
+    } else {
+        rq->dl_head = task->next;
+    }
+    if (task->next) {
+        task->next->prev = task->prev;
+    }
+    task->next = task->prev = NULL;
+    rq->nr_dl_ready--;
+}
+
+static void enqueue_task(runqueue_t* rq, task_t* task) {
+    if (task_is_dl(task)) {
+        dl_enqueue(rq, task);
+    } else {
+        rq_enqueue(rq, task);
+    }
+}
+
+// Earliest deadline first, then the highest priority normal task
+static task_t* pick_next_task(runqueue_t* rq) {
+    task_t* task = rq->dl_head;
+    if (task) {
+        dl_remove(rq, task);
+        return task;
+    }
+    return rq_dequeue(rq);
+}
+
+// Ask for a reschedule if task should run before the current one
+static bool check_preempt(runqueue_t* rq, task_t* task) {
+    task_t* cur = rq->current;
+    bool preempt;
+    if (cur == rq->idle) {
+        preempt = true;
+    } else if (task_is_dl(task)) {
+        preempt = !task_is_dl(cur) || dl_before(task, cur);
+    } else {
+        preempt = !task_is_dl(cur) && task->prio < cur->prio;
+    }
+    if (preempt) {
+        rq->need_resched = true;
+    }
+    return preempt;
+}
+
+static bool rq_is_idle(runqueue_t* rq) {
+    return rq->current == rq->idle && rq->nr_ready == 0 && rq->nr_dl_ready == 0;
+}
+
+// Charge the running deadline task for the time since the last update.
+// A job still running past its deadline counts as missed once.
+static void dl_update_curr(task_t* task, uint64_t now) {
+    sched_dl_t* dl = &task->dl;
+    dl->runtime_left -= (int64_t)(now - dl->last_update);
+    dl->last_update = now;
+    if (!dl->missed && (int64_t)(now - dl->abs_deadline) > 0) {
+        dl->missed = true;
+        dl->nr_missed++;
+    }
+}
+
+// Start the next period after a throttle. Periods that passed while the
+// task could not run are skipped; an overrun is paid back from the new
+// budget.
+static void dl_replenish(task_t* task, uint64_t now) {
+    sched_dl_t* dl = &task->dl;
+    dl->release += dl->period;
+    if ((int64_t)(now - dl->release) >= (int64_t)dl->period) {
+        dl->release = now;
+    }
+    dl->abs_deadline = dl->release + dl->deadline;
+    dl->runtime_left = (dl->runtime_left < 0 ? dl->runtime_left : 0) + (int64_t)dl->runtime;
+    dl->missed = false;
+    dl->nr_periods++;
+}
+
+// Constant bandwidth server rule for a waking task: keep the current job
+// only if the budget left fits its bandwidth before the deadline,
+// otherwise start a new job now so a late wakeup cannot take more than
+// runtime/period of the CPU
+static void dl_wakeup(task_t* task, uint64_t now) {
+    sched_dl_t* dl = &task->dl;
+    if ((int64_t)(dl->abs_deadline - now) > 0 && dl->runtime_left > 0) {
+        // Scaled down so the products fit 64 bits
+        uint64_t left = ((uint64_t)dl->runtime_left >> 10) * (dl->period >> 10);
+        uint64_t room = ((dl->abs_deadline - now) >> 10) * (dl->runtime >> 10);
+        if (left <= room) {
+            return;
+        }
+    }
+    dl->release = now;
+    dl->abs_deadline = now + dl->deadline;
+    dl->runtime_left = (int64_t)dl->runtime;
+    dl->missed = false;
+    dl->nr_periods++;
+}
+
+// Park a deadline task that used up its budget or finished its job until
+// the next period, scheduler_tick() queues it again
+static void dl_throttle(runqueue_t* rq, task_t* task) {
+    if (!task->dl.yielded) {
+        task->dl.nr_overruns++;
+    }
+    task->dl.yielded = false;
+    task->state = TASK_THROTTLED;
+    task->prev = NULL;
+    task->next = rq->dl_throttled;
+    rq->dl_throttled = task;
+}
+
+// Queue throttled tasks whose next period has started, rq locked
+static void dl_release_throttled(runqueue_t* rq, uint64_t now) {
+    task_t** link = &rq->dl_throttled;
+    while (*link) {
+        task_t* task = *link;
+        if ((int64_t)(now - (task->dl.release + task->dl.period)) < 0) {
+            link = &task->next;
+            continue;
+        }
+        *link = task->next;
+        dl_replenish(task, now);
+        task->state = TASK_READY;
+        dl_enqueue(rq, task);
+        check_preempt(rq, task);
+    }
+}
+
+// Lock the run queue a task is queued on, retrying if it migrates meanwhile
+static runqueue_t* task_rq_lock(task_t* task, uint32_t* flags) {
+    while (1) {
+        *flags = irq_save();
+        runqueue_t* rq = cpu_rq(task->cpu);
+        ticket_lock(&rq->lock);
+        if (rq->cpu == task->cpu) {
+            return rq;
+        }
+        ticket_unlock_irqrestore(&rq->lock, *flags);
+    }
+}
+
+// True when another online CPU has tasks waiting, read without locks
+static bool other_cpu_busy(runqueue_t* rq) {
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        // Deadline tasks stay on their CPU, only normal ones count
+        if (cpu != rq->cpu && cpu_online(cpu) && cpu_rq(cpu)->nr_ready) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Take the highest priority normal task from the busiest other CPU. Called
+// with rq locked, the other queue is only try-locked so two CPUs stealing
+// from each other cannot deadlock.
+static task_t* steal_task(runqueue_t* rq) {
+    runqueue_t* busiest = NULL;
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        runqueue_t* src = cpu_rq(cpu);
+        if (src == rq || !cpu_online(cpu) || !src->nr_ready) {
+            continue;
+        }
+        if (!busiest || src->nr_ready > busiest->nr_ready) {
+            busiest = src;
+        }
+    }
+
+    if (!busiest || !ticket_trylock(&busiest->lock)) {
+        return NULL;
+    }
+    task_t* task = rq_dequeue(busiest);
+    if (task) {
+        task->cpu = rq->cpu;
+    }
+    ticket_unlock(&busiest->lock);
+    return task;
+}
+
+// Prefer the CPU the task last ran on, unless it is busy and another is idle
+static uint32_t select_task_cpu(task_t* task) {
+    uint32_t cpu = task->cpu;
+    if (!cpu_online(cpu)) {
+        cpu = smp_processor_id();
+    }
+    if (rq_is_idle(cpu_rq(cpu))) {
+        return cpu;
+    }
+    for (uint32_t i = 0; i < NR_CPUS; i++) {
+        if (cpu_online(i) && rq_is_idle(cpu_rq(i))) {
+            return i;
+        }
+    }
+    return cpu;
+}
+
+// Queue a waking task on a CPU, interrupts must be disabled. Deadline
+// tasks always go to the CPU their bandwidth is reserved on.
+static void activate_task(task_t* task) {
+    uint32_t cpu;
+    if (task_is_dl(task)) {
+        cpu = task->dl.cpu;
+        dl_wakeup(task, ktime_get_ns());
+    } else {
+        cpu = select_task_cpu(task);
+    }
+    runqueue_t* rq = cpu_rq(cpu);
+
+    ticket_lock(&rq->lock);
+    enqueue_task(rq, task);
+    task->state = TASK_READY;
+    trace_sched_wakeup(smp_processor_id(), task, cpu);
+    bool resched = check_preempt(rq, task);
+    ticket_unlock(&rq->lock);
+
+    if (resched && cpu != smp_processor_id()) {
+        smp_send_reschedule(cpu);
+    }
+}
+
+task_t* current_task(void) {
+    uint32_t flags = irq_save();
+    task_t* task = this_rq()->current;
+    irq_restore(flags);
+    return task;
+}
+
+bool sched_can_block(void) {
+    if (!sched_ready) {
+        return false;
+    }
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    bool can_block = rq->current != rq->idle;
+    irq_restore(flags);
+    return can_block;
+}
+
+bool sched_has_ready_tasks(void) {
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    bool ready = rq->nr_ready != 0 || rq->nr_dl_ready != 0;
+    irq_restore(flags);
+    return ready;
+}
+
+uint32_t sched_nr_running(uint32_t cpu) {
+    runqueue_t* rq = cpu_rq(cpu);
+    return rq->nr_ready + rq->nr_dl_ready + (rq->current != rq->idle);
+}
+
+uint32_t sched_nr_switches(uint32_t cpu) {
+    return cpu_rq(cpu)->nr_switches;
+}
+
+// Runs on the new task right after switch_to, interrupts still disabled
+// and the run queue still locked by schedule()
+void finish_task_switch(void) {
+    runqueue_t* rq = this_rq();
+    task_t* prev = rq->last;
+    rq->last = NULL;
+
+    if (prev && prev->state == TASK_DEAD) {
+        prev->next = rq->dead;
+        rq->dead = prev;
+    }
+    // A deadline task switched out on a CPU other than its own moves there.
+    // Checked under the lock, once it is dropped wakers may change prev.
+    bool migrate = prev && prev->state == TASK_WAKING;
+
+    // The context of prev is saved, a waker on another CPU may queue it now
+    ticket_unlock(&rq->lock);
+
+    if (migrate) {
+        activate_task(prev);
+    }
+}
+
+// A preempted task is queued again even if it was about to block: it
+// may not have checked its wakeup condition yet, and wait_event() will
+// set the blocked state again before checking
+static void __schedule(bool preempt) {
+    if (!sched_ready) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    task_t* prev = rq->current;
+
+    if (prev->magic != STACK_MAGIC) {
+        kernel_panic("Kernel stack overflow");
+    }
+
+    ticket_lock(&rq->lock);
+    rq->need_resched = false;
+    rcu_note_qs();
+    bool dl = task_is_dl(prev);
+    uint64_t now_ns = dl ? ktime_get_ns() : 0;
+    if (dl) {
+        dl_update_curr(prev, now_ns);
+    }
+    if (prev->state == TASK_RUNNING || (preempt && prev->state == TASK_BLOCKED)) {
+        prev->state = TASK_READY;
+        if (dl && (prev->dl.yielded || prev->dl.runtime_left <= 0)) {
+            dl_throttle(rq, prev);
+            // Its next period may have started already when it ran late
+            dl_release_throttled(rq, now_ns);
+        } else if (dl && prev->dl.cpu != rq->cpu) {
+            // Queued on its own CPU by finish_task_switch
+            prev->state = TASK_WAKING;
+        } else if (prev != rq->idle) {
+            enqueue_task(rq, prev);
+        }
+    }
+
+    // A synchronous wakeup hands the CPU over, unless a deadline task waits
+    task_t* next = rq->sync_next;
+    if (next && !rq->dl_head) {
+        rq_remove(rq, next);
+    } else {
+        next = pick_next_task(rq);
+    }
+    if (!next) {
+        next = steal_task(rq);
+    }
+    if (!next) {
+        next = rq->idle;
+    }
+    next->state = TASK_RUNNING;
+    next->time_slice = SCHED_TIME_SLICE;
+
+    if (next != prev) {
+        // CPU time accounting and tracing, all under the run queue lock
+        uint64_t now = rdtsc();
+        uint64_t runtime = now - prev->exec_start;
+        prev->sum_exec += runtime;
+        next->exec_start = now;
+        if (task_is_dl(next)) {
+            next->dl.last_update = ktime_get_ns();
+        }
+        next->nr_switches++;
+        rq->nr_switches++;
+        trace_sched_switch(rq->cpu, prev, next, runtime, now);
+        fpu_switch(prev, next);
+        if (next->mm != prev->mm) {
+            switch_mm(next->mm);
+        }
+        // Where the CPU switches stacks when next is interrupted in user mode
+        this_cpu()->tss.esp0 = next->user_esp0;
+
+        next->cpu = rq->cpu;
+        rq->current = next;
+        rq->last = prev;
+        switch_to(&prev->esp, next->esp);
+
+        // Back on this task, possibly on another CPU
+        finish_task_switch();
+    } else {
+        ticket_unlock(&rq->lock);
+    }
+
+    irq_restore(flags);
+}
+
+void schedule(void) {
+    __schedule(false);
+}
+
+void yield(void) {
+    schedule();
+}
+
+void wake_up_task_boost(task_t* task, uint32_t boost) {
+    uint32_t flags;
+    runqueue_t* rq = task_rq_lock(task, &flags);
+    if (task->state != TASK_BLOCKED) {
+        ticket_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    task->prio = task->static_prio > boost ? task->static_prio - boost : SCHED_PRIO_HIGHEST;
+    if (rq->current == task) {
+        // Marked blocked but not switched out yet, it just keeps running
+        task->state = TASK_RUNNING;
+        ticket_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    // Switched out: rq->current only changes with the lock held until the
+    // next task runs, so its context is saved and it may run anywhere
+    task->state = TASK_WAKING;
+    ticket_unlock(&rq->lock);
+    activate_task(task);
+    irq_restore(flags);
+}
+
+void wake_up_task(task_t* task) {
+    wake_up_task_boost(task, 0);
+}
+
+void wake_up_task_sync(task_t* task) {
+    uint32_t flags;
+    runqueue_t* rq = task_rq_lock(task, &flags);
+    if (task->state != TASK_BLOCKED) {
+        ticket_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    if (rq->current == task) {
+        task->state = TASK_RUNNING;
+        ticket_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    task->state = TASK_WAKING;
+    ticket_unlock(&rq->lock);
+
+    if (task_is_dl(task)) {
+        // Its bandwidth is reserved on its own CPU
+        activate_task(task);
+    } else {
+        rq = this_rq();
+        ticket_lock(&rq->lock);
+        task->prio = task->static_prio;
+        rq_enqueue(rq, task);
+        task->state = TASK_READY;
+        trace_sched_wakeup(rq->cpu, task, rq->cpu);
+        rq->sync_next = task;
+        rq->need_resched = true;
+        ticket_unlock(&rq->lock);
+    }
+    irq_restore(flags);
+}
+
+void set_current_state(uint32_t state) {
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    if (rq->current == rq->idle) {
+        kernel_panic("Idle task blocked");
+    }
+    rq->current->state = state;
+    irq_restore(flags);
+}
+
+void sched_set_priority(task_t* task, uint32_t prio) {
+    if (prio > SCHED_PRIO_LOWEST) {
+        prio = SCHED_PRIO_LOWEST;
+    }
+
+    uint32_t flags;
+    runqueue_t* rq;
+    while (1) {
+        rq = task_rq_lock(task, &flags);
+        // A task woken onto another CPU meanwhile is queued there
+        if (task->state != TASK_READY || task->cpu == rq->cpu) {
+            break;
+        }
+        ticket_unlock_irqrestore(&rq->lock, flags);
+    }
+
+    task->static_prio = prio;
+    bool resched = false;
+    if (task == rq->idle) {
+        task->static_prio = SCHED_PRIO_LOWEST;
+    } else if (task_is_dl(task)) {
+        // Used once it is a normal task again
+        task->prio = prio;
+    } else if (task->state == TASK_READY) {
+        rq_remove(rq, task);
+        task->prio = prio;
+        rq_enqueue(rq, task);
+        resched = check_preempt(rq, task);
+    } else if (task->state == TASK_RUNNING) {
+        task->prio = prio;
+        if (rq->dl_head || (rq->ready_bitmap && (uint32_t)__builtin_ctz(rq->ready_bitmap) < prio)) {
+            rq->need_resched = true;
+            resched = true;
+        }
+    }
+    // Blocked tasks take the new priority when they are woken
+    ticket_unlock(&rq->lock);
+
+    if (resched && rq->cpu != smp_processor_id()) {
+        smp_send_reschedule(rq->cpu);
+    }
+    irq_restore(flags);
+}
+
+int sched_set_deadline(uint32_t runtime_us, uint32_t deadline_us, uint32_t period_us) {
+    if (!sched_can_block()) {
+        return -1;
+    }
+    if (deadline_us == 0) {
+        deadline_us = period_us;
+    }
+    uint32_t util = 0;
+    if (runtime_us) {
+        if (period_us < SCHED_DL_MIN_PERIOD_US || period_us > SCHED_DL_MAX_PERIOD_US ||
+            runtime_us > deadline_us || deadline_us > period_us) {
+            return -1;
+        }
+        util = (uint32_t)div64_u32((uint64_t)runtime_us << 20, period_us);
+    }
+    task_t* task = current_task();
+
+    // Admission control: a CPU takes deadline tasks while their total
+    // bandwidth stays under the limit, so every deadline can be met. The
+    // current CPU is kept if it fits, otherwise the least loaded one is used.
+    uint32_t limit = (SCHED_DL_MAX_UTIL << 20) / 100;
+    uint32_t flags = spin_lock_irqsave(&dl_bw_lock);
+    if (task_is_dl(task)) {
+        cpu_rq(task->dl.cpu)->dl_util -= task->dl.util;
+    }
+    uint32_t cpu = NR_CPUS;
+    if (util) {
+        if (cpu_rq(smp_processor_id())->dl_util + util <= limit) {
+            cpu = smp_processor_id();
+        } else {
+            for (uint32_t i = 0; i < NR_CPUS; i++) {
+                if (cpu_online(i) && cpu_rq(i)->dl_util + util <= limit &&
+                    (cpu == NR_CPUS || cpu_rq(i)->dl_util < cpu_rq(cpu)->dl_util)) {
+                    cpu = i;
+                }
+            }
+        }
+        if (cpu == NR_CPUS) {
+            if (task_is_dl(task)) {
+                cpu_rq(task->dl.cpu)->dl_util += task->dl.util;
+            }
+            spin_unlock_irqrestore(&dl_bw_lock, flags);
+            return -1;
+        }
+        cpu_rq(cpu)->dl_util += util;
+    }
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+
+    flags = irq_save();
+    runqueue_t* rq = this_rq();
+    ticket_lock(&rq->lock);
+    if (util) {
+        sched_dl_t* dl = &task->dl;
+        uint64_t now = ktime_get_ns();
+        if (!task_is_dl(task)) {
+            memset(dl, 0, sizeof(sched_dl_t));
+        }
+        dl->runtime = runtime_us * NSEC_PER_USEC;
+        dl->deadline = deadline_us * NSEC_PER_USEC;
+        dl->period = period_us * NSEC_PER_USEC;
+        dl->util = util;
+        dl->cpu = cpu;
+        dl->release = now;
+        dl->abs_deadline = now + dl->deadline;
+        dl->runtime_left = (int64_t)dl->runtime;
+        dl->last_update = now;
+        dl->yielded = false;
+        dl->missed = false;
+        dl->nr_periods++;
+        task->policy = SCHED_DEADLINE;
+        if (cpu != rq->cpu) {
+            rq->need_resched = true;
+        }
+    } else {
+        task->policy = SCHED_NORMAL;
+        task->prio = task->static_prio;
+        if (rq->dl_head || (rq->ready_bitmap && (uint32_t)__builtin_ctz(rq->ready_bitmap) < task->prio)) {
+            rq->need_resched = true;
+        }
+    }
+    bool resched = rq->need_resched;
+    ticket_unlock_irqrestore(&rq->lock, flags);
+
+    // Switching out moves a deadline task to its reserved CPU
+    if (resched) {
+        schedule();
+    }
+    return 0;
+}
+
+void sched_dl_yield(void) {
+    uint32_t flags = irq_save();
+    task_t* cur = this_rq()->current;
+    if (task_is_dl(cur)) {
+        cur->dl.yielded = true;
+    }
+    irq_restore(flags);
+    schedule();
+}
+
+task_t* find_task(uint32_t id) {
+    uint32_t flags = read_lock_irqsave(&tasks_lock);
+    task_t* t = all_tasks;
+    while (t && t->id != id) {
+        t = t->all_next;
+    }
+    read_unlock_irqrestore(&tasks_lock, flags);
+    return t;
+}
+
+// Time slice accounting, run from SCHED_SOFTIRQ on every timer tick
+void scheduler_tick(void) {
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    ticket_lock(&rq->lock);
+    task_t* cur = rq->current;
+
+    if (rq->dl_throttled || task_is_dl(cur)) {
+        uint64_t now = ktime_get_ns();
+        dl_release_throttled(rq, now);
+        if (task_is_dl(cur)) {
+            dl_update_curr(cur, now);
+        }
+    }
+
+    if (cur == rq->idle) {
+        if (rq->nr_ready || rq->nr_dl_ready || other_cpu_busy(rq)) {
+            rq->need_resched = true;
+        }
+    } else if (task_is_dl(cur)) {
+        // No time slices, it runs until its budget is gone or an earlier
+        // deadline is ready
+        if (cur->dl.runtime_left <= 0 || (rq->dl_head && dl_before(rq->dl_head, cur))) {
+            rq->need_resched = true;
+        }
+    } else if (rq->dl_head) {
+        rq->need_resched = true;
+    } else if (cur->time_slice == 0 || --cur->time_slice == 0) {
+        // A full slice used up ends any interactive boost
+        cur->prio = cur->static_prio;
+        rq->need_resched = true;
+    } else if (rq->ready_bitmap && (uint32_t)__builtin_ctz(rq->ready_bitmap) < cur->prio) {
+        rq->need_resched = true;
+    }
+    // Readers run with preemption disabled, none was interrupted otherwise
+    bool quiescent = rq->preempt_count == 0;
+    ticket_unlock_irqrestore(&rq->lock, flags);
+
+    rcu_sched_tick(quiescent);
+}
+
+// Called on the way out of an interrupt with interrupts disabled
+void preempt_schedule_irq(void) {
+    runqueue_t* rq = this_rq();
+    if (sched_ready && rq->need_resched && rq->preempt_count == 0 && !in_interrupt()) {
+        __schedule(true);
+    }
+}
+
+void preempt_disable(void) {
+    uint32_t flags = irq_save();
+    this_rq()->preempt_count++;
+    irq_restore(flags);
+}
+
+void preempt_enable(void) {
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    if (--rq->preempt_count == 0 && rq->need_resched && !in_interrupt()) {
+        __schedule(true);
+    }
+    irq_restore(flags);
+}
+
+// Allocate a task with its stack, the task structure sits at the bottom
+static task_t* task_alloc(const char* name) {
+    void* stack = alloc_pages(THREAD_STACK_PAGES);
+    if (!stack) {
+        return NULL;
+    }
+
+    task_t* task = (task_t*)stack;
+    memset(task, 0, sizeof(task_t));
+    strncpy(task->name, name, TASK_NAME_LEN - 1);
+    task->stack = stack;
+    task->fpu_cpu = FPU_NO_CPU;
+    task->magic = STACK_MAGIC;
+    return task;
+}
+
+static void task_link(task_t* task, bool new_id) {
+    uint32_t flags = write_lock_irqsave(&tasks_lock);
+    if (new_id) {
+        task->id = next_task_id++;
+    }
+    task->all_next = all_tasks;
+    all_tasks = task;
+    write_unlock_irqrestore(&tasks_lock, flags);
+}
+
+task_t* kthread_create(const char* name, void (*fn)(void* arg), void* arg) {
+    if (!sched_ready) {
+        return NULL;
+    }
+
+    reap_dead_tasks();
+
+    task_t* task = task_alloc(name);
+    if (!task) {
+        return NULL;
+    }
+    task->entry = fn;
+    task->arg = arg;
+    task->prio = SCHED_PRIO_DEFAULT;
+    task->static_prio = SCHED_PRIO_DEFAULT;
+
+    // Initial frame popped by switch_to: edi, esi, ebx, ebp, return address
+    uint32_t* sp = (uint32_t*)((uint8_t*)task->stack + THREAD_STACK_SIZE);
+    *--sp = 0;                          // Padding at the top of the stack
+    *--sp = (uint32_t)task_trampoline;
+    *--sp = 0;                          // ebp
+    *--sp = (uint32_t)fn;               // ebx
+    *--sp = (uint32_t)arg;              // esi
+    *--sp = 0;                          // edi
+    task->esp = (uint32_t)sp;
+    task->state = TASK_WAKING;
+
+    task_link(task, true);
+
+    uint32_t flags = irq_save();
+    task->cpu = smp_processor_id();
+    activate_task(task);
+    irq_restore(flags);
+
+    return task;
+}
+
+// Adapter for create_task(): entry points without an argument
+static void task_entry_noarg(void* arg) {
+    ((void (*)(void))arg)();
+}
+
+uint32_t create_task(void (*entry_point)(void)) {
+    task_t* task = kthread_create("task", task_entry_noarg, (void*)entry_point);
+    return task ? task->id : 0;
+}
+
+void task_exit(void) {
+    // Give back reserved deadline bandwidth
+    if (task_is_dl(current_task())) {
+        sched_set_deadline(0, 0, 0);
+    }
+
+    disable_interrupts();
+    runqueue_t* rq = this_rq();
+    if (rq->current == rq->idle) {
+        kernel_panic("Idle task exited");
+    }
+    rq->current->state = TASK_DEAD;
+    schedule();
+
+    // A dead task is never scheduled again
+    while (1) {
+        asm volatile("hlt");
+    }
+}
+
+uint32_t reap_dead_tasks(void) {
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    ticket_lock(&rq->lock);
+    task_t* list = rq->dead;
+    rq->dead = NULL;
+    ticket_unlock(&rq->lock);
+
+    // Unlink from the task list before the memory goes away
+    write_lock(&tasks_lock);
+    for (task_t* t = list; t; t = t->next) {
+        task_t** link = &all_tasks;
+        while (*link && *link != t) {
+            link = &(*link)->all_next;
+        }
+        if (*link) {
+            *link = t->all_next;
+        }
+    }
+    write_unlock_irqrestore(&tasks_lock, flags);
+
+    uint32_t reaped = 0;
+    while (list) {
+        task_t* t = list;
+        list = list->next;
+        free_pages(t->stack, THREAD_STACK_PAGES);
+        reaped++;
+    }
+    return reaped;
+}
+
+void cpu_idle(void) {
+    while (1) {
+        reap_dead_tasks();
+        do_softirq();
+
+        disable_interrupts();
+        rcu_note_qs();
+        runqueue_t* rq = this_rq();
+        if (rq->nr_ready || rq->nr_dl_ready || rq->need_resched || other_cpu_busy(rq)) {
+            enable_interrupts();
+            schedule();
+            continue;
+        }
+        // sti takes effect after hlt starts, so no wakeup is lost
+        asm volatile("sti\n\thlt");
+    }
+}
+
+const char* task_state_name(uint32_t state) {
+    switch (state) {
+        case TASK_RUNNING: return "running";
+        case TASK_READY: return "ready";
+        case TASK_BLOCKED: return "blocked";
+        case TASK_DEAD: return "dead";
+        case TASK_WAKING: return "waking";
+        case TASK_THROTTLED: return "throttled";
+        default: return "?";
+    }
+}
+
+void sched_show_tasks(void) {
+    printk("  ID  CPU  PRIO     STATE  NAME\n");
+    uint32_t flags = read_lock_irqsave(&tasks_lock);
+    for (task_t* t = all_tasks; t; t = t->all_next) {
+        printk("%4u  %3u  %2u/%2u  %8s  %s\n", t->id, t->cpu, t->prio, t->static_prio,
+               task_state_name(t->state), t->name);
+    }
+    read_unlock_irqrestore(&tasks_lock, flags);
+}
+
+void sched_dl_show(void) {
+    printk("   ID  CPU  RUNTIME  DEADLINE   PERIOD  PERIODS  MISSED  OVERRUNS  NAME\n");
+    uint32_t flags = read_lock_irqsave(&tasks_lock);
+    for (task_t* t = all_tasks; t; t = t->all_next) {
+        if (!task_is_dl(t)) {
+            continue;
+        }
+        sched_dl_t* dl = &t->dl;
+        printk("  %3u  %3u  %7u  %8u  %7u  %7u  %6u  %8u  %s\n", t->id, dl->cpu,
+               (uint32_t)div64_u32(dl->runtime, NSEC_PER_USEC),
+               (uint32_t)div64_u32(dl->deadline, NSEC_PER_USEC),
+               (uint32_t)div64_u32(dl->period, NSEC_PER_USEC),
+               dl->nr_periods, dl->nr_missed, dl->nr_overruns, t->name);
+    }
+    read_unlock_irqrestore(&tasks_lock, flags);
+
+    printk("Times in us. Bandwidth reserved, at most %u%% per CPU:\n", SCHED_DL_MAX_UTIL);
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu_online(cpu)) {
+            uint32_t permille = (uint32_t)(((uint64_t)cpu_rq(cpu)->dl_util * 1000) >> 20);
+            printk("  CPU %u: %3u.%u%%\n", cpu, permille / 10, permille % 10);
+        }
+    }
+}
+
+uint32_t sched_task_stats(task_stat_t* stats, uint32_t max) {
+    uint32_t count = 0;
+    uint32_t flags = read_lock_irqsave(&tasks_lock);
+    for (task_t* t = all_tasks; t && count < max; t = t->all_next) {
+        task_stat_t* st = &stats[count++];
+        uint32_t rq_flags;
+        runqueue_t* rq = task_rq_lock(t, &rq_flags);
+        st->task = t;
+        st->id = t->id;
+        st->cpu = t->cpu;
+        st->state = t->state;
+        st->prio = t->prio;
+        st->nr_switches = t->nr_switches;
+        st->exec_cycles = t->sum_exec;
+        if (rq->current == t) {
+            st->exec_cycles += rdtsc() - t->exec_start;
+        }
+        ticket_unlock_irqrestore(&rq->lock, rq_flags);
+        memcpy(st->name, t->name, TASK_NAME_LEN);
+    }
+    read_unlock_irqrestore(&tasks_lock, flags);
+    return count;
+}
+
+static void sched_softirq(void) {
+    scheduler_tick();
+}
+
+task_t* sched_create_idle(uint32_t cpu) {
+    task_t* idle = task_alloc("idle");
+    if (!idle) {
+        return NULL;
+    }
+    idle->cpu = cpu;
+    idle->state = TASK_RUNNING;
+    idle->prio = SCHED_PRIO_LOWEST;
+    idle->static_prio = SCHED_PRIO_LOWEST;
+    return idle;
+}
+
+void sched_initialize_ap(task_t* idle) {
+    uint32_t flags = irq_save();
+    runqueue_t* rq = this_rq();
+    rq->current = idle;
+    rq->idle = idle;
+    idle->exec_start = rdtsc();
+    irq_restore(flags);
+
+    // Idle tasks share id 0
+    task_link(idle, false);
+}
+
+void sched_initialize(void) {
+    memset(runqueues, 0, sizeof(runqueues));
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        runqueues[cpu].cpu = cpu;
+        ticket_lock_init(&runqueues[cpu].lock);
+    }
+    runqueue_t* rq = this_rq();
+
+    // The boot context keeps running on the boot stack as the idle task
+    memset(&boot_task, 0, sizeof(task_t));
+    boot_task.id = 0;
+    strcpy(boot_task.name, "idle");
+    boot_task.cpu = rq->cpu;
+    boot_task.state = TASK_RUNNING;
+    boot_task.prio = SCHED_PRIO_LOWEST;
+    boot_task.static_prio = SCHED_PRIO_LOWEST;
+    boot_task.fpu_cpu = FPU_NO_CPU;
+    boot_task.magic = STACK_MAGIC;
+    boot_task.exec_start = rdtsc();
+    boot_task.all_next = NULL;
+    all_tasks = &boot_task;
+
+    rq->current = &boot_task;
+    rq->idle = &boot_task;
+
+    open_softirq(SCHED_SOFTIRQ, sched_softirq);
+    sched_ready = true;
+}
@@ -0,0 +1,170 @@
+#include "basedos.h"
+#include "sched_trace.h"
+#include "time.h"
+#include "timer.h"
+#include "div64.h"
+#include "string.h"
+
+trace_buffer_t trace_buffers[NR_CPUS];
+
+static uint32_t cycles_to_us(uint64_t cycles) {
+    return (uint32_t)div64_u32(cycles_to_ns(cycles), 1000);
+}
+
+// Other CPUs keep recording while this runs, an event being written at
+// the moment it is copied may show up garbled
+void trace_show(uint32_t cpu, uint32_t count) {
+    if (cpu >= NR_CPUS || !cpu_online(cpu)) {
+        printk("CPU %u is not online\n", cpu);
+        return;
+    }
+
+    trace_buffer_t* buf = &trace_buffers[cpu];
+    uint32_t head = buf->head;
+    if (count > TRACE_EVENTS) {
+        count = TRACE_EVENTS;
+    }
+    if (count > head) {
+        count = head;
+    }
+    uint64_t now = rdtsc();
+
+    printk("CPU %u: %u events recorded, last %u (times in us before now)\n", cpu, head, count);
+    for (uint32_t i = head - count; i != head; i++) {
+        trace_event_t ev = buf->events[i & (TRACE_EVENTS - 1)];
+        uint32_t ago = ev.tsc < now ? cycles_to_us(now - ev.tsc) : 0;
+        if (ev.type == TRACE_SWITCH) {
+            printk("  %9u  switch  %3u -> %3u  ran %7u us, prio %2u, %s\n", ago, ev.id, ev.next_id,
+                   cycles_to_us(ev.runtime), ev.prio, task_state_name(ev.state));
+        } else if (ev.type == TRACE_WAKEUP) {
+            printk("  %9u  wakeup  %3u on CPU %u, prio %2u\n", ago, ev.id, ev.cpu, ev.prio);
+        }
+    }
+}
+
+// top keeps the previous sample to turn counters into rates. Only the
+// shell runs it, so the samples can be static instead of on its stack.
+#define TOP_MAX_TASKS 48
+#define TOP_SHOW_TASKS 12
+
+static task_stat_t top_prev[TOP_MAX_TASKS];
+static task_stat_t top_cur[TOP_MAX_TASKS];
+static uint32_t top_prev_count;
+static uint32_t top_cpu_switches[NR_CPUS];
+
+typedef struct {
+    task_stat_t* st;
+    uint32_t permille;     // CPU time in tenths of a percent of one CPU
+    uint32_t switches;
+} top_row_t;
+
+static const task_stat_t* top_find_prev(const task_stat_t* st) {
+    for (uint32_t i = 0; i < top_prev_count; i++) {
+        if (top_prev[i].task == st->task && top_prev[i].id == st->id) {
+            return &top_prev[i];
+        }
+    }
+    return NULL;
+}
+
+// Share of the interval, both in cycles scaled down to fit 32 bits
+static uint32_t top_permille(uint64_t delta, uint64_t interval) {
+    uint32_t div = (uint32_t)(interval >> 10);
+    if (div == 0) {
+        return 0;
+    }
+    uint64_t p = div64_u32((delta >> 10) * 1000, div);
+    return p > 1000 ? 1000 : (uint32_t)p;
+}
+
+static uint32_t top_rate(uint32_t count, uint64_t interval_ns) {
+    uint32_t ms = (uint32_t)div64_u32(interval_ns, NSEC_PER_MSEC);
+    return ms ? (uint32_t)div64_u32((uint64_t)count * 1000, ms) : 0;
+}
+
+static void top_sample(uint64_t interval_cycles, uint64_t interval_ns) {
+    uint32_t count = sched_task_stats(top_cur, TOP_MAX_TASKS);
+    top_row_t rows[TOP_SHOW_TASKS];
+    uint32_t nr_rows = 0;
+    uint32_t cpu_idle[NR_CPUS];
+    memset(cpu_idle, 0, sizeof(cpu_idle));
+
+    for (uint32_t i = 0; i < count; i++) {
+        task_stat_t* st = &top_cur[i];
+        const task_stat_t* prev = top_find_prev(st);
+        uint64_t exec = st->exec_cycles - (prev ? prev->exec_cycles : 0);
+        top_row_t row = { st, top_permille(exec, interval_cycles),
+                          st->nr_switches - (prev ? prev->nr_switches : 0) };
+
+        if (st->id == 0) {
+            if (st->cpu < NR_CPUS) {
+                cpu_idle[st->cpu] = row.permille;
+            }
+            continue;
+        }
+
+        // Keep the busiest tasks, sorted by CPU time
+        uint32_t pos = nr_rows < TOP_SHOW_TASKS ? nr_rows++ : TOP_SHOW_TASKS;
+        while (pos > 0 && rows[pos - 1].permille < row.permille) {
+            if (pos < TOP_SHOW_TASKS) {
+                rows[pos] = rows[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < TOP_SHOW_TASKS) {
+            rows[pos] = row;
+        }
+    }
+
+    terminal_clear();
+    printk("top - %u CPUs, %u tasks, %u ms interval, press any key to quit\n\n",
+           smp_num_cpus(), count, (uint32_t)div64_u32(interval_ns, NSEC_PER_MSEC));
+    printk("  CPU   IDLE%%  RUNQ  SWITCH/S\n");
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (!cpu_online(cpu)) {
+            continue;
+        }
+        uint32_t switches = sched_nr_switches(cpu);
+        printk("  %3u  %3u.%u  %4u  %8u\n", cpu, cpu_idle[cpu] / 10, cpu_idle[cpu] % 10,
+               sched_nr_running(cpu), top_rate(switches - top_cpu_switches[cpu], interval_ns));
+        top_cpu_switches[cpu] = switches;
+    }
+
+    printk("\n   ID  CPU  PRIO    CPU%%  SWITCH/S     STATE  NAME\n");
+    for (uint32_t i = 0; i < nr_rows; i++) {
+        task_stat_t* st = rows[i].st;
+        printk("  %3u  %3u  %4u  %3u.%u  %8u  %8s  %s\n", st->id, st->cpu, st->prio,
+               rows[i].permille / 10, rows[i].permille % 10,
+               top_rate(rows[i].switches, interval_ns), task_state_name(st->state), st->name);
+    }
+
+    memcpy(top_prev, top_cur, count * sizeof(task_stat_t));
+    top_prev_count = count;
+}
+
+void sched_top(uint32_t interval_ms) {
+    // The first sample only establishes the baseline
+    top_prev_count = sched_task_stats(top_prev, TOP_MAX_TASKS);
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        top_cpu_switches[cpu] = sched_nr_switches(cpu);
+    }
+    uint64_t last_cycles = rdtsc();
+    uint64_t last_ns = ktime_get_ns();
+
+    while (1) {
+        // Sleep in short steps so a key press is noticed quickly
+        for (uint32_t slept = 0; slept < interval_ms && !keyboard_haschar(); slept += 100) {
+            msleep(100);
+        }
+        if (keyboard_haschar()) {
+            keyboard_getchar();
+            return;
+        }
+
+        uint64_t now_cycles = rdtsc();
+        uint64_t now_ns = ktime_get_ns();
+        top_sample(now_cycles - last_cycles, now_ns - last_ns);
+        last_cycles = now_cycles;
+        last_ns = now_ns;
+    }
+}
@@ -1,8 +1,27 @@
 #include "basedos.h"
 #include "string.h"
 #include "fs/vfs.h"
+#include "memory.h"
 #include "sound.h"
 #include "io.h"
+#include "time.h"
+#include "div64.h"
+#include "latency.h"
+#include "sched.h"
+#include "cpu.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include "sched_trace.h"
+#include "async.h"
+#include "rcu.h"
+#include "syscall.h"
+#include "sysbench.h"
+#include "exec.h"
+#include "wait.h"
+#include "fs/pipe.h"
+#include "fs/console.h"
+#include "fs/poll.h"
 
 // External VFS root
 extern fs_node_t* fs_root;
@@ -12,20 +31,32 @@ extern fs_node_t* fs_root;
 #define HISTORY_SIZE 10
 #define MAX_ARGS 16
 #define MAX_ALIASES 20
+#define MAX_PIPELINE 4
 
 // Command history
 static char history[HISTORY_SIZE][MAX_INPUT];
 static int history_pos = 0;
 static int current_history = -1;
 
-// Command aliases
-typedef struct {
+// Command aliases, looked up under RCU on every command. Updates replace
+// the whole entry so a lookup never sees a half-copied command. Entries
+// come from a static pool: kfree() cannot give heap memory back. There
+// is room for every alias plus as many replaced ones still waiting for
+// their grace period.
+typedef struct alias {
+    rcu_head_t rcu;
+    struct alias* next;
     char alias[32];
     char command[MAX_INPUT];
+    bool used;             // Pool slot taken, until the grace period ends
 } alias_t;
 
-static alias_t aliases[MAX_ALIASES];
+#define ALIAS_POOL_SIZE (MAX_ALIASES * 2)
+
+static alias_t alias_pool[ALIAS_POOL_SIZE];
+static alias_t* aliases = NULL;
 static int alias_count = 0;
+static spinlock_t aliases_lock = SPINLOCK_INIT;
 
 // Shell state
 static struct {
@@ -44,9 +75,21 @@ static struct {
 
 // Enhanced delay function
 void delay(int milliseconds) {
-    for (int i = 0; i < milliseconds * 1000; i++) {
-        asm volatile("nop");
-    }
+    mdelay(milliseconds);
+}
+
+// Print uptime with millisecond resolution
+static void print_uptime(void) {
+    uint64_t ms = div64_u32(ktime_get_ns(), NSEC_PER_MSEC);
+    uint32_t rem = div64_u32_rem(&ms, 1000);
+    printk("System uptime: %llu.%03u seconds\n", ms, rem);
+}
+
+static void print_date(void) {
+    rtc_time_t tm;
+    wall_clock_get(&tm);
+    printk("%u-%02u-%02u %02u:%02u:%02u UTC\n",
+           tm.year, tm.month, tm.day, tm.hour, tm.minute, tm.second);
 }
 
 // Color printing functions
@@ -76,64 +119,158 @@ static void print_warning(const char* text) {
     print_color(text, 14); // Yellow
 }
 
-// Command parsing
-static int parse_command(const char* input, char* args[]) {
-    static char buffer[MAX_INPUT];
+// Command parsing, into the caller's buffer of MAX_INPUT characters so
+// the commands of a pipeline can be parsed at the same time
+static int parse_command(const char* input, char* buffer, char* args[]) {
     strcpy(buffer, input);
     
     int argc = 0;
-    char* token = strtok(buffer, " \t");
+    char* save;
+    char* token = strtok_r(buffer, " \t", &save);
     
     while (token != NULL && argc < MAX_ARGS - 1) {
         args[argc++] = token;
-        token = strtok(NULL, " \t");
+        token = strtok_r(NULL, " \t", &save);
     }
     
     args[argc] = NULL;
     return argc;
 }
 
+static bool resolve_alias(const char* name, char* command);
+
+// Parse a command line, expanding an alias in the first word
+static int parse_command_line(const char* input, char* buffer, char* args[]) {
+    int argc = parse_command(input, buffer, args);
+    
+    // Resolve aliases
+    char resolved_cmd[MAX_INPUT];
+    if (argc > 0 && resolve_alias(args[0], resolved_cmd)) {
+        // Re-parse if alias was resolved
+        argc = parse_command(resolved_cmd, buffer, args);
+    }
+    return argc;
+}
+
 // Alias management
+static alias_t* alias_alloc(void) {
+    alias_t* entry = NULL;
+    uint32_t flags = spin_lock_irqsave(&aliases_lock);
+    for (int i = 0; i < ALIAS_POOL_SIZE; i++) {
+        if (!alias_pool[i].used) {
+            entry = &alias_pool[i];
+            entry->used = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&aliases_lock, flags);
+    return entry;
+}
+
+static void alias_free(alias_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&aliases_lock);
+    entry->used = false;
+    spin_unlock_irqrestore(&aliases_lock, flags);
+}
+
+static void alias_free_rcu(rcu_head_t* head) {
+    alias_free((alias_t*)head);   // rcu is the first member
+}
+
+// Writers hold aliases_lock
+static alias_t* find_alias_locked(const char* alias_name) {
+    for (alias_t* a = aliases; a; a = a->next) {
+        if (strcmp(a->alias, alias_name) == 0) {
+            return a;
+        }
+    }
+    return NULL;
+}
+
 static void add_alias(const char* alias_name, const char* command) {
-    if (alias_count >= MAX_ALIASES) {
-        print_error("Maximum aliases reached\n");
+    if (strlen(alias_name) >= sizeof(((alias_t*)0)->alias)) {
+        print_error("Alias name too long\n");
         return;
     }
-    
-    // Check if alias already exists
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].alias, alias_name) == 0) {
-            strcpy(aliases[i].command, command);
-            print_success("Alias updated\n");
-            return;
-        }
+    alias_t* entry = alias_alloc();
+    if (!entry) {
+        print_error("Too many alias updates waiting, try again\n");
+        return;
+    }
+    strcpy(entry->alias, alias_name);
+    strncpy(entry->command, command, MAX_INPUT - 1);
+    entry->command[MAX_INPUT - 1] = '\0';
+
+    uint32_t flags = spin_lock_irqsave(&aliases_lock);
+    alias_t* old = find_alias_locked(alias_name);
+    bool added = false;
+    if (old) {
+        rcu_list_replace(aliases, old, entry);
+    } else if (alias_count < MAX_ALIASES) {
+        rcu_list_add(aliases, entry);
+        alias_count++;
+        added = true;
+    }
+    spin_unlock_irqrestore(&aliases_lock, flags);
+
+    if (old) {
+        // Freed once no lookup can still be reading it
+        call_rcu(&old->rcu, alias_free_rcu);
+        print_success("Alias updated\n");
+    } else if (added) {
+        print_success("Alias added\n");
+    } else {
+        alias_free(entry);
+        print_error("Maximum aliases reached\n");
+    }
+}
+
+static void remove_alias(const char* alias_name) {
+    uint32_t flags = spin_lock_irqsave(&aliases_lock);
+    alias_t* old = find_alias_locked(alias_name);
+    if (old) {
+        rcu_list_del(aliases, old);
+        alias_count--;
+    }
+    spin_unlock_irqrestore(&aliases_lock, flags);
+
+    if (old) {
+        call_rcu(&old->rcu, alias_free_rcu);
+        print_success("Alias removed\n");
+    } else {
+        print_error("No such alias\n");
     }
-    
-    strcpy(aliases[alias_count].alias, alias_name);
-    strcpy(aliases[alias_count].command, command);
-    alias_count++;
-    print_success("Alias added\n");
 }
 
-static const char* resolve_alias(const char* cmd) {
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].alias, cmd) == 0) {
-            return aliases[i].command;
+// Copy the command an alias stands for into out, false if cmd is no alias
+static bool resolve_alias(const char* cmd, char* out) {
+    bool found = false;
+    alias_t* a;
+    rcu_read_lock();
+    rcu_list_for_each(a, aliases) {
+        if (strcmp(a->alias, cmd) == 0) {
+            strcpy(out, a->command);
+            found = true;
+            break;
         }
     }
-    return cmd;
+    rcu_read_unlock();
+    return found;
 }
 
 static void list_aliases(void) {
-    if (alias_count == 0) {
+    if (!rcu_dereference(aliases)) {
         print_info("No aliases defined\n");
         return;
     }
     
     print_info("Defined aliases:\n");
-    for (int i = 0; i < alias_count; i++) {
-        printk("  %s -> %s\n", aliases[i].alias, aliases[i].command);
+    alias_t* a;
+    rcu_read_lock();
+    rcu_list_for_each(a, aliases) {
+        printk("  %s -> %s\n", a->alias, a->command);
     }
+    rcu_read_unlock();
 }
 
 // History management
@@ -164,6 +301,12 @@ static void show_system_info(void) {
     printk("OS Version: BasedOS v0.1\n");
     printk("Architecture: x86 32-bit\n");
     printk("Uptime: %d seconds\n", get_uptime());
+    if (tsc_khz_get()) {
+        printk("Clocksource: %s, %u.%03u MHz\n", clocksource_name(),
+               tsc_khz_get() / 1000, tsc_khz_get() % 1000);
+    } else {
+        printk("Clocksource: %s\n", clocksource_name());
+    }
     
     uint32_t total_mem, free_mem;
     get_memory_stats(&total_mem, &free_mem);
@@ -271,24 +414,210 @@ static void calculator(int argc, char* args[]) {
 }
 
 // Enhanced command execution
-static void execute_command(const char* input) {
-    if (strlen(input) == 0) return;
-    
-    add_to_history(input);
-    
-    char* args[MAX_ARGS];
-    int argc = parse_command(input, args);
-    
-    if (argc == 0) return;
-    
-    // Resolve aliases
-    const char* resolved_cmd = resolve_alias(args[0]);
-    if (resolved_cmd != args[0]) {
-        // Re-parse if alias was resolved
-        argc = parse_command(resolved_cmd, args);
+// CPU-bound background thread, used to check the shell stays responsive
+static void spin_thread(void* arg) {
+    uint64_t end = ktime_get_ns() + (uint64_t)(uint32_t)arg * NSEC_PER_SEC;
+    while (ktime_get_ns() < end) {
+        cpu_relax();
     }
-    
-    shell_state.last_exit_code = 0;
+}
+
+// Periodic real-time thread for 'edf test': each period it busy-waits
+// for three quarters of its runtime, like an audio buffer refill
+static uint32_t edf_test_runtime_us;
+static uint32_t edf_test_period_us;
+
+static void edf_test_thread(void* arg) {
+    uint64_t end = ktime_get_ns() + (uint64_t)(uint32_t)arg * NSEC_PER_SEC;
+    if (sched_set_deadline(edf_test_runtime_us, 0, edf_test_period_us) != 0) {
+        print_error("edf: admission failed\n");
+        return;
+    }
+    while (ktime_get_ns() < end) {
+        udelay(edf_test_runtime_us * 3 / 4);
+        sched_dl_yield();
+    }
+}
+
+// Writer for 'evloop': a line into the pipe every half second until the
+// loop closes its end
+static void evloop_ticker(void* arg) {
+    fs_node_t* out = arg;
+    for (int n = 1; ; n++) {
+        msleep(500);
+        char line[24] = "tick ";
+        itoa(n, line + 5, 10);
+        strcat(line, "\n");
+        if (vfs_write(out, 0, strlen(line), (uint8_t*)line) == 0) {
+            break;
+        }
+    }
+    vfs_close(out);
+}
+
+// Event loop over the keyboard and a pipe with one epoll set: sleeps
+// until either has input or a second passes, never spins
+static int evloop_run(int seconds) {
+    fs_node_t* in;
+    fs_node_t* out;
+    if (pipe_create(&in, &out) != 0) {
+        print_error("Out of pipes\n");
+        return 1;
+    }
+    int32_t pipe_fd = open_node(in, O_RDONLY);
+    vfs_close(in);
+    int32_t epfd = epoll_create();
+    epoll_event_t key_event = { EPOLLIN, 0 };
+    epoll_event_t pipe_event = { EPOLLIN, 1 };
+    if (pipe_fd < 0 || epfd < 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &key_event) != 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, pipe_fd, &pipe_event) != 0 ||
+        !kthread_create("ticker", evloop_ticker, out)) {
+        print_error("evloop: setup failed\n");
+        vfs_close(out);
+        close(pipe_fd);
+        close(epfd);
+        return 1;
+    }
+
+    printk("Waiting for keys and ticks for %d seconds, q quits\n", seconds);
+    uint64_t end = ktime_get_ns() + (uint64_t)seconds * NSEC_PER_SEC;
+    uint32_t wakeups = 0, timeouts = 0;
+    bool quit = false;
+    while (!quit && ktime_get_ns() < end) {
+        epoll_event_t events[EPOLL_MAX_EVENTS];
+        int32_t n = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, 1000);
+        wakeups++;
+        if (n == 0) {
+            timeouts++;
+        }
+        for (int32_t i = 0; i < n; i++) {
+            if (events[i].data == 0) {
+                char c = keyboard_getchar();
+                printk("key '%c'\n", c);
+                quit |= c == 'q';
+            } else {
+                char buffer[64];
+                int32_t len = read(pipe_fd, buffer, sizeof(buffer) - 1);
+                buffer[len > 0 ? len : 0] = '\0';
+                printk("pipe: %s", buffer);
+            }
+        }
+    }
+
+    // The ticker sees the readers gone and exits
+    close(epfd);
+    close(pipe_fd);
+    printk("%u wakeups, %u timeouts\n", wakeups, timeouts);
+    return 0;
+}
+
+// Busy work items for 'wq test', each runs for wq_test_ms
+#define WQ_TEST_ITEMS 8
+static work_t wq_test_work[WQ_TEST_ITEMS];
+static uint32_t wq_test_ms;
+
+static void wq_test_func(work_t* work) {
+    (void)work;
+    uint64_t end = ktime_get_ns() + (uint64_t)wq_test_ms * NSEC_PER_MSEC;
+    while (ktime_get_ns() < end) {
+        cpu_relax();
+    }
+}
+
+// Coroutines for 'async test': each sleeps a few times and frees itself
+#define ASYNC_TEST_SLEEPS 5
+
+typedef struct async_test {
+    coro_t co;
+    uint32_t round;
+    struct async_test* next_free;
+} async_test_t;
+
+// They live in whole pages from the page allocator, kmalloc() cannot
+// free. A page goes back once all of its coroutines are done.
+typedef struct async_test_page {
+    struct async_test_page* next;  // On async_test_pages while it has free slots
+    async_test_t* free;
+    uint32_t used;
+} async_test_page_t;
+
+#define ASYNC_TEST_PER_PAGE ((PAGE_SIZE - sizeof(async_test_page_t)) / sizeof(async_test_t))
+
+static async_test_page_t* async_test_pages;
+static spinlock_t async_test_lock = SPINLOCK_INIT;
+static volatile uint32_t async_test_live;
+
+static async_test_t* async_test_alloc(void) {
+    uint32_t flags = spin_lock_irqsave(&async_test_lock);
+    if (!async_test_pages) {
+        spin_unlock_irqrestore(&async_test_lock, flags);
+        async_test_page_t* page = alloc_page();
+        if (!page) {
+            return NULL;
+        }
+        async_test_t* slots = (async_test_t*)(page + 1);
+        page->free = NULL;
+        page->used = 0;
+        for (uint32_t i = 0; i < ASYNC_TEST_PER_PAGE; i++) {
+            slots[i].next_free = page->free;
+            page->free = &slots[i];
+        }
+        flags = spin_lock_irqsave(&async_test_lock);
+        page->next = async_test_pages;
+        async_test_pages = page;
+    }
+    async_test_page_t* page = async_test_pages;
+    async_test_t* t = page->free;
+    page->free = t->next_free;
+    page->used++;
+    if (!page->free) {
+        async_test_pages = page->next;
+    }
+    spin_unlock_irqrestore(&async_test_lock, flags);
+    return t;
+}
+
+static void async_test_free(async_test_t* t) {
+    async_test_page_t* page = (async_test_page_t*)((uint32_t)t & ~(PAGE_SIZE - 1));
+    uint32_t flags = spin_lock_irqsave(&async_test_lock);
+    if (!page->free) {
+        page->next = async_test_pages;
+        async_test_pages = page;
+    }
+    t->next_free = page->free;
+    page->free = t;
+    bool empty = --page->used == 0;
+    if (empty) {
+        async_test_page_t** link = &async_test_pages;
+        while (*link != page) {
+            link = &(*link)->next;
+        }
+        *link = page->next;
+    }
+    spin_unlock_irqrestore(&async_test_lock, flags);
+    if (empty) {
+        free_page(page);
+    }
+}
+
+static int async_test_func(coro_t* co) {
+    async_test_t* t = co->data;
+    CORO_BEGIN(co);
+    for (t->round = 0; t->round < ASYNC_TEST_SLEEPS; t->round++) {
+        CORO_SLEEP(co, 10 + (uint32_t)t % 50);
+    }
+    CORO_END(co);
+}
+
+static void async_test_release(coro_t* co) {
+    async_test_free(co->data);
+    __sync_fetch_and_sub(&async_test_live, 1);
+}
+
+// Run one parsed command, returns its exit code
+static int run_command(int argc, char* args[]) {
+    int status = 0;
     
     // Command execution
     if (strcmp(args[0], "help") == 0) {
@@ -305,19 +634,45 @@ static void execute_command(const char* input) {
         printk("  ls            - List directory contents\n");
         printk("  cd <dir>      - Change directory\n");
         printk("  pwd           - Print working directory\n");
-        printk("  cat <file>    - Display file contents\n");
+        printk("  cat <file>    - Display file contents, or standard input in a pipeline\n");
+        printk("  wc            - Count lines, words and bytes of standard input\n");
         printk("  mkdir <dir>   - Create a directory\n");
         printk("  touch <file>  - Create an empty file\n");
         printk("  rm <file>     - Remove a file or directory\n");
         printk("  write <file>  - Write text to a file\n");
-        printk("  date          - Show system uptime\n");
+        printk("  date          - Show date and time\n");
         printk("  banner        - Show ASCII banner\n");
         printk("  alias         - Manage command aliases\n");
+        printk("  unalias       - Remove a command alias\n");
         printk("  set           - Change shell settings\n");
         printk("  history       - Show command history\n");
         printk("  sysinfo       - Show system information\n");
         printk("  calc          - Simple calculator\n");
         printk("  sound         - Play startup sound\n");
+        printk("  ps            - List kernel threads\n");
+        printk("  cpus          - List online CPUs\n");
+        printk("  fpu           - FPU features and lazy switching statistics\n");
+        printk("  top           - CPU usage per task, refreshed every [ms]\n");
+        printk("  trace         - Recent scheduler events [cpu] [count]\n");
+        printk("  nice          - Set thread priority (0-31, 0 highest)\n");
+        printk("  spin          - Run a busy background thread for N seconds\n");
+        printk("  irqstat       - Interrupt cost statistics (on|off|reset)\n");
+        printk("  keylat        - Keypress to echo latency (reset)\n");
+        printk("  lockstat      - Lock contention statistics (on|off|reset)\n");
+        printk("  wq            - Work queues (test <n> [ms] queues busy work)\n");
+        printk("  async         - Coroutine executors (test <n> starts sleeping coroutines)\n");
+        printk("  rcu           - RCU grace period and callback statistics\n");
+        printk("  edf           - Deadline tasks (test <runtime us> <period us> [seconds])\n");
+        printk("  syscalls      - System call counts and kernel cycles\n");
+        printk("  sysbench      - Time system calls and the vDSO clock from user mode [n]\n");
+        printk("  forkbench     - Time fork+exit and fork+exec against the parent's size [n]\n");
+        printk("  ipcbench      - Time IPC round trips between two processes [n]\n");
+        printk("  stdiobench    - User program: write() calls per stdio buffering mode [lines]\n");
+        printk("  futexbench    - User program: futex mutex vs syscall lock across processes [iterations]\n");
+        printk("  mallocbench   - User program: malloc throughput against mmap per allocation [n]\n");
+        printk("  pipes         - Show bytes copied and pages moved through pipes\n");
+        printk("  evloop        - Wait on the keyboard and a ticking pipe with epoll [seconds]\n");
+        printk("  cmd1 | cmd2   - Run commands together, each one's output feeding the next\n");
         
     } else if (strcmp(args[0], "clear") == 0) {
         terminal_clear();
@@ -327,7 +682,7 @@ static void execute_command(const char* input) {
         
     } else if (strcmp(args[0], "exit") == 0) {
         print_info("Goodbye!\n");
-        return;
+        return status;
         
     } else if (strcmp(args[0], "shutdown") == 0) {
         print_info("Shutting down system...\n");
@@ -356,7 +711,7 @@ static void execute_command(const char* input) {
         } else {
             print_error("No such directory: ");
             printk("%s\n", path);
-            shell_state.last_exit_code = 1;
+            status = 1;
         }
         
     } else if (strcmp(args[0], "beep") == 0) {
@@ -368,19 +723,19 @@ static void execute_command(const char* input) {
         show_memory_info();
         
     } else if (strcmp(args[0], "uptime") == 0) {
-        printk("System uptime: %d seconds\n", get_uptime());
+        print_uptime();
         
     } else if (strcmp(args[0], "ls") == 0) {
         fs_node_t* dir = vfs_open("/", 0);
         if (!dir) {
             printk("Error: Could not open directory /\n");
-            return;
+            return status;
         }
         
         if ((dir->flags & 0x7) != FS_DIRECTORY) {
             printk("Error: / is not a directory\n");
             vfs_close(dir);
-            return;
+            return status;
         }
         
         printk("Contents of /\n");
@@ -394,32 +749,78 @@ static void execute_command(const char* input) {
         vfs_close(dir);
         
     } else if (strcmp(args[0], "cat") == 0) {
+        if (argc < 2 && current_task()->console_in) {
+            // Inside a pipeline: copy standard input through
+            char buffer[256];
+            int bytes_read;
+            while ((bytes_read = read(0, buffer, sizeof(buffer))) > 0) {
+                write(1, buffer, bytes_read);
+            }
+            return status;
+        }
         if (argc < 2) {
             printk("Usage: cat <file>\n");
-            return;
+            return status;
         }
         
         int fd = open(args[1], O_RDONLY);
         if (fd < 0) {
             printk("Error: Could not open file %s\n", args[1]);
-            return;
+            return status;
         }
         
+        // Write out the file's own pages where it has them, copying
+        // through a buffer only when it does not
+        fs_node_t* node = fd_lookup(fd);
+        uint32_t offset = 0;
+        uint32_t frame;
+        while (offset < node->length && (frame = vfs_mmap_page(node, offset)) != 0) {
+            uint32_t len = node->length - offset < PAGE_SIZE ? node->length - offset : PAGE_SIZE;
+            write(1, (const void*)frame, len);
+            free_page((void*)frame);
+            offset += len;
+        }
         char buffer[1024];
         int bytes_read;
-        
-        while ((bytes_read = read(fd, buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-            printk("%s", buffer);
+        lseek(fd, offset, SEEK_SET);
+        while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+            write(1, buffer, bytes_read);
         }
         
         close(fd);
         printk("\n");
         
+    } else if (strcmp(args[0], "wc") == 0) {
+        if (!current_task()->console_in) {
+            printk("Usage: <command> | wc\n");
+            return status;
+        }
+        
+        char buffer[256];
+        int bytes_read;
+        uint32_t lines = 0, words = 0, bytes = 0;
+        bool in_word = false;
+        while ((bytes_read = read(0, buffer, sizeof(buffer))) > 0) {
+            for (int i = 0; i < bytes_read; i++) {
+                char c = buffer[i];
+                if (c == '\n') {
+                    lines++;
+                }
+                if (c == ' ' || c == '\t' || c == '\n') {
+                    in_word = false;
+                } else if (!in_word) {
+                    in_word = true;
+                    words++;
+                }
+            }
+            bytes += bytes_read;
+        }
+        printk("%7u %7u %7u\n", lines, words, bytes);
+        
     } else if (strcmp(args[0], "mkdir") == 0) {
         if (argc < 2) {
             printk("Usage: mkdir <directory>\n");
-            return;
+            return status;
         }
         
         // TODO: Implement directory creation
@@ -428,13 +829,13 @@ static void execute_command(const char* input) {
     } else if (strcmp(args[0], "touch") == 0) {
         if (argc < 2) {
             printk("Usage: touch <file>\n");
-            return;
+            return status;
         }
         
         int fd = open(args[1], O_CREAT | O_WRONLY);
         if (fd < 0) {
             printk("Error: Could not create file %s\n", args[1]);
-            return;
+            return status;
         }
         
         close(fd);
@@ -443,7 +844,7 @@ static void execute_command(const char* input) {
     } else if (strcmp(args[0], "rm") == 0) {
         if (argc < 2) {
             printk("Usage: rm <file>\n");
-            return;
+            return status;
         }
         
         // TODO: Implement file/directory removal
@@ -452,13 +853,13 @@ static void execute_command(const char* input) {
     } else if (strcmp(args[0], "write") == 0) {
         if (argc < 3) {
             printk("Usage: write <file> <text>\n");
-            return;
+            return status;
         }
         
         int fd = open(args[1], O_WRONLY | O_CREAT);
         if (fd < 0) {
             printk("Error: Could not open file %s\n", args[1]);
-            return;
+            return status;
         }
         
         // Combine all arguments after the filename
@@ -482,7 +883,7 @@ static void execute_command(const char* input) {
         close(fd);
         
     } else if (strcmp(args[0], "date") == 0) {
-        printk("System uptime: %d seconds\n", get_uptime());
+        print_date();
         
     } else if (strcmp(args[0], "banner") == 0) {
         display_banner();
@@ -496,6 +897,14 @@ static void execute_command(const char* input) {
             printk("Usage: alias [name] [command]\n");
         }
         
+    } else if (strcmp(args[0], "unalias") == 0) {
+        if (argc == 2) {
+            remove_alias(args[1]);
+        } else {
+            printk("Usage: unalias <name>\n");
+            status = 1;
+        }
+        
     } else if (strcmp(args[0], "set") == 0) {
         if (argc == 1) {
             printk("Shell settings:\n");
@@ -531,20 +940,374 @@ static void execute_command(const char* input) {
     } else if (strcmp(args[0], "sound") == 0) {
         play_startup_sound();
         
+    } else if (strcmp(args[0], "ps") == 0) {
+        sched_show_tasks();
+        
+    } else if (strcmp(args[0], "cpus") == 0) {
+        smp_show_cpus();
+        
+    } else if (strcmp(args[0], "fpu") == 0) {
+        fpu_show();
+        
+    } else if (strcmp(args[0], "top") == 0) {
+        int ms = argc > 1 ? atoi(args[1]) : 1000;
+        if (ms < 100) {
+            printk("Usage: top [ms], at least 100\n");
+            status = 1;
+        } else {
+            sched_top(ms);
+        }
+        
+    } else if (strcmp(args[0], "trace") == 0) {
+        int cpu = argc > 1 ? atoi(args[1]) : 0;
+        int count = argc > 2 ? atoi(args[2]) : 16;
+        if (cpu < 0 || count <= 0) {
+            printk("Usage: trace [cpu] [count]\n");
+            status = 1;
+        } else {
+            trace_show(cpu, count);
+        }
+        
+    } else if (strcmp(args[0], "nice") == 0) {
+        if (argc != 3) {
+            printk("Usage: nice <id> <priority>\n");
+            status = 1;
+        } else {
+            task_t* task = find_task(atoi(args[1]));
+            int prio = atoi(args[2]);
+            if (!task) {
+                print_error("No such thread\n");
+                status = 1;
+            } else if (prio < 0 || prio > SCHED_PRIO_LOWEST) {
+                print_error("Priority must be 0-31\n");
+                status = 1;
+            } else {
+                sched_set_priority(task, prio);
+                print_success("Priority updated\n");
+            }
+        }
+        
+    } else if (strcmp(args[0], "spin") == 0) {
+        int seconds = argc > 1 ? atoi(args[1]) : 10;
+        if (seconds <= 0) {
+            printk("Usage: spin [seconds]\n");
+            status = 1;
+        } else {
+            task_t* task = kthread_create("spin", spin_thread, (void*)(uint32_t)seconds);
+            if (!task) {
+                print_error("Out of memory\n");
+                status = 1;
+            } else {
+                sched_set_priority(task, SCHED_PRIO_BACKGROUND);
+                printk("Started spin thread %u for %d seconds\n", task->id, seconds);
+            }
+        }
+        
+    } else if (strcmp(args[0], "keylat") == 0) {
+        if (argc > 1 && strcmp(args[1], "reset") == 0) {
+            latency_reset(input_latency_stats());
+            print_success("Keypress latency statistics reset\n");
+        } else if (argc > 1) {
+            printk("Usage: keylat [reset]\n");
+            status = 1;
+        } else {
+            latency_show(input_latency_stats());
+        }
+        
+    } else if (strcmp(args[0], "irqstat") == 0) {
+        if (argc == 1) {
+            irqstat_show();
+        } else if (strcmp(args[1], "on") == 0) {
+            irqstat_enable(true);
+            print_success("IRQ statistics enabled\n");
+        } else if (strcmp(args[1], "off") == 0) {
+            irqstat_enable(false);
+            print_success("IRQ statistics disabled\n");
+        } else if (strcmp(args[1], "reset") == 0) {
+            irqstat_reset();
+            print_success("IRQ statistics reset\n");
+        } else {
+            printk("Usage: irqstat [on|off|reset]\n");
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "wq") == 0) {
+        if (argc == 1) {
+            workqueue_show();
+        } else if (strcmp(args[1], "test") == 0 && argc >= 3) {
+            int count = atoi(args[2]);
+            int ms = argc > 3 ? atoi(args[3]) : 1000;
+            if (count <= 0 || count > WQ_TEST_ITEMS || ms <= 0) {
+                printk("Usage: wq test <1-%d> [ms]\n", WQ_TEST_ITEMS);
+                status = 1;
+            } else {
+                wq_test_ms = ms;
+                int queued = 0;
+                for (int i = 0; i < count; i++) {
+                    if (!wq_test_work[i].func) {
+                        init_work(&wq_test_work[i], wq_test_func);
+                    }
+                    queued += schedule_work(&wq_test_work[i]);
+                }
+                printk("Queued %d work items of %d ms\n", queued, ms);
+            }
+        } else {
+            printk("Usage: wq [test <n> [ms]]\n");
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "rcu") == 0) {
+        rcu_show();
+        
+    } else if (strcmp(args[0], "edf") == 0) {
+        if (argc == 1) {
+            sched_dl_show();
+        } else if (strcmp(args[1], "test") == 0 && argc >= 4) {
+            int runtime = atoi(args[2]);
+            int period = atoi(args[3]);
+            int seconds = argc > 4 ? atoi(args[4]) : 10;
+            if (runtime <= 0 || period < SCHED_DL_MIN_PERIOD_US || runtime > period || seconds <= 0) {
+                printk("Usage: edf test <runtime us> <period us, at least %u> [seconds]\n",
+                       SCHED_DL_MIN_PERIOD_US);
+                status = 1;
+            } else {
+                edf_test_runtime_us = runtime;
+                edf_test_period_us = period;
+                task_t* task = kthread_create("edf", edf_test_thread, (void*)(uint32_t)seconds);
+                if (!task) {
+                    print_error("Out of memory\n");
+                    status = 1;
+                } else {
+                    printk("Started deadline thread %u: %d us every %d us for %d seconds\n",
+                           task->id, runtime, period, seconds);
+                }
+            }
+        } else {
+            printk("Usage: edf [test <runtime us> <period us> [seconds]]\n");
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "async") == 0) {
+        if (argc == 1) {
+            async_show();
+            printk("  Test coroutines alive: %u\n", async_test_live);
+        } else if (strcmp(args[1], "test") == 0 && argc >= 3 && atoi(args[2]) > 0) {
+            int count = atoi(args[2]);
+            int started = 0;
+            for (; started < count; started++) {
+                async_test_t* t = async_test_alloc();
+                if (!t) {
+                    break;
+                }
+                coro_init(&t->co, async_test_func, t);
+                t->co.release = async_test_release;
+                __sync_fetch_and_add(&async_test_live, 1);
+                coro_start(&t->co);
+            }
+            printk("Started %d coroutines of %u bytes each\n", started, (uint32_t)sizeof(async_test_t));
+            if (started < count) {
+                print_error("Out of memory\n");
+                status = 1;
+            }
+        } else {
+            printk("Usage: async [test <n>]\n");
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "syscalls") == 0) {
+        syscall_show();
+        
+    } else if (strcmp(args[0], "sysbench") == 0) {
+        int iterations = argc > 1 ? atoi(args[1]) : 10000;
+        if (iterations <= 0) {
+            printk("Usage: sysbench [iterations]\n");
+            status = 1;
+        } else if (sysbench_run(iterations) != 0) {
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "ipcbench") == 0) {
+        int iterations = argc > 1 ? atoi(args[1]) : 1000;
+        if (iterations <= 0) {
+            printk("Usage: ipcbench [iterations]\n");
+            status = 1;
+        } else if (ipcbench_run(iterations) != 0) {
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "evloop") == 0) {
+        int seconds = argc > 1 ? atoi(args[1]) : 5;
+        if (seconds <= 0) {
+            printk("Usage: evloop [seconds]\n");
+            status = 1;
+        } else {
+            status = evloop_run(seconds);
+        }
+        
+    } else if (strcmp(args[0], "pipes") == 0) {
+        uint32_t copied, moved;
+        pipe_stats(&copied, &moved);
+        printk("Pipes: %u bytes copied, %u pages moved\n", copied, moved);
+        
+    } else if (strcmp(args[0], "forkbench") == 0) {
+        int iterations = argc > 1 ? atoi(args[1]) : 100;
+        if (iterations <= 0) {
+            printk("Usage: forkbench [iterations]\n");
+            status = 1;
+        } else if (forkbench_run(iterations) != 0) {
+            status = 1;
+        }
+        
+    } else if (strcmp(args[0], "lockstat") == 0) {
+        if (argc == 1) {
+            lockstat_show();
+        } else if (strcmp(args[1], "on") == 0) {
+            lockstat_enable(true);
+            print_success("Lock statistics enabled\n");
+        } else if (strcmp(args[1], "off") == 0) {
+            lockstat_enable(false);
+            print_success("Lock statistics disabled\n");
+        } else if (strcmp(args[1], "reset") == 0) {
+            lockstat_reset();
+            print_success("Lock statistics reset\n");
+        } else {
+            printk("Usage: lockstat [on|off|reset]\n");
+            status = 1;
+        }
+        
     } else {
-        // Check if it's a file in the current directory
-        fs_node_t* node = vfs_finddir(fs_root, args[0]);
-        if (node) {
-            // TODO: Implement execution of binary files
-            print_error("Execution of binary files is not yet implemented\n");
-            shell_state.last_exit_code = 126; // Cannot execute
+        // Check if it's a program: built into the kernel or a file
+        fs_node_t* node = exec_find(args[0]);
+        int exit_code;
+        if (node && exec_run(node, argc, args, &exit_code) == 0) {
+            status = exit_code;
+        } else if (node) {
+            status = 126; // Cannot execute
         } else {
             print_error("Command not found: ");
             printk("%s\n", args[0]);
-            shell_state.last_exit_code = 127; // Command not found
+            status = 127; // Command not found
+        }
+    }
+    
+    return status;
+}
+
+// One command of a pipeline, run by a task of its own
+typedef struct {
+    char command[MAX_INPUT];
+    fs_node_t* in;             // Pipe from the previous command, NULL for the keyboard
+    fs_node_t* out;            // Pipe to the next command, NULL for the screen
+    int exit_code;
+    volatile bool done;
+} pipeline_stage_t;
+
+static DECLARE_WAIT_QUEUE_HEAD(pipeline_wq);
+
+static void pipeline_stage(void* arg) {
+    pipeline_stage_t* stage = arg;
+    console_redirect(stage->in, stage->out);
+    
+    char buffer[MAX_INPUT];
+    char* args[MAX_ARGS];
+    int argc = parse_command_line(stage->command, buffer, args);
+    stage->exit_code = argc > 0 ? run_command(argc, args) : 0;
+    
+    // Closing the pipes lets the neighbours see end of file
+    console_unredirect();
+    stage->done = true;
+    wake_up_all(&pipeline_wq);
+}
+
+static bool pipeline_done(pipeline_stage_t* stages, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!stages[i].done) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run "cmd1 | cmd2 | ..." with every command in its own task at the same
+// time, each one's console output feeding the next one's console input.
+// Returns the exit code of the last command.
+static int run_pipeline(const char* input) {
+    pipeline_stage_t stages[MAX_PIPELINE];
+    int count = 0;
+    
+    char line[MAX_INPUT];
+    strcpy(line, input);
+    char* rest = line;
+    for (char* bar = line; bar; rest = bar + 1) {
+        bar = strchr(rest, '|');
+        if (bar) {
+            *bar = '\0';
         }
+        if (count == MAX_PIPELINE || rest[strspn(rest, " \t")] == '\0') {
+            print_error(count == MAX_PIPELINE ? "Pipeline too long\n" : "Syntax error near '|'\n");
+            return 2;
+        }
+        memset(&stages[count], 0, sizeof(stages[count]));
+        strcpy(stages[count].command, rest);
+        count++;
+        if (!bar) {
+            break;
+        }
+    }
+    
+    for (int i = 0; i + 1 < count; i++) {
+        if (pipe_create(&stages[i + 1].in, &stages[i].out) != 0) {
+            print_error("Out of pipes\n");
+            for (int j = 0; j <= i; j++) {
+                if (stages[j].in) {
+                    vfs_close(stages[j].in);
+                }
+                if (stages[j].out) {
+                    vfs_close(stages[j].out);
+                }
+            }
+            return 1;
+        }
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (!kthread_create("pipeline", pipeline_stage, &stages[i])) {
+            if (stages[i].in) {
+                vfs_close(stages[i].in);
+            }
+            if (stages[i].out) {
+                vfs_close(stages[i].out);
+            }
+            stages[i].exit_code = 126;
+            stages[i].done = true;
+        }
+    }
+    
+    wait_event(pipeline_wq, pipeline_done(stages, count));
+    return stages[count - 1].exit_code;
+}
+
+static void execute_command(const char* input) {
+    if (strlen(input) == 0) return;
+    
+    add_to_history(input);
+    
+    if (strchr(input, '|')) {
+        shell_state.last_exit_code = run_pipeline(input);
+        if (shell_state.debug_mode) {
+            printk("[DEBUG] Pipeline exited with code %d\n", shell_state.last_exit_code);
+        }
+        return;
     }
     
+    char buffer[MAX_INPUT];
+    char* args[MAX_ARGS];
+    int argc = parse_command_line(input, buffer, args);
+    
+    if (argc == 0) return;
+    
+    shell_state.last_exit_code = run_command(argc, args);
+    
     if (shell_state.debug_mode) {
         printk("[DEBUG] Command '%s' exited with code %d\n", 
                args[0], shell_state.last_exit_code);
@@ -649,8 +1412,9 @@ int start_shell(void) {
                     const char* commands[] = {
                         "help", "clear", "echo", "exit", "shutdown", "reboot",
                         "beep", "memory", "uptime", "date", "ls", "cat",
-                        "mkdir", "touch", "rm", "write", "banner", "alias",
-                        "set", "history", "sysinfo", "calc", "sound", NULL
+                        "mkdir", "touch", "rm", "write", "banner", "alias", "unalias",
+                        "set", "history", "sysinfo", "calc", "sound",
+                        "wc", "pipes", "evloop", "ps", "cpus", "fpu", "top", "trace", "nice", "spin", "irqstat", "keylat", "lockstat", "wq", "async", "edf", "rcu", NULL
                     };
                     
                     for (int i = 0; commands[i]; i++) {
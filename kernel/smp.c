@@ -0,0 +1,326 @@
+#include "basedos.h"
+#include "smp.h"
+#include "apic.h"
+#include "cpu.h"
+#include "sched.h"
+#include "softirq.h"
+#include "string.h"
+#include "time.h"
+#include "paging.h"
+#include "syscall.h"
+
+cpu_t cpus[NR_CPUS];
+static volatile uint32_t nr_cpus_online = 1;
+
+// Handed to the application processor being started, one at a time
+static volatile uint32_t ap_boot_cpu;
+static volatile uint32_t ap_boot_stack;
+static task_t* volatile ap_boot_idle;
+
+// ACPI tables, only what is needed to find the local APICs
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_TYPE_LAPIC    0
+#define MADT_LAPIC_ENABLED 0x1
+
+// Real-mode entry of the application processors, copied to
+// AP_TRAMPOLINE_ADDR. CS is AP_TRAMPOLINE_ADDR >> 4 on entry, so the 16-bit
+// part only uses offsets from the trampoline start. It loads a flat GDT and
+// jumps to the 32-bit code at its link address.
+extern char ap_trampoline_start[], ap_trampoline_end[];
+void ap_start(void);
+
+asm (
+    ".pushsection .text\n"
+    ".code16\n"
+    ".global ap_trampoline_start\n"
+    "ap_trampoline_start:\n"
+    "    cli\n"
+    "    cld\n"
+    "    mov %cs, %ax\n"
+    "    mov %ax, %ds\n"
+    "    lgdtl ap_gdt_desc - ap_trampoline_start\n"
+    "    mov %cr0, %eax\n"
+    "    or $1, %eax\n"
+    "    mov %eax, %cr0\n"
+    "    ljmpl $0x08, $ap_protected_mode\n"
+    "ap_gdt_desc:\n"
+    "    .word 23\n"
+    "    .long ap_boot_gdt\n"
+    ".global ap_trampoline_end\n"
+    "ap_trampoline_end:\n"
+    ".code32\n"
+    "ap_protected_mode:\n"
+    "    mov $0x10, %ax\n"
+    "    mov %ax, %ds\n"
+    "    mov %ax, %es\n"
+    "    mov %ax, %ss\n"
+    "    mov %ax, %fs\n"
+    "    mov %ax, %gs\n"
+    "    mov ap_boot_stack, %esp\n"
+    "    call ap_start\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+    ".align 8\n"
+    "ap_boot_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00CF9A000000FFFF\n"
+    "    .quad 0x00CF92000000FFFF\n"
+    ".popsection\n"
+);
+
+static uint64_t gdt_entry(uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    uint64_t entry = limit & 0xFFFF;
+    entry |= (uint64_t)(base & 0xFFFFFF) << 16;
+    entry |= (uint64_t)access << 40;
+    entry |= (uint64_t)((limit >> 16) & 0xF) << 48;
+    entry |= (uint64_t)(flags & 0xF) << 52;
+    entry |= (uint64_t)(base >> 24) << 56;
+    return entry;
+}
+
+// Build the GDT and TSS of a CPU and load them on the calling CPU
+static void cpu_setup(cpu_t* cpu, uint32_t id) {
+    cpu->self = cpu;
+    cpu->id = id;
+
+    memset(&cpu->tss, 0, sizeof(tss_t));
+    cpu->tss.ss0 = GDT_KERNEL_DATA;
+    cpu->tss.iomap_base = sizeof(tss_t); // No I/O permission bitmap
+
+    cpu->gdt[0] = 0;
+    cpu->gdt[GDT_KERNEL_CODE / 8] = gdt_entry(0, 0xFFFFF, 0x9A, 0xC);
+    cpu->gdt[GDT_KERNEL_DATA / 8] = gdt_entry(0, 0xFFFFF, 0x92, 0xC);
+    cpu->gdt[GDT_USER_CODE / 8] = gdt_entry(0, 0xFFFFF, 0xFA, 0xC);
+    cpu->gdt[GDT_USER_DATA / 8] = gdt_entry(0, 0xFFFFF, 0xF2, 0xC);
+    cpu->gdt[GDT_TSS / 8] = gdt_entry((uint32_t)&cpu->tss, sizeof(tss_t) - 1, 0x89, 0x0);
+    cpu->gdt[GDT_PERCPU / 8] = gdt_entry((uint32_t)cpu, sizeof(cpu_t) - 1, 0x92, 0x4);
+
+    struct {
+        uint16_t limit;
+        uint32_t base;
+    } __attribute__((packed)) gdtr = { sizeof(cpu->gdt) - 1, (uint32_t)cpu->gdt };
+
+    asm volatile(
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%ss\n"
+        "mov %%ax, %%gs\n"
+        "mov %3, %%ax\n"
+        "mov %%ax, %%fs\n"
+        "ltr %w4\n"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA), "i"(GDT_PERCPU), "r"(GDT_TSS)
+        : "eax", "memory");
+}
+
+void smp_prepare_boot_cpu(void) {
+    cpu_setup(&cpus[0], 0);
+    cpus[0].online = true;
+}
+
+static bool acpi_checksum_ok(const void* table, uint32_t length) {
+    const uint8_t* p = table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += p[i];
+    }
+    return sum == 0;
+}
+
+// The RSDP is in the first KiB of the EBDA or in the BIOS ROM area
+static acpi_rsdp_t* acpi_find_rsdp(void) {
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t*)0x40E) << 4;
+    uint32_t ranges[2][2] = { { ebda, ebda + 1024 }, { 0xE0000, 0x100000 } };
+
+    for (int r = 0; r < 2; r++) {
+        if (ranges[r][0] == 0) {
+            continue;
+        }
+        for (uint32_t addr = ranges[r][0]; addr < ranges[r][1]; addr += 16) {
+            acpi_rsdp_t* rsdp = (acpi_rsdp_t*)addr;
+            if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum_ok(rsdp, 20)) {
+                return rsdp;
+            }
+        }
+    }
+    return NULL;
+}
+
+static acpi_madt_t* acpi_find_madt(void) {
+    acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        return NULL;
+    }
+
+    acpi_header_t* rsdt = (acpi_header_t*)rsdp->rsdt_address;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !acpi_checksum_ok(rsdt, rsdt->length)) {
+        return NULL;
+    }
+
+    uint32_t count = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    uint32_t* tables = (uint32_t*)(rsdt + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        acpi_header_t* table = (acpi_header_t*)tables[i];
+        if (memcmp(table->signature, "APIC", 4) == 0 && acpi_checksum_ok(table, table->length)) {
+            return (acpi_madt_t*)table;
+        }
+    }
+    return NULL;
+}
+
+// Local APIC timer tick on the application processors, the boot CPU
+// keeps the PIT for timekeeping
+static void lapic_timer_interrupt(interrupt_frame_t* frame) {
+    (void)frame;
+    raise_softirq_irqoff(SCHED_SOFTIRQ);
+}
+
+// The sender already set need_resched, the interrupt return path schedules
+static void reschedule_interrupt(interrupt_frame_t* frame) {
+    (void)frame;
+}
+
+// First C code on an application processor, on its idle task's stack
+void ap_start(void) {
+    uint32_t id = ap_boot_cpu;
+    cpu_t* cpu = &cpus[id];
+
+    cpu_setup(cpu, id);
+    paging_enable_ap();
+    idt_load();
+    syscall_cpu_init();
+    fpu_initialize(false);
+    lapic_initialize(false);
+    sched_initialize_ap(ap_boot_idle);
+    lapic_timer_start();
+
+    __sync_fetch_and_add(&nr_cpus_online, 1);
+    cpu->online = true;
+
+    cpu_idle();
+}
+
+// INIT-SIPI-SIPI sequence from the Intel MultiProcessor Specification
+static bool smp_boot_ap(uint32_t id, uint32_t apic_id) {
+    task_t* idle = sched_create_idle(id);
+    if (!idle) {
+        return false;
+    }
+
+    cpu_t* cpu = &cpus[id];
+    cpu->apic_id = apic_id;
+    ap_boot_cpu = id;
+    ap_boot_idle = idle;
+    ap_boot_stack = (uint32_t)idle->stack + THREAD_STACK_SIZE;
+
+    lapic_send_ipi(apic_id, APIC_DM_INIT | APIC_LEVEL_ASSERT);
+    mdelay(10);
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_ipi(apic_id, APIC_DM_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+        udelay(200);
+    }
+
+    for (int ms = 0; ms < 100 && !cpu->online; ms++) {
+        mdelay(1);
+    }
+    return cpu->online;
+}
+
+void smp_initialize(void) {
+    local_irq_install_handler(LAPIC_TIMER_VECTOR, lapic_timer_interrupt);
+    local_irq_install_handler(RESCHEDULE_VECTOR, reschedule_interrupt);
+
+    if (!lapic_present()) {
+        printk("SMP: no local APIC, running on one CPU\n");
+        return;
+    }
+    lapic_initialize(true);
+    cpus[0].apic_id = lapic_id();
+
+    acpi_madt_t* madt = acpi_find_madt();
+    if (!madt) {
+        printk("SMP: no ACPI MADT, running on one CPU\n");
+        return;
+    }
+
+    lapic_timer_calibrate();
+    memcpy((void*)AP_TRAMPOLINE_ADDR, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+
+    uint32_t next_id = 1;
+    uint32_t skipped = 0;
+    uint8_t* entry = madt->entries;
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2) {
+        // Processor local APIC: type, length, ACPI id, APIC id, flags
+        if (entry[0] == MADT_TYPE_LAPIC && entry[1] >= 8) {
+            uint32_t apic_id = entry[3];
+            uint32_t flags = *(uint32_t*)(entry + 4);
+            if ((flags & MADT_LAPIC_ENABLED) && apic_id != cpus[0].apic_id) {
+                if (next_id >= NR_CPUS) {
+                    skipped++;
+                } else if (smp_boot_ap(next_id, apic_id)) {
+                    next_id++;
+                } else {
+                    printk("SMP: CPU with APIC id %u did not start\n", apic_id);
+                    break;
+                }
+            }
+        }
+        entry += entry[1];
+    }
+
+    printk("SMP: %u CPUs online", nr_cpus_online);
+    if (skipped) {
+        printk(", %u more above NR_CPUS", skipped);
+    }
+    printk("\n");
+}
+
+uint32_t smp_num_cpus(void) {
+    return nr_cpus_online;
+}
+
+void smp_send_reschedule(uint32_t cpu) {
+    if (cpu < NR_CPUS && cpus[cpu].online && cpu != smp_processor_id()) {
+        lapic_send_ipi(cpus[cpu].apic_id, RESCHEDULE_VECTOR);
+    }
+}
+
+void smp_show_cpus(void) {
+    printk("  CPU  APIC  RUNNING\n");
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpus[cpu].online) {
+            printk("  %3u  %4u  %7u\n", cpu, cpus[cpu].apic_id, sched_nr_running(cpu));
+        }
+    }
+}
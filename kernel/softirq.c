@@ -0,0 +1,190 @@
+#include "basedos.h"
+#include "softirq.h"
+#include "smp.h"
+
+// Softirqs raised repeatedly are run at most this many rounds per call,
+// whatever is left stays pending for the next irq_exit or the idle loop
+#define MAX_SOFTIRQ_RESTART 10
+
+// Per-CPU softirq state
+typedef struct {
+    volatile uint32_t pending;   // Bitmap of raised softirqs
+    uint32_t irq_count;          // Hard interrupt nesting depth
+    uint32_t softirq_count;      // Non-zero while running softirqs
+    tasklet_t* tasklet_head[2];  // Queued tasklets (normal, high priority)
+    tasklet_t** tasklet_tail[2];
+} softirq_cpu_t;
+
+static softirq_cpu_t softirq_cpu[NR_CPUS];
+static softirq_action_t softirq_vec[NR_SOFTIRQS];
+
+#define TASKLET_QUEUE_NORMAL 0
+#define TASKLET_QUEUE_HI     1
+
+void open_softirq(uint32_t nr, softirq_action_t action) {
+    if (nr < NR_SOFTIRQS) {
+        softirq_vec[nr] = action;
+    }
+}
+
+void raise_softirq_irqoff(uint32_t nr) {
+    softirq_cpu[smp_processor_id()].pending |= (1 << nr);
+}
+
+void raise_softirq(uint32_t nr) {
+    uint32_t flags = irq_save();
+    raise_softirq_irqoff(nr);
+    irq_restore(flags);
+}
+
+bool softirq_pending(void) {
+    return softirq_cpu[smp_processor_id()].pending != 0;
+}
+
+bool in_irq(void) {
+    return softirq_cpu[smp_processor_id()].irq_count != 0;
+}
+
+bool in_interrupt(void) {
+    softirq_cpu_t* cpu = &softirq_cpu[smp_processor_id()];
+    return cpu->irq_count != 0 || cpu->softirq_count != 0;
+}
+
+void irq_enter(void) {
+    softirq_cpu[smp_processor_id()].irq_count++;
+}
+
+// Leave hard interrupt context, running softirqs if this was the outermost IRQ
+void irq_exit(void) {
+    softirq_cpu_t* cpu = &softirq_cpu[smp_processor_id()];
+    cpu->irq_count--;
+    if (cpu->pending && cpu->irq_count == 0 && cpu->softirq_count == 0) {
+        do_softirq();
+    }
+}
+
+void do_softirq(void) {
+    if (in_interrupt()) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    softirq_cpu_t* cpu = &softirq_cpu[smp_processor_id()];
+    uint32_t pending = cpu->pending;
+    int restart = MAX_SOFTIRQ_RESTART;
+
+    if (pending) {
+        cpu->softirq_count++;
+        // Interrupts come back on here, end of the IRQ's irqs-off window
+        irqstat_irqs_on();
+        do {
+            cpu->pending = 0;
+            enable_interrupts();
+
+            while (pending) {
+                uint32_t nr = __builtin_ctz(pending);
+                pending &= pending - 1;
+                if (softirq_vec[nr]) {
+                    softirq_vec[nr]();
+                }
+            }
+
+            disable_interrupts();
+            pending = cpu->pending;
+        } while (pending && --restart);
+        cpu->softirq_count--;
+    }
+
+    irq_restore(flags);
+}
+
+// Tasklets
+
+void tasklet_init(tasklet_t* t, void (*func)(uint32_t data), uint32_t data) {
+    t->next = NULL;
+    t->state = 0;
+    t->func = func;
+    t->data = data;
+}
+
+static void tasklet_enqueue(tasklet_t* t, int queue, uint32_t nr) {
+    uint32_t flags = irq_save();
+    if (!(t->state & TASKLET_STATE_SCHED)) {
+        softirq_cpu_t* cpu = &softirq_cpu[smp_processor_id()];
+        t->state |= TASKLET_STATE_SCHED;
+        t->next = NULL;
+        *cpu->tasklet_tail[queue] = t;
+        cpu->tasklet_tail[queue] = &t->next;
+        raise_softirq_irqoff(nr);
+    }
+    irq_restore(flags);
+}
+
+void tasklet_schedule(tasklet_t* t) {
+    tasklet_enqueue(t, TASKLET_QUEUE_NORMAL, TASKLET_SOFTIRQ);
+}
+
+void tasklet_hi_schedule(tasklet_t* t) {
+    tasklet_enqueue(t, TASKLET_QUEUE_HI, HI_SOFTIRQ);
+}
+
+// Run every tasklet queued on this CPU, called from softirq context
+static void tasklet_run_queue(int queue, uint32_t nr) {
+    softirq_cpu_t* cpu = &softirq_cpu[smp_processor_id()];
+
+    // Detach the list so handlers can requeue themselves
+    disable_interrupts();
+    tasklet_t* list = cpu->tasklet_head[queue];
+    cpu->tasklet_head[queue] = NULL;
+    cpu->tasklet_tail[queue] = &cpu->tasklet_head[queue];
+    enable_interrupts();
+
+    while (list) {
+        tasklet_t* t = list;
+        list = list->next;
+
+        if (t->state & TASKLET_STATE_RUN) {
+            // Still running elsewhere, try again on the next round
+            disable_interrupts();
+            t->next = NULL;
+            *cpu->tasklet_tail[queue] = t;
+            cpu->tasklet_tail[queue] = &t->next;
+            raise_softirq_irqoff(nr);
+            enable_interrupts();
+            continue;
+        }
+
+        disable_interrupts();
+        t->state = (t->state | TASKLET_STATE_RUN) & ~TASKLET_STATE_SCHED;
+        enable_interrupts();
+
+        t->func(t->data);
+
+        disable_interrupts();
+        t->state &= ~TASKLET_STATE_RUN;
+        enable_interrupts();
+    }
+}
+
+static void tasklet_action(void) {
+    tasklet_run_queue(TASKLET_QUEUE_NORMAL, TASKLET_SOFTIRQ);
+}
+
+static void tasklet_hi_action(void) {
+    tasklet_run_queue(TASKLET_QUEUE_HI, HI_SOFTIRQ);
+}
+
+void softirq_initialize(void) {
+    for (int i = 0; i < NR_CPUS; i++) {
+        softirq_cpu[i].pending = 0;
+        softirq_cpu[i].irq_count = 0;
+        softirq_cpu[i].softirq_count = 0;
+        for (int q = 0; q < 2; q++) {
+            softirq_cpu[i].tasklet_head[q] = NULL;
+            softirq_cpu[i].tasklet_tail[q] = &softirq_cpu[i].tasklet_head[q];
+        }
+    }
+
+    open_softirq(HI_SOFTIRQ, tasklet_hi_action);
+    open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+}
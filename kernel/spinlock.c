@@ -0,0 +1,163 @@
+#include "basedos.h"
+#include "spinlock.h"
+#include "div64.h"
+
+#if CONFIG_LOCKSTAT
+volatile bool lockstat_enabled = false;
+
+// Sites that were acquired while statistics were on, append-only so the
+// list can be walked without holding lockstat_lock
+static lockstat_site_t* volatile lockstat_sites = NULL;
+static volatile uint32_t lockstat_nr_sites = 0;
+
+// Raw lock for the 64-bit counters, taking a tracked lock here would recurse
+static volatile uint32_t lockstat_lock = 0;
+
+static uint32_t lockstat_raw_lock(void) {
+    uint32_t flags = irq_save();
+    while (__sync_lock_test_and_set(&lockstat_lock, 1)) {
+        cpu_relax();
+    }
+    return flags;
+}
+
+static void lockstat_raw_unlock(uint32_t flags) {
+    __sync_lock_release(&lockstat_lock);
+    irq_restore(flags);
+}
+
+void lockstat_register(lockstat_site_t* site) {
+    uint32_t flags = lockstat_raw_lock();
+    if (!site->registered) {
+        site->next = lockstat_sites;
+        lockstat_sites = site;
+        lockstat_nr_sites++;
+        site->registered = 1;
+    }
+    lockstat_raw_unlock(flags);
+}
+
+void lockstat_record_wait(lockstat_site_t* site, uint64_t cycles) {
+    uint32_t flags = lockstat_raw_lock();
+    site->contended++;
+    site->wait_cycles += cycles;
+    if (cycles > site->max_wait_cycles) {
+        site->max_wait_cycles = cycles;
+    }
+    lockstat_raw_unlock(flags);
+}
+
+void lockstat_enable(bool enable) {
+    lockstat_enabled = enable;
+}
+
+void lockstat_reset(void) {
+    uint32_t flags = lockstat_raw_lock();
+    for (lockstat_site_t* site = lockstat_sites; site; site = site->next) {
+        site->acquisitions = 0;
+        site->contended = 0;
+        site->wait_cycles = 0;
+        site->max_wait_cycles = 0;
+    }
+    lockstat_raw_unlock(flags);
+}
+
+#define LOCKSTAT_SHOW_MAX 16
+
+// Sites sorted by total wait, the most contended first
+void lockstat_show(void) {
+    lockstat_site_t snapshot[LOCKSTAT_SHOW_MAX];
+    uint32_t count = 0;
+    uint32_t idle = 0;
+
+    uint32_t flags = lockstat_raw_lock();
+    for (lockstat_site_t* site = lockstat_sites; site; site = site->next) {
+        if (site->acquisitions == 0) {
+            idle++;
+            continue;
+        }
+        // Insert, dropping the least contended site once the table is full
+        uint32_t i = count < LOCKSTAT_SHOW_MAX ? count++ : LOCKSTAT_SHOW_MAX;
+        while (i > 0 && (snapshot[i - 1].wait_cycles < site->wait_cycles ||
+                         (snapshot[i - 1].wait_cycles == site->wait_cycles &&
+                          snapshot[i - 1].acquisitions < site->acquisitions))) {
+            if (i < LOCKSTAT_SHOW_MAX) {
+                snapshot[i] = snapshot[i - 1];
+            }
+            i--;
+        }
+        if (i < LOCKSTAT_SHOW_MAX) {
+            snapshot[i] = *site;
+        }
+    }
+    uint32_t total = lockstat_nr_sites;
+    lockstat_raw_unlock(flags);
+
+    printk("Lock statistics %s, %u sites (%u unused since reset)\n",
+           lockstat_enabled ? "on" : "off", total, idle);
+    printk("  ACQUIRED  CONTENDED   AVG WAIT   MAX WAIT  LOCK\n");
+    for (uint32_t i = 0; i < count; i++) {
+        lockstat_site_t* s = &snapshot[i];
+        uint32_t avg = s->contended ? (uint32_t)div64_u32(s->wait_cycles, s->contended) : 0;
+        uint32_t max = s->max_wait_cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)s->max_wait_cycles;
+        printk("  %8u  %9u  %9u  %9u  %s %s:%u\n",
+               s->acquisitions, s->contended, avg, max, s->name, s->file, s->line);
+    }
+}
+#else
+void lockstat_enable(bool enable) {
+    (void)enable;
+}
+
+void lockstat_reset(void) {
+}
+
+void lockstat_show(void) {
+    printk("Lock statistics are not compiled in (build with LOCKSTAT=1)\n");
+}
+#endif
+
+#ifdef CONFIG_SMP
+void spin_lock_slow(spinlock_t* lock, lockstat_site_t* site) {
+    uint64_t start = lockstat_wait_begin();
+    do {
+        while (lock->locked) {
+            cpu_relax();
+        }
+    } while (!arch_spin_trylock(lock));
+    lockstat_wait_end(site, start);
+    lockstat_acquired(site);
+}
+
+void ticket_lock_slow(ticketlock_t* lock, uint16_t ticket, lockstat_site_t* site) {
+    uint64_t start = lockstat_wait_begin();
+    while (lock->owner != ticket) {
+        cpu_relax();
+    }
+    asm volatile("" : : : "memory");
+    lockstat_wait_end(site, start);
+    lockstat_acquired(site);
+}
+
+void read_lock_slow(rwlock_t* lock, lockstat_site_t* site) {
+    uint64_t start = lockstat_wait_begin();
+    do {
+        while (lock->count < 0) {
+            cpu_relax();
+        }
+    } while (!arch_read_trylock(lock));
+    lockstat_wait_end(site, start);
+    lockstat_acquired(site);
+}
+
+void write_lock_slow(rwlock_t* lock, lockstat_site_t* site) {
+    uint64_t start = lockstat_wait_begin();
+    do {
+        while (lock->count != 0) {
+            cpu_relax();
+        }
+    } while (!arch_write_trylock(lock));
+    lockstat_wait_end(site, start);
+    lockstat_acquired(site);
+}
+#endif
@@ -0,0 +1,474 @@
+#include "basedos.h"
+#include "sysbench.h"
+#include "syscall.h"
+#include "paging.h"
+#include "memory.h"
+#include "vdso.h"
+#include "time.h"
+#include "div64.h"
+#include "elf.h"
+#include "exec.h"
+#include "ipc.h"
+#include "string.h"
+
+// Byte offsets of the cycle counts the user program writes, one per method
+#define BENCH_INT80          0    // getpid through int 0x80
+#define BENCH_VDSO_SYSCALL   8    // getpid through the vDSO stub (SYSENTER if available)
+#define BENCH_VDSO_CLOCK     16   // Time read in the vDSO, no kernel entry
+#define BENCH_SYSCALL_CLOCK  24   // clock_ns system call through the vDSO stub
+#define BENCH_SCRATCH        32   // clock_ns result
+#define BENCH_SIZE           40
+
+// The same for the fork benchmark
+#define FORKBENCH_EXIT       0    // fork, the child exits, wait
+#define FORKBENCH_EXEC       8    // fork, the child execs a program that exits, wait
+#define FORKBENCH_SIZE       16
+
+// The same for the IPC benchmark, round trips of each message kind
+#define IPCBENCH_REGS        0    // Two words in registers
+#define IPCBENCH_INLINE      8    // IPC_INLINE_SIZE bytes inline
+#define IPCBENCH_PAGES       16   // IPCBENCH_NR_PAGES pages remapped
+#define IPCBENCH_SIZE        24
+
+// Pages the client sends from and the server's window, IPCBENCH_NR_PAGES each
+#define IPCBENCH_NR_PAGES    4
+#define IPCBENCH_SEND        (USER_BASE + 0x400000)
+#define IPCBENCH_WINDOW      (USER_BASE + 0x800000)
+
+// Built-in program the fork benchmark's children exec
+#define FORKBENCH_CHILD      "forkbench-child"
+
+// Parent sizes the fork benchmark runs with, in pages mapped and touched
+static const uint32_t forkbench_sizes[] = { 0, 256, 1024 };
+
+// The user program, copied to USER_BASE. The kernel leaves the iteration
+// count at (%esp) and the address of the result slots at 4(%esp). Each
+// benchmark times its loop with rdtsc and stores the cycles in its slot.
+// The code is position independent apart from the fixed vDSO address.
+extern char sysbench_user_start[], sysbench_user_end[];
+
+asm (
+    ".pushsection .text\n"
+    ".macro sysbench_begin slot\n"
+    "    rdtsc\n"
+    "    mov %eax, \\slot(%esi)\n"
+    "    mov %edx, \\slot+4(%esi)\n"
+    "    mov %ebp, %edi\n"
+    ".endm\n"
+    ".macro sysbench_end slot\n"
+    "    rdtsc\n"
+    "    sub \\slot(%esi), %eax\n"
+    "    sbb \\slot+4(%esi), %edx\n"
+    "    mov %eax, \\slot(%esi)\n"
+    "    mov %edx, \\slot+4(%esi)\n"
+    ".endm\n"
+    ".global sysbench_user_start\n"
+    "sysbench_user_start:\n"
+    "    mov (%esp), %ebp\n"
+    "    mov 4(%esp), %esi\n"
+    "    sysbench_begin " __stringify(BENCH_INT80) "\n"
+    "1:  mov $" __stringify(SYS_getpid) ", %eax\n"
+    "    int $0x80\n"
+    "    dec %edi\n"
+    "    jnz 1b\n"
+    "    sysbench_end " __stringify(BENCH_INT80) "\n"
+    "    sysbench_begin " __stringify(BENCH_VDSO_SYSCALL) "\n"
+    "2:  mov $" __stringify(SYS_getpid) ", %eax\n"
+    "    call *" __stringify(VDSO_BASE) "+" __stringify(VDSO_SYSCALL_ENTRY) "\n"
+    "    dec %edi\n"
+    "    jnz 2b\n"
+    "    sysbench_end " __stringify(BENCH_VDSO_SYSCALL) "\n"
+    "    sysbench_begin " __stringify(BENCH_VDSO_CLOCK) "\n"
+    "3:  call *" __stringify(VDSO_BASE) "+" __stringify(VDSO_CLOCK_NS) "\n"
+    "    dec %edi\n"
+    "    jnz 3b\n"
+    "    sysbench_end " __stringify(BENCH_VDSO_CLOCK) "\n"
+    "    sysbench_begin " __stringify(BENCH_SYSCALL_CLOCK) "\n"
+    "4:  mov $" __stringify(SYS_clock_ns) ", %eax\n"
+    "    lea " __stringify(BENCH_SCRATCH) "(%esi), %ebx\n"
+    "    call *" __stringify(VDSO_BASE) "+" __stringify(VDSO_SYSCALL_ENTRY) "\n"
+    "    dec %edi\n"
+    "    jnz 4b\n"
+    "    sysbench_end " __stringify(BENCH_SYSCALL_CLOCK) "\n"
+    "    mov $" __stringify(SYS_exit) ", %eax\n"
+    "    xor %ebx, %ebx\n"
+    "    int $0x80\n"
+    ".global sysbench_user_end\n"
+    "sysbench_user_end:\n"
+    ".popsection\n"
+);
+
+// The fork benchmark, loaded the same way. The stack holds the iteration
+// count, the result slots, and the path and argv the children exec. A
+// failed fork ends the program with status 1.
+extern char forkbench_user_start[], forkbench_user_end[];
+extern char forkbench_child_start[], forkbench_child_end[];
+
+asm (
+    ".pushsection .text\n"
+    ".global forkbench_user_start\n"
+    "forkbench_user_start:\n"
+    "    mov (%esp), %ebp\n"
+    "    mov 4(%esp), %esi\n"
+    "    sysbench_begin " __stringify(FORKBENCH_EXIT) "\n"
+    "1:  mov $" __stringify(SYS_fork) ", %eax\n"
+    "    int $0x80\n"
+    "    test %eax, %eax\n"
+    "    jz 3f\n"
+    "    js 5f\n"
+    "    mov %eax, %ebx\n"
+    "    xor %ecx, %ecx\n"
+    "    mov $" __stringify(SYS_wait) ", %eax\n"
+    "    int $0x80\n"
+    "    dec %edi\n"
+    "    jnz 1b\n"
+    "    sysbench_end " __stringify(FORKBENCH_EXIT) "\n"
+    "    sysbench_begin " __stringify(FORKBENCH_EXEC) "\n"
+    "2:  mov $" __stringify(SYS_fork) ", %eax\n"
+    "    int $0x80\n"
+    "    test %eax, %eax\n"
+    "    jz 4f\n"
+    "    js 5f\n"
+    "    mov %eax, %ebx\n"
+    "    xor %ecx, %ecx\n"
+    "    mov $" __stringify(SYS_wait) ", %eax\n"
+    "    int $0x80\n"
+    "    dec %edi\n"
+    "    jnz 2b\n"
+    "    sysbench_end " __stringify(FORKBENCH_EXEC) "\n"
+    "    xor %ebx, %ebx\n"
+    "    jmp 6f\n"
+    "3:  xor %ebx, %ebx\n"          // Child: exit right away
+    "    jmp 6f\n"
+    "4:  mov $" __stringify(SYS_exec) ", %eax\n"
+    "    mov 8(%esp), %ebx\n"
+    "    mov 12(%esp), %ecx\n"
+    "    int $0x80\n"
+    "5:  mov $1, %ebx\n"
+    "6:  mov $" __stringify(SYS_exit) ", %eax\n"
+    "    int $0x80\n"
+    ".global forkbench_user_end\n"
+    "forkbench_user_end:\n"
+    ".global forkbench_child_start\n"
+    "forkbench_child_start:\n"
+    "    mov $" __stringify(SYS_exit) ", %eax\n"
+    "    xor %ebx, %ebx\n"
+    "    int $0x80\n"
+    ".global forkbench_child_end\n"
+    "forkbench_child_end:\n"
+    ".popsection\n"
+);
+
+// The IPC benchmark. The program creates a port and forks: the child
+// serves it, replying to each call with the words it got, until a call
+// with -1 in esi; the parent times calls with each kind of message. The
+// stack holds the iteration count, the result slots, the port, the two
+// ipc_msg_t buffers, the child's pid and the loop start time.
+extern char ipcbench_user_start[], ipcbench_user_end[];
+
+asm (
+    ".pushsection .text\n"
+    ".macro ipcbench_begin\n"
+    "    rdtsc\n"
+    "    mov %eax, 24(%esp)\n"
+    "    mov %edx, 28(%esp)\n"
+    "    mov (%esp), %ebp\n"
+    ".endm\n"
+    ".macro ipcbench_end slot\n"
+    "    rdtsc\n"
+    "    sub 24(%esp), %eax\n"
+    "    sbb 28(%esp), %edx\n"
+    "    mov 4(%esp), %ecx\n"
+    "    mov %eax, \\slot(%ecx)\n"
+    "    mov %edx, \\slot+4(%ecx)\n"
+    ".endm\n"
+    ".macro ipcbench_call\n"
+    "    mov $" __stringify(SYS_ipc_call) ", %eax\n"
+    "    mov 8(%esp), %ebx\n"
+    "    mov %ebp, %esi\n"
+    "    call *" __stringify(VDSO_BASE) "+" __stringify(VDSO_SYSCALL_ENTRY) "\n"
+    "    test %eax, %eax\n"
+    "    jnz 8f\n"
+    "    dec %ebp\n"
+    ".endm\n"
+    ".global ipcbench_user_start\n"
+    "ipcbench_user_start:\n"
+    "    mov $" __stringify(SYS_port_create) ", %eax\n"
+    "    int $0x80\n"
+    "    test %eax, %eax\n"
+    "    js 9f\n"
+    "    mov %eax, 8(%esp)\n"
+    "    mov $" __stringify(SYS_fork) ", %eax\n"
+    "    int $0x80\n"
+    "    test %eax, %eax\n"
+    "    jz 5f\n"
+    "    js 9f\n"
+    "    mov %eax, 20(%esp)\n"
+    "    ipcbench_begin\n"
+    "1:  xor %ecx, %ecx\n"
+    "    ipcbench_call\n"
+    "    jnz 1b\n"
+    "    ipcbench_end " __stringify(IPCBENCH_REGS) "\n"
+    "    ipcbench_begin\n"
+    "2:  mov 12(%esp), %ecx\n"
+    "    movl $" __stringify(IPC_INLINE_SIZE) ", " __stringify(IPC_MSG_LEN) "(%ecx)\n"
+    "    movl $0, " __stringify(IPC_MSG_PAGES) "(%ecx)\n"
+    "    ipcbench_call\n"
+    "    jnz 2b\n"
+    "    ipcbench_end " __stringify(IPCBENCH_INLINE) "\n"
+    "    ipcbench_begin\n"
+    "3:  mov 12(%esp), %ecx\n"
+    "    movl $0, " __stringify(IPC_MSG_LEN) "(%ecx)\n"
+    "    movl $" __stringify(IPCBENCH_NR_PAGES) ", " __stringify(IPC_MSG_PAGES) "(%ecx)\n"
+    "    ipcbench_call\n"
+    "    jnz 3b\n"
+    "    ipcbench_end " __stringify(IPCBENCH_PAGES) "\n"
+    "    mov $" __stringify(SYS_ipc_call) ", %eax\n"  // Stop the server
+    "    mov 8(%esp), %ebx\n"
+    "    xor %ecx, %ecx\n"
+    "    mov $-1, %esi\n"
+    "    int $0x80\n"
+    "    mov $" __stringify(SYS_wait) ", %eax\n"
+    "    mov 20(%esp), %ebx\n"
+    "    xor %ecx, %ecx\n"
+    "    int $0x80\n"
+    "    xor %ebx, %ebx\n"
+    "    jmp 7f\n"
+    "5:  xor %edx, %edx\n"            // Server: nothing to answer yet
+    "6:  mov 16(%esp), %ecx\n"
+    "    movl $0, " __stringify(IPC_MSG_LEN) "(%ecx)\n"
+    "    movl $0, " __stringify(IPC_MSG_PAGES) "(%ecx)\n"
+    "    mov $" __stringify(SYS_ipc_reply_wait) ", %eax\n"
+    "    mov 8(%esp), %ebx\n"
+    "    call *" __stringify(VDSO_BASE) "+" __stringify(VDSO_SYSCALL_ENTRY) "\n"
+    "    test %eax, %eax\n"
+    "    js 9f\n"
+    "    mov %eax, %edx\n"
+    "    cmp $-1, %esi\n"
+    "    jne 6b\n"
+    "    mov $" __stringify(SYS_ipc_reply) ", %eax\n"
+    "    xor %ecx, %ecx\n"
+    "    int $0x80\n"
+    "    xor %ebx, %ebx\n"
+    "    jmp 7f\n"
+    "8:  mov $2, %ebx\n"              // A call failed
+    "    jmp 7f\n"
+    "9:  mov $1, %ebx\n"
+    "7:  mov $" __stringify(SYS_exit) ", %eax\n"
+    "    int $0x80\n"
+    ".global ipcbench_user_end\n"
+    "ipcbench_user_end:\n"
+    ".popsection\n"
+);
+
+// ELF image of the exec'd child: one segment holding the whole file
+static struct {
+    Elf32_Ehdr eh;
+    Elf32_Phdr ph;
+    uint8_t code[16];
+} forkbench_child;
+
+static void sysbench_print(const char* what, uint64_t cycles, uint32_t iterations) {
+    uint64_t per_call = div64_u32(cycles, iterations);
+    uint64_t ns = cycles_to_ns(cycles);
+    printk("  %24s  %8llu cycles  %6llu ns\n", what, per_call, div64_u32(ns, iterations));
+}
+
+// Code at USER_BASE, one stack page with the arguments and result slots
+static bool sysbench_load(mm_t* mm, const char* code, uint32_t code_len, uint32_t esp,
+                          const uint32_t* args, uint32_t args_len) {
+    return mm_map_anon(mm, USER_BASE, code_len, PTE_USER) == 0 &&
+           mm_map_anon(mm, USER_STACK_TOP - PAGE_SIZE, PAGE_SIZE, PTE_USER | PTE_WRITE) == 0 &&
+           mm_write(mm, USER_BASE, code, code_len) == 0 &&
+           mm_write(mm, esp, args, args_len) == 0;
+}
+
+static void sysbench_report(mm_t* mm, uint32_t results, uint32_t iterations) {
+    uint64_t cycles[BENCH_SIZE / 8];
+    mm_read(mm, results, cycles, sizeof(cycles));
+    printk("Per call, %u iterations each:\n", iterations);
+    sysbench_print("getpid int 0x80", cycles[BENCH_INT80 / 8], iterations);
+    sysbench_print(syscall_has_sysenter() ? "getpid sysenter (vDSO)" : "getpid int 0x80 (vDSO)",
+                   cycles[BENCH_VDSO_SYSCALL / 8], iterations);
+    sysbench_print("clock_ns system call", cycles[BENCH_SYSCALL_CLOCK / 8], iterations);
+    sysbench_print("clock_ns vDSO", cycles[BENCH_VDSO_CLOCK / 8], iterations);
+}
+
+int sysbench_run(uint32_t iterations) {
+    if (iterations == 0) {
+        return -1;
+    }
+    mm_t* mm = mm_create();
+    if (!mm) {
+        printk("sysbench: %s\n", paging_enabled() ? "out of memory" : "no user mode without paging");
+        return -1;
+    }
+
+    uint32_t results = USER_STACK_TOP - BENCH_SIZE;
+    uint32_t args[2] = { iterations, results };
+    uint32_t esp = results - sizeof(args);
+    int ret = -1;
+
+    if (!sysbench_load(mm, sysbench_user_start, sysbench_user_end - sysbench_user_start,
+                       esp, args, sizeof(args))) {
+        printk("sysbench: out of memory\n");
+    } else if ((ret = user_run(mm, USER_BASE, esp)) != 0) {
+        printk("sysbench: user program failed (%d)\n", ret);
+    } else {
+        sysbench_report(mm, results, iterations);
+    }
+
+    mm_destroy(mm);
+    return ret;
+}
+
+static void forkbench_build_child(void) {
+    uint32_t code_len = forkbench_child_end - forkbench_child_start;
+    Elf32_Ehdr* eh = &forkbench_child.eh;
+    Elf32_Phdr* ph = &forkbench_child.ph;
+
+    memset(&forkbench_child, 0, sizeof(forkbench_child));
+    eh->e_ident[0] = ELFMAG0;
+    eh->e_ident[1] = ELFMAG1;
+    eh->e_ident[2] = ELFMAG2;
+    eh->e_ident[3] = ELFMAG3;
+    eh->e_ident[EI_CLASS] = ELFCLASS32;
+    eh->e_ident[EI_DATA] = ELFDATA2LSB;
+    eh->e_type = ET_EXEC;
+    eh->e_machine = EM_386;
+    eh->e_version = EV_CURRENT;
+    eh->e_entry = USER_BASE + __builtin_offsetof(typeof(forkbench_child), code);
+    eh->e_phoff = sizeof(Elf32_Ehdr);
+    eh->e_ehsize = sizeof(Elf32_Ehdr);
+    eh->e_phentsize = sizeof(Elf32_Phdr);
+    eh->e_phnum = 1;
+    ph->p_type = PT_LOAD;
+    ph->p_vaddr = USER_BASE;
+    ph->p_filesz = sizeof(forkbench_child);
+    ph->p_memsz = sizeof(forkbench_child);
+    ph->p_flags = PF_R | PF_X;
+    ph->p_align = PAGE_SIZE;
+    memcpy(forkbench_child.code, forkbench_child_start, code_len);
+}
+
+// One run with pages of touched memory in the parent. Returns 0 and the
+// cycles per iteration of each loop, or -1.
+static int forkbench_once(uint32_t iterations, uint32_t pages, uint64_t* cycles, uint32_t* copied) {
+    mm_t* mm = mm_create();
+    if (!mm) {
+        return -1;
+    }
+
+    // Top of the stack: result slots, the path, argv, then the arguments
+    uint32_t results = USER_STACK_TOP - FORKBENCH_SIZE;
+    uint32_t path = results - 32;
+    uint32_t argv[2] = { path, 0 };
+    uint32_t argv_addr = path - sizeof(argv);
+    uint32_t args[4] = { iterations, results, path, argv_addr };
+    uint32_t esp = argv_addr - sizeof(args);
+    int ret = -1;
+
+    if (sysbench_load(mm, forkbench_user_start, forkbench_user_end - forkbench_user_start,
+                      esp, args, sizeof(args)) &&
+        mm_write(mm, path, FORKBENCH_CHILD, sizeof(FORKBENCH_CHILD)) == 0 &&
+        mm_write(mm, argv_addr, argv, sizeof(argv)) == 0 &&
+        (pages == 0 || mm_map_anon(mm, USER_BASE + 0x400000, pages * PAGE_SIZE,
+                                   PTE_USER | PTE_WRITE) == 0)) {
+        ret = user_run(mm, USER_BASE, esp);
+    }
+    if (ret == 0) {
+        uint64_t total[FORKBENCH_SIZE / 8];
+        mm_read(mm, results, total, sizeof(total));
+        cycles[0] = div64_u32(total[FORKBENCH_EXIT / 8], iterations);
+        cycles[1] = div64_u32(total[FORKBENCH_EXEC / 8], iterations);
+        *copied = mm->nr_cow;
+    }
+
+    mm_destroy(mm);
+    return ret;
+}
+
+int forkbench_run(uint32_t iterations) {
+    if (iterations == 0) {
+        return -1;
+    }
+    if (!paging_enabled()) {
+        printk("forkbench: no user mode without paging\n");
+        return -1;
+    }
+    forkbench_build_child();
+    if (!exec_register_image(FORKBENCH_CHILD, &forkbench_child, sizeof(forkbench_child))) {
+        printk("forkbench: no room for the child program\n");
+        return -1;
+    }
+
+    printk("Cycles per iteration, %u iterations each:\n", iterations);
+    printk("  PARENT PAGES   FORK+EXIT   FORK+EXEC  PARENT COPIES\n");
+    for (uint32_t i = 0; i < sizeof(forkbench_sizes) / sizeof(forkbench_sizes[0]); i++) {
+        uint64_t cycles[2];
+        uint32_t copied;
+        if (forkbench_once(iterations, forkbench_sizes[i], cycles, &copied) != 0) {
+            printk("forkbench: user program failed\n");
+            return -1;
+        }
+        printk("  %12u  %10llu  %10llu  %13u\n", forkbench_sizes[i], cycles[0], cycles[1], copied);
+    }
+    return 0;
+}
+
+int ipcbench_run(uint32_t iterations) {
+    if (iterations == 0) {
+        return -1;
+    }
+    mm_t* mm = mm_create();
+    if (!mm) {
+        printk("ipcbench: %s\n", paging_enabled() ? "out of memory" : "no user mode without paging");
+        return -1;
+    }
+
+    // Top of the stack: result slots, the server's and the client's
+    // message, then the arguments
+    ipc_msg_t msgs[2];
+    memset(msgs, 0, sizeof(msgs));
+    msgs[0].addr = IPCBENCH_SEND;
+    msgs[1].window = IPCBENCH_WINDOW;
+    msgs[1].window_pages = IPCBENCH_NR_PAGES;
+    uint32_t results = USER_STACK_TOP - IPCBENCH_SIZE;
+    uint32_t client_msg = results - sizeof(msgs);
+    uint32_t args[8] = { iterations, results, 0, client_msg, client_msg + sizeof(ipc_msg_t), 0, 0, 0 };
+    uint32_t esp = client_msg - sizeof(args);
+    uint32_t pages_len = IPCBENCH_NR_PAGES * PAGE_SIZE;
+    int ret = -1;
+
+    ipc_stats_t before, after;
+    ipc_get_stats(&before);
+    if (sysbench_load(mm, ipcbench_user_start, ipcbench_user_end - ipcbench_user_start,
+                      esp, args, sizeof(args)) &&
+        mm_write(mm, client_msg, msgs, sizeof(msgs)) == 0 &&
+        mm_map_anon(mm, IPCBENCH_SEND, pages_len, PTE_USER | PTE_WRITE) == 0 &&
+        mm_map_anon(mm, IPCBENCH_WINDOW, pages_len, PTE_USER | PTE_WRITE) == 0) {
+        ret = user_run(mm, USER_BASE, esp);
+    }
+    ipc_get_stats(&after);
+
+    if (ret != 0) {
+        printk("ipcbench: user program failed (%d)\n", ret);
+    } else {
+        uint64_t cycles[IPCBENCH_SIZE / 8];
+        mm_read(mm, results, cycles, sizeof(cycles));
+        printk("Per round trip, %u iterations each:\n", iterations);
+        sysbench_print("two words in registers", cycles[IPCBENCH_REGS / 8], iterations);
+        sysbench_print("64 bytes inline", cycles[IPCBENCH_INLINE / 8], iterations);
+        sysbench_print("4 pages remapped", cycles[IPCBENCH_PAGES / 8], iterations);
+
+        uint32_t ns = (uint32_t)div64_u32(cycles_to_ns(cycles[IPCBENCH_PAGES / 8]), iterations);
+        if (ns) {
+            printk("Remapped payload: %llu MB/s\n", div64_u32((uint64_t)pages_len * 1000, ns));
+        }
+        printk("%u calls, %u switched straight to a waiting server, %u pages moved\n",
+               after.calls - before.calls, after.direct - before.direct, after.pages - before.pages);
+    }
+
+    mm_destroy(mm);
+    return ret;
+}
@@ -0,0 +1,567 @@
+#include "basedos.h"
+#include "syscall.h"
+#include "cpu.h"
+#include "sched.h"
+#include "smp.h"
+#include "time.h"
+#include "timer.h"
+#include "div64.h"
+#include "vdso.h"
+#include "exec.h"
+#include "process.h"
+#include "ipc.h"
+#include "fs/poll.h"
+#include "futex.h"
+#include "mman.h"
+#include "memory.h"
+#include "string.h"
+
+// SYSENTER model specific registers
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// CPUID leaf 1 EDX
+#define CPUID_SEP (1 << 11)
+
+#define SYSCALL_PATH_MAX 256
+
+typedef int32_t (*syscall_fn_t)(const uint32_t* args);
+
+typedef struct {
+    syscall_fn_t fn;
+    const char* name;
+} syscall_entry_t;
+
+static bool has_sysenter;
+
+static struct {
+    uint32_t calls[NR_SYSCALLS];
+    uint64_t cycles[NR_SYSCALLS];   // In the handler, time spent asleep included
+    uint32_t sysenter;              // Calls that came in through SYSENTER
+} __attribute__((aligned(64))) syscall_stats[NR_CPUS];
+
+// Size of interrupt_frame_t, copied by user_enter
+#define USER_FRAME_SIZE 76
+
+_Static_assert(sizeof(interrupt_frame_t) == USER_FRAME_SIZE, "user frame layout");
+
+// user_enter(&task->user_esp0, frame, offset of tss.esp0 in cpu_t): save
+// the callee-saved registers and the flags like switch_to, record the
+// stack pointer as the task's kernel entry stack in the task and in this
+// CPU's TSS, then return to ring 3 through a copy of frame the way an
+// interrupt returns. Entries from user mode push their frame right below
+// that stack pointer. user_leave(esp0, code) unwinds to that point from
+// anywhere deeper on the stack and makes user_enter return code.
+int user_enter(uint32_t* esp0, const interrupt_frame_t* frame, uint32_t tss_esp0);
+void user_leave(uint32_t esp0, int code) __attribute__((noreturn));
+
+// SYSENTER lands here on the stack in the TSS with interrupts disabled.
+// It builds the same frame as int 0x80, user esp from ebp, and returns
+// with SYSEXIT to eip in edx and esp in ecx; the vDSO stub restores them.
+void sysenter_entry(void);
+
+asm (
+    ".pushsection .text\n"
+    ".global user_enter\n"
+    "user_enter:\n"
+    "    pushf\n"
+    "    push %ebp\n"
+    "    push %ebx\n"
+    "    push %esi\n"
+    "    push %edi\n"
+    "    cli\n"
+    "    mov 24(%esp), %eax\n"
+    "    mov 28(%esp), %esi\n"
+    "    mov 32(%esp), %ebx\n"
+    "    mov %esp, (%eax)\n"
+    "    mov %esp, %fs:(%ebx)\n"
+    "    sub $" __stringify(USER_FRAME_SIZE) ", %esp\n"
+    "    mov %esp, %edi\n"
+    "    mov $" __stringify(USER_FRAME_SIZE) "/4, %ecx\n"
+    "    cld\n"
+    "    rep movsl\n"
+    "    pop %gs\n"
+    "    pop %fs\n"
+    "    pop %es\n"
+    "    pop %ds\n"
+    "    popa\n"
+    "    add $8, %esp\n"
+    "    iret\n"
+    ".global user_leave\n"
+    "user_leave:\n"
+    "    mov 8(%esp), %eax\n"
+    "    mov 4(%esp), %esp\n"
+    "    pop %edi\n"
+    "    pop %esi\n"
+    "    pop %ebx\n"
+    "    pop %ebp\n"
+    "    popf\n"
+    "    ret\n"
+    ".global sysenter_entry\n"
+    "sysenter_entry:\n"
+    "    movl (%esp), %esp\n"
+    "    pushl $0x23\n"              // ss
+    "    push %ebp\n"                // esp
+    "    pushf\n"
+    "    orl $0x200, (%esp)\n"       // User mode always runs with interrupts on
+    "    pushl $0x1B\n"              // cs
+    "    pushl $0\n"                 // eip, filled in by sysenter_dispatch
+    "    pushl $0\n"
+    "    pushl $0x80\n"
+    "    pusha\n"
+    "    push %ds\n"
+    "    push %es\n"
+    "    push %fs\n"
+    "    push %gs\n"
+    "    mov $0x10, %ax\n"
+    "    mov %ax, %ds\n"
+    "    mov %ax, %es\n"
+    "    mov $0x30, %ax\n"
+    "    mov %ax, %fs\n"
+    "    cld\n"
+    "    push %esp\n"
+    "    call sysenter_dispatch\n"
+    "    add $4, %esp\n"
+    "    pop %gs\n"
+    "    pop %fs\n"
+    "    pop %es\n"
+    "    pop %ds\n"
+    "    popa\n"
+    "    add $8, %esp\n"
+    "    mov (%esp), %edx\n"
+    "    mov 12(%esp), %ecx\n"
+    "    andl $0xFFFFFDFF, 8(%esp)\n" // Keep interrupts off until sysexit
+    "    add $8, %esp\n"
+    "    popf\n"
+    "    add $8, %esp\n"
+    "    sti\n"                      // Takes effect after sysexit
+    "    sysexit\n"
+    ".popsection\n"
+);
+
+static int32_t sys_exit(const uint32_t* args) {
+    user_return((int)args[0]);
+}
+
+static int32_t sys_read(const uint32_t* args) {
+    void* buf = (void*)args[1];
+    if (!user_access_ok(buf, args[2], true)) {
+        return -1;
+    }
+    return read((int32_t)args[0], buf, args[2]);
+}
+
+static int32_t sys_write(const uint32_t* args) {
+    const void* buf = (const void*)args[1];
+    if (!user_access_ok(buf, args[2], false)) {
+        return -1;
+    }
+    return write((int32_t)args[0], buf, args[2]);
+}
+
+static int32_t sys_open(const uint32_t* args) {
+    char path[SYSCALL_PATH_MAX];
+    if (strncpy_from_user(path, (const char*)args[0], sizeof(path)) < 0) {
+        return -1;
+    }
+    return open(path, args[1]);
+}
+
+static int32_t sys_close(const uint32_t* args) {
+    return close((int32_t)args[0]);
+}
+
+static int32_t sys_lseek(const uint32_t* args) {
+    return lseek((int32_t)args[0], (int32_t)args[1], (int32_t)args[2]);
+}
+
+static int32_t sys_getpid(const uint32_t* args) {
+    (void)args;
+    return current_task()->id;
+}
+
+static int32_t sys_yield(const uint32_t* args) {
+    (void)args;
+    yield();
+    return 0;
+}
+
+static int32_t sys_sleep(const uint32_t* args) {
+    msleep(args[0]);
+    return 0;
+}
+
+static int32_t sys_clock_ns(const uint32_t* args) {
+    uint64_t ns = ktime_get_ns();
+    return copy_to_user((void*)args[0], &ns, sizeof(ns));
+}
+
+static int32_t sys_fork(const uint32_t* args) {
+    (void)args;
+    return process_fork();
+}
+
+// Copy a NULL-terminated user argv, the strings into one page. Returns
+// argc, or -1 when it is unmapped or too big.
+static int syscall_copy_argv(char** argv, char* strings, const uint32_t* uargv) {
+    uint32_t used = 0;
+    for (int argc = 0; ; argc++) {
+        uint32_t ptr;
+        if (copy_from_user(&ptr, &uargv[argc], sizeof(ptr)) != 0) {
+            return -1;
+        }
+        if (!ptr) {
+            return argc;
+        }
+        int32_t len;
+        if (argc == EXEC_MAX_ARGS ||
+            (len = strncpy_from_user(strings + used, (const char*)ptr, PAGE_SIZE - used)) < 0) {
+            return -1;
+        }
+        argv[argc] = strings + used;
+        used += len + 1;
+    }
+}
+
+static int32_t sys_exec(const uint32_t* args) {
+    char path[SYSCALL_PATH_MAX];
+    if (strncpy_from_user(path, (const char*)args[0], sizeof(path)) < 0) {
+        return -1;
+    }
+    fs_node_t* node = exec_find(path);
+    char* strings = alloc_page();
+    if (!node || !strings) {
+        free_page(strings);
+        return -1;
+    }
+
+    // No argv: the path is the only argument
+    char* argv[EXEC_MAX_ARGS] = { path };
+    int argc = args[1] ? syscall_copy_argv(argv, strings, (const uint32_t*)args[1]) : 1;
+    int32_t ret = -1;
+    if (argc > 0) {
+        ret = exec_replace(node, argc, argv, user_frame(current_task()));
+    }
+    free_page(strings);
+    return ret;
+}
+
+static int32_t sys_wait(const uint32_t* args) {
+    int* status = (int*)args[1];
+    if (status && !user_access_ok(status, sizeof(*status), true)) {
+        return -1;
+    }
+    int code;
+    int32_t pid = process_wait((int32_t)args[0], &code);
+    if (pid > 0 && status) {
+        *status = code;
+    }
+    return pid;
+}
+
+static int32_t sys_port_create(const uint32_t* args) {
+    (void)args;
+    return ipc_port_create();
+}
+
+static int32_t sys_port_destroy(const uint32_t* args) {
+    return ipc_port_destroy((int32_t)args[0]);
+}
+
+static int32_t sys_ipc_call(const uint32_t* args) {
+    ipc_msg_t* umsg = (ipc_msg_t*)args[1];
+    ipc_payload_t msg;
+    if (ipc_msg_in(&msg, umsg, args[3], args[4]) != 0 || ipc_call((int32_t)args[0], &msg) != 0) {
+        return -1;
+    }
+    ipc_msg_out(&msg, umsg, user_frame(current_task()));
+    return 0;
+}
+
+static int32_t sys_ipc_reply(const uint32_t* args) {
+    ipc_payload_t msg;
+    if (ipc_msg_in(&msg, (const ipc_msg_t*)args[1], args[3], args[4]) != 0) {
+        return -1;
+    }
+    return ipc_reply((int32_t)args[0], args[2], &msg);
+}
+
+static int32_t sys_ipc_reply_wait(const uint32_t* args) {
+    ipc_msg_t* umsg = (ipc_msg_t*)args[1];
+    ipc_payload_t msg;
+    if (ipc_msg_in(&msg, umsg, args[3], args[4]) != 0) {
+        return -1;
+    }
+    int32_t token = ipc_reply_wait((int32_t)args[0], args[2], &msg);
+    if (token > 0) {
+        ipc_msg_out(&msg, umsg, user_frame(current_task()));
+    }
+    return token;
+}
+
+static int32_t sys_poll(const uint32_t* args) {
+    pollfd_t fds[POLL_MAX_FDS];
+    uint32_t nfds = args[1];
+    if (nfds > POLL_MAX_FDS || copy_from_user(fds, (const void*)args[0], nfds * sizeof(pollfd_t)) != 0) {
+        return -1;
+    }
+    int32_t ready = poll(fds, nfds, (int32_t)args[2]);
+    if (ready >= 0 && copy_to_user((void*)args[0], fds, nfds * sizeof(pollfd_t)) != 0) {
+        return -1;
+    }
+    return ready;
+}
+
+static int32_t sys_epoll_create(const uint32_t* args) {
+    (void)args;
+    return epoll_create();
+}
+
+static int32_t sys_epoll_ctl(const uint32_t* args) {
+    epoll_event_t event;
+    const void* uevent = (const void*)args[3];
+    if (uevent && copy_from_user(&event, uevent, sizeof(event)) != 0) {
+        return -1;
+    }
+    return epoll_ctl((int32_t)args[0], (int32_t)args[1], (int32_t)args[2], uevent ? &event : NULL);
+}
+
+static int32_t sys_epoll_wait(const uint32_t* args) {
+    epoll_event_t events[EPOLL_MAX_EVENTS];
+    uint32_t max = args[2] < EPOLL_MAX_EVENTS ? args[2] : EPOLL_MAX_EVENTS;
+    if (!user_access_ok((void*)args[1], max * sizeof(epoll_event_t), true)) {
+        return -1;
+    }
+    int32_t n = epoll_wait((int32_t)args[0], events, max, (int32_t)args[3]);
+    if (n > 0 && copy_to_user((void*)args[1], events, n * sizeof(epoll_event_t)) != 0) {
+        return -1;
+    }
+    return n;
+}
+
+static int32_t sys_futex(const uint32_t* args) {
+    switch (args[1]) {
+        case FUTEX_WAIT:
+            return futex_wait(args[0], args[2]);
+        case FUTEX_WAKE:
+            return futex_wake(args[0], args[2]);
+        case FUTEX_LOCK:
+            return futex_lock(args[0]);
+        case FUTEX_UNLOCK:
+            return futex_unlock(args[0]);
+        default:
+            return -1;
+    }
+}
+
+// The address comes back as an int32_t, -1 cannot be a page address
+static int32_t sys_mmap(const uint32_t* args) {
+    uint32_t len = args[1];
+    uint32_t flags = args[2];
+    int32_t fd = (int32_t)args[3];
+    uint32_t offset = args[4];
+    mm_t* mm = current_task()->mm;
+    bool shared = flags & MAP_SHARED;
+    if (!mm || !len || shared == !!(flags & MAP_PRIVATE)) {
+        return -1;
+    }
+    uint32_t addr = mm_find_free(mm, len);
+    uint32_t pte_flags = PTE_USER | ((flags & PROT_WRITE) ? PTE_WRITE : 0);
+    if (!addr) {
+        return -1;
+    }
+
+    if (flags & MAP_ANONYMOUS) {
+        if (shared) {
+            return mm_map_shared(mm, addr, len, pte_flags) == 0 ? (int32_t)addr : -1;
+        }
+        return mm_map_file(mm, addr, len, pte_flags, NULL, 0, 0) == 0 ? (int32_t)addr : -1;
+    }
+
+    // Shared file pages must be the file's own frames
+    fs_node_t* node = fd_lookup(fd);
+    if (!node || (node->flags & 0x7) != FS_FILE || (offset & (PAGE_SIZE - 1)) ||
+        (shared && !node->mmap_page)) {
+        return -1;
+    }
+    // Pages past the end of the file read as zeros and are private
+    uint32_t in_file = offset < node->length ? node->length - offset : 0;
+    if (mm_map_file(mm, addr, len, pte_flags | (shared ? PTE_SHARED : 0), node, offset,
+                    len < in_file ? len : in_file) != 0) {
+        return -1;
+    }
+    return (int32_t)addr;
+}
+
+static int32_t sys_munmap(const uint32_t* args) {
+    mm_t* mm = current_task()->mm;
+    return mm ? mm_unmap(mm, args[0], args[1]) : -1;
+}
+
+static int32_t sys_brk(const uint32_t* args) {
+    mm_t* mm = current_task()->mm;
+    if (!mm) {
+        return -1;
+    }
+    return (int32_t)(args[0] ? mm_brk(mm, args[0]) : mm->brk);
+}
+
+static const syscall_entry_t syscall_table[NR_SYSCALLS] = {
+    [SYS_exit] = { sys_exit, "exit" },
+    [SYS_read] = { sys_read, "read" },
+    [SYS_write] = { sys_write, "write" },
+    [SYS_open] = { sys_open, "open" },
+    [SYS_close] = { sys_close, "close" },
+    [SYS_lseek] = { sys_lseek, "lseek" },
+    [SYS_getpid] = { sys_getpid, "getpid" },
+    [SYS_yield] = { sys_yield, "yield" },
+    [SYS_sleep] = { sys_sleep, "sleep" },
+    [SYS_clock_ns] = { sys_clock_ns, "clock_ns" },
+    [SYS_fork] = { sys_fork, "fork" },
+    [SYS_exec] = { sys_exec, "exec" },
+    [SYS_wait] = { sys_wait, "wait" },
+    [SYS_port_create] = { sys_port_create, "port_create" },
+    [SYS_port_destroy] = { sys_port_destroy, "port_destroy" },
+    [SYS_ipc_call] = { sys_ipc_call, "ipc_call" },
+    [SYS_ipc_reply] = { sys_ipc_reply, "ipc_reply" },
+    [SYS_ipc_reply_wait] = { sys_ipc_reply_wait, "ipc_reply_wait" },
+    [SYS_poll] = { sys_poll, "poll" },
+    [SYS_epoll_create] = { sys_epoll_create, "epoll_create" },
+    [SYS_epoll_ctl] = { sys_epoll_ctl, "epoll_ctl" },
+    [SYS_epoll_wait] = { sys_epoll_wait, "epoll_wait" },
+    [SYS_futex] = { sys_futex, "futex" },
+    [SYS_mmap] = { sys_mmap, "mmap" },
+    [SYS_munmap] = { sys_munmap, "munmap" },
+    [SYS_brk] = { sys_brk, "brk" },
+};
+
+// Entered with interrupts disabled, the handler runs with them enabled
+// like any task code and may sleep
+void syscall_interrupt(interrupt_frame_t* frame) {
+    uint32_t nr = frame->eax;
+    if (nr >= NR_SYSCALLS) {
+        frame->eax = (uint32_t)-1;
+        return;
+    }
+
+    syscall_stats[smp_processor_id()].calls[nr]++;
+    uint32_t args[5] = { frame->ebx, frame->ecx, frame->edx, frame->esi, frame->edi };
+    uint64_t start = rdtsc();
+    enable_interrupts();
+
+    frame->eax = (uint32_t)syscall_table[nr].fn(args);
+
+    disable_interrupts();
+    syscall_stats[smp_processor_id()].cycles[nr] += rdtsc() - start;
+    preempt_schedule_irq();
+}
+
+void sysenter_dispatch(interrupt_frame_t* frame) {
+    frame->eip = vdso_sysenter_return();
+    syscall_stats[smp_processor_id()].sysenter++;
+    syscall_interrupt(frame);
+}
+
+int user_run_frame(mm_t* mm, const interrupt_frame_t* frame) {
+    task_t* task = current_task();
+    if (!paging_enabled() || !mm || task->mm) {
+        return -1;
+    }
+
+    // Whatever the frame says, enter ring 3 with interrupts enabled
+    interrupt_frame_t entry = *frame;
+    entry.cs = GDT_USER_CODE | 3;
+    entry.ss = entry.ds = entry.es = entry.fs = entry.gs = GDT_USER_DATA | 3;
+    entry.eflags = (entry.eflags & EFLAGS_USER_MASK) | EFLAGS_IF;
+
+    uint32_t flags = irq_save();
+    task->mm = mm;
+    switch_mm(mm);
+    irq_restore(flags);
+
+    int code = user_enter(&task->user_esp0, &entry, __builtin_offsetof(cpu_t, tss.esp0));
+
+    flags = irq_save();
+    task->user_esp0 = 0;
+    task->mm = NULL;
+    switch_mm(NULL);
+    irq_restore(flags);
+
+    process_orphan_children();
+    ipc_task_exit();
+    return code;
+}
+
+int user_run(mm_t* mm, uint32_t eip, uint32_t esp) {
+    interrupt_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.eip = eip;
+    frame.useresp = esp;
+    return user_run_frame(mm, &frame);
+}
+
+interrupt_frame_t* user_frame(task_t* task) {
+    return (interrupt_frame_t*)(task->user_esp0 - sizeof(interrupt_frame_t));
+}
+
+void user_return(int code) {
+    disable_interrupts();
+    task_t* task = current_task();
+    if (!task->user_esp0) {
+        kernel_panic("user_return outside of a user program");
+    }
+    user_leave(task->user_esp0, code);
+}
+
+void user_fault(interrupt_frame_t* frame, const char* what) {
+    task_t* task = current_task();
+    printk("Task %u (%s): %s at %x, error code %x, killed\n", task->id, task->name, what,
+           frame->eip, frame->err_code);
+    user_return(-1);
+}
+
+// Kernel code segment, entry stack (this CPU's TSS esp0, loaded by the
+// entry code) and entry point
+void syscall_cpu_init(void) {
+    if (!has_sysenter) {
+        return;
+    }
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&this_cpu()->tss.esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void syscall_initialize(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    has_sysenter = (edx & CPUID_SEP) != 0;
+
+    syscall_cpu_init();
+    vdso_initialize(has_sysenter);
+}
+
+bool syscall_has_sysenter(void) {
+    return has_sysenter;
+}
+
+void syscall_show(void) {
+    uint32_t sysenter = 0;
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        sysenter += syscall_stats[cpu].sysenter;
+    }
+    printk("System calls: int 0x80%s, %u through SYSENTER\n",
+           has_sysenter ? " and SYSENTER" : " only", sysenter);
+    printk("      NAME     CALLS  AVG CYCLES\n");
+    for (uint32_t nr = 0; nr < NR_SYSCALLS; nr++) {
+        uint32_t calls = 0;
+        uint64_t cycles = 0;
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            calls += syscall_stats[cpu].calls[nr];
+            cycles += syscall_stats[cpu].cycles[nr];
+        }
+        if (calls) {
+            printk("  %8s  %8u  %10llu\n", syscall_table[nr].name, calls, div64_u32(cycles, calls));
+        }
+    }
+}
@@ -1,10 +1,15 @@
 #include "basedos.h"
 #include "string.h"
+#include "div64.h"
+#include "latency.h"
+#include "spinlock.h"
+#include "fs/console.h"
 
 // Terminal state
 uint16_t* video_memory = (uint16_t*)0xB8000;
 int cursor_x = 0, cursor_y = 0;
 static uint8_t text_attribute = 0x07;
+static spinlock_t terminal_lock = SPINLOCK_INIT; // Cursor and screen, shared by all CPUs
 
 static void update_cursor(void) {
     uint16_t pos = cursor_y * 80 + cursor_x;
@@ -30,7 +35,9 @@ void terminal_clear(void) {
     terminal_initialize();
 }
 
-void putchar(char c) {
+// Put one character on the screen, terminal_lock held. The hardware
+// cursor is left for the caller to move.
+static void terminal_put_locked(char c) {
     if (c == '\n') {
         cursor_x = 0;
         cursor_y++;
@@ -68,8 +75,38 @@ void putchar(char c) {
         }
         cursor_y = 24;
     }
+}
+
+void putchar(char c) {
+    if (console_redirect_putchar(c)) {
+        return;
+    }
 
+    uint32_t flags = spin_lock_irqsave(&terminal_lock);
+    terminal_put_locked(c);
     update_cursor();
+    spin_unlock_irqrestore(&terminal_lock, flags);
+
+    // First output after a key was read is its echo
+    if (input_latency_pending) {
+        input_latency_echo_done();
+    }
+}
+
+void terminal_write(const char* data, uint32_t len) {
+    // One lock round trip and cursor move for the whole buffer, the
+    // cursor costs four port writes
+    uint32_t flags = spin_lock_irqsave(&terminal_lock);
+    for (uint32_t i = 0; i < len; i++) {
+        terminal_put_locked(data[i]);
+    }
+    update_cursor();
+    spin_unlock_irqrestore(&terminal_lock, flags);
+
+    // First output after a key was read is its echo
+    if (input_latency_pending) {
+        input_latency_echo_done();
+    }
 }
 
 void terminal_writestring(const char* str) {
@@ -113,6 +150,36 @@ void terminal_setcolor(uint8_t fg, uint8_t bg) {
     text_attribute = (bg << 4) | (fg & 0x0F);
 }
 
+// Convert a 64-bit value to a string in the given base
+static void u64toa(uint64_t value, char* str, uint32_t base) {
+    char tmp[24];
+    int i = 0;
+
+    do {
+        uint32_t rem = div64_u32_rem(&value, base);
+        tmp[i++] = (rem > 9) ? (rem - 10) + 'a' : rem + '0';
+    } while (value != 0);
+
+    while (i > 0) {
+        *str++ = tmp[--i];
+    }
+    *str = '\0';
+}
+
+// Write a string right-aligned in a field of the given width
+static void terminal_write_padded(const char* str, int width, char pad) {
+    int len = strlen(str);
+    if (pad == '0' && *str == '-') {
+        putchar(*str++);
+        width--;
+        len--;
+    }
+    while (len < width--) {
+        putchar(pad);
+    }
+    terminal_writestring(str);
+}
+
 void printk(const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -120,28 +187,65 @@ void printk(const char* format, ...) {
     while (*format) {
         if (*format == '%') {
             format++;
+
+            // Optional zero padding and field width, e.g. %02d or %8s
+            char pad = ' ';
+            int width = 0;
+            if (*format == '0') {
+                pad = '0';
+                format++;
+            }
+            while (*format >= '0' && *format <= '9') {
+                width = width * 10 + (*format - '0');
+                format++;
+            }
+
+            char buffer[32];
             switch (*format) {
                 case 'd':
                 case 'i': {
                     int num = va_arg(args, int);
-                    char buffer[32];
                     itoa(num, buffer, 10);
-                    terminal_writestring(buffer);
+                    terminal_write_padded(buffer, width, pad);
                     break;
                 }
                 case 'u': {
                     unsigned int num = va_arg(args, unsigned int);
-                    char buffer[32];
-                    itoa(num, buffer, 10);
-                    terminal_writestring(buffer);
+                    u64toa(num, buffer, 10);
+                    terminal_write_padded(buffer, width, pad);
                     break;
                 }
                 case 'x':
                 case 'X': {
                     unsigned int num = va_arg(args, unsigned int);
-                    char buffer[32];
-                    itoa(num, buffer, 16);
-                    terminal_writestring(buffer);
+                    u64toa(num, buffer, 16);
+                    terminal_write_padded(buffer, width, pad);
+                    break;
+                }
+                case 'l': {
+                    // %lu, %ld, %lx take a 32-bit long, %llu, %lld, %llx
+                    // a 64-bit one
+                    bool wide = format[1] == 'l';
+                    if (wide) {
+                        format++;
+                    }
+                    if (format[1] == '\0') {
+                        break;
+                    }
+                    format++;
+                    if (*format == 'd' || *format == 'i') {
+                        int64_t num = wide ? va_arg(args, int64_t) : va_arg(args, long);
+                        char* p = buffer;
+                        if (num < 0) {
+                            *p++ = '-';
+                            num = -num;
+                        }
+                        u64toa((uint64_t)num, p, 10);
+                    } else {
+                        uint64_t num = wide ? va_arg(args, uint64_t) : va_arg(args, unsigned long);
+                        u64toa(num, buffer, (*format == 'x' || *format == 'X') ? 16 : 10);
+                    }
+                    terminal_write_padded(buffer, width, pad);
                     break;
                 }
                 case 'c': {
@@ -151,16 +255,15 @@ void printk(const char* format, ...) {
                 }
                 case 's': {
                     const char* str = va_arg(args, const char*);
-                    if (str == NULL) {
-                        terminal_writestring("(null)");
-                    } else {
-                        terminal_writestring(str);
-                    }
+                    terminal_write_padded(str ? str : "(null)", width, ' ');
                     break;
                 }
                 case '%':
                     putchar('%');
                     break;
+                case '\0':
+                    format--;
+                    break;
                 default:
                     putchar('%');
                     putchar(*format);
@@ -0,0 +1,359 @@
+#include "basedos.h"
+#include "time.h"
+#include "cpu.h"
+#include "string.h"
+#include "div64.h"
+#include "spinlock.h"
+
+// PIT channel 0 reload value for the TIMER_HZ tick
+#define PIT_DIVISOR (PIT_FREQUENCY / TIMER_HZ)
+
+// TSC calibration: CALIBRATE_RUNS windows of CALIBRATE_MS each,
+// runs disagreeing by more than CALIBRATE_TOLERANCE percent mean the TSC
+// is not a usable clocksource
+#define CALIBRATE_MS        10
+#define CALIBRATE_RUNS      3
+#define CALIBRATE_TOLERANCE 2
+
+// CMOS RTC registers
+#define CMOS_ADDRESS  0x70
+#define CMOS_DATA     0x71
+#define RTC_SECONDS   0x00
+#define RTC_MINUTES   0x02
+#define RTC_HOURS     0x04
+#define RTC_DAY       0x07
+#define RTC_MONTH     0x08
+#define RTC_YEAR      0x09
+#define RTC_STATUS_A  0x0A
+#define RTC_STATUS_B  0x0B
+#define RTC_CENTURY   0x32
+
+typedef enum {
+    CLOCKSOURCE_NONE = 0,
+    CLOCKSOURCE_PIT,
+    CLOCKSOURCE_TSC
+} clocksource_t;
+
+static clocksource_t clocksource = CLOCKSOURCE_NONE;
+
+// TSC state: ns = (tsc - tsc_base) * tsc_mult >> tsc_shift
+static uint64_t tsc_base = 0;
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 0;
+static uint32_t tsc_khz = 0;
+static bool tsc_invariant = false;
+
+// PIT fallback: ns = pit_cycles * pit_mult >> pit_shift
+static uint32_t pit_mult = 0;
+static uint32_t pit_shift = 0;
+static uint64_t pit_base_ns = 0;
+static uint64_t pit_last_ns = 0;
+
+// Wall clock read from the RTC at boot
+static time_t boot_epoch = 0;
+static uint64_t boot_epoch_ns = 0;
+
+// Pick the largest shift for which (num << shift) / den still fits in 32 bits
+static void calc_mult_shift(uint32_t* mult, uint32_t* shift, uint32_t num, uint32_t den) {
+    for (uint32_t sft = 32; sft > 0; sft--) {
+        uint64_t tmp = div64_u32((uint64_t)num << sft, den);
+        if ((tmp >> 32) == 0) {
+            *mult = (uint32_t)tmp;
+            *shift = sft;
+            return;
+        }
+    }
+    *mult = 0;
+    *shift = 1;
+}
+
+// Time one PIT channel 2 one-shot of CALIBRATE_MS in TSC cycles, 0 on timeout
+static uint64_t pit_calibrate_tsc_once(void) {
+    uint32_t latch = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+
+    // Gate channel 2 on, keep the speaker disconnected
+    outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(0x43, 0xB0);
+    outb(0x42, latch & 0xFF);
+    outb(0x42, (latch >> 8) & 0xFF);
+
+    uint64_t start = rdtsc();
+    uint32_t spins = 0;
+    while (!(inb(0x61) & 0x20)) {
+        if (++spins > 10000000) {
+            return 0;
+        }
+    }
+    return rdtsc() - start;
+}
+
+static bool tsc_calibrate(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 1) {
+        return false;
+    }
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1 << 4))) {
+        return false; // No TSC
+    }
+
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        tsc_invariant = (edx & (1 << 8)) != 0;
+    }
+
+    uint64_t min = ~0ULL;
+    uint64_t max = 0;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t cycles = pit_calibrate_tsc_once();
+        if (cycles == 0) {
+            return false;
+        }
+        if (cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+    }
+
+    // Runs must agree, otherwise the TSC rate is not trustworthy
+    if (div64_u32((max - min) * 100, CALIBRATE_TOLERANCE) > min) {
+        return false;
+    }
+
+    uint64_t khz = div64_u32(min, CALIBRATE_MS);
+    if (khz == 0 || (khz >> 32) != 0) {
+        return false;
+    }
+
+    tsc_khz = (uint32_t)khz;
+    calc_mult_shift(&tsc_mult, &tsc_shift, 1000000, tsc_khz);
+    return tsc_mult != 0;
+}
+
+// Nanoseconds since the PIT tick started, from the tick count and the
+// channel 0 down-counter
+static spinlock_t pit_lock = SPINLOCK_INIT; // Latch and read must not interleave between CPUs
+
+static uint64_t pit_read_ns(void) {
+    uint32_t flags = spin_lock_irqsave(&pit_lock);
+    uint32_t ticks = timer_ticks;
+
+    outb(0x43, 0x00); // Latch channel 0
+    uint32_t count = inb(0x40);
+    count |= inb(0x40) << 8;
+
+    // The counter wrapped but the tick interrupt has not been serviced yet
+    outb(0x20, 0x0A); // OCW3: read IRR
+    if ((inb(0x20) & 0x01) && count > PIT_DIVISOR / 2) {
+        ticks++;
+    }
+
+    uint64_t pit_cycles = (uint64_t)ticks * PIT_DIVISOR + (PIT_DIVISOR - count);
+    uint64_t ns = mul_u64_u32_shr(pit_cycles, pit_mult, pit_shift) - pit_base_ns;
+    if (ns < pit_last_ns) {
+        ns = pit_last_ns;
+    }
+    pit_last_ns = ns;
+
+    spin_unlock_irqrestore(&pit_lock, flags);
+    return ns;
+}
+
+uint64_t ktime_get_ns(void) {
+    if (clocksource == CLOCKSOURCE_TSC) {
+        return mul_u64_u32_shr(rdtsc() - tsc_base, tsc_mult, tsc_shift);
+    }
+    if (clocksource == CLOCKSOURCE_PIT) {
+        return pit_read_ns();
+    }
+    return 0;
+}
+
+uint64_t cycles_to_ns(uint64_t cycles) {
+    if (clocksource != CLOCKSOURCE_TSC) {
+        return 0;
+    }
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+bool clocksource_tsc_params(uint64_t* base, uint32_t* mult, uint32_t* shift) {
+    if (clocksource != CLOCKSOURCE_TSC) {
+        return false;
+    }
+    *base = tsc_base;
+    *mult = tsc_mult;
+    *shift = tsc_shift;
+    return true;
+}
+
+uint32_t tsc_khz_get(void) {
+    return clocksource == CLOCKSOURCE_TSC ? tsc_khz : 0;
+}
+
+const char* clocksource_name(void) {
+    switch (clocksource) {
+        case CLOCKSOURCE_TSC: return tsc_invariant ? "tsc (invariant)" : "tsc";
+        case CLOCKSOURCE_PIT: return "pit";
+        default: return "none";
+    }
+}
+
+// Calendar conversion, days relative to 1970-01-01
+
+static int32_t days_from_civil(int32_t y, uint32_t m, uint32_t d) {
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);
+    uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+static void civil_from_days(int32_t z, rtc_time_t* tm) {
+    z += 719468;
+    int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+    uint32_t doe = (uint32_t)(z - era * 146097);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    tm->day = doy - (153 * mp + 2) / 5 + 1;
+    tm->month = mp < 10 ? mp + 3 : mp - 9;
+    tm->year = (uint32_t)((int32_t)yoe + era * 400) + (tm->month <= 2);
+}
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_ADDRESS, reg);
+    return inb(CMOS_DATA);
+}
+
+static uint32_t bcd_to_bin(uint8_t v) {
+    return (v & 0x0F) + (v >> 4) * 10;
+}
+
+static void rtc_read_raw(uint8_t regs[7]) {
+    while (cmos_read(RTC_STATUS_A) & 0x80) {
+        // Update in progress
+    }
+    regs[0] = cmos_read(RTC_SECONDS);
+    regs[1] = cmos_read(RTC_MINUTES);
+    regs[2] = cmos_read(RTC_HOURS);
+    regs[3] = cmos_read(RTC_DAY);
+    regs[4] = cmos_read(RTC_MONTH);
+    regs[5] = cmos_read(RTC_YEAR);
+    regs[6] = cmos_read(RTC_CENTURY);
+}
+
+// Read the RTC once, re-reading until two consecutive reads agree
+static time_t rtc_read_epoch(void) {
+    uint8_t regs[7], prev[7];
+
+    rtc_read_raw(regs);
+    do {
+        memcpy(prev, regs, sizeof(regs));
+        rtc_read_raw(regs);
+    } while (memcmp(prev, regs, sizeof(regs)) != 0);
+
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    bool pm = (regs[2] & 0x80) != 0;
+    regs[2] &= 0x7F;
+
+    rtc_time_t tm;
+    if (status_b & 0x04) {
+        tm.second = regs[0];
+        tm.minute = regs[1];
+        tm.hour = regs[2];
+        tm.day = regs[3];
+        tm.month = regs[4];
+        tm.year = regs[5];
+        tm.year += (regs[6] >= 19 && regs[6] <= 21) ? regs[6] * 100 : 2000;
+    } else {
+        tm.second = bcd_to_bin(regs[0]);
+        tm.minute = bcd_to_bin(regs[1]);
+        tm.hour = bcd_to_bin(regs[2]);
+        tm.day = bcd_to_bin(regs[3]);
+        tm.month = bcd_to_bin(regs[4]);
+        tm.year = bcd_to_bin(regs[5]);
+        uint32_t century = bcd_to_bin(regs[6]);
+        tm.year += (century >= 19 && century <= 21) ? century * 100 : 2000;
+    }
+
+    // 12-hour mode: 12 AM is midnight, PM adds 12
+    if (!(status_b & 0x02)) {
+        tm.hour %= 12;
+        if (pm) {
+            tm.hour += 12;
+        }
+    }
+
+    if (tm.month < 1 || tm.month > 12 || tm.day < 1 || tm.day > 31) {
+        return 0;
+    }
+
+    int32_t days = days_from_civil((int32_t)tm.year, tm.month, tm.day);
+    return (time_t)days * 86400 + tm.hour * 3600 + tm.minute * 60 + tm.second;
+}
+
+time_t wall_clock_seconds(void) {
+    uint64_t elapsed = ktime_get_ns() - boot_epoch_ns;
+    return boot_epoch + (time_t)div64_u32(elapsed, NSEC_PER_SEC);
+}
+
+time_t wall_clock_boot_time(void) {
+    return boot_epoch - (time_t)div64_u32(boot_epoch_ns, NSEC_PER_SEC);
+}
+
+void wall_clock_get(rtc_time_t* tm) {
+    time_t now = wall_clock_seconds();
+    uint32_t secs = now % 86400;
+
+    civil_from_days((int32_t)(now / 86400), tm);
+    tm->hour = secs / 3600;
+    tm->minute = (secs / 60) % 60;
+    tm->second = secs % 60;
+}
+
+void udelay(uint32_t usecs) {
+    if (clocksource == CLOCKSOURCE_NONE) {
+        // Not calibrated yet. Guess one loop iteration per nanosecond,
+        // which assumes about one iteration per cycle at 1 GHz: slower
+        // CPUs wait longer than asked, faster ones shorter.
+        uint64_t loops = (uint64_t)usecs * NSEC_PER_USEC;
+        for (uint64_t i = 0; i < loops; i++) {
+            asm volatile("nop");
+        }
+        return;
+    }
+
+    uint64_t end = ktime_get_ns() + (uint64_t)usecs * NSEC_PER_USEC;
+    while (ktime_get_ns() < end) {
+        cpu_relax();
+    }
+}
+
+void mdelay(uint32_t msecs) {
+    while (msecs--) {
+        udelay(1000);
+    }
+}
+
+void clocksource_initialize(void) {
+    calc_mult_shift(&pit_mult, &pit_shift, 1000000000, PIT_FREQUENCY);
+
+    if (tsc_calibrate()) {
+        tsc_base = rdtsc();
+        clocksource = CLOCKSOURCE_TSC;
+    } else {
+        // Start the PIT clock at zero like the TSC one
+        clocksource = CLOCKSOURCE_PIT;
+        pit_last_ns = 0;
+        pit_base_ns = 0;
+        pit_base_ns = pit_read_ns();
+        pit_last_ns = 0;
+    }
+
+    boot_epoch = rtc_read_epoch();
+    boot_epoch_ns = ktime_get_ns();
+}
@@ -0,0 +1,102 @@
+#include "basedos.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "sched.h"
+
+// Pending timers sorted by expiry, the next one to fire first
+static timer_list_t* timer_list = NULL;
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+void timer_setup(timer_list_t* timer, void (*func)(uint32_t data), uint32_t data) {
+    timer->next = NULL;
+    timer->expires = 0;
+    timer->func = func;
+    timer->data = data;
+    timer->pending = false;
+}
+
+static void timer_unlink(timer_list_t* timer) {
+    timer_list_t** link = &timer_list;
+    while (*link && *link != timer) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = timer->next;
+    }
+    timer->next = NULL;
+    timer->pending = false;
+}
+
+void mod_timer(timer_list_t* timer, uint32_t expires) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (timer->pending) {
+        timer_unlink(timer);
+    }
+
+    timer->expires = expires;
+    timer_list_t** link = &timer_list;
+    while (*link && time_after_eq(expires, (*link)->expires)) {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link = timer;
+    timer->pending = true;
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+bool del_timer(timer_list_t* timer) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    bool was_pending = timer->pending;
+    if (was_pending) {
+        timer_unlink(timer);
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return was_pending;
+}
+
+bool timer_pending(timer_list_t* timer) {
+    return timer->pending;
+}
+
+void run_timers(void) {
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&timer_lock);
+        timer_list_t* timer = timer_list;
+        if (!timer || !time_after_eq(timer_ticks, timer->expires)) {
+            spin_unlock_irqrestore(&timer_lock, flags);
+            break;
+        }
+        timer_list = timer->next;
+        timer->next = NULL;
+        timer->pending = false;
+        void (*func)(uint32_t data) = timer->func;
+        uint32_t data = timer->data;
+        spin_unlock_irqrestore(&timer_lock, flags);
+
+        // Not pending any more, so the owner may re-arm or free the timer
+        func(data);
+    }
+}
+
+static void msleep_timeout(uint32_t data) {
+    wake_up_task((task_t*)data);
+}
+
+void msleep(uint32_t msecs) {
+    if (!sched_can_block()) {
+        mdelay(msecs);
+        return;
+    }
+
+    timer_list_t timer;
+    timer_setup(&timer, msleep_timeout, (uint32_t)current_task());
+    mod_timer(&timer, timer_ticks + msecs_to_ticks(msecs));
+    while (1) {
+        set_current_state(TASK_BLOCKED);
+        if (!timer_pending(&timer)) {
+            break;
+        }
+        schedule();
+    }
+    set_current_state(TASK_RUNNING);
+}
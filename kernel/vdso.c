@@ -0,0 +1,157 @@
+#include "basedos.h"
+#include "vdso.h"
+#include "memory.h"
+#include "string.h"
+#include "time.h"
+
+// Absolute address of a vdso_data_t field, for the assembly below
+#define VDSO_FIELD(off) __stringify(VDSO_BASE) "+" __stringify(off)
+
+_Static_assert(__builtin_offsetof(vdso_data_t, ticks) == VDSO_TICKS, "vdso layout");
+_Static_assert(__builtin_offsetof(vdso_data_t, tick_ns) == VDSO_TICK_NS, "vdso layout");
+_Static_assert(__builtin_offsetof(vdso_data_t, tsc_mult) == VDSO_TSC_MULT, "vdso layout");
+_Static_assert(__builtin_offsetof(vdso_data_t, tsc_shift) == VDSO_TSC_SHIFT, "vdso layout");
+_Static_assert(__builtin_offsetof(vdso_data_t, tsc_base) == VDSO_TSC_BASE, "vdso layout");
+_Static_assert(__builtin_offsetof(vdso_data_t, syscall_entry) == VDSO_SYSCALL_ENTRY, "vdso layout");
+_Static_assert(__builtin_offsetof(vdso_data_t, clock_ns) == VDSO_CLOCK_NS, "vdso layout");
+
+// User mode routines, copied to VDSO_CODE_OFFSET of the page. They only
+// use relative jumps and the fixed address of the data, so they run
+// wherever the copy is.
+//
+// The SYSENTER stub saves ecx and edx, which SYSEXIT overwrites with the
+// return esp and eip, and passes the user stack in ebp. clock_ns is the
+// ktime_get_ns() formula: a 64x32 bit multiply into 96 bits, shifted.
+extern char vdso_code_start[], vdso_code_end[];
+extern char vdso_sysenter[], vdso_sysenter_ret[], vdso_int80[], vdso_clock_ns[];
+
+asm (
+    ".pushsection .text\n"
+    ".global vdso_code_start\n"
+    "vdso_code_start:\n"
+    ".global vdso_sysenter\n"
+    "vdso_sysenter:\n"
+    "    push %ecx\n"
+    "    push %edx\n"
+    "    push %ebp\n"
+    "    mov %esp, %ebp\n"
+    "    sysenter\n"
+    ".global vdso_sysenter_ret\n"
+    "vdso_sysenter_ret:\n"
+    "    pop %ebp\n"
+    "    pop %edx\n"
+    "    pop %ecx\n"
+    "    ret\n"
+    ".global vdso_int80\n"
+    "vdso_int80:\n"
+    "    int $0x80\n"
+    "    ret\n"
+    ".global vdso_clock_ns\n"
+    "vdso_clock_ns:\n"
+    "    push %ebx\n"
+    "    push %esi\n"
+    "    push %edi\n"
+    "    push %ebp\n"
+    "1:  mov " VDSO_FIELD(VDSO_SEQ) ", %ebp\n"
+    "    test $1, %ebp\n"
+    "    jnz 5f\n"
+    "    mov " VDSO_FIELD(VDSO_TSC_MULT) ", %ecx\n"
+    "    test %ecx, %ecx\n"
+    "    jz 4f\n"
+    "    rdtsc\n"
+    "    sub " VDSO_FIELD(VDSO_TSC_BASE) ", %eax\n"
+    "    sbb " VDSO_FIELD(VDSO_TSC_BASE + 4) ", %edx\n"
+    "    mov %edx, %esi\n"
+    "    mul %ecx\n"                 // low half * mult
+    "    mov %eax, %edi\n"
+    "    mov %edx, %ebx\n"
+    "    mov %esi, %eax\n"
+    "    mul %ecx\n"                 // high half * mult
+    "    add %ebx, %eax\n"
+    "    adc $0, %edx\n"             // Product in edx:eax:edi
+    "    mov " VDSO_FIELD(VDSO_TSC_SHIFT) ", %ecx\n"
+    "    cmp $32, %ecx\n"
+    "    jb 2f\n"
+    "    sub $32, %ecx\n"
+    "    shrd %cl, %edx, %eax\n"
+    "    shr %cl, %edx\n"
+    "    jmp 3f\n"
+    "2:  shrd %cl, %eax, %edi\n"
+    "    shrd %cl, %edx, %eax\n"
+    "    mov %eax, %edx\n"
+    "    mov %edi, %eax\n"
+    "3:  cmp " VDSO_FIELD(VDSO_SEQ) ", %ebp\n"
+    "    jne 1b\n"
+    "    pop %ebp\n"
+    "    pop %edi\n"
+    "    pop %esi\n"
+    "    pop %ebx\n"
+    "    ret\n"
+    // No TSC: tick resolution
+    "4:  mov " VDSO_FIELD(VDSO_TICKS) ", %eax\n"
+    "    mull " VDSO_FIELD(VDSO_TICK_NS) "\n"
+    "    jmp 3b\n"
+    "5:  pause\n"
+    "    jmp 1b\n"
+    ".global vdso_code_end\n"
+    "vdso_code_end:\n"
+    ".popsection\n"
+);
+
+static uint8_t* vdso_page;
+
+static inline vdso_data_t* vdso_data(void) {
+    return (vdso_data_t*)vdso_page;
+}
+
+// User address of a routine in the code copy
+static inline uint32_t vdso_symbol(const char* sym) {
+    return VDSO_BASE + VDSO_CODE_OFFSET + (uint32_t)(sym - vdso_code_start);
+}
+
+void vdso_initialize(bool sysenter) {
+    if (vdso_code_end - vdso_code_start > PAGE_SIZE - VDSO_CODE_OFFSET) {
+        kernel_panic("vDSO code does not fit its page");
+    }
+    vdso_page = alloc_page();
+    if (!vdso_page) {
+        kernel_panic("Out of memory for the vDSO");
+    }
+    memset(vdso_page, 0, PAGE_SIZE);
+    memcpy(vdso_page + VDSO_CODE_OFFSET, vdso_code_start, vdso_code_end - vdso_code_start);
+
+    vdso_data_t* vd = vdso_data();
+    vd->hz = TIMER_HZ;
+    vd->tick_ns = NSEC_PER_SEC / TIMER_HZ;
+    vd->ticks = timer_ticks;
+    if (clocksource_tsc_params(&vd->tsc_base, &vd->tsc_mult, &vd->tsc_shift)) {
+        vd->tsc_khz = tsc_khz_get();
+    }
+    vd->boot_epoch = wall_clock_boot_time();
+    vd->syscall_entry = vdso_symbol(sysenter ? vdso_sysenter : vdso_int80);
+    vd->clock_ns = vdso_symbol(vdso_clock_ns);
+}
+
+int vdso_map(mm_t* mm) {
+    if (!vdso_page) {
+        return 0;
+    }
+    return mm_map_page(mm, VDSO_BASE, (uint32_t)vdso_page, PTE_USER | PTE_NOFREE);
+}
+
+uint32_t vdso_sysenter_return(void) {
+    return vdso_symbol(vdso_sysenter_ret);
+}
+
+// Only the boot CPU counts ticks, so there is a single writer
+void vdso_tick(uint32_t ticks) {
+    vdso_data_t* vd = vdso_data();
+    if (!vd) {
+        return;
+    }
+    vd->seq++;
+    asm volatile("" : : : "memory");
+    vd->ticks = ticks;
+    asm volatile("" : : : "memory");
+    vd->seq++;
+}
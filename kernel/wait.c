@@ -0,0 +1,118 @@
+#include "basedos.h"
+#include "wait.h"
+
+void init_waitqueue_head(wait_queue_head_t* wq) {
+    spin_lock_init(&wq->lock);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void init_wait_entry(wait_queue_entry_t* entry, uint32_t flags) {
+    entry->task = current_task();
+    entry->flags = flags;
+    entry->func = NULL;
+    entry->private = NULL;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+void init_wait_func(wait_queue_entry_t* entry, void (*func)(wait_queue_entry_t* entry), void* private) {
+    entry->task = NULL;
+    entry->flags = 0;
+    entry->func = func;
+    entry->private = private;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static bool entry_queued(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    return entry->prev || wq->head == entry;
+}
+
+static void wq_add_tail(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    entry->next = NULL;
+    entry->prev = wq->tail;
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        wq->head = entry;
+    }
+    wq->tail = entry;
+}
+
+static void wq_remove(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+    entry->next = entry->prev = NULL;
+}
+
+void prepare_to_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (!entry_queued(wq, entry)) {
+        wq_add_tail(wq, entry);
+    }
+    set_current_state(TASK_BLOCKED);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void finish_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    set_current_state(TASK_RUNNING);
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (entry_queued(wq, entry)) {
+        wq_remove(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void add_wait_queue(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (!entry_queued(wq, entry)) {
+        wq_add_tail(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Once this returns func cannot be running for the entry any more
+void remove_wait_queue(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (entry_queued(wq, entry)) {
+        wq_remove(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Woken entries are dequeued, a task that finds its condition still false
+// queues itself again in prepare_to_wait() before checking once more.
+// Callback entries stay and do not count as exclusive waiters.
+void __wake_up(wait_queue_head_t* wq, uint32_t nr_exclusive, uint32_t boost) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    wait_queue_entry_t* entry = wq->head;
+    while (entry) {
+        wait_queue_entry_t* next = entry->next;
+        if (entry->func) {
+            entry->func(entry);
+            entry = next;
+            continue;
+        }
+        bool exclusive = entry->flags & WQ_FLAG_EXCLUSIVE;
+        wq_remove(wq, entry);
+        wake_up_task_boost(entry->task, boost);
+        if (exclusive && nr_exclusive && --nr_exclusive == 0) {
+            break;
+        }
+        entry = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+bool waitqueue_active(wait_queue_head_t* wq) {
+    return wq->head != NULL;
+}
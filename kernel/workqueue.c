@@ -0,0 +1,355 @@
+#include "basedos.h"
+#include "workqueue.h"
+#include "memory.h"
+#include "sched.h"
+#include "string.h"
+
+workqueue_t* system_wq = NULL;
+
+static workqueue_t* workqueues = NULL;
+static spinlock_t workqueues_lock = SPINLOCK_INIT;
+
+static void worker_thread(void* arg);
+
+void init_work(work_t* work, void (*func)(work_t* work)) {
+    work->next = NULL;
+    work->state = 0;
+    work->func = func;
+    work->wq = NULL;
+}
+
+// Append to the pending list, called with wq->lock held. Returns true when
+// no worker is free to take it and the pool may grow.
+static bool insert_work(workqueue_t* wq, work_t* work) {
+    work->next = NULL;
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+    wq->nr_pending++;
+    wake_up(&wq->more_work);
+    return wq->nr_pending > wq->nr_idle && wq->nr_workers < wq->max_workers;
+}
+
+// Start one more worker unless the pool is full. New workers count as idle
+// from the start so concurrent callers do not all spawn one.
+static void wq_grow(workqueue_t* wq) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (wq->nr_workers >= wq->max_workers || wq->nr_pending <= wq->nr_idle) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return;
+    }
+    wq->nr_workers++;
+    wq->nr_idle++;
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    task_t* task = kthread_create(wq->name, worker_thread, wq);
+
+    flags = spin_lock_irqsave(&wq->lock);
+    if (!task) {
+        wq->nr_workers--;
+        wq->nr_idle--;
+    } else {
+        sched_set_priority(task, wq->prio);
+        if (wq->nr_workers > wq->min_workers && !timer_pending(&wq->idle_timer)) {
+            mod_timer(&wq->idle_timer, timer_ticks + TIMER_HZ);
+        }
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+static void wq_grow_tasklet(uint32_t data) {
+    wq_grow((workqueue_t*)data);
+}
+
+// Thread creation allocates a stack, keep it out of hard interrupts and
+// code running with interrupts disabled
+static void wq_request_worker(workqueue_t* wq) {
+    if (in_interrupt() || !sched_can_block()) {
+        tasklet_schedule(&wq->grow_tasklet);
+    } else {
+        wq_grow(wq);
+    }
+}
+
+bool queue_work(workqueue_t* wq, work_t* work) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (work->state & WORK_STATE_PENDING) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return false;
+    }
+    work->state |= WORK_STATE_PENDING;
+    work->wq = wq;
+
+    // Work that is still running is queued again by its worker when it
+    // returns, so it never runs twice at the same time
+    bool grow = false;
+    if (!(work->state & WORK_STATE_RUNNING)) {
+        grow = insert_work(wq, work);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    if (grow) {
+        wq_request_worker(wq);
+    }
+    return true;
+}
+
+void init_delayed_work(delayed_work_t* dwork, void (*func)(work_t* work)) {
+    init_work(&dwork->work, func);
+    timer_setup(&dwork->timer, NULL, (uint32_t)dwork);
+}
+
+// Timer callback, the work is already marked pending
+static void delayed_work_timer(uint32_t data) {
+    delayed_work_t* dwork = (delayed_work_t*)data;
+    workqueue_t* wq = dwork->work.wq;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    bool grow = false;
+    if (!(dwork->work.state & WORK_STATE_RUNNING)) {
+        grow = insert_work(wq, &dwork->work);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    if (grow) {
+        wq_request_worker(wq);
+    }
+}
+
+bool queue_delayed_work(workqueue_t* wq, delayed_work_t* dwork, uint32_t delay_ms) {
+    if (delay_ms == 0) {
+        return queue_work(wq, &dwork->work);
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (dwork->work.state & WORK_STATE_PENDING) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return false;
+    }
+    dwork->work.state |= WORK_STATE_PENDING;
+    dwork->work.wq = wq;
+    dwork->timer.func = delayed_work_timer;
+    mod_timer(&dwork->timer, timer_ticks + msecs_to_ticks(delay_ms));
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return true;
+}
+
+bool cancel_work(work_t* work) {
+    workqueue_t* wq = work->wq;
+    if (!wq) {
+        return false;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    work_t* prev = NULL;
+    work_t* w = wq->head;
+    while (w && w != work) {
+        prev = w;
+        w = w->next;
+    }
+    if (w) {
+        if (prev) {
+            prev->next = w->next;
+        } else {
+            wq->head = w->next;
+        }
+        if (wq->tail == w) {
+            wq->tail = prev;
+        }
+        w->next = NULL;
+        w->state &= ~WORK_STATE_PENDING;
+        wq->nr_pending--;
+    }
+
+    // Queued again while running: dropping the flag stops the requeue
+    bool cancelled = w != NULL;
+    if (!w && (work->state & WORK_STATE_RUNNING) && (work->state & WORK_STATE_PENDING)) {
+        work->state &= ~WORK_STATE_PENDING;
+        cancelled = true;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return cancelled;
+}
+
+bool cancel_delayed_work(delayed_work_t* dwork) {
+    workqueue_t* wq = dwork->work.wq;
+    if (!wq) {
+        return false;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    bool cancelled = del_timer(&dwork->timer);
+    if (cancelled) {
+        dwork->work.state &= ~WORK_STATE_PENDING;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    return cancelled || cancel_work(&dwork->work);
+}
+
+void flush_work(work_t* work) {
+    workqueue_t* wq = work->wq;
+    if (!wq) {
+        return;
+    }
+    wait_event(wq->work_done, !(work->state & (WORK_STATE_PENDING | WORK_STATE_RUNNING)));
+}
+
+// Queue the work now instead of waiting for its timer, then flush it
+void flush_delayed_work(delayed_work_t* dwork) {
+    workqueue_t* wq = dwork->work.wq;
+    if (!wq) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    bool grow = false;
+    if (del_timer(&dwork->timer) && !(dwork->work.state & WORK_STATE_RUNNING)) {
+        grow = insert_work(wq, &dwork->work);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    if (grow) {
+        wq_request_worker(wq);
+    }
+    flush_work(&dwork->work);
+}
+
+static void worker_thread(void* arg) {
+    workqueue_t* wq = arg;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    while (1) {
+        work_t* work = wq->head;
+        if (!work) {
+            if (wq->nr_retire) {
+                wq->nr_retire--;
+                if (wq->nr_workers > wq->min_workers) {
+                    wq->nr_workers--;
+                    wq->nr_idle--;
+                    break;
+                }
+            }
+            spin_unlock_irqrestore(&wq->lock, flags);
+            wait_event_exclusive(wq->more_work, wq->head || wq->nr_retire);
+            flags = spin_lock_irqsave(&wq->lock);
+            continue;
+        }
+
+        wq->head = work->next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+        work->next = NULL;
+        work->state = (work->state | WORK_STATE_RUNNING) & ~WORK_STATE_PENDING;
+        wq->nr_pending--;
+        wq->nr_idle--;
+        if (wq->nr_idle == 0) {
+            wq->last_busy = timer_ticks;
+        }
+        bool grow = wq->nr_pending > wq->nr_idle && wq->nr_workers < wq->max_workers;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        if (grow) {
+            wq_grow(wq);
+        }
+        work->func(work);
+
+        flags = spin_lock_irqsave(&wq->lock);
+        work->state &= ~WORK_STATE_RUNNING;
+        if (work->state & WORK_STATE_PENDING) {
+            // Queued again while it ran
+            insert_work(wq, work);
+        }
+        wq->nr_idle++;
+        wq->completed++;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        wake_up_all(&wq->work_done);
+        flags = spin_lock_irqsave(&wq->lock);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Once a second while the pool is above its minimum: retire one idle
+// worker if none has been needed for WQ_IDLE_TIMEOUT_MS
+static void wq_idle_timer(uint32_t data) {
+    workqueue_t* wq = (workqueue_t*)data;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (wq->nr_workers > wq->min_workers) {
+        if (wq->nr_idle > 0 && wq->nr_retire == 0 &&
+            time_after_eq(timer_ticks, wq->last_busy + msecs_to_ticks(WQ_IDLE_TIMEOUT_MS))) {
+            wq->nr_retire = 1;
+            wake_up(&wq->more_work);
+        }
+        mod_timer(&wq->idle_timer, timer_ticks + TIMER_HZ);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+workqueue_t* alloc_workqueue(const char* name, uint32_t prio, uint32_t min_workers, uint32_t max_workers) {
+    workqueue_t* wq = kmalloc(sizeof(workqueue_t));
+    if (!wq) {
+        return NULL;
+    }
+    memset(wq, 0, sizeof(workqueue_t));
+    strncpy(wq->name, name, WQ_NAME_LEN - 1);
+    spin_lock_init(&wq->lock);
+    init_waitqueue_head(&wq->more_work);
+    init_waitqueue_head(&wq->work_done);
+    wq->prio = prio;
+    wq->min_workers = min_workers ? min_workers : 1;
+    wq->max_workers = max_workers > wq->min_workers ? max_workers : wq->min_workers;
+    wq->last_busy = timer_ticks;
+    timer_setup(&wq->idle_timer, wq_idle_timer, (uint32_t)wq);
+    tasklet_init(&wq->grow_tasklet, wq_grow_tasklet, (uint32_t)wq);
+
+    // wq_grow only starts workers for pending work, so start these directly
+    for (uint32_t i = 0; i < wq->min_workers; i++) {
+        uint32_t flags = spin_lock_irqsave(&wq->lock);
+        wq->nr_workers++;
+        wq->nr_idle++;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        task_t* task = kthread_create(wq->name, worker_thread, wq);
+        if (!task) {
+            flags = spin_lock_irqsave(&wq->lock);
+            wq->nr_workers--;
+            wq->nr_idle--;
+            spin_unlock_irqrestore(&wq->lock, flags);
+            break;
+        }
+        sched_set_priority(task, prio);
+    }
+    if (wq->nr_workers == 0) {
+        kfree(wq);
+        return NULL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&workqueues_lock);
+    wq->next = workqueues;
+    workqueues = wq;
+    spin_unlock_irqrestore(&workqueues_lock, flags);
+    return wq;
+}
+
+void workqueue_initialize(void) {
+    system_wq = alloc_workqueue("events", SCHED_PRIO_DEFAULT + 4, 1, 4);
+    if (!system_wq) {
+        kernel_panic("Could not create the system workqueue");
+    }
+}
+
+void workqueue_show(void) {
+    printk("  PRIO  WORKERS  MAX  IDLE  PENDING  COMPLETED  NAME\n");
+    uint32_t flags = spin_lock_irqsave(&workqueues_lock);
+    for (workqueue_t* wq = workqueues; wq; wq = wq->next) {
+        printk("  %4u  %7u  %3u  %4u  %7u  %9u  %s\n", wq->prio, wq->nr_workers,
+               wq->max_workers, wq->nr_idle, wq->nr_pending, wq->completed, wq->name);
+    }
+    spin_unlock_irqrestore(&workqueues_lock, flags);
+}
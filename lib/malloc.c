@@ -0,0 +1,160 @@
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "mman.h"
+#include "memory.h"
+#include "paging.h"
+
+// Small blocks are cut from spans: SPAN_SIZE bytes of brk() heap,
+// aligned to their size, each holding blocks of one size class behind a
+// header. A freed block goes on its class's bin and is handed out again
+// from there, so steady malloc() and free() make no system calls; the
+// heap grows a span at a time and never shrinks. Large blocks are
+// anonymous mappings above MMAP_BASE, which the heap never reaches, so
+// free() tells them apart by address.
+//
+// There are no user threads: a process has one heap, which fork()
+// copies, so the bins serve as its thread cache and take no lock.
+
+#define SPAN_SIZE        0x10000
+#define MALLOC_SMALL_MAX 16384
+#define NR_CLASSES       36
+
+typedef struct {
+    uint32_t class;
+    uint32_t pad[3];             // Blocks stay 16-byte aligned
+} span_t;
+
+typedef struct {
+    uint32_t len;                // Of the mapping, header included
+    uint32_t pad[3];
+} large_t;
+
+typedef struct block {
+    struct block* next;
+} block_t;
+
+static block_t* bins[NR_CLASSES];
+static uint8_t* span_next[NR_CLASSES];   // Uncut part of the class's newest span
+static uint8_t* span_end[NR_CLASSES];
+
+// 16-byte steps up to 128, then four classes per doubling up to
+// MALLOC_SMALL_MAX
+static uint32_t size_class(uint32_t size) {
+    if (size <= 128) {
+        return size ? (size - 1) >> 4 : 0;
+    }
+    uint32_t shift = 31 - __builtin_clz(size - 1);
+    return 8 + (shift - 7) * 4 + (((size - 1) >> (shift - 2)) & 3);
+}
+
+static uint32_t class_size(uint32_t class) {
+    if (class < 8) {
+        return (class + 1) << 4;
+    }
+    uint32_t shift = 7 + (class - 8) / 4;
+    return (5 + (class - 8) % 4) << (shift - 2);
+}
+
+// Start a span for class on the next aligned address past the break.
+// Its pages are made as blocks are cut from it.
+static bool span_alloc(uint32_t class) {
+    uint32_t start = ((uint32_t)sbrk(0) + SPAN_SIZE - 1) & ~(SPAN_SIZE - 1);
+    if (brk((void*)(start + SPAN_SIZE)) != 0) {
+        return false;
+    }
+    span_t* span = (span_t*)start;
+    span->class = class;
+    span_next[class] = (uint8_t*)(span + 1);
+    span_end[class] = (uint8_t*)start + SPAN_SIZE;
+    return true;
+}
+
+static void* large_alloc(uint32_t size) {
+    uint32_t len = (size + sizeof(large_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (len < size) {
+        return NULL;
+    }
+    large_t* large = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (large == MAP_FAILED) {
+        return NULL;
+    }
+    large->len = len;
+    return large + 1;
+}
+
+static bool is_large(void* ptr) {
+    return (uint32_t)ptr >= MMAP_BASE;
+}
+
+// Bytes the block can hold
+static uint32_t block_size(void* ptr) {
+    if (is_large(ptr)) {
+        return ((large_t*)ptr - 1)->len - sizeof(large_t);
+    }
+    return class_size(((span_t*)((uint32_t)ptr & ~(SPAN_SIZE - 1)))->class);
+}
+
+void* malloc(uint32_t size) {
+    if (size > MALLOC_SMALL_MAX) {
+        return large_alloc(size);
+    }
+    uint32_t class = size_class(size);
+    block_t* block = bins[class];
+    if (block) {
+        bins[class] = block->next;
+        return block;
+    }
+
+    uint32_t len = class_size(class);
+    if ((uint32_t)(span_end[class] - span_next[class]) < len && !span_alloc(class)) {
+        return NULL;
+    }
+    void* ptr = span_next[class];
+    span_next[class] += len;
+    return ptr;
+}
+
+void free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (is_large(ptr)) {
+        large_t* large = (large_t*)ptr - 1;
+        munmap(large, large->len);
+        return;
+    }
+    span_t* span = (span_t*)((uint32_t)ptr & ~(SPAN_SIZE - 1));
+    block_t* block = ptr;
+    block->next = bins[span->class];
+    bins[span->class] = block;
+}
+
+void* calloc(uint32_t nmemb, uint32_t size) {
+    if (size && nmemb > 0xFFFFFFFF / size) {
+        return NULL;
+    }
+    uint32_t len = nmemb * size;
+    void* ptr = malloc(len);
+    // Fresh mappings are zeroed already
+    if (ptr && !is_large(ptr)) {
+        memset(ptr, 0, len);
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, uint32_t size) {
+    if (!ptr) {
+        return malloc(size);
+    }
+    uint32_t old = block_size(ptr);
+    if (size <= old && (size > MALLOC_SMALL_MAX || !is_large(ptr))) {
+        return ptr;
+    }
+    void* moved = malloc(size);
+    if (moved) {
+        memcpy(moved, ptr, size < old ? size : old);
+        free(ptr);
+    }
+    return moved;
+}
@@ -1,3 +1,533 @@
-#include "basedos.h"
+#include "stdio.h"
+#include "string.h"
+#include "div64.h"
 
-// Empty: printk and putchar are in io.c
\ No newline at end of file
+// FILE flags
+#define FILE_USED  0x01
+#define FILE_READ  0x02
+#define FILE_WRITE 0x04
+#define FILE_EOF   0x08
+#define FILE_ERR   0x10
+#define FILE_OUT   0x20      // The buffer holds output, else input
+
+static FILE streams[FOPEN_MAX] = {
+    { .fd = 0, .flags = FILE_USED | FILE_READ, .mode = _IOLBF },
+    { .fd = 1, .flags = FILE_USED | FILE_WRITE, .mode = _IOLBF },
+    { .fd = 2, .flags = FILE_USED | FILE_WRITE, .mode = _IONBF },
+};
+
+static uint8_t stream_buffers[FOPEN_MAX][BUFSIZ];
+
+FILE* stdin = &streams[0];
+FILE* stdout = &streams[1];
+FILE* stderr = &streams[2];
+
+static void stream_init_buffer(FILE* stream) {
+    if (!stream->buf) {
+        stream->buf = stream_buffers[stream - streams];
+        stream->size = BUFSIZ;
+    }
+}
+
+// Write all of buf, false on error
+static bool write_all(FILE* stream, const uint8_t* buf, uint32_t len) {
+    while (len) {
+        int32_t n = write(stream->fd, buf, len);
+        if (n <= 0) {
+            stream->flags |= FILE_ERR;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int stream_flush(FILE* stream) {
+    if (!(stream->flags & FILE_OUT)) {
+        // Give back input read ahead, so the descriptor is where the
+        // caller has got to
+        if (stream->pos < stream->len) {
+            lseek(stream->fd, (int32_t)stream->pos - (int32_t)stream->len, SEEK_CUR);
+        }
+        stream->len = stream->pos = 0;
+        return 0;
+    }
+    bool ok = write_all(stream, stream->buf, stream->len);
+    stream->len = 0;
+    stream->flags &= ~FILE_OUT;
+    return ok ? 0 : EOF;
+}
+
+int fflush(FILE* stream) {
+    if (stream) {
+        return stream_flush(stream);
+    }
+    int ret = 0;
+    for (uint32_t i = 0; i < FOPEN_MAX; i++) {
+        if ((streams[i].flags & (FILE_USED | FILE_OUT)) == (FILE_USED | FILE_OUT) &&
+            stream_flush(&streams[i]) != 0) {
+            ret = EOF;
+        }
+    }
+    return ret;
+}
+
+// Parse an fopen() mode into open() flags, -1 when invalid
+static int32_t parse_mode(const char* mode, uint32_t* stream_flags) {
+    int32_t flags;
+    if (mode[0] == 'r') {
+        flags = O_RDONLY;
+        *stream_flags = FILE_READ;
+    } else if (mode[0] == 'w') {
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+        *stream_flags = FILE_WRITE;
+    } else if (mode[0] == 'a') {
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        *stream_flags = FILE_WRITE;
+    } else {
+        return -1;
+    }
+    if (strchr(mode, '+')) {
+        flags = (flags & ~O_WRONLY) | O_RDWR;
+        *stream_flags = FILE_READ | FILE_WRITE;
+    }
+    return flags;
+}
+
+static FILE* stream_alloc(int32_t fd, uint32_t flags) {
+    for (uint32_t i = 0; i < FOPEN_MAX; i++) {
+        FILE* stream = &streams[i];
+        if (!(stream->flags & FILE_USED)) {
+            memset(stream, 0, sizeof(*stream));
+            stream->fd = fd;
+            stream->flags = FILE_USED | flags;
+            stream->mode = _IOFBF;
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+FILE* fopen(const char* path, const char* mode) {
+    uint32_t stream_flags;
+    int32_t flags = parse_mode(mode, &stream_flags);
+    if (flags < 0) {
+        return NULL;
+    }
+    int32_t fd = open(path, flags);
+    if (fd < 0) {
+        return NULL;
+    }
+    FILE* stream = stream_alloc(fd, stream_flags);
+    if (!stream) {
+        close(fd);
+    }
+    return stream;
+}
+
+FILE* fdopen(int32_t fd, const char* mode) {
+    uint32_t stream_flags;
+    if (fd < 0 || parse_mode(mode, &stream_flags) < 0) {
+        return NULL;
+    }
+    return stream_alloc(fd, stream_flags);
+}
+
+int fclose(FILE* stream) {
+    int ret = stream_flush(stream);
+    if (close(stream->fd) != 0) {
+        ret = EOF;
+    }
+    stream->flags = 0;
+    return ret;
+}
+
+int setvbuf(FILE* stream, char* buf, int mode, uint32_t size) {
+    if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+        return -1;
+    }
+    stream->mode = mode;
+    if (buf && size) {
+        stream->buf = (uint8_t*)buf;
+        stream->size = size;
+    } else {
+        stream->buf = stream_buffers[stream - streams];
+        stream->size = (size && size < BUFSIZ) ? size : BUFSIZ;
+    }
+    return 0;
+}
+
+// Output
+
+uint32_t fwrite(const void* ptr, uint32_t size, uint32_t nmemb, FILE* stream) {
+    uint32_t total = size * nmemb;
+    const uint8_t* data = ptr;
+    if (!total) {
+        return 0;
+    }
+    if (!(stream->flags & FILE_WRITE)) {
+        stream->flags |= FILE_ERR;
+        return 0;
+    }
+    if (!(stream->flags & FILE_OUT)) {
+        stream_flush(stream);
+        stream->flags |= FILE_OUT;
+    }
+    stream_init_buffer(stream);
+
+    if (stream->mode == _IONBF) {
+        return write_all(stream, data, total) ? nmemb : 0;
+    }
+
+    // What does not fit goes out with the buffer, large writes directly
+    if (stream->len + total > stream->size) {
+        if (stream_flush(stream) != 0) {
+            return 0;
+        }
+        stream->flags |= FILE_OUT;
+        if (total >= stream->size) {
+            return write_all(stream, data, total) ? nmemb : 0;
+        }
+    }
+    memcpy(stream->buf + stream->len, data, total);
+    stream->len += total;
+
+    if (stream->mode == _IOLBF) {
+        for (uint32_t i = total; i > 0; i--) {
+            if (data[i - 1] == '\n') {
+                return stream_flush(stream) == 0 ? nmemb : 0;
+            }
+        }
+    }
+    return nmemb;
+}
+
+int fputc(int c, FILE* stream) {
+    uint8_t byte = (uint8_t)c;
+    return fwrite(&byte, 1, 1, stream) == 1 ? byte : EOF;
+}
+
+int fputs(const char* s, FILE* stream) {
+    uint32_t len = strlen(s);
+    return fwrite(s, 1, len, stream) == len ? 0 : EOF;
+}
+
+int puts(const char* s) {
+    return fputs(s, stdout) == 0 && fputc('\n', stdout) != EOF ? 0 : EOF;
+}
+
+// Input
+
+// Refill the empty read buffer, false at end of file or on error
+static bool stream_fill(FILE* stream) {
+    if (!(stream->flags & FILE_READ)) {
+        stream->flags |= FILE_ERR;
+        return false;
+    }
+    if (stream->flags & FILE_OUT) {
+        stream_flush(stream);
+    }
+    // A prompt written without a newline shows before we wait
+    if (stream == stdin) {
+        fflush(stdout);
+    }
+    stream_init_buffer(stream);
+
+    // Unbuffered streams still read a byte at a time
+    uint32_t want = stream->mode == _IONBF ? 1 : stream->size;
+    int32_t n = read(stream->fd, stream->buf, want);
+    stream->pos = 0;
+    stream->len = n > 0 ? (uint32_t)n : 0;
+    if (n <= 0) {
+        stream->flags |= n == 0 ? FILE_EOF : FILE_ERR;
+        return false;
+    }
+    return true;
+}
+
+uint32_t fread(void* ptr, uint32_t size, uint32_t nmemb, FILE* stream) {
+    uint32_t total = size * nmemb;
+    uint8_t* data = ptr;
+    uint32_t done = 0;
+    while (done < total) {
+        if (stream->pos == stream->len) {
+            // Large reads bypass the buffer
+            if (total - done >= stream->size && stream->size &&
+                !(stream->flags & FILE_OUT) && (stream->flags & FILE_READ)) {
+                int32_t n = read(stream->fd, data + done, total - done);
+                if (n <= 0) {
+                    stream->flags |= n == 0 ? FILE_EOF : FILE_ERR;
+                    break;
+                }
+                done += n;
+                continue;
+            }
+            if (!stream_fill(stream)) {
+                break;
+            }
+        }
+        uint32_t n = stream->len - stream->pos;
+        if (n > total - done) {
+            n = total - done;
+        }
+        memcpy(data + done, stream->buf + stream->pos, n);
+        stream->pos += n;
+        done += n;
+    }
+    return size ? done / size : 0;
+}
+
+int fgetc(FILE* stream) {
+    if (stream->pos == stream->len && !stream_fill(stream)) {
+        return EOF;
+    }
+    return stream->buf[stream->pos++];
+}
+
+char* fgets(char* s, int n, FILE* stream) {
+    int i = 0;
+    while (i < n - 1) {
+        if (stream->pos == stream->len && !stream_fill(stream)) {
+            break;
+        }
+        // Copy up to the newline straight out of the buffer
+        uint8_t* start = stream->buf + stream->pos;
+        uint32_t avail = stream->len - stream->pos;
+        if (avail > (uint32_t)(n - 1 - i)) {
+            avail = n - 1 - i;
+        }
+        uint32_t len = 0;
+        while (len < avail && start[len++] != '\n') {
+        }
+        memcpy(s + i, start, len);
+        stream->pos += len;
+        i += len;
+        if (s[i - 1] == '\n') {
+            break;
+        }
+    }
+    if (i == 0 || (stream->flags & FILE_ERR)) {
+        return NULL;
+    }
+    s[i] = '\0';
+    return s;
+}
+
+int feof(FILE* stream) {
+    return (stream->flags & FILE_EOF) != 0;
+}
+
+int ferror(FILE* stream) {
+    return (stream->flags & FILE_ERR) != 0;
+}
+
+void clearerr(FILE* stream) {
+    stream->flags &= ~(FILE_EOF | FILE_ERR);
+}
+
+int32_t fileno(FILE* stream) {
+    return stream->fd;
+}
+
+// Formatting, into a stream or a string
+
+typedef struct {
+    FILE* stream;
+    char* str;
+    uint32_t size;
+    uint32_t count;          // Characters produced
+} format_out_t;
+
+static void format_emit(format_out_t* out, const char* s, uint32_t len) {
+    if (out->stream) {
+        fwrite(s, 1, len, out->stream);
+    } else if (out->count + 1 < out->size) {
+        uint32_t room = out->size - 1 - out->count;
+        memcpy(out->str + out->count, s, len < room ? len : room);
+    }
+    out->count += len;
+}
+
+static void format_pad(format_out_t* out, char pad, int n) {
+    char chunk[16];
+    memset(chunk, pad, sizeof(chunk));
+    while (n > 0) {
+        int len = n < (int)sizeof(chunk) ? n : (int)sizeof(chunk);
+        format_emit(out, chunk, len);
+        n -= len;
+    }
+}
+
+// Convert a 64-bit value, returns the start of the digits in tmp
+static char* format_u64(uint64_t value, uint32_t base, bool upper, char* end) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char* p = end;
+    do {
+        *--p = digits[div64_u32_rem(&value, base)];
+    } while (value);
+    return p;
+}
+
+static void format_field(format_out_t* out, const char* s, uint32_t len, int width,
+                         bool left, char pad) {
+    int fill = width - (int)len;
+    if (!left && pad == '0' && len && *s == '-') {
+        format_emit(out, s, 1);
+        s++;
+        len--;
+    }
+    if (!left) {
+        format_pad(out, pad, fill);
+    }
+    format_emit(out, s, len);
+    if (left) {
+        format_pad(out, ' ', fill);
+    }
+}
+
+static int format(format_out_t* out, const char* fmt, va_list args) {
+    while (*fmt) {
+        // Runs of plain text go out in one piece
+        const char* text = fmt;
+        while (*fmt && *fmt != '%') {
+            fmt++;
+        }
+        if (fmt != text) {
+            format_emit(out, text, fmt - text);
+        }
+        if (!*fmt) {
+            break;
+        }
+        fmt++;
+
+        bool left = false;
+        char pad = ' ';
+        while (*fmt == '-' || *fmt == '0') {
+            if (*fmt == '-') {
+                left = true;
+            } else {
+                pad = '0';
+            }
+            fmt++;
+        }
+        int width = 0;
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        int precision = -1;
+        if (*fmt == '.') {
+            precision = 0;
+            fmt++;
+            while (*fmt >= '0' && *fmt <= '9') {
+                precision = precision * 10 + (*fmt++ - '0');
+            }
+        }
+        int longs = 0;
+        while (*fmt == 'l') {
+            longs++;
+            fmt++;
+        }
+        if (left) {
+            pad = ' ';
+        }
+
+        char buffer[24];
+        char* end = buffer + sizeof(buffer);
+        char* p;
+        switch (*fmt) {
+            case 'd':
+            case 'i': {
+                int64_t num = longs >= 2 ? va_arg(args, int64_t) : va_arg(args, int);
+                p = format_u64(num < 0 ? -(uint64_t)num : (uint64_t)num, 10, false, end);
+                if (num < 0) {
+                    *--p = '-';
+                }
+                format_field(out, p, end - p, width, left, pad);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                uint64_t num = longs >= 2 ? va_arg(args, uint64_t) : va_arg(args, unsigned int);
+                p = format_u64(num, *fmt == 'u' ? 10 : 16, *fmt == 'X', end);
+                format_field(out, p, end - p, width, left, pad);
+                break;
+            }
+            case 'p': {
+                p = format_u64((uint32_t)va_arg(args, void*), 16, false, end);
+                *--p = 'x';
+                *--p = '0';
+                format_field(out, p, end - p, width, left, ' ');
+                break;
+            }
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                format_field(out, &c, 1, width, left, ' ');
+                break;
+            }
+            case 's': {
+                const char* s = va_arg(args, const char*);
+                if (!s) {
+                    s = "(null)";
+                }
+                uint32_t len = 0;
+                while (s[len] && (precision < 0 || len < (uint32_t)precision)) {
+                    len++;
+                }
+                format_field(out, s, len, width, left, ' ');
+                break;
+            }
+            case '%':
+                format_emit(out, "%", 1);
+                break;
+            case '\0':
+                fmt--;
+                break;
+            default:
+                format_emit(out, fmt - 1, 2);
+                break;
+        }
+        fmt++;
+    }
+    return out->count;
+}
+
+int vfprintf(FILE* stream, const char* format_str, va_list args) {
+    format_out_t out = { stream, NULL, 0, 0 };
+    int count = format(&out, format_str, args);
+    return ferror(stream) ? -1 : count;
+}
+
+int fprintf(FILE* stream, const char* format_str, ...) {
+    va_list args;
+    va_start(args, format_str);
+    int count = vfprintf(stream, format_str, args);
+    va_end(args);
+    return count;
+}
+
+int printf(const char* format_str, ...) {
+    va_list args;
+    va_start(args, format_str);
+    int count = vfprintf(stdout, format_str, args);
+    va_end(args);
+    return count;
+}
+
+int vsnprintf(char* str, uint32_t size, const char* format_str, va_list args) {
+    format_out_t out = { NULL, str, size, 0 };
+    int count = format(&out, format_str, args);
+    if (size) {
+        str[count < (int)size ? (uint32_t)count : size - 1] = '\0';
+    }
+    return count;
+}
+
+int snprintf(char* str, uint32_t size, const char* format_str, ...) {
+    va_list args;
+    va_start(args, format_str);
+    int count = vsnprintf(str, size, format_str, args);
+    va_end(args);
+    return count;
+}
@@ -140,15 +140,14 @@ int strncmp(const char* s1, const char* s2, size_t n) {
  return *(unsigned char*)s1 - *(unsigned char*)s2;
 }
 
-char* strtok(char* str, const char* delim) {
- static char* last = 0;
- if (str) last = str;
+char* strtok_r(char* str, const char* delim, char** saveptr) {
+ char* last = str ? str : *saveptr;
  if (!last || !*last) return 0;
  
  // Skip leading delimiters
  str = last + strspn(last, delim);
  if (!*str) {
- last = 0;
+ *saveptr = 0;
  return 0;
  }
  
@@ -156,13 +155,18 @@ char* strtok(char* str, const char* delim) {
  char* end = str + strcspn(str, delim);
  if (*end) {
  *end = 0;
- last = end + 1;
+ *saveptr = end + 1;
  } else {
- last = end;
+ *saveptr = end;
  }
  return str;
 }
 
+char* strtok(char* str, const char* delim) {
+ static char* last = 0;
+ return strtok_r(str, delim, &last);
+}
+
 size_t strspn(const char* str, const char* accept) {
  const char* p;
  const char* a;
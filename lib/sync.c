@@ -0,0 +1,80 @@
+#include "sync.h"
+#include "futex.h"
+#include "cpu.h"
+
+// Spins on a taken mutex before sleeping, the holder may be about to
+// let go on another CPU
+#define MUTEX_SPIN 100
+
+static inline uint32_t cmpxchg(volatile uint32_t* ptr, uint32_t old, uint32_t new) {
+    return __sync_val_compare_and_swap(ptr, old, new);
+}
+
+static inline uint32_t xchg(volatile uint32_t* ptr, uint32_t val) {
+    asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+    return val;
+}
+
+bool mutex_trylock(mutex_t* mutex) {
+    return cmpxchg(&mutex->state, 0, 1) == 0;
+}
+
+void mutex_lock(mutex_t* mutex) {
+    uint32_t c = cmpxchg(&mutex->state, 0, 1);
+    for (int i = 0; c != 0 && i < MUTEX_SPIN; i++) {
+        cpu_relax();
+        if (mutex->state == 0) {
+            c = cmpxchg(&mutex->state, 0, 1);
+        }
+    }
+    if (c == 0) {
+        return;
+    }
+
+    // Mark it waited for, so the unlock wakes us, and sleep until it is
+    // free. Whoever takes it this way leaves it marked.
+    if (c != 2) {
+        c = xchg(&mutex->state, 2);
+    }
+    while (c != 0) {
+        futex(&mutex->state, FUTEX_WAIT, 2);
+        c = xchg(&mutex->state, 2);
+    }
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    if (__sync_fetch_and_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        futex(&mutex->state, FUTEX_WAKE, 1);
+    }
+}
+
+void cond_wait(cond_t* cond, mutex_t* mutex) {
+    uint32_t seq = cond->seq;
+    __sync_fetch_and_add(&cond->waiters, 1);
+    mutex_unlock(mutex);
+    // Returns at once when a signal came after we read seq
+    futex(&cond->seq, FUTEX_WAIT, seq);
+
+    // Others may be woken with us, take the mutex as contended
+    uint32_t c = xchg(&mutex->state, 2);
+    while (c != 0) {
+        futex(&mutex->state, FUTEX_WAIT, 2);
+        c = xchg(&mutex->state, 2);
+    }
+    __sync_fetch_and_sub(&cond->waiters, 1);
+}
+
+void cond_signal(cond_t* cond) {
+    __sync_fetch_and_add(&cond->seq, 1);
+    if (cond->waiters) {
+        futex(&cond->seq, FUTEX_WAKE, 1);
+    }
+}
+
+void cond_broadcast(cond_t* cond) {
+    __sync_fetch_and_add(&cond->seq, 1);
+    if (cond->waiters) {
+        futex(&cond->seq, FUTEX_WAKE, 0x7FFFFFFF);
+    }
+}
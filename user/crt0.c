@@ -0,0 +1,113 @@
+#include "basedos.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "stdio.h"
+#include "unistd.h"
+#include "futex.h"
+#include "mman.h"
+
+// Startup and system calls for C user programs. The kernel starts a
+// program at _start with argc, argv[] and envp[] on the stack.
+
+int main(int argc, char** argv);
+
+uint32_t syscall_count;
+
+#define vdso ((vdso_data_t*)VDSO_BASE)
+
+// Through the vDSO stub, which uses SYSENTER when the CPU has it
+static int32_t user_syscall5(uint32_t nr, uint32_t a, uint32_t b, uint32_t c,
+                             uint32_t d, uint32_t e) {
+    int32_t ret;
+    syscall_count++;
+    asm volatile("call *" __stringify(VDSO_BASE) "+" __stringify(VDSO_SYSCALL_ENTRY)
+                 : "=a"(ret), "+S"(d), "+D"(e)
+                 : "a"(nr), "b"(a), "c"(b), "d"(c)
+                 : "memory");
+    return ret;
+}
+
+static int32_t user_syscall(uint32_t nr, uint32_t a, uint32_t b, uint32_t c) {
+    return user_syscall5(nr, a, b, c, 0, 0);
+}
+
+int32_t read(int32_t fd, void* buf, uint32_t size) {
+    return user_syscall(SYS_read, fd, (uint32_t)buf, size);
+}
+
+int32_t write(int32_t fd, const void* buf, uint32_t size) {
+    return user_syscall(SYS_write, fd, (uint32_t)buf, size);
+}
+
+int32_t open(const char* filename, uint32_t flags) {
+    return user_syscall(SYS_open, (uint32_t)filename, flags, 0);
+}
+
+int32_t close(int32_t fd) {
+    return user_syscall(SYS_close, fd, 0, 0);
+}
+
+int32_t lseek(int32_t fd, int32_t offset, int32_t whence) {
+    return user_syscall(SYS_lseek, fd, offset, whence);
+}
+
+int32_t fork(void) {
+    fflush(NULL);
+    return user_syscall(SYS_fork, 0, 0, 0);
+}
+
+int32_t wait(int32_t pid, int* status) {
+    return user_syscall(SYS_wait, pid, (uint32_t)status, 0);
+}
+
+int32_t futex(volatile uint32_t* uaddr, int32_t op, uint32_t val) {
+    return user_syscall(SYS_futex, (uint32_t)uaddr, op, val);
+}
+
+void* mmap(void* addr, uint32_t len, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset) {
+    int32_t ret = user_syscall5(SYS_mmap, (uint32_t)addr, len, prot | flags, fd, offset);
+    return ret == -1 ? MAP_FAILED : (void*)ret;
+}
+
+int32_t munmap(void* addr, uint32_t len) {
+    return user_syscall(SYS_munmap, (uint32_t)addr, len, 0);
+}
+
+int brk(void* addr) {
+    return (uint32_t)user_syscall(SYS_brk, (uint32_t)addr, 0, 0) == (uint32_t)addr ? 0 : -1;
+}
+
+void* sbrk(int32_t increment) {
+    uint32_t old = user_syscall(SYS_brk, 0, 0, 0);
+    if (increment && (uint32_t)user_syscall(SYS_brk, old + increment, 0, 0) != old + increment) {
+        return (void*)-1;
+    }
+    return (void*)old;
+}
+
+void exit(int status) {
+    fflush(NULL);
+    while (1) {
+        user_syscall(SYS_exit, status, 0, 0);
+    }
+}
+
+uint64_t clock_ns(void) {
+    return ((uint64_t (*)(void))vdso->clock_ns)();
+}
+
+void crt0_main(int argc, char** argv) {
+    exit(main(argc, argv));
+}
+
+asm (
+    ".pushsection .text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    mov (%esp), %eax\n"
+    "    lea 4(%esp), %ecx\n"
+    "    push %ecx\n"
+    "    push %eax\n"
+    "    call crt0_main\n"
+    ".popsection\n"
+);
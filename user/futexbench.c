@@ -0,0 +1,145 @@
+#include "stdio.h"
+#include "string.h"
+#include "unistd.h"
+#include "sync.h"
+#include "futex.h"
+#include "mman.h"
+#include "div64.h"
+
+// Processes increment a shared counter under a lock, taken either with
+// mutex_lock(), which only enters the kernel under contention, or with
+// FUTEX_LOCK, which enters it every time. Then two processes hand a turn
+// back and forth through a condition variable.
+
+#define MAX_PROCS 4
+
+typedef struct {
+    mutex_t mutex;
+    volatile uint32_t syslock;   // FUTEX_LOCK word
+    volatile uint32_t counter;
+    volatile uint32_t syscalls;  // Made by the children while locking
+    mutex_t turn_lock;
+    cond_t turn_cond;
+    volatile uint32_t turn;
+} shared_t;
+
+static shared_t* shared;
+
+static void lock(bool kernel) {
+    if (kernel) {
+        futex(&shared->syslock, FUTEX_LOCK, 0);
+    } else {
+        mutex_lock(&shared->mutex);
+    }
+}
+
+static void unlock(bool kernel) {
+    if (kernel) {
+        futex(&shared->syslock, FUTEX_UNLOCK, 0);
+    } else {
+        mutex_unlock(&shared->mutex);
+    }
+}
+
+static void contend(bool kernel, int iterations) {
+    uint32_t calls = syscall_count;
+    for (int i = 0; i < iterations; i++) {
+        lock(kernel);
+        shared->counter++;
+        unlock(kernel);
+    }
+    __sync_fetch_and_add(&shared->syscalls, syscall_count - calls);
+}
+
+// Wait for every child, false when one failed
+static bool reap(int children) {
+    bool ok = true;
+    for (int i = 0; i < children; i++) {
+        int status;
+        if (wait(-1, &status) < 0 || status != 0) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool run_lock(bool kernel, int procs, int iterations) {
+    shared->counter = 0;
+    shared->syscalls = 0;
+    uint64_t start = clock_ns();
+    int children = 0;
+    for (; children < procs; children++) {
+        int32_t pid = fork();
+        if (pid == 0) {
+            contend(kernel, iterations);
+            exit(0);
+        }
+        if (pid < 0) {
+            break;
+        }
+    }
+    bool ok = reap(children) && children == procs;
+    uint64_t ns = clock_ns() - start;
+
+    uint32_t ops = procs * iterations;
+    uint32_t per_k = (uint32_t)div64_u32((uint64_t)shared->syscalls * 1000, ops);
+    printf("%-6s %5d %9llu %6u.%03u %s\n", kernel ? "kernel" : "futex", procs,
+           div64_u32(ns, ops), per_k / 1000, per_k % 1000,
+           ok && shared->counter == ops ? "ok" : "WRONG COUNT");
+    return ok && shared->counter == ops;
+}
+
+// Parent and child take turns: each waits for its number, then passes
+// the turn on
+static void take_turns(uint32_t me, int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        mutex_lock(&shared->turn_lock);
+        while (shared->turn != me) {
+            cond_wait(&shared->turn_cond, &shared->turn_lock);
+        }
+        shared->turn = !me;
+        cond_signal(&shared->turn_cond);
+        mutex_unlock(&shared->turn_lock);
+    }
+}
+
+static bool run_turns(int rounds) {
+    shared->turn = 0;
+    uint64_t start = clock_ns();
+    int32_t pid = fork();
+    if (pid == 0) {
+        take_turns(1, rounds);
+        exit(0);
+    }
+    if (pid < 0) {
+        return false;
+    }
+    take_turns(0, rounds);
+    bool ok = reap(1);
+    uint64_t ns = clock_ns() - start;
+    printf("Condition variable handoff: %llu ns\n", div64_u32(ns, 2 * rounds));
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    if (iterations <= 0) {
+        fprintf(stderr, "Usage: futexbench [iterations]\n");
+        return 1;
+    }
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        fprintf(stderr, "futexbench: no shared memory\n");
+        return 1;
+    }
+
+    bool ok = true;
+    printf("lock   procs     ns/op  syscalls/op\n");
+    for (int kernel = 0; kernel < 2; kernel++) {
+        for (int procs = 1; procs <= MAX_PROCS; procs *= 2) {
+            ok &= run_lock(kernel, procs, iterations);
+        }
+    }
+    ok &= run_turns(iterations / 10 + 1);
+    return ok ? 0 : 1;
+}
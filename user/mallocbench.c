@@ -0,0 +1,106 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "mman.h"
+#include "div64.h"
+
+// Allocation throughput: malloc() and free() pairs per size, against a
+// mmap() and munmap() per allocation, then a random mix of sizes with
+// many blocks live, each checked for being overwritten before its free.
+
+#define SLOTS 256
+
+typedef struct {
+    uint8_t* ptr;
+    uint32_t size;
+} slot_t;
+
+static slot_t slots[SLOTS];
+static uint32_t seed = 2463534242u;
+
+static uint32_t xorshift(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void report(const char* what, uint32_t size, uint64_t ns, uint32_t calls, uint32_t ops) {
+    uint32_t per_k = (uint32_t)div64_u32((uint64_t)calls * 1000, ops);
+    printf("%-14s %6u %8llu %6u.%03u\n", what, size, div64_u32(ns, ops), per_k / 1000, per_k % 1000);
+}
+
+static void pairs(uint32_t size, int iterations) {
+    uint32_t calls = syscall_count;
+    uint64_t start = clock_ns();
+    for (int i = 0; i < iterations; i++) {
+        uint8_t* ptr = malloc(size);
+        ptr[0] = ptr[size - 1] = i;
+        free(ptr);
+    }
+    report("malloc/free", size, clock_ns() - start, syscall_count - calls, iterations);
+}
+
+static void mmap_pairs(uint32_t size, int iterations) {
+    uint32_t calls = syscall_count;
+    uint64_t start = clock_ns();
+    for (int i = 0; i < iterations; i++) {
+        uint8_t* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ptr[0] = ptr[size - 1] = i;
+        munmap(ptr, size);
+    }
+    report("mmap/munmap", size, clock_ns() - start, syscall_count - calls, iterations);
+}
+
+// Mostly small blocks, one in 64 large. The first and last byte carry
+// the slot number.
+static bool churn(int iterations) {
+    bool ok = true;
+    uint32_t heap = (uint32_t)sbrk(0);
+    uint32_t calls = syscall_count;
+    uint64_t start = clock_ns();
+    for (int i = 0; i < iterations; i++) {
+        uint32_t n = xorshift() % SLOTS;
+        slot_t* slot = &slots[n];
+        if (slot->ptr) {
+            ok &= slot->ptr[0] == n && slot->ptr[slot->size - 1] == n;
+            free(slot->ptr);
+        }
+        uint32_t r = xorshift();
+        slot->size = (r & 63) ? 16 + (r >> 8) % 2048 : 20000 + (r >> 8) % 80000;
+        slot->ptr = malloc(slot->size);
+        if (!slot->ptr) {
+            printf("malloc(%u) failed\n", slot->size);
+            return false;
+        }
+        slot->ptr[0] = slot->ptr[slot->size - 1] = n;
+    }
+    uint64_t ns = clock_ns() - start;
+    for (int n = 0; n < SLOTS; n++) {
+        if (slots[n].ptr) {
+            ok &= slots[n].ptr[0] == n && slots[n].ptr[slots[n].size - 1] == n;
+            free(slots[n].ptr);
+        }
+    }
+    report("mixed", 0, ns, syscall_count - calls, iterations);
+    printf("Heap grew %u KiB, blocks %s\n", ((uint32_t)sbrk(0) - heap) / 1024,
+           ok ? "intact" : "OVERWRITTEN");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    if (iterations <= 0) {
+        fprintf(stderr, "Usage: mallocbench [iterations]\n");
+        return 1;
+    }
+
+    static const uint32_t sizes[] = { 16, 100, 1000, 4000, 16000, 65536 };
+    printf("what             size    ns/op  syscalls/op\n");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        pairs(sizes[i], iterations);
+    }
+    mmap_pairs(4096, iterations);
+    return churn(iterations) ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#include "stdio.h"
+#include "string.h"
+#include "unistd.h"
+#include "div64.h"
+
+// Print the same lines through stdout in each buffering mode, then the
+// write() calls and time per line each took. Unbuffered output makes a
+// system call for every piece of every printf(); line buffering one per
+// line; full buffering one per BUFSIZ bytes.
+
+static const char* mode_names[] = { "full", "line", "none" };
+
+int main(int argc, char** argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 100;
+    if (lines <= 0) {
+        fprintf(stderr, "Usage: stdiobench [lines]\n");
+        return 1;
+    }
+
+    uint32_t calls[3];
+    uint64_t ns[3];
+    for (int mode = _IOFBF; mode <= _IONBF; mode++) {
+        fflush(stdout);
+        setvbuf(stdout, NULL, mode, BUFSIZ);
+        uint32_t start_calls = syscall_count;
+        uint64_t start = clock_ns();
+        for (int i = 0; i < lines; i++) {
+            printf("%s buffering, line %d of %d\n", mode_names[mode], i + 1, lines);
+        }
+        fflush(stdout);
+        ns[mode] = clock_ns() - start;
+        calls[mode] = syscall_count - start_calls;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+    printf("\nmode   writes   ns/line\n");
+    for (int mode = _IOFBF; mode <= _IONBF; mode++) {
+        printf("%-5s %7u %9llu\n", mode_names[mode], calls[mode], div64_u32(ns[mode], lines));
+    }
+    return 0;
+}